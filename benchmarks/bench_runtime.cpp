@@ -0,0 +1,180 @@
+// Microbenchmarks of interpreter internals, built optimized as bench_runtime.
+// Run from the build directory like the tests, so ../tests/lib.so is found. For results which can be
+// compared over time, run the bench_runtime_json target or pass --reporter JSON::out=<file> yourself
+// Catch 2
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+// Runtime
+#include "../src/compiler/tokenizer.h"
+#include "../src/compiler/parser.h"
+#include "../src/compiler/interpreter.h"
+#include "../src/compiler/context.h"
+#include "../src/compiler/symbol_table.h"
+#include "../src/compiler/shared_libs.h"
+// C++
+#include <memory>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Script of lines objects, each with a number, a string and a call
+/// </summary>
+[[nodiscard]] static std::string objectScript(size_t lines)
+{
+	std::string script;
+	for (size_t i = 0; i < lines; ++i)
+		script += "Object(o" + std::to_string(i) + " " + std::to_string(i) + " 'member " + std::to_string(i) + "' +(1 " + std::to_string(i) + "))\n";
+	return script;
+}
+
+TEST_CASE("Tokenizer throughput", "[benchmark]")
+{
+	for (size_t lines : { 100, 10000 }) {
+		const std::string script = objectScript(lines);
+		REQUIRE(not rt::tokenize(script.c_str()).empty());
+		BENCHMARK("tokenize " + std::to_string(script.size()) + " bytes")
+		{
+			return rt::tokenize(script.c_str());
+		};
+	}
+}
+
+TEST_CASE("Parser on large inputs", "[benchmark]")
+{
+	for (size_t lines : { 100, 10000 }) {
+		const auto tokens = rt::tokenize(objectScript(lines).c_str());
+		BENCHMARK("parse " + std::to_string(tokens.size()) + " tokens")
+		{
+			return rt::parse(tokens);
+		};
+	}
+}
+
+TEST_CASE("Symbol lookup by scope depth", "[benchmark]")
+{
+	// An object in the global scope, looked up from nested scopes like those of nested calls
+	rt::Interpreter interpreter;
+	interpreter.globalSymtab.updateSymbol("target", std::make_shared<rt::Object>("target"));
+	rt::ArgState argState;
+	for (size_t depth : { 1, 8, 64 }) {
+		std::vector<std::unique_ptr<rt::SymbolTable>> scopes;
+		rt::SymbolTable* innermost = &interpreter.globalSymtab;
+		for (size_t i = 0; i < depth; ++i)
+			innermost = scopes.emplace_back(std::make_unique<rt::SymbolTable>(innermost)).get();
+		REQUIRE(std::holds_alternative<std::shared_ptr<rt::Object>>(innermost->lookUp("target", argState)));
+		BENCHMARK("lookUp object at depth " + std::to_string(depth))
+		{
+			return &innermost->lookUp("target", argState);
+		};
+		BENCHMARK("lookUp builtin at depth " + std::to_string(depth))
+		{
+			return &innermost->lookUp("Print", argState);
+		};
+	}
+}
+
+TEST_CASE("Object members", "[benchmark]")
+{
+	constexpr int count = 1000;
+	std::vector<std::string> names;
+	for (int i = 0; i < count; ++i)
+		names.push_back("member" + std::to_string(i));
+	const objectOrValue value = std::variant<double, std::string>(1.0);
+
+	BENCHMARK("addMember 1000 values")
+	{
+		auto object = std::make_shared<rt::Object>("bench");
+		for (int i = 0; i < count; ++i)
+			object->addMember(value);
+		return object;
+	};
+	BENCHMARK("addMember 1000 named")
+	{
+		auto object = std::make_shared<rt::Object>("bench");
+		for (int i = 0; i < count; ++i)
+			object->addMember(value, names[i]);
+		return object;
+	};
+
+	auto object = std::make_shared<rt::Object>("bench");
+	for (int i = 0; i < count; ++i)
+		object->addMember(value, names[i]);
+	REQUIRE(object->size() == count);
+	BENCHMARK("getMember 1000 by index")
+	{
+		double sum = 0;
+		for (int i = 0; i < count; ++i)
+			sum += std::get<double>(std::get<std::variant<double, std::string>>(*object->getMember(i)));
+		return sum;
+	};
+	BENCHMARK("getMember 1000 by name")
+	{
+		double sum = 0;
+		for (int i = 0; i < count; ++i)
+			sum += std::get<double>(std::get<std::variant<double, std::string>>(*object->getMember(names[i])));
+		return sum;
+	};
+}
+
+TEST_CASE("Evaluating deep objects", "[benchmark]")
+{
+	// Object(d0 1)
+	// Object(d1 d0)
+	// ...
+	// Each object evaluates to the one before it, so evaluating the last one walks the whole chain
+	for (size_t depth : { 8, 64 }) {
+		std::string script = "Object(d0 1)\n";
+		for (size_t i = 1; i < depth; ++i)
+			script += "Object(d" + std::to_string(i) + " d" + std::to_string(i - 1) + ")\n";
+		rt::Interpreter interpreter;
+		interpreter.run(rt::parse(rt::tokenize(script.c_str())));
+		const Symbol& last = interpreter.globalSymtab.lookUpHard("d" + std::to_string(depth - 1));
+		const objectOrValue deepest = std::get<std::shared_ptr<rt::Object>>(last);
+		REQUIRE(rt::evaluate(deepest, &interpreter.globalSymtab, interpreter.mainArgState, false) == std::variant<double, std::string>(1.0));
+		BENCHMARK("evaluate depth " + std::to_string(depth))
+		{
+			return rt::evaluate(deepest, &interpreter.globalSymtab, interpreter.mainArgState, false);
+		};
+	}
+}
+
+TEST_CASE("Builtin arithmetic dispatch", "[benchmark]")
+{
+	rt::Interpreter interpreter;
+	const std::vector<objectOrValue> operands = { std::variant<double, std::string>(1.0), std::variant<double, std::string>(2.0) };
+	for (const char* name : { "+", "*" }) {
+		BENCHMARK(std::string("call ") + name)
+		{
+			return interpreter.call(name, operands);
+		};
+	}
+
+	// Assign(i 0 0)
+	// While(<(i 1000) Assign(i 0 +(i 1)))
+	// A builtin call per operator, as scripts make them
+	const auto loop = rt::parse(rt::tokenize("Assign(i 0 0)\nWhile(<(i 1000) Assign(i 0 +(i 1)))"));
+	BENCHMARK("interpret 1000 loop iterations")
+	{
+		return interpreter.run(loop);
+	};
+}
+
+TEST_CASE("Shared function calls", "[benchmark]")
+{
+	// Include("../tests/lib.so")
+	// Bind("test" "int" "int")
+	// test(1) is then called directly through callShared
+	rt::Interpreter interpreter;
+	interpreter.run(rt::parse(rt::tokenize("Include(\"../tests/lib.so\")\nBind(\"test\" \"int\" \"int\")")));
+	const auto function = std::get<std::shared_ptr<rt::LibFunc>>(interpreter.globalSymtab.lookUpHard("test"));
+	const std::vector<objectOrValue> args = { std::variant<double, std::string>(1.0) };
+	REQUIRE(rt::callShared(args, *function, &interpreter.globalSymtab, interpreter.mainArgState, rt::SourceLocation()) == objectOrValue(std::variant<double, std::string>(2.0)));
+	BENCHMARK("callShared int(int)")
+	{
+		return rt::callShared(args, *function, &interpreter.globalSymtab, interpreter.mainArgState, rt::SourceLocation());
+	};
+	BENCHMARK("call through the interpreter")
+	{
+		return interpreter.call("test", args);
+	};
+}
@@ -0,0 +1,191 @@
+// Runs Runtime scripts a number of times and prints the median time, peak resident set size and allocations
+// of each. Every run is a fresh process forked from this one, so runs don't share memory or counters.
+// Allocations are only counted when built with RUNTIME_MEMORY_STATS
+// Runtime
+#include "Runtime.hpp"
+#include "../src/libruntime.h"
+#include "../src/compiler/memory_stats.h"
+// C++
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+// C
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void usage()
+{
+	std::cout <<
+		"usage: bench_scripts [options] file...\n"
+		"Options:\n"
+		"--runs n\ttimes every file is run, 5 by default\n"
+		"Arguments:\n"
+		"file\t\tpath to a Runtime script to be run" << std::endl;
+}
+
+/// <summary>
+/// What a run sends back to the runner
+/// </summary>
+struct RunResult
+{
+	bool succeeded = false;
+	double milliseconds = 0;
+	uint64_t allocations = 0;
+};
+
+/// <summary>
+/// Measurements of one finished run
+/// </summary>
+struct Run
+{
+	double milliseconds;
+	/// <summary>
+	/// Peak resident set size in kilobytes
+	/// </summary>
+	long peakResident;
+	uint64_t allocations;
+};
+
+/// <summary>
+/// Allocations of every category so far
+/// </summary>
+[[nodiscard]] static uint64_t allocations()
+{
+	uint64_t total = 0;
+	for (size_t i = 0; i < rt::memoryCategoryCount; ++i)
+		total += rt::memoryUsage(rt::MemoryCategory(i)).allocations;
+	return total;
+}
+
+/// <summary>
+/// Runs a script in a forked process, with its output discarded
+/// </summary>
+/// <returns>The run, or nothing if the script failed</returns>
+[[nodiscard]] static std::optional<Run> runOnce(const std::string& path)
+{
+	int results[2];
+	if (pipe(results) != 0)
+		return std::nullopt;
+	const pid_t child = fork();
+	if (child == -1) {
+		close(results[0]);
+		close(results[1]);
+		return std::nullopt;
+	}
+	if (child == 0) {
+		close(results[0]);
+		const int null = open("/dev/null", O_WRONLY);
+		dup2(null, STDOUT_FILENO);
+		RunResult result;
+		const uint64_t before = allocations();
+		const auto start = std::chrono::steady_clock::now();
+		rt_interpreter* interpreter = rt_create();
+		const rt_status status = rt_load_file(interpreter, path.c_str());
+		if (status != RT_OK and status != RT_EXIT)
+			std::cerr << path << ": " << rt_error_message(interpreter) << " " << rt_error_location(interpreter) << std::endl;
+		rt_destroy(interpreter);
+		result.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		result.allocations = allocations() - before;
+		result.succeeded = status == RT_OK or status == RT_EXIT;
+		const bool written = write(results[1], &result, sizeof(result)) == sizeof(result);
+		_exit(written ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(results[1]);
+	RunResult result;
+	const bool received = read(results[0], &result, sizeof(result)) == sizeof(result);
+	close(results[0]);
+	int status;
+	rusage usage{};
+	if (wait4(child, &status, 0, &usage) == -1 or not received or not result.succeeded)
+		return std::nullopt;
+	return Run{ result.milliseconds, usage.ru_maxrss, result.allocations };
+}
+
+template <typename T>
+[[nodiscard]] static T median(std::vector<T> values)
+{
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+int main(int argc, char* argv[])
+{
+	int runs = 5;
+	std::vector<std::string> files;
+	int opt;
+	const option longOptions[] = {
+		{ "runs", required_argument, nullptr, 'r' },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	while ((opt = getopt_long(argc, argv, "-:h", longOptions, nullptr)) != -1)
+	{
+		switch (opt)
+		{
+		case 'r':
+			runs = std::atoi(optarg);
+			break;
+		case 1:
+			files.push_back(optarg);
+			break;
+		case 'h':
+			usage();
+			return EXIT_SUCCESS;
+		default:
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if (files.empty() or runs < 1)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	std::cout << std::left << std::setw(24) << "script" << std::right << std::setw(14) << "median ms" << std::setw(14) << "min ms"
+	          << std::setw(16) << "median RSS KB" << std::setw(16) << "allocations" << std::endl;
+	int failures = 0;
+	for (const std::string& file : files)
+	{
+		std::vector<double> milliseconds;
+		std::vector<long> peakResident;
+		std::vector<uint64_t> allocationCounts;
+		for (int i = 0; i < runs; ++i)
+		{
+			const std::optional<Run> run = runOnce(file);
+			if (not run)
+				break;
+			milliseconds.push_back(run->milliseconds);
+			peakResident.push_back(run->peakResident);
+			allocationCounts.push_back(run->allocations);
+		}
+		const std::string name = file.substr(file.find_last_of('/') + 1);
+		std::cout << std::left << std::setw(24) << name << std::right;
+		if (milliseconds.size() != static_cast<size_t>(runs))
+		{
+			std::cout << "  failed" << std::endl;
+			++failures;
+			continue;
+		}
+		std::cout << std::fixed << std::setprecision(2) << std::setw(14) << median(milliseconds)
+		          << std::setw(14) << *std::min_element(milliseconds.begin(), milliseconds.end())
+		          << std::setw(16) << median(peakResident);
+#if RUNTIME_MEMORY_STATS==1
+		std::cout << std::setw(16) << median(allocationCounts);
+#else
+		std::cout << std::setw(16) << "-";
+#endif // RUNTIME_MEMORY_STATS
+		std::cout << std::endl;
+	}
+#if RUNTIME_MEMORY_STATS!=1
+	std::cout << "Allocations are only counted when built with RUNTIME_MEMORY_STATS" << std::endl;
+#endif // RUNTIME_MEMORY_STATS
+	return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,27 +1,34 @@
 ﻿// Runtime
 #include "Runtime.hpp"
-#include "compiler/object.h"
-#include "compiler/tokenizer.h"
-#include "compiler/shared_libs.h"
-#include "compiler/parser.h"
-#include "compiler/interpreter.h"
-#include "compiler/exceptions.h"
+#include "libruntime.h"
+#include "server.h"
+#include "compiler/heap_dump.h"
+#include "compiler/memory_stats.h"
+#include "compiler/perf_counters.h"
+#include "compiler/profiler.h"
+#include "compiler/stats.h"
+#include "compiler/trace.h"
 // C++
-#include <bits/getopt_core.h>
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
-#include <iostream> 
+#include <filesystem>
 #include <fstream>
+#include <iostream> 
+#include <iterator>
 #include <optional>
+#include <system_error>
+#include <thread>
 // C
 #include <memory>
 #include <ostream>
 #include <stdlib.h>
 #include <getopt.h>
+#include <signal.h>
 // Gnu
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <string>
-#include <variant>
 
 #ifdef _WIN32
 
@@ -45,20 +52,226 @@ static void usage()
 		"usage: Runtime [options] file...\n" // TODO: Don't harcode file name
 		"Options:\n"
 		"-v\t\tdisplays version information\n"
+		"--serve socket\truns scripts sent to the socket on warm interpreters\n"
+		"--workers n\tamount of interpreters used by --serve\n"
+		"--preload file\tfile to include in every interpreter of --serve, can be repeated\n"
+		"--connect socket\truns file, or standard input without one, on a server\n"
+		"--profile out\tsamples file while it runs, writes the call stacks to out for flamegraph tools\n"
+		"\t\tand prints the objects taking the most time\n"
+		"--profile-calls out\tcounts and times every call while file runs, writes the totals to out as JSON\n"
+		"\t\tand prints the objects taking the most time\n"
+		"--stats\t\tprints counters of the work done by the interpreter at exit, if built with RUNTIME_STATS,\n"
+		"\t\tand the memory of each kind of allocation, if built with RUNTIME_MEMORY_STATS\n"
+		"\t\t--stats, --profile and --profile-calls also print the time, cycles, instructions, cache\n"
+		"\t\tand branch misses of tokenizing, parsing, interpreting and native calls at exit\n"
+		"--trace out\twrites a trace of loading, Include, top-level members and native calls to out at exit,\n"
+		"\t\tfor chrome://tracing or Perfetto\n"
+		"--trace-objects us\talso traces object calls taking at least us microseconds\n"
+		"--heap-dump out\twrites the objects reachable from the running script to out whenever Runtime gets SIGUSR1\n"
+		"--heap-summary dump\tprints the largest retainers, object counts by name and reference cycles of a heap dump\n"
 		"Arguments:\n"
 		"file\t\tpath to a Runtime script to be run" << std::endl;
 }
 
+/// <summary>
+/// Prints the summary of a heap dump written by HeapDump or --heap-dump
+/// </summary>
+/// <returns>Exit code</returns>
+static int summarizeHeapDump(const std::string& path)
+{
+	std::ifstream in(path);
+	if (not in)
+	{
+		std::cerr << "Unable to read heap dump from " << path << std::endl;
+		return EXIT_FAILURE;
+	}
+	if (not rt::summarizeHeapDump(in, std::cout, 20))
+	{
+		std::cerr << path << " is not a heap dump" << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/// <summary>
+/// Serves scripts until interrupted
+/// </summary>
+static int serve(rt::ServerOptions options)
+{
+	// Handle the signals on this thread only, the workers inherit the mask
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	try
+	{
+		rt::Server server(std::move(options));
+		int signal;
+		sigwait(&signals, &signal);
+		server.stop();
+	}
+	catch (const std::system_error& e)
+	{
+		std::cerr << "Unable to serve: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/// <summary>
+/// Runs a file, or standard input, on a server
+/// </summary>
+static int runOnServer(const std::string& socketPath, const std::optional<std::string>& filePath)
+{
+	try
+	{
+		rt::ScriptResult result = filePath
+			? rt::runRemote(socketPath, std::filesystem::absolute(filePath.value()).string(), true)
+			: rt::runRemote(socketPath, std::string(std::istreambuf_iterator<char>(std::cin), {}), false);
+		std::cout << result.output << std::flush;
+		return result.status;
+	}
+	catch (const std::system_error& e)
+	{
+		std::cerr << "Unable to reach server: " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+}
+
+/// <summary>
+/// Writes the samples of a profiler as collapsed stacks, and prints the hottest objects
+/// </summary>
+static void writeProfile(rt::SamplingProfiler& profiler, const std::string& path)
+{
+	profiler.stop();
+	std::ofstream out(path);
+	if (out)
+		profiler.writeCollapsed(out);
+	else
+		std::cerr << "Unable to write profile to " << path << std::endl;
+	profiler.writeTop(std::cerr, 20);
+}
+
+/// <summary>
+/// Writes the call totals of a profiler as JSON, and prints the objects taking the most time
+/// </summary>
+static void writeCallProfile(rt::CallProfiler& profiler, const std::string& path)
+{
+	profiler.stop();
+	std::ofstream out(path);
+	if (out)
+		profiler.writeJson(out);
+	else
+		std::cerr << "Unable to write call profile to " << path << std::endl;
+	profiler.writeTable(std::cerr, 20);
+}
+
+/// <summary>
+/// Prints the last error of the interpreter
+/// </summary>
+static void printError(const rt_interpreter* interpreter, rt_status status)
+{
+#ifdef _WIN32
+	HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+#endif // _WIN32
+	if (status == RT_ERROR) {
+		std::cout << rt_error_message(interpreter) << std::endl;
+		return;
+	}
+	YELLOW_TEXT
+	switch (status)
+	{
+	case RT_TOKENIZER_ERROR:
+		std::cerr << "TokenizerException: ";
+		break;
+	case RT_PARSER_ERROR:
+		std::cerr << "ParserException: ";
+		break;
+	default:
+		std::cerr << "InterpreterException: ";
+	}
+	WHITE_TEXT
+		std::cerr << rt_error_message(interpreter) << std::endl;
+		std::cerr << rt_error_location(interpreter) << std::endl;
+}
+
 int main(int argc, char* argv[])
 {
 	std::optional<std::string> filePath = std::nullopt;
+	std::optional<std::string> serveSocket = std::nullopt;
+	std::optional<std::string> connectSocket = std::nullopt;
+	std::optional<std::string> profilePath = std::nullopt;
+	std::optional<std::string> callProfilePath = std::nullopt;
+	std::optional<std::string> tracePath = std::nullopt;
+	std::optional<std::chrono::nanoseconds> traceObjectThreshold = std::nullopt;
+	bool countPhases = false;
+	rt::ServerOptions serverOptions;
+	serverOptions.workers = std::max(1u, std::thread::hardware_concurrency());
 	int opt;
+	const option longOptions[] = {
+		{ "serve", required_argument, nullptr, 's' },
+		{ "workers", required_argument, nullptr, 'w' },
+		{ "preload", required_argument, nullptr, 'p' },
+		{ "connect", required_argument, nullptr, 'c' },
+		{ "profile", required_argument, nullptr, 'f' },
+		{ "profile-calls", required_argument, nullptr, 'i' },
+		{ "stats", no_argument, nullptr, 'S' },
+		{ "trace", required_argument, nullptr, 't' },
+		{ "trace-objects", required_argument, nullptr, 'o' },
+		{ "heap-dump", required_argument, nullptr, 'd' },
+		{ "heap-summary", required_argument, nullptr, 'm' },
+		{ nullptr, 0, nullptr, 0 }
+	};
 
 	// Parse arguments
-	while ((opt = getopt(argc, argv, "-:vh")) != -1)
+	while ((opt = getopt_long(argc, argv, "-:vh", longOptions, nullptr)) != -1)
 	{
 		switch (opt)
 		{
+		case 's':
+			serveSocket = optarg;
+			break;
+		case 'w':
+			serverOptions.workers = std::strtoul(optarg, nullptr, 10);
+			break;
+		case 'p':
+			serverOptions.preload.push_back(optarg);
+			break;
+		case 'c':
+			connectSocket = optarg;
+			break;
+		case 'f':
+			profilePath = optarg;
+			countPhases = true;
+			break;
+		case 'i':
+			callProfilePath = optarg;
+			countPhases = true;
+			break;
+		case 'S':
+#if RUNTIME_STATS==1
+			// Also printed when the script calls Exit
+			std::atexit([] { std::cerr << rt::interpreterStatsReport(); });
+#else
+			std::cerr << "Runtime was built without RUNTIME_STATS, --stats only prints phase counters" << std::endl;
+#endif // RUNTIME_STATS
+#if RUNTIME_MEMORY_STATS==1
+			std::atexit([] { std::cerr << rt::memoryStatsReport(); });
+#endif // RUNTIME_MEMORY_STATS
+			countPhases = true;
+			break;
+		case 't':
+			tracePath = optarg;
+			break;
+		case 'o':
+			traceObjectThreshold = std::chrono::microseconds(std::strtoul(optarg, nullptr, 10));
+			break;
+		case 'd':
+			rt::enableHeapDumpSignal(optarg);
+			break;
+		case 'm':
+			exit(summarizeHeapDump(optarg));
 		case 'v':
 			std::cout << "Runtime " << RUNTIME_VERSION << std::endl;
 			exit(EXIT_SUCCESS);
@@ -77,63 +290,45 @@ int main(int argc, char* argv[])
 			filePath = optarg;
 		}
 	}
-	
-	if (filePath) // File input
+
+	if (tracePath)
+		rt::startTrace(tracePath, traceObjectThreshold);
+	if (countPhases)
 	{
-#ifdef _WIN32
-		HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-#endif // _WIN32
+		rt::startPhaseCounters();
+		std::atexit([] { std::cerr << rt::phaseReport(); });
+	}
 
-		std::ifstream file;
-		// Open file
-		file.open(filePath.value(), std::fstream::in);
-		if (file.fail())
-		{
-			std::cout << "Unable to open file " << filePath.value() << std::endl;
-			return EXIT_FAILURE;
-		}
-		file.seekg(0, std::ios::end);
-		size_t size = file.tellg();
-		std::string fileText(size, ' ');
-		file.seekg(0);
-		file.read(&fileText[0], size);
-		file.close();
-
-		try
-		{
-			rt::interpret(rt::parse((rt::tokenize(fileText.c_str(), argv[1])), true), argc, argv);
-		}
-		catch (ParserException e)
-		{
-			YELLOW_TEXT
-				std::cerr << "ParserException: ";
-			WHITE_TEXT
-				std::cerr << e.what() << std::endl;
-				std::cerr << e.where() << std::endl;
-			rt::cleanLibraries();
-			return EXIT_FAILURE;
-		}
-		catch (TokenizerException e)
-		{
-			YELLOW_TEXT
-				std::cerr << "TokenizerException: ";
-			WHITE_TEXT
-				std::cerr << e.what() << std::endl;
-				std::cerr << e.where() << std::endl;
-			rt::cleanLibraries();
-			return EXIT_FAILURE;
-		}
-		catch (InterpreterException e)
+	if (serveSocket) // Server
+	{
+		serverOptions.socketPath = serveSocket.value();
+		return serve(std::move(serverOptions));
+	}
+	if (connectSocket) // Client of a server
+		return runOnServer(connectSocket.value(), filePath);
+
+	std::unique_ptr<rt_interpreter, decltype(&rt_destroy)> interpreter(rt_create(), rt_destroy);
+	if (filePath) // File input
+	{
+		rt_set_arguments(interpreter.get(), argc, argv);
+		std::optional<rt::SamplingProfiler> profiler;
+		if (profilePath)
+			profiler.emplace();
+		std::optional<rt::CallProfiler> callProfiler;
+		if (callProfilePath)
+			callProfiler.emplace();
+		rt_status status = rt_load_file(interpreter.get(), filePath.value().c_str());
+		if (profiler)
+			writeProfile(*profiler, profilePath.value());
+		if (callProfiler)
+			writeCallProfile(*callProfiler, callProfilePath.value());
+		if (status == RT_EXIT)
+			return rt_exit_code(interpreter.get());
+		if (status != RT_OK)
 		{
-			YELLOW_TEXT
-				std::cerr << "InterpreterException: ";
-			WHITE_TEXT
-				std::cerr << e.what() << std::endl;
-				std::cerr << e.where() << std::endl;
-			rt::cleanLibraries();
+			printError(interpreter.get(), status);
 			return EXIT_FAILURE;
 		}
-		rt::cleanLibraries();
 		return EXIT_SUCCESS;
 	}
 	else // Live interpret
@@ -144,9 +339,8 @@ int main(int argc, char* argv[])
 		YELLOW_TEXT
 			std::cout << "  _____             _   _                \n |  __ \\           | | (_)               \n | |__) |   _ _ __ | |_ _ _ __ ___   ___ \n |  _  / | | | '_ \\| __| | '_ ` _ \\ / _ \\\n | | \\ \\ |_| | | | | |_| | | | | | |  __/\n |_|  \\_\\__,_|_| |_|\\__|_|_| |_| |_|\\___|\n";
 		WHITE_TEXT
-			std::cout << std::endl << "Running Runtime " << RUNTIME_VERSION << std::endl;
+			std::cout << std::endl << "Running Runtime " << rt_version() << std::endl;
 		// Interpreter
-		rt::liveIntrepretSetup();
 		while (true)
 		{
 #ifdef _WIN32
@@ -160,48 +354,31 @@ int main(int argc, char* argv[])
 #endif
 			if (not input.empty())
 			{
-				try
-				{
-					objectOrValue v = rt::liveIntrepret(rt::parse(rt::tokenize(input.c_str(), "live-input"), false));
-					CYAN_TEXT;
-					if (auto obj = std::get_if<std::shared_ptr<rt::Object>>(&v)) {
-						std::cout << "Object \"" << (*obj)->getName() << "\"" << std::endl;
-					} else {
-						std::variant<double, std::string> value = std::get<std::variant<double, std::string>>(v);
-						if (auto str = std::get_if<std::string>(&value))
-							std::cout << *str << std::endl;
-						else
-							std::cout << std::get<double>(value) << std::endl;
-					}
-				}
-				catch (ParserException e)
-				{
-					YELLOW_TEXT
-						std::cerr << "ParserException: ";
-					WHITE_TEXT
-						std::cerr << e.what() << std::endl;
-						std::cerr << e.where() << std::endl;
-				}
-				catch (TokenizerException e)
+				rt_value* v = nullptr;
+				rt_status status = rt_eval(interpreter.get(), input.c_str(), &v);
+				if (status == RT_EXIT)
+					return rt_exit_code(interpreter.get());
+				if (status != RT_OK)
 				{
-					YELLOW_TEXT
-						std::cerr << "TokenizerException: ";
-					WHITE_TEXT
-						std::cerr << e.what() << std::endl;
-						std::cerr << e.where() << std::endl;
+					printError(interpreter.get(), status);
+					continue;
 				}
-				catch (InterpreterException e)
+				CYAN_TEXT;
+				switch (rt_type(v))
 				{
-					YELLOW_TEXT
-						std::cerr << "InterpreterException: ";
-					WHITE_TEXT
-						std::cerr << e.what() << std::endl;
-						std::cerr << e.where() << std::endl;
+				case RT_OBJECT:
+					std::cout << "Object \"" << rt_to_string(v) << "\"" << std::endl;
+					break;
+				case RT_STRING:
+					std::cout << rt_to_string(v) << std::endl;
+					break;
+				case RT_NUMBER:
+					std::cout << rt_to_number(v) << std::endl;
 				}
+				rt_free(v);
 			};
 		}
 		rl_clear_history();
-		rt::cleanLibraries();
 		return EXIT_SUCCESS;
 	}
 }
@@ -2,18 +2,23 @@
 // This file contains all the I/O functions in Runtime
 #include "StandardFiles.h"
 #include "../interpreter.h"
+#include "../context.h"
+#include "../shared_segment.h"
 // C++
 #include <variant>
 #include <vector>
 #include <unordered_map>
 #include <iostream>
 #include <fstream>
+#include <cstring>
+// C
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 namespace rt
 {
-    // Keep track of opened files, since the info can't be stored in the file objects themselves
-    std::unordered_map<std::string, std::fstream> openedFiles = {};
-
     /// <summary>
 	/// Creates a file object. The object is written into the first argument. 2 arg is file path
 	/// </summary>
@@ -63,11 +68,11 @@ namespace rt
             else
 				return giveException("Path is of wrong type");
             // Open file
-			if (openedFiles.contains(path)) {
+			if (symtab->interpreter().openedFiles.contains(path)) {
 				return giveException("File is already opened");
 			}
-            openedFiles.insert({path, std::fstream()});
-            std::fstream* f = &openedFiles.at(path);
+            symtab->interpreter().openedFiles.insert({path, std::fstream()});
+            std::fstream* f = &symtab->interpreter().openedFiles.at(path);
             f->open(path, std::ios::in | std::ios::out);
             if (not f->is_open())
             {
@@ -100,8 +105,8 @@ namespace rt
             else
 				return giveException("Path is of wrong type");
             // Close file
-            openedFiles.at(path).close();
-            openedFiles.erase(path);
+            symtab->interpreter().openedFiles.at(path).close();
+            symtab->interpreter().openedFiles.erase(path);
             file->setMember("open", False);
             return True;
 	    }    
@@ -129,7 +134,7 @@ namespace rt
             else
 				return giveException("Path is of wrong type");
 			// Open file
-            std::fstream* f = &openedFiles.at(path);
+            std::fstream* f = &symtab->interpreter().openedFiles.at(path);
             if (not f->is_open())
 				return giveException("File failed to open");
 			// Read line
@@ -161,7 +166,7 @@ namespace rt
             else
 				return giveException("Path is of wrong type");
             // Open file
-            std::fstream* f = &openedFiles.at(path);
+            std::fstream* f = &symtab->interpreter().openedFiles.at(path);
             if (not f->is_open())
 				return giveException("File failed to open");
             // Get text to add
@@ -201,7 +206,7 @@ namespace rt
             else
 				return giveException("Path is of wrong type");
             // Open file
-            std::fstream* f = &openedFiles.at(path);
+            std::fstream* f = &symtab->interpreter().openedFiles.at(path);
             if (not f->is_open())
 				return giveException("File failed to open");
 			// Get file position
@@ -245,7 +250,7 @@ namespace rt
             else
 				return giveException("Path is of wrong type");
             // Open file
-            std::fstream* f = &openedFiles.at(path);
+            std::fstream* f = &symtab->interpreter().openedFiles.at(path);
             if (not f->is_open())
                 return giveException("File failed to open");
             // Get file position
@@ -272,4 +277,417 @@ namespace rt
 	    }    
 		return giveException("Wrong amount of arguments");
 	}  
+
+	/*
+	 * Desc=Opens a file, pipe or other path for non-blocking reads and writes with StreamRead and StreamWrite.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Stream=An object to attach the stream to.
+	 * Param1[True]Path=Path to open.
+	 * Param2[True]Mode="r" to read, "w" to write over or "a" to append. Defaults to "r".
+	 */
+	objectOrValue StreamOpen(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Stream must be object");
+		}
+		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		auto path = evaluate(args.at(1), symtab, argState);
+		if (not std::holds_alternative<std::string>(path)) {
+			return giveException("Path is of wrong type");
+		}
+		std::variant<double, std::string> mode = std::string("r");
+		if (args.size() > 2)
+			mode = evaluate(args.at(2), symtab, argState);
+		int flags;
+		if (mode == std::variant<double, std::string>(std::string("r")))
+			flags = O_RDONLY;
+		else if (mode == std::variant<double, std::string>(std::string("w")))
+			flags = O_WRONLY | O_CREAT | O_TRUNC;
+		else if (mode == std::variant<double, std::string>(std::string("a")))
+			flags = O_WRONLY | O_CREAT | O_APPEND;
+		else
+			return giveException("Mode is of wrong type");
+		const int fd = open(std::get<std::string>(path).c_str(), flags | O_NONBLOCK | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			return giveException(std::string("Unable to open stream: ") + std::strerror(errno));
+		}
+		obj->setNative(std::make_shared<Stream>(fd));
+		obj->addMember(path, "path");
+		return True;
+	}
+
+	/*
+	 * Desc=Connects to a Unix domain socket, for non-blocking reads and writes with StreamRead and StreamWrite.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Stream=An object to attach the connection to.
+	 * Param1[True]Path=Path of the socket.
+	 */
+	objectOrValue SocketConnect(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Stream must be object");
+		}
+		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		auto path = evaluate(args.at(1), symtab, argState);
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (not std::holds_alternative<std::string>(path) or std::get<std::string>(path).size() >= sizeof(address.sun_path)) {
+			return giveException("Path is of wrong type");
+		}
+		std::strcpy(address.sun_path, std::get<std::string>(path).c_str());
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			return giveException(std::string("Unable to create socket: ") + std::strerror(errno));
+		}
+		auto stream = std::make_shared<Stream>(fd);
+		// Local connections are accepted or refused right away
+		if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+			return giveException(std::string("Unable to connect: ") + std::strerror(errno));
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		obj->setNative(stream);
+		obj->addMember(path, "path");
+		return True;
+	}
+
+	/// <summary>
+	/// Checks that an operation can be started on the stream in the argument
+	/// </summary>
+	/// <returns>The stream, or nullptr if an exception was written to error</returns>
+	[[nodiscard]] static std::shared_ptr<Stream> idleStream(const objectOrValue& arg, SymbolTable* symtab, objectOrValue& error)
+	{
+		auto stream = getStream(arg);
+		if (stream == nullptr)
+			error = giveException("Object is not a stream");
+		else if (symtab->interpreter().events.busy(*stream))
+			error = giveException("Stream already has a pending operation");
+		else
+			return stream;
+		return nullptr;
+	}
+
+	/*
+	 * Desc=Starts reading from a stream. The handle can then be passed to Await, Ready or OnComplete.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Handle=An object to attach the operation to. Its result is the data read, an empty string at the end of the stream.
+	 * Param1[False]Stream=A stream opened with StreamOpen or SocketConnect.
+	 */
+	objectOrValue StreamRead(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (not symtab->interpreter().scheduler.usable()) {
+			return giveException("Events cannot be used in parallel calls");
+		}
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Handle must be object");
+		}
+		objectOrValue error;
+		auto stream = idleStream(args.at(1), symtab, error);
+		if (stream == nullptr)
+			return error;
+		auto operation = std::make_shared<IoOperation>();
+		std::get<std::shared_ptr<Object>>(args.at(0))->setNative(operation);
+		symtab->interpreter().events.read(stream, operation);
+		return True;
+	}
+
+	/*
+	 * Desc=Starts writing to a stream. The handle can then be passed to Await, Ready or OnComplete.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Handle=An object to attach the operation to. Its result is the amount of bytes written.
+	 * Param1[False]Stream=A stream opened with StreamOpen or SocketConnect.
+	 * Param2[True]Data=String to write.
+	 */
+	objectOrValue StreamWrite(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 3) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (not symtab->interpreter().scheduler.usable()) {
+			return giveException("Events cannot be used in parallel calls");
+		}
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Handle must be object");
+		}
+		objectOrValue error;
+		auto stream = idleStream(args.at(1), symtab, error);
+		if (stream == nullptr)
+			return error;
+		auto data = evaluate(args.at(2), symtab, argState);
+		if (not std::holds_alternative<std::string>(data)) {
+			return giveException("Data is of wrong type");
+		}
+		auto operation = std::make_shared<IoOperation>();
+		std::get<std::shared_ptr<Object>>(args.at(0))->setNative(operation);
+		symtab->interpreter().events.write(stream, std::get<std::string>(std::move(data)), operation);
+		return True;
+	}
+
+	/*
+	 * Desc=Closes a stream.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Stream=A stream opened with StreamOpen or SocketConnect, without pending operations.
+	 */
+	objectOrValue StreamClose(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		objectOrValue error;
+		if (idleStream(args.at(0), symtab, error) == nullptr)
+			return error;
+		std::get<std::shared_ptr<Object>>(args.at(0))->setNative(std::any());
+		return True;
+	}
+
+	/*
+	 * Desc=Starts a timer. The handle can then be passed to Await, Ready or OnComplete.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Handle=An object to attach the timer to. Its result is 1.
+	 * Param1[True]Milliseconds=Time until the timer completes.
+	 */
+	objectOrValue Timer(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (not symtab->interpreter().scheduler.usable()) {
+			return giveException("Events cannot be used in parallel calls");
+		}
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Handle must be object");
+		}
+		auto milliseconds = evaluate(args.at(1), symtab, argState);
+		if (not std::holds_alternative<double>(milliseconds) or std::get<double>(milliseconds) < 0) {
+			return giveException("Milliseconds is of wrong type");
+		}
+		auto operation = std::make_shared<IoOperation>();
+		std::get<std::shared_ptr<Object>>(args.at(0))->setNative(operation);
+		symtab->interpreter().events.timer(std::get<double>(milliseconds), operation);
+		return True;
+	}
+
+	/*
+	 * Desc=Calls an object with the result of an operation once it completes, while the program awaits or yields. Failed operations pass an exception.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Handle=An object passed to StreamRead, StreamWrite or Timer.
+	 * Param1[False]Callback=An object to call, in the global scope.
+	 */
+	objectOrValue OnComplete(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (not symtab->interpreter().scheduler.usable()) {
+			return giveException("Events cannot be used in parallel calls");
+		}
+		auto operation = getIoOperation(args.at(0));
+		if (operation == nullptr) {
+			return giveException("Object is not an I/O handle");
+		}
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(1))) {
+			return giveException("Callback must be object");
+		}
+		auto callback = std::get<std::shared_ptr<Object>>(args.at(1));
+		if (not operation->done) {
+			operation->callback = callback;
+			return True;
+		}
+		// Already done, call right away
+		SymbolTable localSt(&symtab->interpreter().globalSymtab);
+		ArgState callArgs;
+		objectOrValue result = operation->error.empty() ? objectOrValue(operation->result) : objectOrValue(giveException(operation->error));
+		callObject(callback, &localSt, callArgs, { result });
+		return True;
+	}
+
+	/*
+	 * Desc=Runs fibers and completion callbacks until no I/O operation is pending.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 */
+	objectOrValue RunEvents(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		Interpreter& interpreter = symtab->interpreter();
+		if (not interpreter.scheduler.usable()) {
+			return giveException("Events cannot be run in parallel calls");
+		}
+		interpreter.scheduler.waitUntil([&] { return interpreter.events.pending() == 0; });
+		return True;
+	}
+
+	/// <summary>
+	/// Turns a member read from a segment into a value, or an object referring to the segment
+	/// </summary>
+	[[nodiscard]] static objectOrValue segmentMember(SegmentMember member)
+	{
+		if (auto value = std::get_if<std::variant<double, std::string>>(&member)) {
+			return std::move(*value);
+		}
+		auto obj = std::make_shared<Object>();
+		obj->setNative(std::get<SegmentNode>(std::move(member)));
+		obj->freeze();
+		return obj;
+	}
+
+	/// <summary>
+	/// Returns the segment object in an argument, calling the argument first if it is a call such as SegmentGet
+	/// </summary>
+	[[nodiscard]] static const SegmentNode* segmentArgument(objectOrValue& arg, SymbolTable* symtab, ArgState& argState)
+	{
+		auto obj = std::get_if<std::shared_ptr<Object>>(&arg);
+		if (obj != nullptr and (*obj)->getExpression() != nullptr and getSegmentNode(arg) == nullptr) {
+			arg = softEvaluate(arg, symtab, argState, false);
+		}
+		return getSegmentNode(arg);
+	}
+
+	/*
+	 * Desc=Writes a frozen object and everything in it to a shared memory segment, which other processes can attach to and read without copying it. Names containing a '/' are written as files.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Object=A frozen object to publish.
+	 * Param1[True]Name=Name of the segment.
+	 */
+	objectOrValue SegmentPublish(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Object must be object");
+		}
+		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		if (not obj->isFrozen()) {
+			return giveException("Object must be frozen");
+		}
+		auto name = evaluate(args.at(1), symtab, argState);
+		if (not std::holds_alternative<std::string>(name)) {
+			return giveException("Name is of wrong type");
+		}
+		try
+		{
+			Segment::publish(*obj, std::get<std::string>(name));
+		}
+		catch (const std::exception& e)
+		{
+			return giveException(e.what());
+		}
+		return True;
+	}
+
+	/*
+	 * Desc=Attaches to a segment written by SegmentPublish, in this or another process. Members are read in place with SegmentGet.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Segment=An object to attach the segment to.
+	 * Param1[True]Name=Name of the segment.
+	 */
+	objectOrValue SegmentAttach(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Segment must be object");
+		}
+		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		auto name = evaluate(args.at(1), symtab, argState);
+		if (not std::holds_alternative<std::string>(name)) {
+			return giveException("Name is of wrong type");
+		}
+		try
+		{
+			obj->setNative(Segment::attach(std::get<std::string>(name))->root());
+		}
+		catch (const std::exception& e)
+		{
+			return giveException(e.what());
+		}
+		obj->addMember(name, "name");
+		return True;
+	}
+
+	/*
+	 * Desc=Reads a member of an attached segment, or of an object in it. Objects are returned without copying them.
+	 * Added=v0.12.0
+	 * Returns=Value, object or exception
+	 * Param0[False]Segment=An attached segment, or an object from one.
+	 * Param1[True]Key=Number or name of the member.
+	 */
+	objectOrValue SegmentGet(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		const SegmentNode* node = segmentArgument(args.at(0), symtab, argState);
+		if (node == nullptr) {
+			return giveException("Segment must be attached");
+		}
+		auto key = evaluate(args.at(1), symtab, argState);
+		try
+		{
+			if (auto member = node->member(key)) {
+				return segmentMember(std::move(*member));
+			}
+		}
+		catch (const std::exception& e)
+		{
+			return giveException(e.what());
+		}
+		return giveException("No such member");
+	}
+
+	/*
+	 * Desc=Returns how many members an attached segment, or an object in it, has.
+	 * Added=v0.12.0
+	 * Returns=Number of members or exception
+	 * Param0[False]Segment=An attached segment, or an object from one.
+	 */
+	objectOrValue SegmentSize(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		const SegmentNode* node = segmentArgument(args.at(0), symtab, argState);
+		if (node == nullptr) {
+			return giveException("Segment must be attached");
+		}
+		try
+		{
+			return static_cast<double>(node->size());
+		}
+		catch (const std::exception& e)
+		{
+			return giveException(e.what());
+		}
+	}
+
+	/*
+	 * Desc=Removes the name of a segment. Processes which are attached keep reading it.
+	 * Added=v0.12.0
+	 * Returns=1, 0 if there was no such segment, or exception
+	 * Param0[True]Name=Name of the segment.
+	 */
+	objectOrValue SegmentRemove(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		auto name = evaluate(args.at(0), symtab, argState);
+		if (not std::holds_alternative<std::string>(name)) {
+			return giveException("Name is of wrong type");
+		}
+		try
+		{
+			return Segment::remove(std::get<std::string>(name)) ? True : 0.0;
+		}
+		catch (const std::exception& e)
+		{
+			return giveException(e.what());
+		}
+	}
 }
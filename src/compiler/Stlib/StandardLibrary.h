@@ -5,10 +5,21 @@
 #include "../interpreter.h"
 #include "../parser.h"
 #include "../shared_libs.h"
+#include "../context.h"
+#include "../ffi_stats.h"
+#include "../heap_dump.h"
+#include "../memory_stats.h"
+#include "../thread_pool.h"
+#include "../stats.h"
+#include "../trace.h"
 // C++
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <deque>
 #include <iostream>
 #include <fstream>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <unordered_map>
@@ -82,24 +93,28 @@ namespace rt
 	/// <param name="args">Value(s) to print</param>
 	objectOrValue Print(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
 	{
+		std::vector<std::string> outputs;
 		for (objectOrValue arg : args)
 		{
 			auto valueHeld = evaluate(arg, symtab, argState);
-			std::string output;
 			// Convert type to string
 			if (std::holds_alternative<std::string>(valueHeld))
-				output = std::get<std::string>(valueHeld);
+				outputs.push_back(std::get<std::string>(valueHeld));
 			else
-				output = std::to_string(std::get<double>(valueHeld));
-			
-			// Print
-			if (isCapture())
-				captureString(output);
+				outputs.push_back(std::to_string(std::get<double>(valueHeld)));
+		}
+
+		// Print
+		std::lock_guard lock(symtab->interpreter().outputMutex);
+		for (std::string& output : outputs)
+		{
+			if (symtab->interpreter().capture)
+				symtab->interpreter().capturedCout.push_back(std::move(output));
 			else // Remove else clause if debugging output
-				std::cout << output;
+				*symtab->interpreter().output << output;
 		}
-		if (not isCapture())
-			std::cout << std::endl;
+		if (not symtab->interpreter().capture)
+			*symtab->interpreter().output << std::endl;
 		return True;
 	}
 
@@ -122,6 +137,10 @@ namespace rt
 		if (args.size() > 0 and std::holds_alternative<std::shared_ptr<Object>>(args.at(0)))
 		{
 			std::shared_ptr<Object> init = std::get<std::shared_ptr<Object>>(args.at(0)); // Main object to initialize
+			if (init->isFrozen())
+				return giveException("Object is frozen");
+			if (ParallelScope::isShared(init.get()))
+				return giveException("Object is shared with other parallel calls");
 			for (std::vector<objectOrValue>::iterator it = ++args.begin(); it != args.end(); ++it)
 			{
 				init.get()->addMember(*it);
@@ -141,6 +160,10 @@ namespace rt
 		if (args.size() > 0 and std::holds_alternative<std::shared_ptr<Object>>(args.at(0)))
 		{
 			std::shared_ptr<Object> init = std::get<std::shared_ptr<Object>>(args.at(0)); // Main object to initialize
+			if (init->isFrozen())
+				return giveException("Object is frozen");
+			if (ParallelScope::isShared(init.get()))
+				return giveException("Object is shared with other parallel calls");
 			for (std::vector<objectOrValue>::iterator it = ++args.begin(); it != args.end(); ++it)
 			{
 				init.get()->addMember(evaluate(*it, symtab, argState, true));
@@ -160,6 +183,10 @@ namespace rt
 		if (args.size() > 0 and std::holds_alternative<std::shared_ptr<Object>>(args.at(0)))
 		{
 			std::shared_ptr<Object> init = std::get<std::shared_ptr<Object>>(args.at(0)); // Main object to initialize
+			if (init->isFrozen())
+				return giveException("Object is frozen");
+			if (ParallelScope::isShared(init.get()))
+				return giveException("Object is shared with other parallel calls");
 			for (std::vector<objectOrValue>::iterator it = ++args.begin(); it != args.end(); ++it)
 			{
 				init.get()->addMember(softEvaluate(*it, symtab, argState, true));
@@ -179,6 +206,10 @@ namespace rt
 		if (args.size() > 0 and std::holds_alternative<std::shared_ptr<Object>>(args.at(0)))
 		{
 			std::shared_ptr<Object> assignee = std::get<std::shared_ptr<Object>>(args.at(0)); // Object to assign value to
+			if (assignee->isFrozen())
+				return giveException("Object is frozen");
+			if (ParallelScope::isShared(assignee.get()))
+				return giveException("Object is shared with other parallel calls");
 			auto key = evaluate(args.at(1), symtab, argState);
 			assignee.get()->setMember(key, evaluate(args.at(2),symtab,argState,false));
 			return True;
@@ -196,6 +227,10 @@ namespace rt
 		if (args.size() > 0 and std::holds_alternative<std::shared_ptr<Object>>(args.at(0)))
 		{
 			std::shared_ptr<Object> assignee = std::get<std::shared_ptr<Object>>(args.at(0)); // Object to assign value to
+			if (assignee->isFrozen())
+				return giveException("Object is frozen");
+			if (ParallelScope::isShared(assignee.get()))
+				return giveException("Object is shared with other parallel calls");
 			auto key = evaluate(args.at(1),symtab, argState, true);
 			assignee.get()->setMember(key, args.at(2));
 			return True;
@@ -204,7 +239,7 @@ namespace rt
 	}
 
 	/// <summary>
-	/// Exits
+	/// Exits, by throwing an ExitException which unwinds the script
 	/// </summary>
 	/// <param name="args">First arg is exit code</param>
 	/// <param name="symtab"></param>
@@ -215,9 +250,9 @@ namespace rt
 		{
 			auto r = evaluate(args.at(0), symtab, argState);
 			if (std::holds_alternative<double>(r))
-				exit(std::get<double>(r));
+				throw ExitException(std::get<double>(r));
 		}
-		exit(0);
+		throw ExitException(0);
 	}
 
 	/// <summary>
@@ -234,6 +269,7 @@ namespace rt
 			if (std::holds_alternative<std::string>(valueHeld)) // If string
 			{
 				std::string fileName = std::get<std::string>(valueHeld);
+				TraceSpan span(TraceCategory::Include, "Include", fileName);
 				std::ifstream file;
 				// Runtime library
 				if (fileName.ends_with(".rnt")) {
@@ -253,7 +289,7 @@ namespace rt
 					rt::include(rt::parse((rt::tokenize(fileText.c_str(), fileName.c_str())), true), symtab, argState);
 					return True;
 				}
-				else if (fileName.ends_with(".so") or fileName.ends_with(".dll")) {
+				else if (fileName.ends_with(".so") or fileName.find(".so.") != std::string::npos or fileName.ends_with(".dll")) {
 					loadSharedLibrary(fileName.c_str(), symtab); // Call function
 					return True;
 				}
@@ -448,6 +484,7 @@ namespace rt
 		if (const auto obj = std::get_if<std::shared_ptr<Object>>(&obv)) {
 			// Struct
 			std::vector<Type> members;
+			RUNTIME_COUNT_MEMBER_COPY(*obj);
 			for (auto m : (*obj)->getMembers()) {
 				members.push_back(std::move(makeType(m, symtab, argState)));
 			}
@@ -456,6 +493,10 @@ namespace rt
 			// Not struct
 			auto rV = evaluate(obv, symtab, argState);
 			if (const std::string* rType = std::get_if<std::string>(&rV)) {
+				// Is array type
+				if (rType->ends_with("[]")) {
+					return Type(typeNames.at(rType->substr(0, rType->size() - 2)), true, true);
+				}
 				// Is pointer type
 				if (rType->back() == '*') {
 					return Type(typeNames.at(rType->substr(0, rType->size() - 1)), true);
@@ -508,6 +549,577 @@ namespace rt
 		return True;
 	}
 
+	/*
+	 * Desc=Turns an object into a C function pointer, which is passed to shared functions as a pointer argument. The object is called whenever the pointer is, while a shared function is running.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Object=The object to call.
+	 * Param1[True]Return=The return type, as a string.
+	 * Params[True]Name=The parameter types in order, as strings. Typed pointers are dereferenced before being passed to the object.
+	 */
+	objectOrValue Callback(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Callback must be object");
+		}
+		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		// The signature is only made of type names, so they identify it
+		std::string signature;
+		for (auto it = args.begin() + 1; it != args.end(); ++it) {
+			if (std::holds_alternative<std::shared_ptr<Object>>(*it)) {
+				return giveException("Callbacks do not support struct types");
+			}
+			auto type = evaluate(*it, symtab, argState);
+			if (not std::holds_alternative<std::string>(type)) {
+				return giveException("Type is of wrong type");
+			}
+			signature += std::get<std::string>(type);
+			signature += ' ';
+		}
+		// Reuse the trampoline if this object was already made into a callback with the same signature
+		auto closure = findClosure(symtab->interpreter(), obj, signature);
+		if (closure == nullptr) {
+			LibFunc func{
+				.function = nullptr,
+				.initialized = false,
+				.retType = std::nullopt,
+				.argTypes = {},
+			};
+			func.retType.emplace(std::move(makeType(args.at(1), symtab, argState)));
+			for (auto it = args.begin() + 2; it != args.end(); ++it) {
+				func.argTypes.emplace_back(std::move(makeType(*it, symtab, argState)));
+			}
+			closure = makeClosure(symtab->interpreter(), obj, signature, std::move(func));
+		}
+		obj->setNative(closure);
+		return True;
+	}
+
+	/*
+	 * Desc=Calls a bound shared function on a worker thread without waiting for it to return. Arguments must not be modified until the call is awaited.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Future=The object to attach the call to.
+	 * Param1[True]Name=The name of the function.
+	 * Params[True?]Args=The arguments, same as when calling the function directly.
+	 */
+	objectOrValue CallAsync(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Future must be object");
+		}
+		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		auto name = evaluate(args.at(1), symtab, argState);
+		if (not std::holds_alternative<std::string>(name)) {
+			return giveException("Func name was of wrong type");
+		}
+		auto func = std::get_if<std::shared_ptr<LibFunc>>(&symtab->lookUpHard(std::get<std::string>(name)));
+		if (func == nullptr) {
+			return giveException("Func name was not of a shared function");
+		}
+		std::vector<objectOrValue> callArgs(args.begin() + 2, args.end());
+		obj->setNative(callSharedAsync(callArgs, *func, symtab, argState, builtInCallSite()));
+		return True;
+	}
+
+	/*
+	 * Desc=Checks whether an asynchronous call or I/O operation has finished.
+	 * Added=v0.12.0
+	 * Returns=1 if finished, otherwise 0, or exception
+	 * Param0[False]Future=An object passed to CallAsync, or an I/O handle.
+	 */
+	objectOrValue Ready(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (auto operation = getIoOperation(args.at(0))) {
+			if (not operation->done and symtab->interpreter().scheduler.usable())
+				symtab->interpreter().events.poll(false);
+			return operation->done ? True : False;
+		}
+		auto async = getAsyncCall(args.at(0));
+		if (async == nullptr) {
+			return giveException("Object is not a future");
+		}
+		return async->ready() ? True : False;
+	}
+
+	/*
+	 * Desc=Waits for an asynchronous call to finish, then writes back its pointer arguments. For I/O handles, fibers and callbacks run while waiting.
+	 * Added=v0.12.0
+	 * Returns=The return value of the function, the result of the operation, or exception
+	 * Param0[False]Future=An object passed to CallAsync, or an I/O handle.
+	 */
+	objectOrValue Await(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (auto operation = getIoOperation(args.at(0))) {
+			if (not symtab->interpreter().scheduler.usable()) {
+				return giveException("Fibers cannot be used in parallel calls");
+			}
+			symtab->interpreter().scheduler.waitUntil([&] { return operation->done; });
+			if (not operation->error.empty()) {
+				return giveException(operation->error);
+			}
+			return operation->result;
+		}
+		auto async = getAsyncCall(args.at(0));
+		if (async == nullptr) {
+			return giveException("Object is not a future");
+		}
+		return async->await();
+	}
+
+	/*
+	 * Desc=Reports how long calls to each shared function have spent marshalling arguments, running natively and converting results. Only available when built with RUNTIME_FFI_STATS.
+	 * Added=v0.12.0
+	 * Returns=The report as a string or exception
+	 */
+	objectOrValue FfiStats(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+#if RUNTIME_FFI_STATS==1
+		return ffiStatsReport();
+#else
+		return giveException("Runtime was built without RUNTIME_FFI_STATS");
+#endif // RUNTIME_FFI_STATS
+	}
+
+	/*
+	 * Desc=Writes every object reachable from the calling scope and the global scope to a file, with its member count, estimated own and retained bytes and the objects it references. Summarize it with Runtime --heap-summary.
+	 * Added=v0.12.0
+	 * Returns=The amount of objects written or exception
+	 * Param0[True]Path=The file to write to.
+	 */
+	objectOrValue HeapDump(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		auto path = evaluate(args.at(0), symtab, argState);
+		if (not std::holds_alternative<std::string>(path)) {
+			return giveException("Path must be string");
+		}
+		std::ofstream out(std::get<std::string>(path));
+		if (not out) {
+			return giveException("Unable to open file");
+		}
+		return static_cast<double>(writeHeapDump(out, symtab));
+	}
+
+	/*
+	 * Desc=Reports memory use, for example to adapt batch sizes to memory pressure. Members "tracked" and "resident" (resident set size in bytes) are always available. When built with RUNTIME_MEMORY_STATS, "objects", "members", "strings", "ast", "tokens" and "ffi" each have "live", "peak" and "allocations" members.
+	 * Added=v0.12.0
+	 * Returns=An object with the statistics as members
+	 */
+	objectOrValue MemoryStats(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		auto stats = std::make_shared<Object>("MemoryStats");
+		stats->addMember(static_cast<double>(RUNTIME_MEMORY_STATS == 1), "tracked");
+		stats->addMember(static_cast<double>(residentBytes()), "resident");
+#if RUNTIME_MEMORY_STATS==1
+		for (size_t i = 0; i < memoryCategoryCount; ++i) {
+			const MemoryUsage usage = memoryUsage(MemoryCategory(i));
+			auto category = std::make_shared<Object>(memoryCategoryName(MemoryCategory(i)));
+			category->addMember(static_cast<double>(usage.live), "live");
+			category->addMember(static_cast<double>(usage.peak), "peak");
+			category->addMember(static_cast<double>(usage.allocations), "allocations");
+			stats->addMember(category, memoryCategoryName(MemoryCategory(i)));
+		}
+#endif // RUNTIME_MEMORY_STATS
+		return stats;
+	}
+
+	/*
+	 * Desc=Allocates a native buffer, which is passed to shared functions as a pointer without copying.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Buffer=The object to attach the buffer to.
+	 * Param1[True]Type=The element type, for example "double".
+	 * Param2[True]Length=The amount of elements, a whole number.
+	 */
+	objectOrValue BufferCreate(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 3) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Buffer must be object");
+		}
+		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		auto type = evaluate(args.at(1), symtab, argState);
+		auto length = evaluate(args.at(2), symtab, argState);
+		if (not std::holds_alternative<std::string>(type) or not typeNames.contains(std::get<std::string>(type))) {
+			return giveException("Type is of wrong type");
+		}
+		// A whole amount which fits in size_t, NaN fails every comparison
+		if (not std::holds_alternative<double>(length) or not (std::get<double>(length) >= 0)
+			or std::get<double>(length) >= static_cast<double>(std::numeric_limits<size_t>::max())
+			or std::get<double>(length) != std::trunc(std::get<double>(length))) {
+			return giveException("Length is of wrong type");
+		}
+		std::shared_ptr<Buffer> buffer;
+		try {
+			buffer = std::make_shared<Buffer>(typeNames.at(std::get<std::string>(type)), static_cast<size_t>(std::get<double>(length)));
+		} catch (const std::bad_alloc&) {
+			return giveException("Buffer is too large");
+		}
+		obj->setNative(std::move(buffer));
+		obj->addMember(type, "type"); // Element type
+		obj->addMember(length, "length"); // Amount of elements
+		return True;
+	}
+
+	/*
+	 * Desc=Reads an element of a buffer.
+	 * Added=v0.12.0
+	 * Returns=Value of the element or exception
+	 * Param0[False]Buffer=A buffer created with BufferCreate.
+	 * Param1[True]Index=Index of the element.
+	 */
+	objectOrValue BufferGet(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		auto buffer = getBuffer(args.at(0));
+		if (buffer == nullptr) {
+			return giveException("Object is not a buffer");
+		}
+		const double index = getNumericalValue(evaluate(args.at(1), symtab, argState));
+		if (index < 0 or index >= buffer->length) {
+			return giveException("Index out of range");
+		}
+		return buffer->get(static_cast<size_t>(index));
+	}
+
+	/*
+	 * Desc=Writes an element of a buffer.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Buffer=A buffer created with BufferCreate.
+	 * Param1[True]Index=Index of the element.
+	 * Param2[True]Value=Numerical value to write, within the range of the element type.
+	 */
+	objectOrValue BufferSet(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 3) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		auto buffer = getBuffer(args.at(0));
+		if (buffer == nullptr) {
+			return giveException("Object is not a buffer");
+		}
+		const double index = getNumericalValue(evaluate(args.at(1), symtab, argState));
+		if (index < 0 or index >= buffer->length) {
+			return giveException("Index out of range");
+		}
+		if (not buffer->set(static_cast<size_t>(index), getNumericalValue(evaluate(args.at(2), symtab, argState)))) {
+			return giveException("Value out of range");
+		}
+		return True;
+	}
+
+	/*
+	 * Desc=Calls an object on every member of another object across all cores. The called object must not change objects it shares with other calls, which are all objects named outside of it: Object, Append, Copy, Assign, Update and Set return an exception for those, and changing them in other ways gives wrong results. Its arguments are its own.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Result=An object the values of the calls are appended to, in the order of the members.
+	 * Param1[False]Source=An object whose members are passed to the calls.
+	 * Param2[False]Function=An object to call with a single member.
+	 */
+	objectOrValue ParallelMap(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 3) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))
+			or std::holds_alternative<std::variant<double, std::string>>(args.at(1))) {
+			return giveException("Object must be object");
+		}
+		auto result = std::get<std::shared_ptr<Object>>(args.at(0));
+		auto source = std::get<std::shared_ptr<Object>>(args.at(1));
+		// Fail before doing the work
+		if (result->isFrozen()) {
+			return giveException("Object is frozen");
+		}
+		// Members are evaluated here, so the calls only read values
+		std::vector<objectOrValue> members;
+		RUNTIME_COUNT_MEMBER_COPY(source);
+		for (auto& member : source->getMembers()) {
+			members.push_back(evaluate(member, symtab, argState));
+		}
+		for (auto& value : callParallel(args.at(2), members, symtab)) {
+			result->addMember(value);
+		}
+		return True;
+	}
+
+	/*
+	 * Desc=Calls an object with every index of a range across all cores. The called object must not change objects it shares with other calls, which are all objects named outside of it: Object, Append, Copy, Assign, Update and Set return an exception for those, and changing them in other ways gives wrong results. Buffers can be written to with BufferSet, one element per call.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[True]Start=First index.
+	 * Param1[True]End=Index after the last one.
+	 * Param2[False]Function=An object to call with a single index.
+	 */
+	objectOrValue ParallelFor(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 3) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		const double start = getNumericalValue(evaluate(args.at(0), symtab, argState));
+		const double end = getNumericalValue(evaluate(args.at(1), symtab, argState));
+		std::vector<objectOrValue> indices;
+		for (double i = start; i < end; ++i) {
+			indices.push_back(i);
+		}
+		callParallel(args.at(2), indices, symtab);
+		return True;
+	}
+
+	/// <summary>
+	/// Reduces values with a builtin combine function as a loop over doubles.
+	/// Returns std::nullopt if the builtin has no such loop
+	/// </summary>
+	[[nodiscard]] static std::optional<double> reduceNative(const std::string& name, const std::vector<double>& values, double init)
+	{
+		double (*combine)(double, double);
+		if (name == "+")
+			combine = [](double a, double b) { return a + b; };
+		else if (name == "*")
+			combine = [](double a, double b) { return a * b; };
+		else if (name == "<")
+			combine = [](double a, double b) { return std::min(a, b); };
+		else if (name == ">")
+			combine = [](double a, double b) { return std::max(a, b); };
+		else
+			return std::nullopt;
+		if (values.empty())
+			return init;
+		WorkStealingPool& pool = parallelPool();
+		const size_t chunks = std::min(values.size(), (pool.size() + 1) * 4);
+		std::vector<double> partials(chunks);
+		pool.parallelFor(chunks, [&](size_t chunk) {
+			const size_t begin = values.size() * chunk / chunks;
+			const size_t end = values.size() * (chunk + 1) / chunks;
+			double acc = values[begin];
+			for (size_t i = begin + 1; i < end; ++i)
+				acc = combine(acc, values[i]);
+			partials[chunk] = acc;
+		});
+		double result = init;
+		for (double partial : partials)
+			result = combine(result, partial);
+		return result;
+	}
+
+	/*
+	 * Desc=Combines the members of an object into one value across all cores. The members are split into chunks, which are combined in parallel, so the combine function must be associative and must not change objects it shares with other calls, as with ParallelMap. The builtins +, *, < (minimum) and > (maximum) run natively when all members are numbers, and < and > only work with numbers.
+	 * Added=v0.12.0
+	 * Returns=The combined value, or exception
+	 * Param0[False]Source=An object whose members are combined.
+	 * Param1[False]Function=An object called with two values, or the name of one or of a builtin.
+	 * Param2[True]Initial=Value combined with the first member, and returned if there are none.
+	 */
+	objectOrValue ParallelReduce(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 3) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Object must be object");
+		}
+		auto source = std::get<std::shared_ptr<Object>>(args.at(0));
+		auto init = evaluate(args.at(2), symtab, argState);
+		// Members are evaluated here, so the calls only read values
+		std::vector<std::variant<double, std::string>> values;
+		RUNTIME_COUNT_MEMBER_COPY(source);
+		for (auto& member : source->getMembers()) {
+			values.push_back(evaluate(member, symtab, argState));
+		}
+		// Resolve the combine function
+		objectOrValue function = args.at(1);
+		std::optional<BuiltIn> builtIn;
+		if (std::holds_alternative<std::variant<double, std::string>>(function)) {
+			auto name = std::get<std::variant<double, std::string>>(function);
+			if (not std::holds_alternative<std::string>(name)) {
+				return giveException("Func name was of wrong type");
+			}
+			const Symbol& symbol = symtab->lookUpHard(std::get<std::string>(name));
+			if (std::holds_alternative<BuiltIn>(symbol)) {
+				// Native loop if everything is a number
+				bool numbers = std::holds_alternative<double>(init);
+				std::vector<double> doubles;
+				doubles.reserve(values.size());
+				for (const auto& value : values) {
+					if (not std::holds_alternative<double>(value)) {
+						numbers = false;
+						break;
+					}
+					doubles.push_back(std::get<double>(value));
+				}
+				if (numbers) {
+					if (auto result = reduceNative(std::get<std::string>(name), doubles, std::get<double>(init))) {
+						return std::variant<double, std::string>(*result);
+					}
+				} else if (std::get<std::string>(name) == "<" or std::get<std::string>(name) == ">") {
+					// The comparison builtins would fold booleans instead of picking a member
+					return giveException("Minimum and maximum need numbers");
+				}
+				builtIn = std::get<BuiltIn>(symbol);
+			} else if (std::holds_alternative<std::shared_ptr<Object>>(symbol)) {
+				function = std::get<std::shared_ptr<Object>>(symbol);
+			} else {
+				return giveException("Func name was of a shared function");
+			}
+		}
+		if (values.empty())
+			return init;
+		auto combine = [&](std::variant<double, std::string> a, std::variant<double, std::string> b) {
+			// Every call gets its own scope, as with normal calls
+			SymbolTable localSt(symtab);
+			// Without a parent, so calls never take arguments meant for the caller
+			ArgState callArgs;
+			std::vector<objectOrValue> pair{ a, b };
+			if (builtIn)
+				return evaluate((*builtIn)(pair, &localSt, callArgs), &localSt, callArgs);
+			return callObject(function, &localSt, callArgs, pair);
+		};
+		// Reduce chunks in parallel
+		WorkStealingPool& pool = parallelPool();
+		const size_t chunks = std::min(values.size(), (pool.size() + 1) * 4);
+		std::vector<std::variant<double, std::string>> partials(chunks);
+		const auto shared = sharedObjects(symtab);
+		pool.parallelFor(chunks, [&](size_t chunk) {
+			ParallelScope scope(&shared);
+			const size_t begin = values.size() * chunk / chunks;
+			const size_t end = values.size() * (chunk + 1) / chunks;
+			auto acc = values[begin];
+			for (size_t i = begin + 1; i < end; ++i)
+				acc = combine(acc, values[i]);
+			partials[chunk] = acc;
+		});
+		// Then the partial results
+		auto result = init;
+		for (auto& partial : partials)
+			result = combine(result, partial);
+		return result;
+	}
+
+	/*
+	 * Desc=Calls an object in a new fiber, which runs whenever the code calling Spawn yields or waits on a channel. The fiber evaluates in the global scope.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Object=An object to call.
+	 * Params[True]Arguments=Arguments of the call, evaluated before Spawn returns.
+	 */
+	objectOrValue Spawn(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Object must be object");
+		}
+		Interpreter& interpreter = symtab->interpreter();
+		if (not interpreter.scheduler.usable()) {
+			return giveException("Fibers cannot be used in parallel calls");
+		}
+		// The calling scope may be gone by the time the fiber runs
+		std::vector<objectOrValue> callArgs;
+		for (auto it = args.begin() + 1; it != args.end(); ++it) {
+			callArgs.push_back(evaluate(*it, symtab, argState));
+		}
+		interpreter.scheduler.spawn([&interpreter, function = args.at(0), callArgs]() {
+			SymbolTable localSt(&interpreter.globalSymtab);
+			ArgState fiberArgs;
+			callObject(function, &localSt, fiberArgs, callArgs);
+		});
+		return True;
+	}
+
+	/*
+	 * Desc=Lets every fiber run once, or from a fiber, lets the others run.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 */
+	objectOrValue Yield(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (not symtab->interpreter().scheduler.usable()) {
+			return giveException("Fibers cannot be used in parallel calls");
+		}
+		symtab->interpreter().scheduler.yield();
+		return True;
+	}
+
+	/*
+	 * Desc=Makes an object a channel, a queue of values passed between fibers.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Channel=An object to make a channel.
+	 * Param1[True]Capacity=Amount of values the channel holds before Send waits.
+	 */
+	objectOrValue ChannelCreate(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Channel must be object");
+		}
+		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		auto capacity = evaluate(args.at(1), symtab, argState);
+		if (not std::holds_alternative<double>(capacity) or std::get<double>(capacity) < 1) {
+			return giveException("Capacity is of wrong type");
+		}
+		obj->setNative(std::make_shared<Channel>(static_cast<size_t>(std::get<double>(capacity))));
+		obj->addMember(capacity, "capacity");
+		return True;
+	}
+
+	/*
+	 * Desc=Adds a value to a channel, letting other fibers run while it is full.
+	 * Added=v0.12.0
+	 * Returns=1 or exception
+	 * Param0[False]Channel=A channel created with ChannelCreate.
+	 * Param1[True]Value=Value to send.
+	 */
+	objectOrValue Send(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 2) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		auto channel = getChannel(args.at(0));
+		if (channel == nullptr) {
+			return giveException("Object is not a channel");
+		}
+		if (not symtab->interpreter().scheduler.usable()) {
+			return giveException("Fibers cannot be used in parallel calls");
+		}
+		auto value = evaluate(args.at(1), symtab, argState);
+		symtab->interpreter().scheduler.waitUntil([&] { return not channel->full(); });
+		channel->values.push_back(std::move(value));
+		return True;
+	}
+
+	/*
+	 * Desc=Takes the oldest value from a channel, letting other fibers run while it is empty.
+	 * Added=v0.12.0
+	 * Returns=The value or exception
+	 * Param0[False]Channel=A channel created with ChannelCreate.
+	 */
+	objectOrValue Receive(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) [[unlikely]]
+			return giveException("Wrong amount of arguments");
+		auto channel = getChannel(args.at(0));
+		if (channel == nullptr) {
+			return giveException("Object is not a channel");
+		}
+		if (not symtab->interpreter().scheduler.usable()) {
+			return giveException("Fibers cannot be used in parallel calls");
+		}
+		symtab->interpreter().scheduler.waitUntil([&] { return not channel->empty(); });
+		auto value = std::move(channel->values.front());
+		channel->values.pop_front();
+		return value;
+	}
+
 	/*
 	 * Desc=Runs a shell command.
 	 * Added=v0.11.0
@@ -516,7 +1128,7 @@ namespace rt
 	 */
 	objectOrValue System(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
 	{
-		static bool works = false;
+		static std::atomic<bool> works = false;
 		if (not works and system(NULL)) // Check whether shell exists
 			works = true;
 		if (not works)
@@ -623,11 +1235,35 @@ namespace rt
 			return giveException("Object must be object");
 		}
 		auto obj = std::get<std::shared_ptr<Object>>(args.at(0));
+		if (obj->isFrozen()) {
+			return giveException("Object is frozen");
+		}
+		if (ParallelScope::isShared(obj.get())) {
+			return giveException("Object is shared with other parallel calls");
+		}
 		// Set value
 		obj->setLast(args.at(1));
 		return True;
 	}
 
+	/*
+	 * Desc=Makes an object and every object in its members immutable. Frozen objects can be read from parallel calls without copying, but every builtin which would change them, such as Assign, Append or BufferCreate, returns an exception instead.
+	 * Added=v0.12.0
+	 * Returns=True
+	 * Param0[False]Object=An object to freeze.
+	 */
+	objectOrValue Freeze(std::vector<objectOrValue>& args, SymbolTable* symtab, ArgState& argState)
+	{
+		if (args.size() < 1) {
+			return giveException("Wrong amount of arguments");
+		}
+		if (std::holds_alternative<std::variant<double, std::string>>(args.at(0))) {
+			return giveException("Object must be object");
+		}
+		std::get<std::shared_ptr<Object>>(args.at(0))->freeze();
+		return True;
+	}
+
 	/*
 	 * Desc=Evaluates an object.
 	 * Added=v0.12.0
@@ -62,7 +62,7 @@ namespace ast
 		/// <summary>
 		/// Default constructor
 		/// </summary>
-		Literal(const rt::SourceLocation src, const std::variant<double, std::string> value) : litValue(value), Expression(src) {};
+		Literal(const rt::SourceLocation src, const std::variant<double, std::string> value) : litValue(value), Expression(src), memoryTag(this->src) {};
 
 		/// <summary>
 		/// Value of literal
@@ -75,6 +75,7 @@ namespace ast
 		/// <param name="other">Ast node to compare against</param>
 		/// <returns>Whether or not the nodes are identical</returns>
 		bool compare(const Expression& other) const override;
+		[[no_unique_address]] rt::MemoryTag<rt::MemoryCategory::Ast, Literal> memoryTag;
 	};
 
 	/// <summary>
@@ -86,7 +87,7 @@ namespace ast
 		/// <summary>
 		/// Default constructor
 		/// </summary>
-		Identifier(const rt::SourceLocation src, const std::string name) : name(name), Expression(src) {};
+		Identifier(const rt::SourceLocation src, const std::string name) : name(name), Expression(src), memoryTag(this->src) {};
 
 		/// <summary>
 		/// Name of identifier
@@ -99,6 +100,7 @@ namespace ast
 		/// <param name="other">Ast node to compare against</param>
 		/// <returns>Whether or not the nodes are identical</returns>
 		bool compare(const Expression& other) const override;
+		[[no_unique_address]] rt::MemoryTag<rt::MemoryCategory::Ast, Identifier> memoryTag;
 	};
 
 	/// <summary>
@@ -110,7 +112,7 @@ namespace ast
 		/// <summary>
 		/// Default constructor
 		/// </summary>
-		Call(const rt::SourceLocation src, std::shared_ptr<Expression> object, std::vector<std::shared_ptr<Expression>> args) : object(object), args(args), Expression(src) {};
+		Call(const rt::SourceLocation src, std::shared_ptr<Expression> object, std::vector<std::shared_ptr<Expression>> args) : object(object), args(args), Expression(src), memoryTag(this->src) {};
 		/// <summary>
 		/// Object to call
 		/// </summary>
@@ -126,6 +128,7 @@ namespace ast
 		/// <param name="other">Ast node to compare against</param>
 		/// <returns>Whether or not the nodes are identical</returns>
 		bool compare(const Expression& other) const override;
+		[[no_unique_address]] rt::MemoryTag<rt::MemoryCategory::Ast, Call> memoryTag;
 	};
 
 	/// <summary>
@@ -137,7 +140,7 @@ namespace ast
 		/// <summary>
 		/// Default constructor
 		/// </summary>
-		BinaryOperator(const rt::SourceLocation src, std::shared_ptr<Expression> left, std::shared_ptr<Expression> right) : left(left), right(right), Expression(src) {};
+		BinaryOperator(const rt::SourceLocation src, std::shared_ptr<Expression> left, std::shared_ptr<Expression> right) : left(left), right(right), Expression(src), memoryTag(this->src) {};
 		/// <summary>
 		/// Left expression
 		/// </summary>
@@ -153,5 +156,6 @@ namespace ast
 		/// <param name="other">Ast node to compare against</param>
 		/// <returns>Whether or not the nodes are identical</returns>
 		bool compare(const Expression& other) const override;
+		[[no_unique_address]] rt::MemoryTag<rt::MemoryCategory::Ast, BinaryOperator> memoryTag;
 	};
 }
@@ -0,0 +1,160 @@
+#pragma once
+// Runtime
+#include "ast.h"
+#include "event_loop.h"
+#include "fibers.h"
+#include "object.h"
+#include "shared_libs.h"
+#include "symbol_table.h"
+// C++
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace rt
+{
+	/// <summary>
+	/// All of the state of a single interpreter. Interpreters share no mutable state,
+	/// so several can run in one process, as long as each is only used by one thread at a time.
+	/// Reached from the evaluator and builtins through SymbolTable::interpreter()
+	/// </summary>
+	class Interpreter
+	{
+	public:
+		Interpreter();
+		/// <summary>
+		/// Unloads the shared libraries loaded by this interpreter
+		/// </summary>
+		~Interpreter();
+		// Symbol tables point to their interpreter, so never copy
+		Interpreter(const Interpreter&) = delete;
+		Interpreter& operator= (const Interpreter&) = delete;
+
+		/// <summary>
+		/// Interprets ast tree, then runs Main
+		/// </summary>
+		/// <param name="argc">Amount of command line arguments, available as carg0, carg1...</param>
+		void interpret(std::shared_ptr<ast::Expression> expr, int argc, char** argv);
+		/// <summary>
+		/// Interprets ast tree, and returns everything printed
+		/// </summary>
+		/// <returns>String list containing everything printed</returns>
+		std::vector<std::string> interpretAndReturn(std::shared_ptr<ast::Expression> expr);
+		/// <summary>
+		/// Interprets ast tree in the global scope and runs its Main, keeping earlier definitions
+		/// </summary>
+		/// <returns>The value of Main</returns>
+		std::variant<double, std::string> run(std::shared_ptr<ast::Expression> expr);
+		/// <summary>
+		/// Makes command line arguments available as carg0, carg1...
+		/// </summary>
+		void setArguments(int argc, char** argv);
+		/// <summary>
+		/// Calls a global object, builtin or shared function by name
+		/// </summary>
+		/// <returns>The value of the call</returns>
+		objectOrValue call(const std::string& name, std::vector<objectOrValue> args);
+		/// <summary>
+		/// Adds a builtin to the global scope, which is kept when the global scope is cleared
+		/// </summary>
+		void registerBuiltIn(const std::string& name, BuiltIn function);
+		/// <summary>
+		/// Sets up the required variables for live interpreting
+		/// </summary>
+		void liveSetup();
+		/// <summary>
+		/// Interprets in live cli session
+		/// </summary>
+		[[nodiscard]] objectOrValue live(std::shared_ptr<ast::Expression> expr);
+
+		// Interpreter
+
+		/// <summary>
+		/// Root symbol table of the program
+		/// </summary>
+		SymbolTable globalSymtab;
+		/// <summary>
+		/// Whether or not to capture printed strings instead of writing them to cout
+		/// </summary>
+		bool capture = false;
+		/// <summary>
+		/// Strings captured from cout
+		/// </summary>
+		std::vector<std::string> capturedCout;
+		/// <summary>
+		/// Stream printed strings go to when not capturing
+		/// </summary>
+		std::ostream* output = &std::cout;
+		/// <summary>
+		/// Held while printing, so output of parallel calls is not interleaved mid-line
+		/// </summary>
+		std::mutex outputMutex;
+		/// <summary>
+		/// Whether or not members can be initialized by reference (ie. obj-0)
+		/// </summary>
+		bool memberInitialization = false;
+		/// <summary>
+		/// Arguments for Main
+		/// </summary>
+		std::vector<objectOrValue> mainArgs;
+		/// <summary>
+		/// Main argument state, all arg states should be derived from this one
+		/// </summary>
+		ArgState mainArgState;
+		/// <summary>
+		/// Stores all objects currently being evaluated, in order to stop endless loops
+		/// </summary>
+		std::unordered_set<const Object*> inEvaluation;
+
+		/// <summary>
+		/// Builtins added by registerBuiltIn
+		/// </summary>
+		std::unordered_map<std::string, BuiltIn> hostBuiltIns;
+
+		// Shared libraries
+
+		/// <summary>
+		/// Stores all currently loaded shared libraries
+		/// </summary>
+		std::vector<Library> libraries;
+		/// <summary>
+		/// Held while lazily resolving functions of the libraries
+		/// </summary>
+		std::mutex librariesMutex;
+		/// <summary>
+		/// Whether any library is loaded lazily, so lookups of other names can skip resolveShared without locking
+		/// </summary>
+		std::atomic<bool> hasLazyLibraries = false;
+		/// <summary>
+		/// Closures by the address of their object and their signature
+		/// </summary>
+		std::map<std::pair<const Object*, std::string>, std::shared_ptr<Closure>> closures;
+
+		// Standard I/O
+
+		/// <summary>
+		/// Keep track of opened files, since the info can't be stored in the file objects themselves
+		/// </summary>
+		std::unordered_map<std::string, std::fstream> openedFiles;
+
+		// Fibers and I/O
+
+		/// <summary>
+		/// Completes the operations of the non-blocking I/O builtins
+		/// </summary>
+		EventLoop events{ *this };
+		/// <summary>
+		/// Runs the fibers created by Spawn, and polls events while they wait. Last, so fibers are cancelled before anything they use is destroyed
+		/// </summary>
+		Scheduler scheduler;
+	};
+}
@@ -0,0 +1,198 @@
+// Runtime
+#include "event_loop.h"
+#include "interpreter.h"
+#include "context.h"
+#include "Stlib/StandardFiles.h"
+// C++
+#include <any>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <system_error>
+#include <utility>
+#include <vector>
+// C
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace rt
+{
+	/// <summary>
+	/// Most bytes returned by a single read
+	/// </summary>
+	static constexpr size_t readSize = 64 * 1024;
+
+	Stream::~Stream()
+	{
+		close(fd);
+	}
+
+	std::shared_ptr<Stream> getStream(const objectOrValue& arg)
+	{
+		if (auto obj = std::get_if<std::shared_ptr<Object>>(&arg)) {
+			if (auto stream = std::any_cast<std::shared_ptr<Stream>>(&(*obj)->getNative())) {
+				return *stream;
+			}
+		}
+		return nullptr;
+	}
+
+	std::shared_ptr<IoOperation> getIoOperation(const objectOrValue& arg)
+	{
+		if (auto obj = std::get_if<std::shared_ptr<Object>>(&arg)) {
+			if (auto operation = std::any_cast<std::shared_ptr<IoOperation>>(&(*obj)->getNative())) {
+				return *operation;
+			}
+		}
+		return nullptr;
+	}
+
+	EventLoop::~EventLoop()
+	{
+		cancel();
+		if (epollFd >= 0)
+			close(epollFd);
+	}
+
+	void EventLoop::read(std::shared_ptr<Stream> stream, std::shared_ptr<IoOperation> operation)
+	{
+		const int fd = stream->fd;
+		start(std::make_unique<Pending>(Pending{ Kind::Read, fd, std::move(stream), std::move(operation), std::string() }), EPOLLIN);
+	}
+
+	void EventLoop::write(std::shared_ptr<Stream> stream, std::string data, std::shared_ptr<IoOperation> operation)
+	{
+		const int fd = stream->fd;
+		start(std::make_unique<Pending>(Pending{ Kind::Write, fd, std::move(stream), std::move(operation), std::move(data) }), EPOLLOUT);
+	}
+
+	void EventLoop::timer(double milliseconds, std::shared_ptr<IoOperation> operation)
+	{
+		const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), "timerfd_create");
+		// A zero expiry would disarm the timer
+		const double nanoseconds = std::max(1.0, milliseconds * 1e6);
+		itimerspec expiry{};
+		expiry.it_value.tv_sec = static_cast<time_t>(nanoseconds / 1e9);
+		expiry.it_value.tv_nsec = static_cast<long>(std::fmod(nanoseconds, 1e9));
+		timerfd_settime(fd, 0, &expiry, nullptr);
+		start(std::make_unique<Pending>(Pending{ Kind::Timer, fd, nullptr, std::move(operation), std::string() }), EPOLLIN);
+	}
+
+	bool EventLoop::poll(bool block)
+	{
+		if (operations.empty())
+			return false;
+		epoll_event events[64];
+		const int count = epoll_wait(epollFd, events, 64, block ? -1 : 0);
+		if (count < 0) {
+			if (errno == EINTR)
+				return true;
+			throw std::system_error(errno, std::generic_category(), "epoll_wait");
+		}
+		// Callbacks may start or wait on operations, so only call them once the ready ones are handled
+		std::vector<std::shared_ptr<IoOperation>> completed;
+		for (int i = 0; i < count; ++i) {
+			auto it = operations.find(events[i].data.fd);
+			if (it == operations.end())
+				continue;
+			Pending& pending = *it->second;
+			if (not advance(pending))
+				continue;
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, pending.fd, nullptr);
+			if (pending.kind == Kind::Timer)
+				close(pending.fd);
+			completed.push_back(std::move(pending.operation));
+			operations.erase(it);
+		}
+		for (const auto& operation : completed)
+			complete(operation);
+		return true;
+	}
+
+	void EventLoop::cancel()
+	{
+		for (auto& [fd, pending] : operations) {
+			epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+			if (pending->kind == Kind::Timer)
+				close(fd);
+		}
+		operations.clear();
+	}
+
+	void EventLoop::start(std::unique_ptr<Pending> pending, uint32_t events)
+	{
+		if (epollFd < 0) {
+			epollFd = epoll_create1(EPOLL_CLOEXEC);
+			if (epollFd < 0)
+				throw std::system_error(errno, std::generic_category(), "epoll_create1");
+		}
+		epoll_event event{};
+		event.events = events;
+		event.data.fd = pending->fd;
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, pending->fd, &event) == 0) {
+			operations.insert({ pending->fd, std::move(pending) });
+			return;
+		}
+		if (errno != EPERM)
+			throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+		// Regular files are always ready
+		while (not advance(*pending)) {}
+	}
+
+	bool EventLoop::advance(Pending& pending)
+	{
+		IoOperation& operation = *pending.operation;
+		switch (pending.kind)
+		{
+		case Kind::Read: {
+			std::string data(readSize, '\0');
+			const ssize_t got = ::read(pending.fd, data.data(), data.size());
+			if (got < 0) {
+				if (errno == EAGAIN or errno == EINTR)
+					return false;
+				operation.error = std::strerror(errno);
+			} else {
+				data.resize(got);
+				operation.result = std::move(data);
+			}
+			break;
+		}
+		case Kind::Write: {
+			const ssize_t put = ::write(pending.fd, pending.data.data() + pending.written, pending.data.size() - pending.written);
+			if (put < 0) {
+				if (errno == EAGAIN or errno == EINTR)
+					return false;
+				operation.error = std::strerror(errno);
+				break;
+			}
+			pending.written += put;
+			if (pending.written < pending.data.size())
+				return false;
+			operation.result = static_cast<double>(pending.written);
+			break;
+		}
+		case Kind::Timer: {
+			uint64_t expirations;
+			if (::read(pending.fd, &expirations, sizeof(expirations)) < 0)
+				return false;
+			operation.result = 1.0;
+			break;
+		}
+		}
+		operation.done = true;
+		return true;
+	}
+
+	void EventLoop::complete(const std::shared_ptr<IoOperation>& operation)
+	{
+		if (operation->callback == nullptr)
+			return;
+		SymbolTable localSt(&interpreter.globalSymtab);
+		ArgState callArgs;
+		objectOrValue result = operation->error.empty() ? objectOrValue(operation->result) : objectOrValue(giveException(operation->error));
+		callObject(std::exchange(operation->callback, nullptr), &localSt, callArgs, { result });
+	}
+}
@@ -0,0 +1,149 @@
+#pragma once
+// This file defines the event loop behind the non-blocking I/O builtins. Operations on streams and timers
+// are started by builtins and complete while the scheduler waits, so fibers and callbacks run in the meantime.
+// Runtime
+#include "object.h"
+// C++
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <variant>
+
+namespace rt
+{
+	class Interpreter;
+
+	/// <summary>
+	/// File descriptor opened by StreamOpen or SocketConnect, closed with its last reference
+	/// </summary>
+	struct Stream
+	{
+		explicit Stream(int fd) : fd(fd) {}
+		~Stream();
+		Stream(const Stream&) = delete;
+		Stream& operator= (const Stream&) = delete;
+
+		int fd;
+	};
+
+	/// <summary>
+	/// A started read, write or timer. Attached to the handle object given to the builtin that started it
+	/// </summary>
+	struct IoOperation
+	{
+		bool done = false;
+		/// <summary>
+		/// Data read, amount of bytes written, or 1 for timers
+		/// </summary>
+		std::variant<double, std::string> result;
+		/// <summary>
+		/// Empty unless the operation failed
+		/// </summary>
+		std::string error;
+		/// <summary>
+		/// Called with the result once done, if set
+		/// </summary>
+		std::shared_ptr<Object> callback;
+	};
+
+	/// <summary>
+	/// Returns the stream attached to an object, or nullptr if it has none
+	/// </summary>
+	[[nodiscard]] std::shared_ptr<Stream> getStream(const objectOrValue& arg);
+	/// <summary>
+	/// Returns the I/O operation attached to an object, or nullptr if it has none
+	/// </summary>
+	[[nodiscard]] std::shared_ptr<IoOperation> getIoOperation(const objectOrValue& arg);
+
+	/// <summary>
+	/// Waits on the pending operations of one interpreter with epoll. Streams which epoll cannot wait on,
+	/// such as regular files, are always ready, so operations on them complete as soon as they start
+	/// </summary>
+	class EventLoop
+	{
+	public:
+		explicit EventLoop(Interpreter& interpreter) : interpreter(interpreter) {}
+		/// <summary>
+		/// Drops the pending operations
+		/// </summary>
+		~EventLoop();
+		EventLoop(const EventLoop&) = delete;
+		EventLoop& operator= (const EventLoop&) = delete;
+
+		/// <summary>
+		/// Starts reading up to 64 KiB. The result is an empty string at the end of the stream
+		/// </summary>
+		void read(std::shared_ptr<Stream> stream, std::shared_ptr<IoOperation> operation);
+		/// <summary>
+		/// Starts writing all of data
+		/// </summary>
+		void write(std::shared_ptr<Stream> stream, std::string data, std::shared_ptr<IoOperation> operation);
+		/// <summary>
+		/// Starts a timer which completes after milliseconds
+		/// </summary>
+		void timer(double milliseconds, std::shared_ptr<IoOperation> operation);
+		/// <summary>
+		/// Completes the operations that are ready, waiting for one if block, and calls their callbacks
+		/// </summary>
+		/// <returns>Whether or not any operation was pending</returns>
+		bool poll(bool block);
+		/// <summary>
+		/// Drops the pending operations without completing them
+		/// </summary>
+		void cancel();
+		/// <summary>
+		/// Whether or not an operation on stream is pending. Only one can be at a time
+		/// </summary>
+		[[nodiscard]] bool busy(const Stream& stream) const { return operations.contains(stream.fd); }
+		/// <summary>
+		/// Amount of operations which have not completed
+		/// </summary>
+		[[nodiscard]] size_t pending() const { return operations.size(); }
+	private:
+		enum class Kind
+		{
+			Read,
+			Write,
+			Timer,
+		};
+
+		struct Pending
+		{
+			Kind kind;
+			int fd;
+			/// <summary>
+			/// Keeps the descriptor open, null for timers
+			/// </summary>
+			std::shared_ptr<Stream> stream;
+			std::shared_ptr<IoOperation> operation;
+			/// <summary>
+			/// Data to write, of which written bytes are done
+			/// </summary>
+			std::string data;
+			size_t written = 0;
+		};
+
+		/// <summary>
+		/// Registers an operation, or runs it right away if epoll cannot wait on its descriptor
+		/// </summary>
+		void start(std::unique_ptr<Pending> pending, uint32_t events);
+		/// <summary>
+		/// Continues an operation whose descriptor is ready
+		/// </summary>
+		/// <returns>Whether or not the operation completed</returns>
+		[[nodiscard]] static bool advance(Pending& pending);
+		/// <summary>
+		/// Calls the callback of a completed operation
+		/// </summary>
+		void complete(const std::shared_ptr<IoOperation>& operation);
+
+		Interpreter& interpreter;
+		int epollFd = -1;
+		/// <summary>
+		/// Pending operations by descriptor, at most one per descriptor
+		/// </summary>
+		std::unordered_map<int, std::unique_ptr<Pending>> operations;
+	};
+}
@@ -67,3 +67,21 @@ public:
         return loc;    
     }
 };
+
+// Thrown by Exit, so whoever runs the script decides what exiting means
+class ExitException : public std::exception
+{
+private:
+    int const code;
+public:
+    // Constructor
+    ExitException(const int code) : code(code) {};
+    const char* what() const throw() override
+    {
+        return "Script called Exit";
+    }
+    int getCode() const
+    {
+        return code;
+    }
+};
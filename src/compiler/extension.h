@@ -0,0 +1,71 @@
+#pragma once
+// This file defines the interface between Runtime and native extensions.
+// An extension is a shared library exporting rt_register_extension, which Include calls
+// after loading the library. Through it the extension registers builtins, which are called
+// exactly like the ones in the standard library, without going through libffi.
+// Extensions use the C++ types of the interpreter, so they must be built with the same
+// compiler and standard library as Runtime itself, and with its Runtime.hpp on the include path.
+#include "interpreter.h"
+#include "object.h"
+#include "symbol_table.h"
+#include "Stlib/StandardFiles.h"
+// C++
+#include <string>
+#include <variant>
+#include <vector>
+
+/// <summary>
+/// Whether Object and the ast nodes track their memory, which changes their inline members. Interpreter and
+/// extension must agree on it, so it is part of RUNTIME_EXTENSION_ABI
+/// </summary>
+#if RUNTIME_MEMORY_STATS==1
+#define RUNTIME_EXTENSION_MEMORY_STATS 1
+#else
+#define RUNTIME_EXTENSION_MEMORY_STATS 0
+#endif
+
+/// <summary>
+/// Version of the extension interface. Changes whenever the layout of rt_extension_api, or of the types it passes, changes.
+/// The lowest bit is RUNTIME_EXTENSION_MEMORY_STATS
+/// </summary>
+#define RUNTIME_EXTENSION_ABI (4 << 1 | RUNTIME_EXTENSION_MEMORY_STATS)
+
+extern "C"
+{
+	/// <summary>
+	/// Builtin registered by an extension, same signature as the standard library builtins
+	/// </summary>
+	typedef objectOrValue (*rt_builtin)(std::vector<objectOrValue>& args, rt::SymbolTable* symtab, rt::ArgState& argState);
+
+	/// <summary>
+	/// Services the interpreter provides to an extension
+	/// </summary>
+	struct rt_extension_api
+	{
+		/// <summary>
+		/// RUNTIME_EXTENSION_ABI of the interpreter. Extensions should refuse to load if it differs
+		/// </summary>
+		int abi;
+		/// <summary>
+		/// Opaque handle passed back to registerBuiltIn
+		/// </summary>
+		void* registrar;
+		/// <summary>
+		/// Makes a builtin available under name. Only valid during rt_register_extension
+		/// </summary>
+		void (*registerBuiltIn)(void* registrar, const char* name, rt_builtin function);
+		/// <summary>
+		/// rt::evaluate
+		/// </summary>
+		std::variant<double, std::string> (*evaluate)(objectOrValue member, rt::SymbolTable* symtab, rt::ArgState& argState, bool write);
+		/// <summary>
+		/// rt::callObject
+		/// </summary>
+		std::variant<double, std::string> (*callObject)(objectOrValue member, rt::SymbolTable* symtab, rt::ArgState& argState, std::vector<objectOrValue> args);
+	};
+
+	/// <summary>
+	/// Entry point exported by an extension. Returns 0 on success
+	/// </summary>
+	typedef int (*rt_register_extension_fn)(const rt_extension_api* api);
+}
@@ -0,0 +1,116 @@
+// Runtime
+#include "ffi_stats.h"
+// C++
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+	/// <summary>
+	/// Statistics by function name. Kept after libraries are unloaded, so they can be reported at exit
+	/// </summary>
+	static std::unordered_map<std::string, CallStats> ffiStats;
+	/// <summary>
+	/// Guards ffiStats, since several interpreters and async calls may record at once
+	/// </summary>
+	static std::mutex ffiStatsMutex;
+
+	void Histogram::record(uint64_t ns)
+	{
+		++buckets[std::min<size_t>(std::bit_width(ns), buckets.size() - 1)];
+		++count;
+		total += ns;
+	}
+
+	uint64_t Histogram::percentile(double fraction) const
+	{
+		const uint64_t target = static_cast<uint64_t>(fraction * count);
+		uint64_t seen = 0;
+		for (size_t i = 0; i < buckets.size(); ++i) {
+			seen += buckets[i];
+			if (seen > target)
+				return i == 0 ? 0 : uint64_t(1) << i;
+		}
+		return uint64_t(1) << (buckets.size() - 1);
+	}
+
+	// Formats nanoseconds with a readable unit
+	[[nodiscard]] static std::string formatDuration(double ns)
+	{
+		std::ostringstream out;
+		out << std::fixed << std::setprecision(1);
+		if (ns < 1e3)
+			out << ns << "ns";
+		else if (ns < 1e6)
+			out << ns / 1e3 << "us";
+		else if (ns < 1e9)
+			out << ns / 1e6 << "ms";
+		else
+			out << ns / 1e9 << "s";
+		return out.str();
+	}
+
+	// Appends a line describing a histogram
+	static void describe(std::ostringstream& out, const char* phase, const Histogram& histogram)
+	{
+		out << "  " << std::left << std::setw(8) << phase
+		    << " total " << std::setw(9) << formatDuration(histogram.total)
+		    << " mean " << std::setw(9) << formatDuration(static_cast<double>(histogram.total) / histogram.count)
+		    << " p50 <" << std::setw(9) << formatDuration(histogram.percentile(0.5))
+		    << " p99 <" << formatDuration(histogram.percentile(0.99)) << "\n";
+		// Non empty buckets
+		out << "          ";
+		for (size_t i = 0; i < histogram.buckets.size(); ++i) {
+			if (histogram.buckets[i] == 0)
+				continue;
+			out << " <" << formatDuration(i == 0 ? 0 : uint64_t(1) << i) << ":" << histogram.buckets[i];
+		}
+		out << "\n";
+	}
+
+	void recordCall(const std::string& name, uint64_t marshalNs, uint64_t nativeNs, uint64_t convertNs)
+	{
+		// Report at exit, including when the script calls Exit
+		[[maybe_unused]] static const bool reportAtExit = []{
+			std::atexit([]{ std::cerr << ffiStatsReport(); });
+			return true;
+		}();
+		std::lock_guard lock(ffiStatsMutex);
+		auto& stats = ffiStats[name];
+		stats.marshal.record(marshalNs);
+		stats.native.record(nativeNs);
+		stats.convert.record(convertNs);
+	}
+
+	std::string ffiStatsReport()
+	{
+		std::lock_guard lock(ffiStatsMutex);
+		// Sort by total time
+		std::vector<std::pair<const std::string*, const CallStats*>> sorted;
+		sorted.reserve(ffiStats.size());
+		for (const auto& [name, stats] : ffiStats) {
+			sorted.emplace_back(&name, &stats);
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+			const auto total = [](const CallStats* s) { return s->marshal.total + s->native.total + s->convert.total; };
+			return total(a.second) > total(b.second);
+		});
+		std::ostringstream out;
+		out << "FFI call statistics\n";
+		for (const auto& [name, stats] : sorted) {
+			out << *name << ": " << stats->native.count << " calls\n";
+			describe(out, "marshal", stats->marshal);
+			describe(out, "native", stats->native);
+			describe(out, "convert", stats->convert);
+		}
+		return out.str();
+	}
+}
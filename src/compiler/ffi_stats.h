@@ -0,0 +1,66 @@
+#pragma once
+// Instrumentation of shared function calls. Only recorded when built with RUNTIME_FFI_STATS,
+// otherwise callShared contains no timing code at all
+// C++
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace rt
+{
+	/// <summary>
+	/// Durations in nanoseconds, bucketed by powers of two
+	/// </summary>
+	struct Histogram
+	{
+		/// <summary>
+		/// Bucket n counts durations in [2^(n-1), 2^n), bucket 0 counts zero durations
+		/// </summary>
+		std::array<uint64_t, 64> buckets{};
+		/// <summary>
+		/// Amount of recorded durations
+		/// </summary>
+		uint64_t count = 0;
+		/// <summary>
+		/// Sum of recorded durations
+		/// </summary>
+		uint64_t total = 0;
+
+		/// <summary>
+		/// Records a duration
+		/// </summary>
+		void record(uint64_t ns);
+		/// <summary>
+		/// Returns the upper bound of the bucket containing the given fraction of durations
+		/// </summary>
+		[[nodiscard]] uint64_t percentile(double fraction) const;
+	};
+
+	/// <summary>
+	/// Timings of every call made to a single shared function
+	/// </summary>
+	struct CallStats
+	{
+		/// <summary>
+		/// Converting arguments into native values, including ffi_prep_cif
+		/// </summary>
+		Histogram marshal;
+		/// <summary>
+		/// ffi_call, the time spent in the function itself
+		/// </summary>
+		Histogram native;
+		/// <summary>
+		/// Writing pointers back and converting the return value
+		/// </summary>
+		Histogram convert;
+	};
+
+	/// <summary>
+	/// Records the phases of one call to a function
+	/// </summary>
+	void recordCall(const std::string& name, uint64_t marshalNs, uint64_t nativeNs, uint64_t convertNs);
+	/// <summary>
+	/// Returns a table of every function called so far, slowest total first
+	/// </summary>
+	[[nodiscard]] std::string ffiStatsReport();
+}
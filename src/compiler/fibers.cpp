@@ -0,0 +1,223 @@
+// Runtime
+#include "fibers.h"
+#include "interpreter.h"
+#include "exceptions.h"
+// C++
+#include <any>
+#include <cstdint>
+#include <new>
+#include <utility>
+// C
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+namespace rt
+{
+	/// <summary>
+	/// Reserved for the stack of every fiber. Pages are only backed by memory once touched
+	/// </summary>
+	static constexpr size_t fiberStackSize = 1 << 20;
+
+	/// <summary>
+	/// Thrown inside a fiber to unwind its stack when it is cancelled
+	/// </summary>
+	struct FiberCancelled {};
+
+	// AddressSanitizer has to be told about stack switches, or it reports the fiber stacks as overflows
+
+	static void startSwitch([[maybe_unused]] void** fakeStack, [[maybe_unused]] const void* bottom, [[maybe_unused]] size_t size)
+	{
+#if defined(__SANITIZE_ADDRESS__)
+		__sanitizer_start_switch_fiber(fakeStack, bottom, size);
+#endif
+	}
+
+	static void finishSwitch([[maybe_unused]] void* fakeStack, [[maybe_unused]] const void** bottom, [[maybe_unused]] size_t* size)
+	{
+#if defined(__SANITIZE_ADDRESS__)
+		__sanitizer_finish_switch_fiber(fakeStack, bottom, size);
+#endif
+	}
+
+	// Stack of the thread running the scheduler, learned by fibers when they start
+	static thread_local const void* threadStackBottom = nullptr;
+	static thread_local size_t threadStackSize = 0;
+
+	std::shared_ptr<Channel> getChannel(const objectOrValue& arg)
+	{
+		if (auto obj = std::get_if<std::shared_ptr<Object>>(&arg)) {
+			if (auto channel = std::any_cast<std::shared_ptr<Channel>>(&(*obj)->getNative())) {
+				return *channel;
+			}
+		}
+		return nullptr;
+	}
+
+	Scheduler::~Scheduler()
+	{
+		cancel();
+		for (Stack& stack : freeStacks) {
+			munmap(stack.memory, stack.size);
+		}
+	}
+
+	void Scheduler::spawn(std::function<void()> body)
+	{
+		auto fiber = std::make_unique<Fiber>();
+		fiber->scheduler = this;
+		fiber->body = std::move(body);
+		fiber->stack = allocateStack();
+		getcontext(&fiber->context);
+		fiber->context.uc_stack.ss_sp = fiber->stack.memory;
+		fiber->context.uc_stack.ss_size = fiber->stack.size;
+		fiber->context.uc_link = nullptr;
+		const auto address = reinterpret_cast<std::uintptr_t>(fiber.get());
+		makecontext(&fiber->context, reinterpret_cast<void (*)()>(&Scheduler::entry), 2,
+			static_cast<unsigned int>(address >> 32), static_cast<unsigned int>(address & 0xffffffff));
+		fibers.push_back(std::move(fiber));
+		progress = true;
+	}
+
+	void Scheduler::yield()
+	{
+		if (running != nullptr) {
+			progress = true;
+			suspend();
+		} else {
+			runRound();
+		}
+	}
+
+	void Scheduler::waitUntil(const std::function<bool()>& ready)
+	{
+		if (running != nullptr) {
+			// The scheduler resumes every fiber once per round, check again each time
+			while (not ready())
+				suspend();
+			progress = true;
+			return;
+		}
+		while (not ready()) {
+			if (runRound() or ready())
+				continue;
+			// Nothing to do but wait for I/O
+			if (not poller or not poller(true))
+				throw InterpreterException("Every fiber is waiting, none can continue", 0, "Unknown");
+		}
+	}
+
+	void Scheduler::cancel()
+	{
+		while (not fibers.empty()) {
+			auto fiber = std::move(fibers.front());
+			fibers.pop_front();
+			fiber->cancelled = true;
+			// Unwinds the stack, or returns immediately if the fiber never started
+			resume(*fiber);
+			releaseStack(fiber->stack);
+		}
+	}
+
+	bool Scheduler::usable() const
+	{
+		return ParallelScope::current() == (running != nullptr ? running->ownScope : nullptr);
+	}
+
+	void Scheduler::entry(unsigned int high, unsigned int low)
+	{
+		Fiber& fiber = *reinterpret_cast<Fiber*>((static_cast<std::uintptr_t>(high) << 32) | low);
+		finishSwitch(nullptr, &threadStackBottom, &threadStackSize);
+		if (not fiber.cancelled) {
+			// Objects evaluated here may be evaluated by other fibers at the same time
+			ParallelScope scope;
+			fiber.ownScope = &scope;
+			try
+			{
+				fiber.body();
+			}
+			catch (const FiberCancelled&)
+			{
+			}
+			catch (...)
+			{
+				fiber.error = std::current_exception();
+			}
+		}
+		fiber.body = nullptr;
+		fiber.finished = true;
+		// Never returns, so the stack is not in use once the fiber has finished
+		startSwitch(nullptr, threadStackBottom, threadStackSize);
+		setcontext(&fiber.scheduler->schedulerContext);
+	}
+
+	bool Scheduler::runRound()
+	{
+		progress = false;
+		if (poller)
+			poller(false);
+		// Fibers spawned in this round run in the next one
+		for (size_t count = fibers.size(); count > 0 and not fibers.empty(); --count) {
+			auto fiber = std::move(fibers.front());
+			fibers.pop_front();
+			resume(*fiber);
+			if (fiber->finished) {
+				progress = true;
+				releaseStack(fiber->stack);
+				if (fiber->error)
+					std::rethrow_exception(fiber->error);
+				continue;
+			}
+			fibers.push_back(std::move(fiber));
+		}
+		return progress;
+	}
+
+	void Scheduler::resume(Fiber& fiber)
+	{
+		running = &fiber;
+		fiber.outer = ParallelScope::exchange(fiber.scope);
+		fiber.outerCalls = exchangeCallStack(&fiber.calls);
+		void* fakeStack = nullptr;
+		startSwitch(&fakeStack, fiber.stack.memory, fiber.stack.size);
+		swapcontext(&schedulerContext, &fiber.context);
+		finishSwitch(fakeStack, nullptr, nullptr);
+		exchangeCallStack(fiber.outerCalls);
+		fiber.scope = ParallelScope::exchange(fiber.outer);
+		running = nullptr;
+	}
+
+	void Scheduler::suspend()
+	{
+		Fiber& fiber = *running;
+		void* fakeStack = nullptr;
+		startSwitch(&fakeStack, threadStackBottom, threadStackSize);
+		swapcontext(&fiber.context, &schedulerContext);
+		finishSwitch(fakeStack, &threadStackBottom, &threadStackSize);
+		if (fiber.cancelled)
+			throw FiberCancelled();
+	}
+
+	Scheduler::Stack Scheduler::allocateStack()
+	{
+		if (not freeStacks.empty()) {
+			Stack stack = freeStacks.back();
+			freeStacks.pop_back();
+			return stack;
+		}
+		const size_t page = sysconf(_SC_PAGESIZE);
+		void* memory = mmap(nullptr, fiberStackSize + page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+		if (memory == MAP_FAILED) [[unlikely]]
+			throw std::bad_alloc();
+		// Overflowing the stack hits the guard page instead of other memory
+		mprotect(memory, page, PROT_NONE);
+		return { memory, fiberStackSize + page };
+	}
+
+	void Scheduler::releaseStack(Stack stack)
+	{
+		freeStacks.push_back(stack);
+	}
+}
@@ -0,0 +1,157 @@
+#pragma once
+// This file defines fibers, lightweight coroutines multiplexed onto the thread of their interpreter,
+// and the bounded channels they pass values through.
+// Runtime
+#include "object.h"
+#include "profiler.h"
+// C++
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+// C
+#include <ucontext.h>
+
+namespace rt
+{
+	class ParallelScope;
+
+	/// <summary>
+	/// Bounded queue of values, attached to an object by ChannelCreate
+	/// </summary>
+	struct Channel
+	{
+		explicit Channel(size_t capacity) : capacity(capacity) {}
+
+		[[nodiscard]] bool full() const { return values.size() >= capacity; }
+		[[nodiscard]] bool empty() const { return values.empty(); }
+
+		const size_t capacity;
+		std::deque<std::variant<double, std::string>> values;
+	};
+
+	/// <summary>
+	/// Returns the channel attached to an object, or nullptr if it has none
+	/// </summary>
+	[[nodiscard]] std::shared_ptr<Channel> getChannel(const objectOrValue& arg);
+
+	/// <summary>
+	/// Runs the fibers of one interpreter. Fibers only run while the code that is not in a fiber
+	/// yields or waits, each until it yields or waits in turn. Every interpreter has its own,
+	/// so interpreters on different threads run their fibers in parallel
+	/// </summary>
+	class Scheduler
+	{
+	public:
+		Scheduler() = default;
+		/// <summary>
+		/// Cancels the fibers that have not finished
+		/// </summary>
+		~Scheduler();
+		// Fibers point to their scheduler, so never copy
+		Scheduler(const Scheduler&) = delete;
+		Scheduler& operator= (const Scheduler&) = delete;
+
+		/// <summary>
+		/// Creates a fiber running body, which starts the next time the scheduler runs
+		/// </summary>
+		void spawn(std::function<void()> body);
+		/// <summary>
+		/// Lets every other fiber run once
+		/// </summary>
+		void yield();
+		/// <summary>
+		/// Lets other fibers run until ready returns true.
+		/// Throws InterpreterException if ready can never become true, because every fiber is waiting and no I/O is pending
+		/// </summary>
+		void waitUntil(const std::function<bool()>& ready);
+		/// <summary>
+		/// Sets the function completing I/O while fibers wait. It is called without blocking every round,
+		/// and blocking once no fiber can continue. It returns false if nothing is left to complete
+		/// </summary>
+		void setPoller(std::function<bool(bool block)> function) { poller = std::move(function); }
+		/// <summary>
+		/// Unwinds the stacks of all fibers that have not finished, and frees them
+		/// </summary>
+		void cancel();
+		/// <summary>
+		/// Whether or not the scheduler can be used on the calling thread,
+		/// which is not the case inside parallel calls
+		/// </summary>
+		[[nodiscard]] bool usable() const;
+	private:
+		/// <summary>
+		/// Memory for the stack of a fiber, kept for the next fiber once its fiber finishes
+		/// </summary>
+		struct Stack
+		{
+			void* memory;
+			size_t size;
+		};
+
+		struct Fiber
+		{
+			Scheduler* scheduler;
+			std::function<void()> body;
+			Stack stack;
+			ucontext_t context;
+			/// <summary>
+			/// Innermost parallel scope of the fiber while it is switched out, and of the thread while it runs
+			/// </summary>
+			ParallelScope* scope = nullptr;
+			ParallelScope* outer = nullptr;
+			/// <summary>
+			/// Scope the fiber evaluates in, once started
+			/// </summary>
+			ParallelScope* ownScope = nullptr;
+			/// <summary>
+			/// Calls the fiber is making, for the sampling profiler
+			/// </summary>
+			CallStack calls;
+			CallStack* outerCalls = nullptr;
+			bool finished = false;
+			bool cancelled = false;
+			std::exception_ptr error;
+		};
+
+		/// <summary>
+		/// Entry point of fibers, which receive their Fiber* split into two ints
+		/// </summary>
+		static void entry(unsigned int high, unsigned int low);
+		/// <summary>
+		/// Runs every fiber once
+		/// </summary>
+		/// <returns>Whether or not any fiber did more than find it still has to wait</returns>
+		bool runRound();
+		/// <summary>
+		/// Switches to a fiber until it yields, waits or finishes
+		/// </summary>
+		void resume(Fiber& fiber);
+		/// <summary>
+		/// Switches from the running fiber back to the scheduler
+		/// </summary>
+		void suspend();
+		[[nodiscard]] Stack allocateStack();
+		void releaseStack(Stack stack);
+
+		/// <summary>
+		/// Fibers which have not finished, in the order they run
+		/// </summary>
+		std::deque<std::unique_ptr<Fiber>> fibers;
+		Fiber* running = nullptr;
+		/// <summary>
+		/// Context of the code that runs the scheduler
+		/// </summary>
+		ucontext_t schedulerContext;
+		/// <summary>
+		/// Whether or not a fiber spawned, yielded, finished or stopped waiting since the round started
+		/// </summary>
+		bool progress = false;
+		std::vector<Stack> freeStacks;
+		std::function<bool(bool block)> poller;
+	};
+}
@@ -0,0 +1,428 @@
+// Runtime
+#include "heap_dump.h"
+#include "context.h"
+#include "object.h"
+#include "symbol_table.h"
+// C++
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// C
+#include <csignal>
+
+namespace rt
+{
+	std::atomic<bool> heapDumpRequested = false;
+
+	/// <summary>
+	/// Where dumps requested by a signal are written
+	/// </summary>
+	static std::string signalDumpPath;
+	static std::mutex signalDumpMutex;
+
+	/// <summary>
+	/// Objects reachable from the roots, with their references as indexes
+	/// </summary>
+	struct HeapGraph
+	{
+		std::vector<Object*> objects;
+		std::unordered_map<const Object*, uint32_t> ids;
+		std::vector<std::vector<uint32_t>> references;
+		std::vector<std::pair<uint32_t, std::string>> roots;
+
+		uint32_t add(Object* object)
+		{
+			auto [it, added] = ids.insert({ object, static_cast<uint32_t>(objects.size()) });
+			if (added) {
+				objects.push_back(object);
+				references.emplace_back();
+			}
+			return it->second;
+		}
+
+		void addRoot(const std::shared_ptr<Object>& object, std::string label)
+		{
+			if (object != nullptr)
+				roots.push_back({ add(object.get()), std::move(label) });
+		}
+
+		/// <summary>
+		/// Adds the objects reachable from the roots, without recursing
+		/// </summary>
+		void walk()
+		{
+			// Objects are numbered as they are found, so every id below the one being visited has been visited
+			for (uint32_t id = 0; id < objects.size(); ++id) {
+				Object* object = objects[id];
+				std::vector<uint32_t> referenced;
+				for (size_t i = 0; i < object->size(); ++i) {
+					if (auto child = std::get_if<std::shared_ptr<Object>>(object->getMemberAt(i)))
+						referenced.push_back(add(child->get()));
+				}
+				std::sort(referenced.begin(), referenced.end());
+				referenced.erase(std::unique(referenced.begin(), referenced.end()), referenced.end());
+				references[id] = std::move(referenced);
+			}
+		}
+	};
+
+	/// <summary>
+	/// Returns the immediate dominator of every object, the virtual root being objects.size().
+	/// An object is only kept alive by its dominators
+	/// </summary>
+	[[nodiscard]] static std::vector<uint32_t> dominators(const HeapGraph& graph, std::vector<uint32_t>& postorder)
+	{
+		const uint32_t root = static_cast<uint32_t>(graph.objects.size());
+		std::vector<std::vector<uint32_t>> successors = graph.references;
+		std::vector<uint32_t> rootSuccessors;
+		for (const auto& [id, label] : graph.roots)
+			rootSuccessors.push_back(id);
+		successors.push_back(std::move(rootSuccessors));
+		// Depth-first postorder from the root
+		std::vector<uint32_t> number(root + 1, UINT32_MAX);
+		std::vector<bool> seen(root + 1);
+		std::vector<std::pair<uint32_t, size_t>> pending{ { root, 0 } };
+		seen[root] = true;
+		while (not pending.empty()) {
+			auto& [node, next] = pending.back();
+			if (next < successors[node].size()) {
+				const uint32_t successor = successors[node][next++];
+				if (not seen[successor]) {
+					seen[successor] = true;
+					pending.push_back({ successor, 0 });
+				}
+			} else {
+				number[node] = static_cast<uint32_t>(postorder.size());
+				postorder.push_back(node);
+				pending.pop_back();
+			}
+		}
+		std::vector<std::vector<uint32_t>> predecessors(root + 1);
+		for (uint32_t node = 0; node <= root; ++node)
+			for (uint32_t successor : successors[node])
+				predecessors[successor].push_back(node);
+		// Cooper, Harvey and Kennedy's iterative algorithm, in reverse postorder
+		std::vector<uint32_t> idom(root + 1, UINT32_MAX);
+		idom[root] = root;
+		const auto intersect = [&](uint32_t a, uint32_t b) {
+			while (a != b) {
+				while (number[a] < number[b])
+					a = idom[a];
+				while (number[b] < number[a])
+					b = idom[b];
+			}
+			return a;
+		};
+		for (bool changed = true; changed;) {
+			changed = false;
+			for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+				const uint32_t node = *it;
+				if (node == root)
+					continue;
+				uint32_t dominator = UINT32_MAX;
+				for (uint32_t predecessor : predecessors[node]) {
+					if (idom[predecessor] == UINT32_MAX)
+						continue;
+					dominator = dominator == UINT32_MAX ? predecessor : intersect(predecessor, dominator);
+				}
+				if (idom[node] != dominator) {
+					idom[node] = dominator;
+					changed = true;
+				}
+			}
+		}
+		return idom;
+	}
+
+	/// <summary>
+	/// Writes a name on one line, escaping tabs, newlines and backslashes
+	/// </summary>
+	static void writeName(std::ostream& out, const std::string& name)
+	{
+		for (const char c : name) {
+			if (c == '\t')
+				out << "\\t";
+			else if (c == '\n')
+				out << "\\n";
+			else if (c == '\\')
+				out << "\\\\";
+			else
+				out << c;
+		}
+	}
+
+	size_t writeHeapDump(std::ostream& out, SymbolTable* symtab)
+	{
+		HeapGraph graph;
+		// Innermost scope first, so objects found there are labeled by the scope using them
+		size_t depth = 0;
+		for (SymbolTable* scope = symtab; scope != nullptr; scope = scope->getParent(), ++depth) {
+			std::map<std::string, std::shared_ptr<Object>> named;
+			for (const auto& [name, symbol] : scope->getLocals())
+				if (auto object = std::get_if<std::shared_ptr<Object>>(&symbol))
+					named.insert({ name, *object });
+			const std::string prefix = scope->getParent() == nullptr ? "global " : "scope " + std::to_string(depth) + " ";
+			for (const auto& [name, object] : named)
+				graph.addRoot(object, prefix + name);
+		}
+		const auto& mainArgs = symtab->interpreter().mainArgs;
+		for (size_t i = 0; i < mainArgs.size(); ++i)
+			if (auto object = std::get_if<std::shared_ptr<Object>>(&mainArgs[i]))
+				graph.addRoot(*object, "Main argument " + std::to_string(i));
+		graph.walk();
+
+		const size_t count = graph.objects.size();
+		std::vector<size_t> retained(count + 1);
+		for (size_t id = 0; id < count; ++id)
+			retained[id] = graph.objects[id]->shallowSize();
+		std::vector<uint32_t> postorder;
+		const std::vector<uint32_t> idom = dominators(graph, postorder);
+		// Every object comes before its dominator in postorder
+		for (uint32_t node : postorder)
+			if (node != count)
+				retained[idom[node]] += retained[node];
+
+		out << "RuntimeHeapDump 1\n";
+		for (const auto& [id, label] : graph.roots) {
+			out << "root\t" << id << "\t";
+			writeName(out, label);
+			out << "\n";
+		}
+		for (size_t id = 0; id < count; ++id) {
+			Object* object = graph.objects[id];
+			out << "object\t" << id << "\t";
+			writeName(out, object->getName());
+			out << "\t" << object->size() << "\t" << object->shallowSize() << "\t" << retained[id] << "\t";
+			for (size_t i = 0; i < graph.references[id].size(); ++i)
+				out << (i == 0 ? "" : " ") << graph.references[id][i];
+			out << "\n";
+		}
+		return count;
+	}
+
+	static void requestHeapDump(int)
+	{
+		heapDumpRequested.store(true, std::memory_order_relaxed);
+	}
+
+	void enableHeapDumpSignal(std::string path)
+	{
+		{
+			std::lock_guard lock(signalDumpMutex);
+			signalDumpPath = std::move(path);
+		}
+		struct sigaction action{};
+		action.sa_handler = requestHeapDump;
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_RESTART;
+		sigaction(SIGUSR1, &action, nullptr);
+	}
+
+	void writeRequestedHeapDump(SymbolTable* symtab)
+	{
+		// Only the first thread to see the request writes it
+		if (not heapDumpRequested.exchange(false))
+			return;
+		std::lock_guard lock(signalDumpMutex);
+		std::ofstream out(signalDumpPath);
+		if (not out) {
+			std::cerr << "Unable to write heap dump to " << signalDumpPath << std::endl;
+			return;
+		}
+		const size_t count = writeHeapDump(out, symtab);
+		std::cerr << "Heap dump of " << count << " objects written to " << signalDumpPath << std::endl;
+	}
+
+	/// <summary>
+	/// An object read back from a heap dump
+	/// </summary>
+	struct DumpedObject
+	{
+		std::string name;
+		size_t members = 0;
+		size_t bytes = 0;
+		size_t retained = 0;
+		std::vector<uint32_t> references;
+	};
+
+	[[nodiscard]] static std::string readName(const std::string& field)
+	{
+		std::string name;
+		for (size_t i = 0; i < field.size(); ++i) {
+			if (field[i] == '\\' and i + 1 < field.size()) {
+				const char c = field[++i];
+				name += c == 't' ? '\t' : c == 'n' ? '\n' : c;
+			} else
+				name += field[i];
+		}
+		return name;
+	}
+
+	/// <summary>
+	/// Returns the strongly connected components with more than one object, or an object referencing itself.
+	/// Objects in one keep each other alive, even once nothing else references them
+	/// </summary>
+	/// <summary>
+	/// Reads a whole field as a count, false if it isn't one
+	/// </summary>
+	[[nodiscard]] static bool readCount(const std::string& field, size_t& count)
+	{
+		const char* end = field.data() + field.size();
+		auto [parsed, error] = std::from_chars(field.data(), end, count);
+		return error == std::errc() and parsed == end;
+	}
+
+	[[nodiscard]] static std::vector<std::vector<uint32_t>> findCycles(const std::vector<DumpedObject>& objects)
+	{
+		// Tarjan's algorithm, without recursing
+		const uint32_t none = UINT32_MAX;
+		std::vector<uint32_t> index(objects.size(), none), low(objects.size());
+		std::vector<bool> onStack(objects.size());
+		std::vector<uint32_t> stack;
+		std::vector<std::pair<uint32_t, size_t>> pending;
+		std::vector<std::vector<uint32_t>> cycles;
+		uint32_t next = 0;
+		const auto visit = [&](uint32_t node) {
+			index[node] = low[node] = next++;
+			stack.push_back(node);
+			onStack[node] = true;
+			pending.push_back({ node, 0 });
+		};
+		for (uint32_t start = 0; start < objects.size(); ++start) {
+			if (index[start] != none)
+				continue;
+			visit(start);
+			while (not pending.empty()) {
+				auto& [node, edge] = pending.back();
+				const auto& references = objects[node].references;
+				if (edge < references.size()) {
+					const uint32_t referenced = references[edge++];
+					if (index[referenced] == none)
+						visit(referenced);
+					else if (onStack[referenced])
+						low[node] = std::min(low[node], index[referenced]);
+					continue;
+				}
+				const uint32_t done = node;
+				pending.pop_back();
+				if (not pending.empty())
+					low[pending.back().first] = std::min(low[pending.back().first], low[done]);
+				if (low[done] != index[done])
+					continue;
+				std::vector<uint32_t> component;
+				uint32_t member;
+				do {
+					member = stack.back();
+					stack.pop_back();
+					onStack[member] = false;
+					component.push_back(member);
+				} while (member != done);
+				const auto& own = objects[done].references;
+				if (component.size() > 1 or std::binary_search(own.begin(), own.end(), done)) {
+					std::sort(component.begin(), component.end());
+					cycles.push_back(std::move(component));
+				}
+			}
+		}
+		return cycles;
+	}
+
+	bool summarizeHeapDump(std::istream& in, std::ostream& out, size_t count)
+	{
+		std::string line;
+		if (not std::getline(in, line) or line != "RuntimeHeapDump 1")
+			return false;
+		std::vector<DumpedObject> objects;
+		size_t roots = 0;
+		while (std::getline(in, line)) {
+			std::vector<std::string> fields;
+			std::istringstream fieldStream(line);
+			for (std::string field; std::getline(fieldStream, field, '\t');)
+				fields.push_back(field);
+			if (not fields.empty() and fields[0] == "root") {
+				++roots;
+				continue;
+			}
+			if (fields.size() < 6 or fields[0] != "object")
+				return false;
+			DumpedObject object;
+			object.name = readName(fields[2]);
+			if (not readCount(fields[3], object.members) or not readCount(fields[4], object.bytes) or not readCount(fields[5], object.retained))
+				return false;
+			if (fields.size() > 6) {
+				std::istringstream references(fields[6]);
+				for (uint32_t id; references >> id;)
+					object.references.push_back(id);
+			}
+			objects.push_back(std::move(object));
+		}
+		for (const DumpedObject& object : objects)
+			for (uint32_t id : object.references)
+				if (id >= objects.size())
+					return false;
+		const auto displayName = [&](uint32_t id) { return objects[id].name.empty() ? std::string("(unnamed)") : objects[id].name; };
+
+		size_t total = 0;
+		for (const DumpedObject& object : objects)
+			total += object.bytes;
+		out << "Heap dump: " << objects.size() << " objects, " << total << " bytes, " << roots << " roots\n";
+
+		std::vector<uint32_t> order(objects.size());
+		for (uint32_t id = 0; id < order.size(); ++id)
+			order[id] = id;
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return objects[a].retained != objects[b].retained ? objects[a].retained > objects[b].retained : a < b;
+		});
+		out << "\nLargest retainers\n" << std::right
+		    << std::setw(14) << "retained" << std::setw(12) << "own bytes" << std::setw(10) << "members" << "  object\n";
+		for (size_t i = 0; i < std::min(count, order.size()); ++i) {
+			const DumpedObject& object = objects[order[i]];
+			out << std::setw(14) << object.retained << std::setw(12) << object.bytes << std::setw(10) << object.members
+			    << "  " << displayName(order[i]) << " #" << order[i] << "\n";
+		}
+
+		struct NameTotals
+		{
+			size_t objects = 0;
+			size_t bytes = 0;
+		};
+		std::unordered_map<std::string, NameTotals> byName;
+		for (uint32_t id = 0; id < objects.size(); ++id) {
+			NameTotals& totals = byName[displayName(id)];
+			++totals.objects;
+			totals.bytes += objects[id].bytes;
+		}
+		std::vector<std::pair<std::string, NameTotals>> names(byName.begin(), byName.end());
+		std::sort(names.begin(), names.end(), [](const auto& a, const auto& b) {
+			return a.second.bytes != b.second.bytes ? a.second.bytes > b.second.bytes : a.first < b.first;
+		});
+		out << "\nObjects by name\n" << std::setw(10) << "objects" << std::setw(12) << "own bytes" << "  name\n";
+		for (size_t i = 0; i < std::min(count, names.size()); ++i)
+			out << std::setw(10) << names[i].second.objects << std::setw(12) << names[i].second.bytes << "  " << names[i].first << "\n";
+
+		// Cycles are never freed by shared_ptr, even after the script drops its last reference to them
+		const auto cycles = findCycles(objects);
+		out << "\nReference cycles: " << cycles.size() << "\n";
+		for (const auto& cycle : cycles) {
+			size_t bytes = 0;
+			for (uint32_t id : cycle)
+				bytes += objects[id].bytes;
+			out << "  " << cycle.size() << " objects, " << bytes << " bytes:";
+			for (size_t i = 0; i < std::min<size_t>(cycle.size(), 5); ++i)
+				out << " " << displayName(cycle[i]) << " #" << cycle[i];
+			if (cycle.size() > 5)
+				out << " ...";
+			out << "\n";
+		}
+		return true;
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+// This file defines heap dumps, which list every object reachable from the scopes of a running script.
+// Each object is written with its name, member count, the bytes it uses itself, the bytes only it keeps alive
+// and the objects it references. A dump is requested by HeapDump, or by SIGUSR1 when enabled, in which case it
+// is written by the next call the interpreter makes.
+// The format is line based and tab separated:
+//   RuntimeHeapDump 1
+//   root <object> <label>
+//   object <id> <name> <members> <own bytes> <retained bytes> <referenced ids separated by spaces>
+// C++
+#include <atomic>
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace rt
+{
+	// Forward declarations
+	class SymbolTable;
+
+	/// <summary>
+	/// Whether or not a heap dump has been requested by a signal
+	/// </summary>
+	extern std::atomic<bool> heapDumpRequested;
+
+	/// <summary>
+	/// Writes every object reachable from symtab, its parent scopes and the arguments of Main
+	/// </summary>
+	/// <returns>The amount of objects written</returns>
+	size_t writeHeapDump(std::ostream& out, SymbolTable* symtab);
+	/// <summary>
+	/// Writes a heap dump to path whenever the process gets SIGUSR1, replacing the previous one
+	/// </summary>
+	void enableHeapDumpSignal(std::string path);
+	/// <summary>
+	/// Writes the heap dump requested by a signal, seen from symtab
+	/// </summary>
+	void writeRequestedHeapDump(SymbolTable* symtab);
+	/// <summary>
+	/// Reads a heap dump and prints its largest retainers, the objects of each name and the reference cycles in it
+	/// </summary>
+	/// <param name="count">Amount of retainers and names printed</param>
+	/// <returns>Whether or not in held a heap dump</returns>
+	bool summarizeHeapDump(std::istream& in, std::ostream& out, size_t count);
+
+	/// <summary>
+	/// Writes a requested heap dump, if there is one. Called between calls, where no object is half updated
+	/// </summary>
+	inline void pollHeapDump(SymbolTable* symtab)
+	{
+		if (heapDumpRequested.load(std::memory_order_relaxed)) [[unlikely]]
+			writeRequestedHeapDump(symtab);
+	}
+}
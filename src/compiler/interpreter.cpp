@@ -3,14 +3,24 @@
 #include "interpreter.h"
 #include "shared_libs.h"
 #include "symbol_table.h"
+#include "context.h"
+#include "thread_pool.h"
+#include "profiler.h"
+#include "stats.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "heap_dump.h"
+#include "memory_stats.h"
 #include "object.h"
 #include "exceptions.h"
+#include "Stlib/StandardFiles.h"
 // C++
 #include <ffi.h>
 #include <memory>
 #include <variant>
 #include <vector>
 #include <unordered_set>
+#include <utility>
 #include <cstring>
 // C
 #include <cstdlib>
@@ -19,15 +29,6 @@ namespace rt
 {
 	// Interpreter
 
-	/// <summary>
-	/// Whether or not to capture cout to string list
-	/// </summary>
-	static bool capture;
-	bool isCapture() { return capture; };
-	/// <summary>
-	/// Strings captured from cout
-	/// </summary>
-	static std::vector<std::string> capturedCout = {};
 	/// <summary>
 	/// Internal recursive function for interpreting an ast tree
 	/// </summary>
@@ -35,87 +36,158 @@ namespace rt
 	/// <param name="call">Whether or not to evaluate call values</param>
 	/// <returns>The value of the node</returns>
 	static objectOrValue interpret_internal(std::shared_ptr<ast::Expression> expr, SymbolTable* symtab, bool call, ArgState& args);
+
 	/// <summary>
-	/// Whether or not members can be initialized by reference (ie. obj-0)
-	/// </summary>
-	static bool memberInitialization;
-	/// <summary>
-	/// Arguments for Main
-	/// </summary>
-	static std::vector<objectOrValue> mainArgs;
-	/// <summary>
-	/// Main argument state, all arg states should be derived from this one
+	/// Location of the innermost builtin call of the current thread
 	/// </summary>
-	static ArgState mainArgState = ArgState(mainArgs);
+	static thread_local const SourceLocation* currentBuiltInSite = nullptr;
+
 	/// <summary>
-	/// Stores all objects currently being evaluated, in order to stop endless loops
+	/// Makes a call the one returned by builtInCallSite while the builtin runs
 	/// </summary>
-	static std::unordered_set<std::shared_ptr<Object>> inEvaluation;
+	class BuiltInSiteScope
+	{
+	public:
+		explicit BuiltInSiteScope(const SourceLocation& site) : previous(std::exchange(currentBuiltInSite, &site)) {}
+		~BuiltInSiteScope() { currentBuiltInSite = previous; }
+		BuiltInSiteScope(const BuiltInSiteScope&) = delete;
+		BuiltInSiteScope& operator= (const BuiltInSiteScope&) = delete;
+	private:
+		const SourceLocation* previous;
+	};
+
+	SourceLocation builtInCallSite()
+	{
+		return currentBuiltInSite != nullptr ? *currentBuiltInSite : SourceLocation();
+	}
 
 	// TODO: ORGANIZE CODE OH MY DAYS
 
-	void liveIntrepretSetup()
+	Interpreter::Interpreter()
+		: mainArgState(mainArgs)
 	{
-		memberInitialization = true;
-		capture = false;
-		clearSymtab(globalSymtab);
+		clearSymtab(*this);
+		scheduler.setPoller([this](bool block) { return events.poll(block); });
 	}
 
-	[[nodiscard]] objectOrValue liveIntrepret(std::shared_ptr<ast::Expression> expr)
+	Interpreter::~Interpreter()
 	{
-		return interpret_internal(expr, &globalSymtab, true, mainArgState);
+		// Fibers may still use the libraries and the global scope
+		scheduler.cancel();
+		events.cancel();
+		cleanLibraries(*this);
+	}
+
+	void Interpreter::liveSetup()
+	{
+		memberInitialization = true;
+		capture = false;
+		clearSymtab(*this);
 	}
 
-	void captureString(std::string str)
+	objectOrValue Interpreter::live(std::shared_ptr<ast::Expression> expr)
 	{
-		capturedCout.push_back(str);
+		PhaseScope phase(Phase::Interpret);
+		return interpret_internal(expr, &globalSymtab, true, mainArgState);
 	}
 
-	const std::vector<std::string> interpretAndReturn(std::shared_ptr<ast::Expression> expr)
+	std::vector<std::string> Interpreter::interpretAndReturn(std::shared_ptr<ast::Expression> expr)
 	{
 		// Clear
 		mainArgs.clear();
 		mainArgState = ArgState(mainArgs);
-		memberInitialization = false;
-		clearSymtab(globalSymtab);
+		clearSymtab(*this);
 		capture = true;
 		capturedCout.clear();
 		// Begin
-		interpret_internal(expr, &globalSymtab, true, mainArgState);
-		std::shared_ptr<Object> main = std::get<std::shared_ptr<Object>>(globalSymtab.lookUp("Main", mainArgState));
-		memberInitialization = true;
-		callObject(main, &globalSymtab, mainArgState);
+		run(expr);
 		// Clear
-		cleanLibraries();
+		cleanLibraries(*this);
 		return capturedCout;
 	}
 
-	void interpret(std::shared_ptr<ast::Expression> expr, int argc, char** argv)
+	const std::vector<std::string> interpretAndReturn(std::shared_ptr<ast::Expression> expr)
+	{
+		Interpreter interpreter;
+		return interpreter.interpretAndReturn(expr);
+	}
+
+	void Interpreter::interpret(std::shared_ptr<ast::Expression> expr, int argc, char** argv)
 	{
-		memberInitialization = false;
 		// Load stdlib
-		clearSymtab(globalSymtab);
+		clearSymtab(*this);
 		// Load command line arguments
+		setArguments(argc, argv);
+		// Get objects and run code starting from main function
+		capture = false;
+		run(expr);
+	}
+
+	std::variant<double, std::string> Interpreter::run(std::shared_ptr<ast::Expression> expr)
+	{
+		PhaseScope phase(Phase::Interpret);
+		memberInitialization = false;
+		// Main of an earlier run would otherwise get this one's members appended to it
+		globalSymtab.erase("Main");
+		interpret_internal(expr, &globalSymtab, true, mainArgState);
+		std::shared_ptr<Object> main = std::get<std::shared_ptr<Object>>(globalSymtab.lookUp("Main", mainArgState));
+		memberInitialization = true;
+		if (not tracing.load(std::memory_order_relaxed) or main->size() == 0)
+			return callObject(main, &globalSymtab, mainArgState);
+		// The same as callObject, with a span for each top-level member
+		ArgState argState = mainArgState;
+		std::variant<double, std::string> result;
+		for (const objectOrValue& member : main->getMembers()) {
+			std::string name = "value";
+			std::string location;
+			if (auto object = std::get_if<std::shared_ptr<Object>>(&member)) {
+				name = (*object)->getName().empty() ? "object" : (*object)->getName();
+				if (auto expr = (*object)->getExpression())
+					location = expr->src.getFile() + ":" + std::to_string(expr->src.getLine());
+			}
+			TraceSpan span(TraceCategory::Main, name, location);
+			result = evaluate(member, &globalSymtab, argState, false);
+		}
+		return result;
+	}
+
+	void Interpreter::setArguments(int argc, char** argv)
+	{
 		for (int i = 0; i < argc; ++i) {
 			std::variant<double, std::string> value = argv[i];
 			std::string name = "carg";
 			name += std::to_string(i);
 			globalSymtab.updateSymbol(name, std::make_shared<Object>(value ));
 		}
-		// Get objects
-		capture = false;
-		interpret_internal(expr, &globalSymtab, true, mainArgState);
-		std::shared_ptr<Object> main = std::get<std::shared_ptr<Object>>(globalSymtab.lookUp("Main", mainArgState));
-		memberInitialization = true;
-		// Run code starting from main function
-		callObject(main, &globalSymtab, mainArgState);
+	}
+
+	objectOrValue Interpreter::call(const std::string& name, std::vector<objectOrValue> args)
+	{
+		PhaseScope phase(Phase::Interpret);
+		const Symbol& v = globalSymtab.lookUpHard(name);
+		if (std::holds_alternative<BuiltIn>(v)) {
+			RUNTIME_COUNT(builtInCalls[name], 1);
+			return std::get<BuiltIn>(v)(args, &globalSymtab, mainArgState);
+		} else if (std::holds_alternative<std::shared_ptr<LibFunc>>(v)) {
+			return callShared(args, *std::get<std::shared_ptr<LibFunc>>(v), &globalSymtab, mainArgState, SourceLocation());
+		} else {
+			SymbolTable localSt = SymbolTable(&globalSymtab);
+			return callObject(std::get<std::shared_ptr<Object>>(v), &localSt, mainArgState, args);
+		}
+	}
+
+	void Interpreter::registerBuiltIn(const std::string& name, BuiltIn function)
+	{
+		hostBuiltIns.insert_or_assign(name, function);
+		globalSymtab.insert(name, std::move(function));
 	}
 
 	void include(std::shared_ptr<ast::Expression> expr, SymbolTable* symtab, ArgState& argState)
 	{
+		Interpreter& interpreter = symtab->interpreter();
 		// Don't forget "global" values before this was called
-		bool prev = memberInitialization;
-		memberInitialization = false;
+		bool prev = interpreter.memberInitialization;
+		interpreter.memberInitialization = false;
 		// Rename main to avoid conflict (I know this is a hacky workaround, but every way of doing this is hacky)
 		// This could also be done in the parser step, which would probably be a lot smarter :thinking:
 		auto node = std::dynamic_pointer_cast<ast::Call>(expr);
@@ -134,16 +206,17 @@ namespace rt
 		//
 		interpret_internal(expr, symtab, true, argState);
 		std::shared_ptr<Object> mainObject = std::get<std::shared_ptr<Object>>((*symtab).lookUp(mainName, argState));
-		memberInitialization = true;
-		callObject(mainObject, &globalSymtab, mainArgState);
+		interpreter.memberInitialization = true;
+		callObject(mainObject, &interpreter.globalSymtab, interpreter.mainArgState);
 		//
-		memberInitialization = prev;
+		interpreter.memberInitialization = prev;
 	}
 
 	objectOrValue interpret_internal(std::shared_ptr<ast::Expression> expr, SymbolTable* symtab, bool call, ArgState& argState)
 	{
 		if (auto node = std::dynamic_pointer_cast<ast::Identifier>(expr))
 		{
+			RUNTIME_COUNT(interpreted[size_t(NodeKind::Identifier)], 1);
 			const Symbol& v = symtab->lookUp(node->name, argState);
 			if (std::holds_alternative<std::shared_ptr<Object>>(v)) // Object
 				return std::get<std::shared_ptr<Object>>(v);
@@ -152,16 +225,19 @@ namespace rt
 		}
 		else if (auto node = std::dynamic_pointer_cast<ast::Literal>(expr))
 		{
+			RUNTIME_COUNT(interpreted[size_t(NodeKind::Literal)], 1);
 			return node->litValue;
 		}
 		else if (auto node = std::dynamic_pointer_cast<ast::Call>(expr))
 		{
+			RUNTIME_COUNT(interpreted[size_t(NodeKind::Call)], 1);
 			// This code is no longer that bad, but I am still struggling to understand some parts
 
 			// If call target is identifier,
 			if (auto bn = std::dynamic_pointer_cast<ast::Identifier>(node->object))
 			{
 				if (call) {
+					AllocationSiteScope site(node->src);
 					const auto& v = symtab->lookUp(bn->name, argState); // Look up object in symtab
 					// Get arguments	
 					std::vector<objectOrValue> args;
@@ -170,17 +246,28 @@ namespace rt
 						// Do not evaluate here
 						args.push_back(interpret_internal(arg, symtab, false, argState));
 					}
+					pollHeapDump(symtab);
 					// Call function
 					if (std::holds_alternative<BuiltIn>(v)) {	
 						// Call builtin
-						return std::get<BuiltIn>(v)(args, symtab, argState);
+						BuiltInSiteScope builtInSite(node->src);
+						ProfileFrame frame(node, bn->name, CallKind::BuiltIn);
+						RUNTIME_COUNT(builtInCalls[bn->name], 1);
+						try {
+							return std::get<BuiltIn>(v)(args, symtab, argState);
+						} catch (const FrozenObjectError& e) {
+							return giveException(e.what());
+						}
 					} else if (std::holds_alternative<std::shared_ptr<LibFunc>>(v)) {
 						// Call shared_library
+						ProfileFrame frame(node, bn->name, CallKind::Shared);
 						return callShared(args, *std::get<std::shared_ptr<LibFunc>>(v), symtab, argState, node->src);
 					} else {
 						// Going down in scope, this creates a new symbol table with the current one as it's parent
 						SymbolTable localSt = SymbolTable(symtab);
 						// Call Runtime function
+						ProfileFrame frame(node, bn->name, CallKind::Object);
+						TraceSpan span(TraceCategory::Object, bn->name);
 						return callObject(std::get<std::shared_ptr<Object>>(v), &localSt, argState, args);
 					}
 				}
@@ -196,6 +283,7 @@ namespace rt
 					auto calledObject = std::get<std::shared_ptr<Object>>(tmp);
 					if (call)
 					{
+						AllocationSiteScope site(node->src);
 						// Get arguments	
 						std::vector<objectOrValue> args;
 						for (auto arg : node->args)
@@ -205,6 +293,8 @@ namespace rt
 						}
 						// Call Runtime function
 						SymbolTable localSt = SymbolTable(symtab); // Going down in scope
+						ProfileFrame frame(node, calledObject->getName(), CallKind::Object);
+						TraceSpan span(TraceCategory::Object, calledObject->getName());
 						return callObject(calledObject, &localSt, argState, args);
 					}
 					// If not called, return something idk
@@ -216,21 +306,34 @@ namespace rt
 		}
 		else if (auto node = std::dynamic_pointer_cast<ast::BinaryOperator>(expr))
 		{
-			if (memberInitialization)
+			RUNTIME_COUNT(interpreted[size_t(NodeKind::BinaryOperator)], 1);
+			if (symtab->interpreter().memberInitialization)
 			{
-				std::shared_ptr<Object> object;
+				std::shared_ptr<Object> held;
+				Object* object = nullptr;
 				std::variant<double, std::string> member;
-				try {
-					object = std::get<std::shared_ptr<Object>>(interpret_internal(node->left, symtab, true, argState));
-				} catch (std::bad_variant_access) {
-					throw InterpreterException("Left-hand operand of accession was not object", node->src.getLine(), node->src.getFile());
+				if (auto identifier = std::dynamic_pointer_cast<ast::Identifier>(node->left)) {
+					// Named objects are kept alive by the symbol table, so reading members of a table
+					// shared between threads doesn't contend on its reference count
+					const Symbol& v = symtab->lookUp(identifier->name, argState);
+					if (auto named = std::get_if<std::shared_ptr<Object>>(&v))
+						object = named->get();
+				} else if (auto left = interpret_internal(node->left, symtab, true, argState); std::holds_alternative<std::shared_ptr<Object>>(left)) {
+					held = std::get<std::shared_ptr<Object>>(std::move(left));
+					object = held.get();
 				}
+				if (object == nullptr)
+					throw InterpreterException("Left-hand operand of accession was not object", node->src.getLine(), node->src.getFile());
 				try {
 					member = std::get<std::variant<double, std::string>>(interpret_internal(node->right, symtab, true, argState));
 				} catch (std::bad_variant_access) {
 					throw InterpreterException("Right-hand operand of accession was not a value", node->src.getLine(), node->src.getFile());
 				}
-				return *(object->getMember(member));
+				try {
+					return *(object->getMember(member));
+				} catch (const std::out_of_range&) {
+					throw InterpreterException("Frozen object has no such member", node->src.getLine(), node->src.getFile());
+				}
 			}
 			else
 			{
@@ -244,13 +347,83 @@ namespace rt
 			throw InterpreterException("Unimplemented ast node encountered", expr->src.getLine(), expr->src.getFile());
 	}
 
+	// Parallel evaluation
+
+	static thread_local ParallelScope* currentScope = nullptr;
+
+	ParallelScope::ParallelScope(const std::unordered_set<const Object*>* shared)
+		: previous(currentScope)
+		, shared(shared)
+	{
+		currentScope = this;
+	}
+
+	ParallelScope::~ParallelScope()
+	{
+		currentScope = previous;
+	}
+
+	ParallelScope* ParallelScope::current()
+	{
+		return currentScope;
+	}
+
+	ParallelScope* ParallelScope::exchange(ParallelScope* scope)
+	{
+		return std::exchange(currentScope, scope);
+	}
+
+	bool ParallelScope::isShared(const Object* object)
+	{
+		return currentScope != nullptr and currentScope->shared != nullptr and currentScope->shared->contains(object);
+	}
+
+	std::unordered_set<const Object*> sharedObjects(SymbolTable* symtab)
+	{
+		std::unordered_set<const Object*> shared;
+		for (SymbolTable* table = symtab; table != nullptr; table = table->getParent()) {
+			for (const auto& [name, symbol] : table->getLocals()) {
+				if (auto object = std::get_if<std::shared_ptr<Object>>(&symbol))
+					shared.insert(object->get());
+			}
+		}
+		return shared;
+	}
+
+	/// <summary>
+	/// Objects being evaluated by the current thread
+	/// </summary>
+	[[nodiscard]] static std::unordered_set<const Object*>& evaluationSet(SymbolTable* symtab)
+	{
+		if (currentScope != nullptr)
+			return currentScope->inEvaluation;
+		return symtab->interpreter().inEvaluation;
+	}
+
+	std::vector<std::variant<double, std::string>> callParallel(objectOrValue function, const std::vector<objectOrValue>& args, SymbolTable* symtab)
+	{
+		std::vector<std::variant<double, std::string>> results(args.size());
+		const auto shared = sharedObjects(symtab);
+		parallelPool().parallelFor(args.size(), [&](size_t i) {
+			ParallelScope scope(&shared);
+			SymbolTable localSt(symtab);
+			// Without a parent, so calls never take arguments meant for the caller
+			ArgState callArgs;
+			results[i] = callObject(function, &localSt, callArgs, { args[i] });
+		});
+		return results;
+	}
+
 	std::variant<double, std::string> evaluate(objectOrValue member, SymbolTable* symtab, ArgState& argState, bool write)
 	{
+		RUNTIME_COUNT(evaluates, 1);
 		if (std::holds_alternative<std::shared_ptr<Object>>(member))
 		{
-			std::shared_ptr<Object> object = std::get<std::shared_ptr<Object>>(member);
-			if (inEvaluation.contains(object)) {
-				inEvaluation.erase(object);
+			// Objects are kept alive by member, so no new reference is taken
+			const std::shared_ptr<Object>& object = std::get<std::shared_ptr<Object>>(member);
+			auto& inEvaluation = evaluationSet(symtab);
+			if (inEvaluation.contains(object.get())) {
+				inEvaluation.erase(object.get());
 				// Get source location
 				if (object->getExpression() != nullptr) {
 					SourceLocation loc = object->getExpression()->src;
@@ -261,11 +434,11 @@ namespace rt
 					throw InterpreterException("Object evaluation got stuck in an infinite loop", 0, "Unknown");
 				}
 			}
-			inEvaluation.insert(object); // This is currently being evaluated
+			inEvaluation.insert(object.get()); // This is currently being evaluated
 			if (object->getExpression()) // Parse expression
 			{
 				auto r = evaluate(interpret_internal(object->getExpression(), symtab, true, argState), symtab, argState, write);
-				if (write)
+				if (write and not object->isFrozen())
 				{
 #if RUNTIME_DEBUG==1
 				std::cout << "Value evaluated to memory";
@@ -273,18 +446,21 @@ namespace rt
 					object->addMember(r);
 					object->deleteExpression();
 				}
-				inEvaluation.erase(object);
+				inEvaluation.erase(object.get());
 				return r;
 			}
-			else if (auto members = object->getMembers(); members.size() > 0)
+			else if (object->size() > 0)
 			{
-				auto r = evaluate(*(--members.end()), symtab, argState, write); // Evaluate last member
-				inEvaluation.erase(object);
+				auto r = evaluate(*object->getMemberAt(object->size() - 1), symtab, argState, write); // Evaluate last member
+				inEvaluation.erase(object.get());
 				return r;
 			}
 			else // No value, generate empty member
 			{
-				inEvaluation.erase(object); // Immediately remove since this one is fine to double evaluate
+				inEvaluation.erase(object.get()); // Immediately remove since this one is fine to double evaluate
+				// Parallel calls may share the object, so it's only written to outside of them
+				if (object->isFrozen() or not symtab->interpreter().scheduler.usable())
+					return 0.0;
 #if RUNTIME_DEBUG==1
 				std::cout << "Empty value initialized" << std::endl;
 #endif // RUNTIME_DEBUG
@@ -305,11 +481,14 @@ namespace rt
 
 	objectOrValue softEvaluate(objectOrValue member, SymbolTable* symtab, ArgState& argState, bool write)
 	{
+		RUNTIME_COUNT(softEvaluates, 1);
 		if (std::holds_alternative<std::shared_ptr<Object>>(member))
 		{
-			std::shared_ptr<Object> object = std::get<std::shared_ptr<Object>>(member);
-			if (inEvaluation.contains(object)) {
-				inEvaluation.erase(object);
+			// Objects are kept alive by member, so no new reference is taken
+			const std::shared_ptr<Object>& object = std::get<std::shared_ptr<Object>>(member);
+			auto& inEvaluation = evaluationSet(symtab);
+			if (inEvaluation.contains(object.get())) {
+				inEvaluation.erase(object.get());
 				// Get source location
 				if (object->getExpression() != nullptr) {
 					SourceLocation loc = object->getExpression()->src;
@@ -320,11 +499,11 @@ namespace rt
 					throw InterpreterException("Object evaluation got stuck in an infinite loop", 0, "Unknown");
 				}
 			}
-			inEvaluation.insert(object); // This is currently being evaluated
+			inEvaluation.insert(object.get()); // This is currently being evaluated
 			if (object->getExpression()) // Parse expression
 			{
 				auto r = interpret_internal(object->getExpression(), symtab, true, argState);
-				if (write)
+				if (write and not object->isFrozen())
 				{
 #if RUNTIME_DEBUG==1
 				std::cout << "Value evaluated to memory";
@@ -332,7 +511,7 @@ namespace rt
 					object->addMember(r);
 					object->deleteExpression();
 				}
-				inEvaluation.erase(object);
+				inEvaluation.erase(object.get());
 				return r;
 			} else throw InterpreterException("Strict evaluation not passed", 0, "Unknown");
 		}
@@ -355,6 +534,7 @@ namespace rt
 				newArgState = ArgState(args, &argState);
 			}
 			// Evaluate all members, and return last one
+			RUNTIME_COUNT_MEMBER_COPY(object);
 			auto members = object->getMembers();
 			if (members.size() > 0)
 			{
@@ -377,7 +557,9 @@ namespace rt
 				// OTHERWISE  HAHAHAHAHAHAAAAAAAAAAa
 				if (object->getExpression())
 					return evaluate(object, symtab, newArgState, false);
-				// Add zero
+				// Add zero, unless the object is frozen or other threads may be calling it too
+				if (object->isFrozen() or not symtab->interpreter().scheduler.usable())
+					return 0.0;
 #if RUNTIME_DEBUG==1
 				std::cout << "Empty value initialized" << std::endl;
 #endif // RUNTIME_DEBUG
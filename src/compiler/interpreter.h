@@ -12,6 +12,7 @@
 #include <vector>
 #include <any>
 #include <deque>
+#include <unordered_set>
 // External
 #include <tsl/ordered_map.h>
 
@@ -20,6 +21,7 @@ namespace rt
 	// Forward declarations
 	class SymbolTable;
 	class ArgState;
+	class Interpreter;
 	struct LibFunc;
 }
 
@@ -78,7 +80,7 @@ namespace rt
 	template <typename T>
 	[[nodiscard]] inline static T* altAlloc(T value, std::deque<std::any>& altheap)
 	{
-		altheap.push_back(std::make_shared<T>(value));
+		altheap.push_back(makeTracked<T>(MemoryCategory::Ffi, value));
 		return std::any_cast<std::shared_ptr<T>&>(altheap.back()).get();
 	}
 	
@@ -103,19 +105,6 @@ namespace rt
 		}
 	}
 
-	/// <summary>
-	/// Sets up the required variables for live interpreting
-	/// </summary>
-	void liveIntrepretSetup();
-	/// <summary>
-	/// Interprets in live cli session
-	/// </summary>
-	[[nodiscard]] objectOrValue liveIntrepret(std::shared_ptr<ast::Expression> expr);
-	/// <summary>
-	/// Interprets ast tree
-	/// </summary>
-	/// <param name="astTree">Ast tree to be interpreted</param>
-	void interpret(std::shared_ptr<ast::Expression> expr, int argc, char** argv);
 	/// <summary>
 	/// Evaluates ast tree and adds all of an it's symbols to another symbol table
 	/// </summary>
@@ -142,19 +131,65 @@ namespace rt
 	/// <param name="object"></param>
 	std::variant<double, std::string> callObject(objectOrValue member, SymbolTable* symtab, ArgState& argState, std::vector<objectOrValue> args = {});
 	/// <summary>
-	/// Interprets ast tree, and returns everything printed to cout
+	/// Returns the location of the innermost builtin call the current thread is interpreting, or an empty location outside of one.
+	/// Builtins aren't given their location, so this is for those which report errors from shared functions
 	/// </summary>
-	/// <param name="astTree">Ast tree to be interpreted</param>
-	/// <returns>String list containing everything printed to cout</returns>
-	const std::vector<std::string> interpretAndReturn(std::shared_ptr<ast::Expression> expr);
+	[[nodiscard]] SourceLocation builtInCallSite();
 	/// <summary>
-	/// Adds a string to the captured cout vector
+	/// Calls function once for every argument across the cores, each call in its own scope below symtab.
+	/// The calls must not modify objects they share, see ParallelScope::isShared
 	/// </summary>
-	/// <returns></returns>
-	void captureString(std::string str);
+	/// <returns>The values of the calls, in the order of the arguments</returns>
+	std::vector<std::variant<double, std::string>> callParallel(objectOrValue function, const std::vector<objectOrValue>& args, SymbolTable* symtab);
+
 	/// <summary>
-	/// Returns whether or not string capture is on
+	/// Lets the current thread evaluate objects while other threads evaluate objects of the same interpreter.
+	/// Infinite loop detection uses a set of its own, and lazily resolved shared functions
+	/// are cached in the calling scope instead of the global one
 	/// </summary>
-	/// <returns></returns>
-	bool isCapture();
+	class ParallelScope
+	{
+	public:
+		/// <summary>
+		/// Scope of a parallel call
+		/// </summary>
+		/// <param name="shared">Objects the call shares with the others, from sharedObjects. nullptr if none</param>
+		explicit ParallelScope(const std::unordered_set<const Object*>* shared = nullptr);
+		~ParallelScope();
+		ParallelScope(const ParallelScope&) = delete;
+		ParallelScope& operator= (const ParallelScope&) = delete;
+		/// <summary>
+		/// Innermost scope of the current thread, or nullptr
+		/// </summary>
+		[[nodiscard]] static ParallelScope* current();
+		/// <summary>
+		/// Makes scope the innermost one of the current thread, for switching between fibers
+		/// </summary>
+		/// <returns>The previous innermost scope</returns>
+		static ParallelScope* exchange(ParallelScope* scope);
+		/// <summary>
+		/// Whether or not the innermost parallel call of the current thread shares an object with other calls.
+		/// Builtins which change objects refuse shared ones, since the other calls may be reading them
+		/// </summary>
+		[[nodiscard]] static bool isShared(const Object* object);
+		/// <summary>
+		/// Objects currently being evaluated on this thread
+		/// </summary>
+		std::unordered_set<const Object*> inEvaluation;
+	private:
+		ParallelScope* previous;
+		const std::unordered_set<const Object*>* shared;
+	};
+
+	/// <summary>
+	/// Objects named in symtab or its parents, which parallel calls made from symtab all see
+	/// </summary>
+	[[nodiscard]] std::unordered_set<const Object*> sharedObjects(SymbolTable* symtab);
+
+	/// <summary>
+	/// Interprets ast tree in a new interpreter, and returns everything printed to cout
+	/// </summary>
+	/// <param name="astTree">Ast tree to be interpreted</param>
+	/// <returns>String list containing everything printed to cout</returns>
+	const std::vector<std::string> interpretAndReturn(std::shared_ptr<ast::Expression> expr);
 }
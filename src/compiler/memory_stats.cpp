@@ -0,0 +1,217 @@
+// Runtime
+#include "memory_stats.h"
+#include "tokenizer.h"
+// C++
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+// C
+#include <unistd.h>
+
+namespace rt
+{
+	static std::array<std::atomic<int64_t>, memoryCategoryCount> liveBytes{};
+	static std::array<std::atomic<int64_t>, memoryCategoryCount> peakBytes{};
+	static std::array<std::atomic<uint64_t>, memoryCategoryCount> allocationCount{};
+
+#if RUNTIME_MEMORY_STATS==1
+	/// <summary>
+	/// Category and source location of an allocation, the file being viewed while looking up
+	/// </summary>
+	template <typename File>
+	struct BasicSiteKey
+	{
+		MemoryCategory category;
+		int line;
+		File file;
+	};
+	using SiteKey = BasicSiteKey<std::string>;
+	using SiteView = BasicSiteKey<std::string_view>;
+
+	/// <summary>
+	/// Hashes and compares site keys, so sites can be looked up without copying their file name
+	/// </summary>
+	struct SiteHash
+	{
+		using is_transparent = void;
+		template <typename File>
+		size_t operator() (const BasicSiteKey<File>& key) const
+		{
+			return std::hash<std::string_view>()(key.file) ^ (size_t(key.line) << 3) ^ size_t(key.category);
+		}
+	};
+	struct SiteEqual
+	{
+		using is_transparent = void;
+		template <typename A, typename B>
+		bool operator() (const BasicSiteKey<A>& a, const BasicSiteKey<B>& b) const
+		{
+			return a.category == b.category and a.line == b.line and std::string_view(a.file) == std::string_view(b.file);
+		}
+	};
+
+	struct SiteTotals
+	{
+		uint64_t allocations = 0;
+		uint64_t bytes = 0;
+	};
+
+	/// <summary>
+	/// Allocation sites of one thread
+	/// </summary>
+	struct ThreadSites
+	{
+		/// <summary>
+		/// Only contended while the sites are read
+		/// </summary>
+		std::mutex mutex;
+		std::unordered_map<SiteKey, SiteTotals, SiteHash, SiteEqual> sites;
+	};
+
+	/// <summary>
+	/// Sites of every thread which allocated something, including finished threads
+	/// </summary>
+	static std::vector<std::unique_ptr<ThreadSites>> threadSites;
+	static std::mutex threadSitesMutex;
+	static thread_local ThreadSites* ownSites = nullptr;
+
+	[[nodiscard]] static ThreadSites& sitesOfThread()
+	{
+		if (ownSites == nullptr) [[unlikely]] {
+			std::lock_guard lock(threadSitesMutex);
+			ownSites = threadSites.emplace_back(std::make_unique<ThreadSites>()).get();
+		}
+		return *ownSites;
+	}
+#endif // RUNTIME_MEMORY_STATS
+
+	/// <summary>
+	/// Adds to the live bytes of a category, raising its peak if needed
+	/// </summary>
+	static void addLive(size_t index, int64_t bytes)
+	{
+		const int64_t live = liveBytes[index].fetch_add(bytes, std::memory_order_relaxed) + bytes;
+		int64_t peak = peakBytes[index].load(std::memory_order_relaxed);
+		while (live > peak and not peakBytes[index].compare_exchange_weak(peak, live, std::memory_order_relaxed))
+			;
+	}
+
+	void trackAllocation(MemoryCategory category, int64_t bytes, [[maybe_unused]] const SourceLocation* site)
+	{
+		const size_t index = size_t(category);
+		addLive(index, bytes);
+		allocationCount[index].fetch_add(1, std::memory_order_relaxed);
+#if RUNTIME_MEMORY_STATS==1
+		if (site == nullptr)
+			site = AllocationSiteScope::current;
+		// Locations without a file, like those of generated nodes, are all the same site
+		const std::string_view file = site ? std::string_view(site->getFile()) : std::string_view();
+		const SiteView view{ category, file.empty() ? 0 : site->getLine(), file };
+		ThreadSites& sites = sitesOfThread();
+		std::lock_guard lock(sites.mutex);
+		auto it = sites.sites.find(view);
+		if (it == sites.sites.end())
+			it = sites.sites.insert({ SiteKey{ category, view.line, std::string(view.file) }, SiteTotals() }).first;
+		++it->second.allocations;
+		it->second.bytes += static_cast<uint64_t>(bytes);
+#endif // RUNTIME_MEMORY_STATS
+	}
+
+	void trackCopy(MemoryCategory category, int64_t bytes)
+	{
+		addLive(size_t(category), bytes);
+	}
+
+	void trackRelease(MemoryCategory category, int64_t bytes)
+	{
+		liveBytes[size_t(category)].fetch_sub(bytes, std::memory_order_relaxed);
+	}
+
+	MemoryUsage memoryUsage(MemoryCategory category)
+	{
+		const size_t index = size_t(category);
+		return { liveBytes[index].load(), peakBytes[index].load(), allocationCount[index].load() };
+	}
+
+	std::vector<AllocationSiteTotals> topAllocationSites([[maybe_unused]] MemoryCategory category, [[maybe_unused]] size_t count)
+	{
+#if RUNTIME_MEMORY_STATS==1
+		std::unordered_map<SiteKey, SiteTotals, SiteHash, SiteEqual> merged;
+		{
+			std::lock_guard lock(threadSitesMutex);
+			for (const auto& sites : threadSites) {
+				std::lock_guard sitesLock(sites->mutex);
+				for (const auto& [key, totals] : sites->sites) {
+					if (key.category != category)
+						continue;
+					SiteTotals& total = merged[key];
+					total.allocations += totals.allocations;
+					total.bytes += totals.bytes;
+				}
+			}
+		}
+		std::vector<AllocationSiteTotals> top;
+		for (const auto& [key, totals] : merged)
+			top.push_back({ key.file, key.line, totals.allocations, totals.bytes });
+		std::sort(top.begin(), top.end(), [](const auto& a, const auto& b) {
+			if (a.bytes != b.bytes)
+				return a.bytes > b.bytes;
+			return a.file != b.file ? a.file < b.file : a.line < b.line;
+		});
+		if (top.size() > count)
+			top.resize(count);
+		return top;
+#else
+		// Sites are only recorded when tracking memory
+		return {};
+#endif // RUNTIME_MEMORY_STATS
+	}
+
+	const char* memoryCategoryName(MemoryCategory category)
+	{
+		const char* names[] = { "objects", "members", "strings", "ast", "tokens", "ffi" };
+		return names[size_t(category)];
+	}
+
+	std::string memoryStatsReport()
+	{
+		std::ostringstream out;
+		out << "Memory statistics\n" << std::right
+		    << std::setw(10) << "category" << std::setw(14) << "live bytes" << std::setw(14) << "peak bytes" << std::setw(14) << "allocations" << "\n";
+		for (size_t i = 0; i < memoryCategoryCount; ++i) {
+			const MemoryUsage usage = memoryUsage(MemoryCategory(i));
+			out << std::setw(10) << memoryCategoryName(MemoryCategory(i)) << std::setw(14) << usage.live
+			    << std::setw(14) << usage.peak << std::setw(14) << usage.allocations << "\n";
+		}
+		for (size_t i = 0; i < memoryCategoryCount; ++i) {
+			const auto sites = topAllocationSites(MemoryCategory(i), 5);
+			if (sites.empty())
+				continue;
+			out << "  top " << memoryCategoryName(MemoryCategory(i)) << " sites\n";
+			for (const AllocationSiteTotals& site : sites) {
+				// Allocations made outside of any call have no site
+				const std::string location = site.file.empty() ? std::string("(no call)") : site.file + ":" + std::to_string(site.line);
+				out << "    " << std::left << std::setw(40) << location << std::right
+				    << std::setw(14) << site.bytes << " bytes" << std::setw(12) << site.allocations << " allocations\n";
+			}
+		}
+		return out.str();
+	}
+
+	size_t residentBytes()
+	{
+		// Total and resident pages
+		std::ifstream statm("/proc/self/statm");
+		size_t total = 0, resident = 0;
+		if (not (statm >> total >> resident))
+			return 0;
+		return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	}
+}
@@ -0,0 +1,190 @@
+#pragma once
+// Allocation accounting, printed by --stats and returned by MemoryStats(). Only tracked when built with
+// RUNTIME_MEMORY_STATS, otherwise the tags and allocators here are empty and track nothing.
+// Each category has its live and peak bytes, and the allocations of each category are counted by the
+// source location they were made at: the node itself for tokens and ast nodes, and the innermost call
+// being interpreted for everything else. Sizes are estimates of what the category holds directly,
+// not what the system allocator hands out.
+// Object, Token and the ast nodes include this, so extensions see it too. An extension built without Runtime.hpp
+// doesn't track, and RUNTIME_EXTENSION_ABI then keeps it from loading into an interpreter which does
+// Runtime
+#if __has_include("Runtime.hpp")
+#include "Runtime.hpp"
+#endif
+// C++
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+	// Forward declarations
+	class SourceLocation;
+
+	/// <summary>
+	/// What an allocation holds
+	/// </summary>
+	enum class MemoryCategory : uint8_t
+	{
+		Objects,
+		/// <summary>
+		/// Member table entries and member names
+		/// </summary>
+		Members,
+		/// <summary>
+		/// Strings stored as member values, outside of the string object
+		/// </summary>
+		Strings,
+		Ast,
+		Tokens,
+		/// <summary>
+		/// Values on the altHeap of shared function calls
+		/// </summary>
+		Ffi
+	};
+	inline constexpr size_t memoryCategoryCount = 6;
+
+	/// <summary>
+	/// Totals of one category, added up over every thread
+	/// </summary>
+	struct MemoryUsage
+	{
+		int64_t live = 0;
+		int64_t peak = 0;
+		uint64_t allocations = 0;
+	};
+
+	/// <summary>
+	/// Allocations of one category made at one source location
+	/// </summary>
+	struct AllocationSiteTotals
+	{
+		std::string file;
+		int line;
+		uint64_t allocations;
+		uint64_t bytes;
+	};
+
+	/// <summary>
+	/// Adds an allocation to a category
+	/// </summary>
+	/// <param name="site">Where it was made, nullptr for the innermost call being interpreted</param>
+	void trackAllocation(MemoryCategory category, int64_t bytes, const SourceLocation* site = nullptr);
+	/// <summary>
+	/// Adds a copy of a tracked value to the live bytes of a category, without counting it as an allocation.
+	/// Containers copy their elements as they grow, which says nothing about the script
+	/// </summary>
+	void trackCopy(MemoryCategory category, int64_t bytes);
+	/// <summary>
+	/// Removes an allocation from the live bytes of a category
+	/// </summary>
+	void trackRelease(MemoryCategory category, int64_t bytes);
+	[[nodiscard]] MemoryUsage memoryUsage(MemoryCategory category);
+	/// <summary>
+	/// Returns the sites of a category with the most bytes allocated, most first
+	/// </summary>
+	[[nodiscard]] std::vector<AllocationSiteTotals> topAllocationSites(MemoryCategory category, size_t count);
+	/// <summary>
+	/// Returns the name of a category, as used by the report and MemoryStats
+	/// </summary>
+	[[nodiscard]] const char* memoryCategoryName(MemoryCategory category);
+	/// <summary>
+	/// Returns the usage and top sites of every category as a table
+	/// </summary>
+	[[nodiscard]] std::string memoryStatsReport();
+	/// <summary>
+	/// Resident set size of the process in bytes, 0 if unknown. Available whether or not memory is tracked
+	/// </summary>
+	[[nodiscard]] size_t residentBytes();
+
+	/// <summary>
+	/// Makes a call the site of the allocations made while it is interpreted
+	/// </summary>
+	class AllocationSiteScope
+	{
+	public:
+#if RUNTIME_MEMORY_STATS==1
+		explicit AllocationSiteScope(const SourceLocation& site) : previous(current)
+		{
+			current = &site;
+		}
+		~AllocationSiteScope()
+		{
+			current = previous;
+		}
+		/// <summary>
+		/// Innermost site of the calling thread, or nullptr
+		/// </summary>
+		static inline thread_local const SourceLocation* current = nullptr;
+	private:
+		const SourceLocation* previous;
+#else
+		explicit AllocationSiteScope(const SourceLocation&) {}
+#endif // RUNTIME_MEMORY_STATS
+	public:
+		AllocationSiteScope(const AllocationSiteScope&) = delete;
+		AllocationSiteScope& operator= (const AllocationSiteScope&) = delete;
+	};
+
+	/// <summary>
+	/// Empty member which tracks every Owner from its construction to its destruction, as sizeof(Owner) bytes
+	/// </summary>
+	template <MemoryCategory category, typename Owner>
+	struct MemoryTag
+	{
+#if RUNTIME_MEMORY_STATS==1
+		MemoryTag() { trackAllocation(category, sizeof(Owner)); }
+		explicit MemoryTag(const SourceLocation& site) { trackAllocation(category, sizeof(Owner), &site); }
+		MemoryTag(const MemoryTag&) { trackCopy(category, sizeof(Owner)); }
+		MemoryTag& operator= (const MemoryTag&) { return *this; }
+		~MemoryTag() { trackRelease(category, sizeof(Owner)); }
+#else
+		MemoryTag() = default;
+		explicit MemoryTag(const SourceLocation&) {}
+#endif // RUNTIME_MEMORY_STATS
+	};
+
+	/// <summary>
+	/// Allocator which tracks what it allocates in a category, for std::allocate_shared
+	/// </summary>
+	template <typename T>
+	struct TrackingAllocator
+	{
+		using value_type = T;
+
+		explicit TrackingAllocator(MemoryCategory category) : category(category) {}
+		template <typename U>
+		TrackingAllocator(const TrackingAllocator<U>& other) : category(other.category) {}
+
+		T* allocate(size_t n)
+		{
+			trackAllocation(category, static_cast<int64_t>(n * sizeof(T)));
+			return std::allocator<T>().allocate(n);
+		}
+		void deallocate(T* pointer, size_t n)
+		{
+			trackRelease(category, static_cast<int64_t>(n * sizeof(T)));
+			std::allocator<T>().deallocate(pointer, n);
+		}
+		template <typename U>
+		bool operator== (const TrackingAllocator<U>& other) const { return category == other.category; }
+
+		MemoryCategory category;
+	};
+
+	/// <summary>
+	/// std::make_shared, tracked in a category when tracking memory
+	/// </summary>
+	template <typename T, typename... Args>
+	[[nodiscard]] std::shared_ptr<T> makeTracked([[maybe_unused]] MemoryCategory category, Args&&... args)
+	{
+#if RUNTIME_MEMORY_STATS==1
+		return std::allocate_shared<T>(TrackingAllocator<T>(category), std::forward<Args>(args)...);
+#else
+		return std::make_shared<T>(std::forward<Args>(args)...);
+#endif // RUNTIME_MEMORY_STATS
+	}
+}
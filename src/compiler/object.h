@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ast.h"
+#include "memory_stats.h"
 #include <tsl/ordered_map.h>
 // C++
 #include <unordered_map> // Do testing later on to figure out if a normal map would be better
@@ -11,6 +12,8 @@
 #include <vector>
 #include <algorithm>
 #include <any>
+#include <stdexcept>
+#include <cstdint>
 
 // Forward declarations
 namespace rt
@@ -24,6 +27,27 @@ namespace rt
 using objectOrValue = std::variant<std::shared_ptr<rt::Object>, std::variant<double, std::string>>;
 
 namespace rt {
+	/// <summary>
+	/// Thrown when writing to a frozen object. Builtins report it as "Object is frozen"
+	/// </summary>
+	class FrozenObjectError : public std::logic_error
+	{
+	public:
+		FrozenObjectError() : std::logic_error("Object is frozen") {}
+	};
+
+	/// <summary>
+	/// Counts the objects created by each thread, for the call profiler
+	/// </summary>
+	struct CreationCounter
+	{
+		CreationCounter() { ++created; }
+		CreationCounter(const CreationCounter&) { ++created; }
+		CreationCounter& operator= (const CreationCounter&) = default;
+
+		static inline thread_local uint64_t created = 0;
+	};
+
 	/// <summary>
 	/// Main class for representing Runtime objects
 	/// </summary>
@@ -74,6 +98,28 @@ namespace rt {
 			expr = nullptr;
 			addMember(value);
 		}
+#if RUNTIME_MEMORY_STATS==1
+		/// <summary>
+		/// Copies an object, tracking the members of the copy like the destructor releases them
+		/// </summary>
+		Object(const Object& other)
+			: name(other.name), expr(other.expr), members(other.members), memberStringMap(other.memberStringMap),
+			  counter(other.counter), native(other.native), frozen(other.frozen), creationCounter(other.creationCounter), memoryTag(other.memoryTag)
+		{
+			for (const auto& [key, member] : members)
+				trackMember(member, true);
+			for (const auto& [key, index] : memberStringMap)
+				trackMemberName(key, true);
+		}
+		Object& operator= (const Object&) = default;
+		~Object()
+		{
+			for (const auto& [key, member] : members)
+				trackMember(member, false);
+			for (const auto& [key, index] : memberStringMap)
+				trackMemberName(key, false);
+		}
+#endif // RUNTIME_MEMORY_STATS
 
 		/// <summary>
 		/// Return name member
@@ -97,6 +143,8 @@ namespace rt {
 			if (it != members.end()) // Exists
 				return &it.value();
 			// if not exist, create
+			if (frozen)
+				throw std::out_of_range("Frozen object has no such member");
 			addMember(key);
 			return getMember(key);
 		};
@@ -112,6 +160,8 @@ namespace rt {
 			if (it != memberStringMap.end()) // Exists
 				return &members[it->second];
 			// if not exist, create
+			if (frozen)
+				throw std::out_of_range("Frozen object has no such member");
 			addMember(name);
 			return getMember(name);
 		}; // TODO: idfk man
@@ -134,6 +184,35 @@ namespace rt {
 			}
 		}
 		/// <summary>
+		/// Returns member by its position in the member list
+		/// </summary>
+		/// <param name="index">Position, must be smaller than size()</param>
+		/// <returns></returns>
+		objectOrValue* getMemberAt(size_t index)
+		{
+			return &members.nth(index).value();
+		}
+		/// <summary>
+		/// Returns the key of the member at a position in the member list
+		/// </summary>
+		/// <param name="index">Position, must be smaller than size()</param>
+		/// <returns></returns>
+		int getKeyAt(size_t index)
+		{
+			return members.nth(index)->first;
+		}
+		/// <summary>
+		/// Returns the names of named members, with the keys they map to
+		/// </summary>
+		/// <returns></returns>
+		const std::unordered_map<std::string, int>& getStringKeys() const { return memberStringMap; }
+		/// <summary>
+		/// Whether or not a member with an int key exists
+		/// </summary>
+		/// <param name="key"></param>
+		/// <returns></returns>
+		bool hasMember(int key) { return members.contains(key); }
+		/// <summary>
 		/// Returns a vector containing all of the members
 		/// </summary>
 		/// <returns></returns>
@@ -157,7 +236,9 @@ namespace rt {
 		/// <param name="key"></param>
 		void addMember(int key)
 		{
-			members.insert({key, std::make_shared<Object>()});
+			checkWritable();
+			if (members.insert({key, std::make_shared<Object>()}).second)
+				trackMember(members.at(key), true);
 		}
 		/// <summary>
 		/// Add member with just string key
@@ -165,10 +246,13 @@ namespace rt {
 		/// <param name="key"></param>
 		void addMember(std::string key)
 		{
+			checkWritable();
 			if (not members.contains(counter))
 			{
 				members.insert({counter, std::make_shared<Object>() });
-				memberStringMap.insert({ key, counter });
+				trackMember(members.at(counter), true);
+				if (memberStringMap.insert({ key, counter }).second)
+					trackMemberName(key, true);
 				counter++;
 			}
 			else
@@ -184,9 +268,11 @@ namespace rt {
 		/// <param name="member"></param>
 		/// <param name="key"></param>
 		void addMember(objectOrValue member, int key) { 
+			checkWritable();
 			if (key == counter) 
 				counter++;
-			members.insert({ key, member });
+			if (members.insert({ key, member }).second)
+				trackMember(members.at(key), true);
 		};
 
 		/// <summary>
@@ -195,9 +281,11 @@ namespace rt {
 		/// <param name="member"></param>
 		void addMember(objectOrValue member)
 		{
+			checkWritable();
 			if (not members.contains(counter))
 			{
 				members.insert({counter, member});
+				trackMember(members.at(counter), true);
 				counter++;
 			}
 			else
@@ -213,10 +301,13 @@ namespace rt {
 		/// <param name="member"></param>
 		/// <param name="key"></param>
 		void addMember(objectOrValue member, std::string key) {
+			checkWritable();
 			if (not members.contains(counter))
 			{
 				members.insert({counter, member});
-				memberStringMap.insert({key, counter});
+				trackMember(members.at(counter), true);
+				if (memberStringMap.insert({key, counter}).second)
+					trackMemberName(key, true);
 				counter++;
 			}
 			else
@@ -233,6 +324,7 @@ namespace rt {
 		/// <param name="value"></param>
 		void setMember(std::variant<double, std::string> key, objectOrValue value)
 		{
+			checkWritable();
 			// Delete old member and add new one because no assignment operator idk don't feel like figuring that out :/
 			// TODO: Probably not particularly hard to fix, at least anymore
 			if (std::holds_alternative<double>(key)) // Number
@@ -240,7 +332,10 @@ namespace rt {
 				// DOES NOT REMOVE STRING KEY MAP TODO TODO TODO
 				int memberKey = static_cast<int>(std::get<double>(key));
 				if (members.contains(memberKey))
+				{
+					trackMember(members.at(memberKey), false);
 					members.erase(memberKey);
+				}
 				addMember(value, memberKey);
 			}
 			else
@@ -248,6 +343,9 @@ namespace rt {
 				std::string memberKey = std::get<std::string>(key); // String
 				if (memberStringMap.contains(memberKey))
 				{
+					if (members.contains(memberStringMap.at(memberKey)))
+						trackMember(members.at(memberStringMap.at(memberKey)), false);
+					trackMemberName(memberKey, false);
 					members.erase(memberStringMap.at(memberKey));
 					memberStringMap.erase(memberKey);
 				}
@@ -261,12 +359,14 @@ namespace rt {
 		/// <param name="value"></param>
 		void setLast(objectOrValue value)
 		{
+			checkWritable();
 			// Delete old member and add new one because no assignment operator idk don't feel like figuring that out :/
 			// TODO
 			if (members.size() > 0)
 			{
 				// TODO DOES NOT REMOVE STRING KEY, ADD METHOD I GUESS?
 				int key = members.back().first;
+				trackMember(members.back().second, false);
 				members.erase(members.end() - 1); // Remove last one
 				addMember(value, key);
 			} else throw; // Bored
@@ -276,6 +376,7 @@ namespace rt {
 		/// </summary>
 		void deleteExpression()
 		{
+			checkWritable();
 			expr.reset();
 		}
 		/// <summary>
@@ -289,7 +390,166 @@ namespace rt {
 			// Remember the constructor associated with this!
 			return std::make_shared<Object>(value);
 		}
+		/// <summary>
+		/// Makes this object and every object reachable from its members immutable.
+		/// Frozen objects are never written to, so any thread can read them without locking. Every method changing
+		/// the members, expression or native data of a frozen object throws FrozenObjectError
+		/// </summary>
+		void freeze()
+		{
+			std::vector<Object*> pending{ this };
+			while (not pending.empty())
+			{
+				Object* object = pending.back();
+				pending.pop_back();
+				if (object->frozen)
+					continue;
+				object->frozen = true;
+				for (auto& [key, member] : object->members)
+				{
+					if (auto child = std::get_if<std::shared_ptr<Object>>(&member))
+						pending.push_back(child->get());
+				}
+			}
+		}
+		/// <summary>
+		/// Whether or not the object has been frozen
+		/// </summary>
+		bool isFrozen() const { return frozen; }
+		/// <summary>
+		/// Copies an object and every unfrozen object reachable from its members. Objects reachable along several paths
+		/// are copied once, so the copies reference each other like the originals do. Frozen objects and native data are shared
+		/// </summary>
+		/// <param name="copies">Originals and their copies, shared between calls to copy several objects as one graph</param>
+		/// <returns></returns>
+		static std::shared_ptr<Object> deepCopy(const std::shared_ptr<Object>& object, std::unordered_map<const Object*, std::shared_ptr<Object>>& copies)
+		{
+			if (object->frozen)
+				return object;
+			auto [first, inserted] = copies.try_emplace(object.get());
+			if (not inserted)
+				return first->second;
+			const std::shared_ptr<Object> root = std::make_shared<Object>(*object);
+			first->second = root;
+			std::vector<std::shared_ptr<Object>> pending{ root };
+			while (not pending.empty())
+			{
+				std::shared_ptr<Object> copy = std::move(pending.back());
+				pending.pop_back();
+				// The members still point to the originals
+				for (auto it = copy->members.begin(); it != copy->members.end(); ++it)
+				{
+					auto child = std::get_if<std::shared_ptr<Object>>(&it.value());
+					if (child == nullptr or (*child)->frozen)
+						continue;
+					auto [found, added] = copies.try_emplace(child->get());
+					if (added)
+					{
+						found->second = std::make_shared<Object>(**child);
+						pending.push_back(found->second);
+					}
+					*child = found->second;
+				}
+			}
+			return root;
+		}
+		/// <summary>
+		/// Returns the native data attached to this object, empty if none
+		/// </summary>
+		/// <returns></returns>
+		std::any& getNative() { return native; };
+		/// <summary>
+		/// Attaches native data (for example a buffer) to this object
+		/// </summary>
+		/// <param name="value"></param>
+		void setNative(std::any value)
+		{
+			checkWritable();
+			native = std::move(value);
+		};
+		/// <summary>
+		/// Estimates the bytes used by the object itself, including its member tables and the strings it holds,
+		/// but not the objects it references, its expression or its native data
+		/// </summary>
+		/// <returns></returns>
+		size_t shallowSize() const
+		{
+			size_t size = sizeof(Object) + heapBytes(name);
+			// Each bucket holds the index of a member and part of its hash
+			size += members.size() * sizeof(std::pair<int, objectOrValue>) + members.bucket_count() * sizeof(uint64_t);
+			for (const auto& [key, member] : members)
+			{
+				if (auto value = std::get_if<std::variant<double, std::string>>(&member))
+					if (auto string = std::get_if<std::string>(value))
+						size += heapBytes(*string);
+			}
+			// Each node holds a name, its key, the next node and the hash of the name
+			size += memberStringMap.bucket_count() * sizeof(void*);
+			for (const auto& [key, index] : memberStringMap)
+				size += sizeof(std::pair<const std::string, int>) + 2 * sizeof(void*) + heapBytes(key);
+			return size;
+		}
+		/// <summary>
+		/// Amount of objects created by the calling thread so far
+		/// </summary>
+		static uint64_t createdByThread() { return CreationCounter::created; }
 	private:
+		/// <summary>
+		/// Bytes a string has allocated outside of itself
+		/// </summary>
+		static size_t heapBytes(const std::string& string)
+		{
+			// Short strings are stored within the string itself
+			const char* data = string.data();
+			if (data >= reinterpret_cast<const char*>(&string) and data < reinterpret_cast<const char*>(&string + 1))
+				return 0;
+			return string.capacity() + 1;
+		}
+		/// <summary>
+		/// Throws if the object is frozen, before anything is changed
+		/// </summary>
+		void checkWritable() const
+		{
+			if (frozen) [[unlikely]]
+				throw FrozenObjectError();
+		}
+		/// <summary>
+		/// Accounts for a member entering or leaving the member table, if tracking memory
+		/// </summary>
+		void trackMember([[maybe_unused]] const objectOrValue& member, [[maybe_unused]] bool added) const
+		{
+#if RUNTIME_MEMORY_STATS==1
+			const int64_t entry = sizeof(std::pair<int, objectOrValue>);
+			int64_t string = 0;
+			if (auto value = std::get_if<std::variant<double, std::string>>(&member))
+				if (auto text = std::get_if<std::string>(value))
+					string = static_cast<int64_t>(heapBytes(*text));
+			if (added) {
+				trackAllocation(MemoryCategory::Members, entry);
+				if (string != 0)
+					trackAllocation(MemoryCategory::Strings, string);
+			} else {
+				trackRelease(MemoryCategory::Members, entry);
+				if (string != 0)
+					trackRelease(MemoryCategory::Strings, string);
+			}
+#endif // RUNTIME_MEMORY_STATS
+		}
+		/// <summary>
+		/// Accounts for a name entering or leaving the member name map, if tracking memory
+		/// </summary>
+		void trackMemberName([[maybe_unused]] const std::string& name, [[maybe_unused]] bool added) const
+		{
+#if RUNTIME_MEMORY_STATS==1
+			// The node holds the name, its key, the next node and the hash of the name
+			const int64_t node = sizeof(std::pair<const std::string, int>) + 2 * sizeof(void*) + heapBytes(name);
+			if (added)
+				trackAllocation(MemoryCategory::Members, node);
+			else
+				trackRelease(MemoryCategory::Members, node);
+#endif // RUNTIME_MEMORY_STATS
+		}
+
 		/// <summary>
 		/// Name of the object
 		/// </summary>
@@ -310,5 +570,15 @@ namespace rt {
 		/// Counts up the indexing of new members
 		/// </summary>
 		int counter = 0;
+		/// <summary>
+		/// (Optional) native data owned by the object, which can't be represented as members
+		/// </summary>
+		std::any native;
+		/// <summary>
+		/// Whether or not the object is immutable
+		/// </summary>
+		bool frozen = false;
+		[[no_unique_address]] CreationCounter creationCounter;
+		[[no_unique_address]] MemoryTag<MemoryCategory::Objects, Object> memoryTag;
 	};
 }
@@ -3,6 +3,9 @@
 #include "tokenizer.h"
 #include "exceptions.h"
 #include "utils.h"
+#include "stats.h"
+#include "trace.h"
+#include "perf_counters.h"
 // C++
 #include <string>
 // C
@@ -13,7 +16,7 @@ namespace rt
 	/// <summary>
 	/// Current position on the token list
 	/// </summary>
-	static int pos = 0;
+	static thread_local int pos = 0;
 
 	/// <summary>
 	/// Returns current token
@@ -191,20 +194,44 @@ namespace rt
 		return std::make_shared<ast::Call>(peek(tokens).getSrc(), std::make_shared<ast::Identifier>(SourceLocation(), "Object"), args);
 	}
 
+#if RUNTIME_STATS==1
+	/// <summary>
+	/// Counts the nodes of an ast tree
+	/// </summary>
+	[[nodiscard]] static uint64_t countNodes(const std::shared_ptr<ast::Expression>& expr)
+	{
+		if (auto node = std::dynamic_pointer_cast<ast::Call>(expr)) {
+			uint64_t count = 1 + countNodes(node->object);
+			for (const auto& arg : node->args)
+				count += countNodes(arg);
+			return count;
+		}
+		if (auto node = std::dynamic_pointer_cast<ast::BinaryOperator>(expr))
+			return 1 + countNodes(node->left) + countNodes(node->right);
+		return expr ? 1 : 0;
+	}
+#endif // RUNTIME_STATS
+
 	std::shared_ptr<ast::Expression> parse(const std::vector<Token>& tokens, bool requireMain)
 	{
+		const std::string file = tokens.empty() ? std::string() : tokens.front().getSrc().getFile();
+		TraceSpan span(TraceCategory::Load, "parse", file);
+		PhaseScope phase(Phase::Parse);
 		pos = 0;
+		std::shared_ptr<ast::Expression> tree;
 		if (requireMain) // True by default
 		{
-			if (tokens[2].getText() == "Main") // Check for main function
-				return parseExpression(tokens);
+			if (tokens.size() > 2 and tokens[2].getText() == "Main") // Check for main function
+				tree = parseExpression(tokens);
 			else
-				return parseMain(tokens);
+				tree = parseMain(tokens);
 		}
 		else // Don't use main function. This will only accept a single statement. Used for live interpret
 		{
-			return parseExpression(tokens);
+			tree = parseExpression(tokens);
 		}
+		RUNTIME_COUNT(astNodes, countNodes(tree));
+		return tree;
 	}
 }
 
@@ -0,0 +1,259 @@
+// Runtime
+#include "perf_counters.h"
+// C++
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+// C
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace rt
+{
+	std::atomic<bool> countingPhases = false;
+
+	/// <summary>
+	/// Hardware events read for every phase, in the order of their values
+	/// </summary>
+	static constexpr std::array<uint64_t, 4> hardwareEvents = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_MISSES
+	};
+	static constexpr size_t phaseCount = 4;
+
+	struct PhaseTotals
+	{
+		std::chrono::nanoseconds wall{};
+		std::array<uint64_t, hardwareEvents.size()> events{};
+		uint64_t entries = 0;
+	};
+
+	/// <summary>
+	/// Wall time and hardware counters at one moment
+	/// </summary>
+	struct Reading
+	{
+		std::chrono::steady_clock::time_point wall;
+		std::array<uint64_t, hardwareEvents.size()> events{};
+	};
+
+	/// <summary>
+	/// Phases of one thread
+	/// </summary>
+	struct ThreadPhases
+	{
+		~ThreadPhases()
+		{
+			if (group != -1)
+				close(group);
+			for (int fd : members)
+				if (fd != -1)
+					close(fd);
+		}
+
+		/// <summary>
+		/// Leader of the counter group and the other counters, -1 without hardware counters
+		/// </summary>
+		int group = -1;
+		std::array<int, hardwareEvents.size() - 1> members{ -1, -1, -1 };
+		/// <summary>
+		/// Phases entered and not yet left, innermost last
+		/// </summary>
+		std::vector<Phase> stack;
+		/// <summary>
+		/// Counters when the innermost phase last changed
+		/// </summary>
+		Reading last;
+		/// <summary>
+		/// Only contended while the report is written
+		/// </summary>
+		std::mutex mutex;
+		std::array<PhaseTotals, phaseCount> totals;
+	};
+
+	/// <summary>
+	/// Phases of every thread which entered one, including finished threads
+	/// </summary>
+	static std::vector<std::unique_ptr<ThreadPhases>> threadPhases;
+	static std::mutex threadPhasesMutex;
+	static thread_local ThreadPhases* ownPhases = nullptr;
+	/// <summary>
+	/// Whether or not hardware counters can be opened, and why not
+	/// </summary>
+	static std::atomic<bool> hardwareCounters = false;
+	static std::string hardwareError;
+
+	[[nodiscard]] static int openCounter(uint64_t config, int group)
+	{
+		perf_event_attr attr{};
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config;
+		attr.read_format = PERF_FORMAT_GROUP;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// The calling thread, on any CPU
+		return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+	}
+
+	/// <summary>
+	/// Opens the counters of the calling thread
+	/// </summary>
+	/// <returns>0, or the errno of the counter which failed to open</returns>
+	[[nodiscard]] static int openCounters(ThreadPhases& phases)
+	{
+		phases.group = openCounter(hardwareEvents[0], -1);
+		if (phases.group == -1)
+			return errno;
+		for (size_t i = 0; i < phases.members.size(); ++i) {
+			phases.members[i] = openCounter(hardwareEvents[i + 1], phases.group);
+			if (phases.members[i] == -1) {
+				const int error = errno;
+				close(phases.group);
+				phases.group = -1;
+				for (int& fd : phases.members) {
+					if (fd != -1)
+						close(fd);
+					fd = -1;
+				}
+				return error;
+			}
+		}
+		return 0;
+	}
+
+	[[nodiscard]] static Reading read(const ThreadPhases& phases)
+	{
+		Reading reading;
+		reading.wall = std::chrono::steady_clock::now();
+		if (phases.group == -1)
+			return reading;
+		// The amount of counters, then their values
+		uint64_t values[1 + hardwareEvents.size()]{};
+		if (::read(phases.group, values, sizeof(values)) == sizeof(values))
+			std::copy(values + 1, values + 1 + hardwareEvents.size(), reading.events.begin());
+		return reading;
+	}
+
+	[[nodiscard]] static ThreadPhases& threadPhasesOf()
+	{
+		if (ownPhases == nullptr) {
+			auto phases = std::make_unique<ThreadPhases>();
+			if (hardwareCounters)
+				(void)openCounters(*phases);
+			std::lock_guard lock(threadPhasesMutex);
+			ownPhases = threadPhases.emplace_back(std::move(phases)).get();
+		}
+		return *ownPhases;
+	}
+
+	/// <summary>
+	/// Adds what happened since the innermost phase last changed to it
+	/// </summary>
+	static void switchPhase(ThreadPhases& phases)
+	{
+		const Reading now = read(phases);
+		if (not phases.stack.empty()) {
+			std::lock_guard lock(phases.mutex);
+			PhaseTotals& totals = phases.totals[size_t(phases.stack.back())];
+			totals.wall += now.wall - phases.last.wall;
+			for (size_t i = 0; i < hardwareEvents.size(); ++i)
+				totals.events[i] += now.events[i] - phases.last.events[i];
+		}
+		phases.last = now;
+	}
+
+	void PhaseScope::enter(Phase phase)
+	{
+		ThreadPhases& phases = threadPhasesOf();
+		switchPhase(phases);
+		phases.stack.push_back(phase);
+		{
+			std::lock_guard lock(phases.mutex);
+			++phases.totals[size_t(phase)].entries;
+		}
+		entered = true;
+	}
+
+	void PhaseScope::leave()
+	{
+		ThreadPhases& phases = threadPhasesOf();
+		switchPhase(phases);
+		phases.stack.pop_back();
+	}
+
+	bool startPhaseCounters()
+	{
+		{
+			std::lock_guard lock(threadPhasesMutex);
+			// Tried once, on the calling thread, so every thread either has counters or doesn't
+			[[maybe_unused]] static const bool tried = [] {
+				ThreadPhases probe;
+				const int error = openCounters(probe);
+				hardwareCounters = error == 0;
+				if (error != 0)
+					hardwareError = std::strerror(error);
+				return true;
+			}();
+		}
+		countingPhases = true;
+		return hardwareCounters;
+	}
+
+	void stopPhaseCounters()
+	{
+		countingPhases = false;
+	}
+
+	std::string phaseReport()
+	{
+		std::array<PhaseTotals, phaseCount> totals;
+		{
+			std::lock_guard lock(threadPhasesMutex);
+			for (const auto& phases : threadPhases) {
+				std::lock_guard phasesLock(phases->mutex);
+				for (size_t phase = 0; phase < phaseCount; ++phase) {
+					totals[phase].wall += phases->totals[phase].wall;
+					totals[phase].entries += phases->totals[phase].entries;
+					for (size_t i = 0; i < hardwareEvents.size(); ++i)
+						totals[phase].events[i] += phases->totals[phase].events[i];
+				}
+			}
+		}
+		const char* names[] = { "tokenize", "parse", "interpret", "ffi" };
+		std::ostringstream out;
+		out << "Phase counters";
+		if (not hardwareCounters)
+			out << " (hardware counters unavailable: " << hardwareError << ", wall time only)";
+		out << "\n" << std::right << std::fixed << std::setprecision(2)
+		    << std::setw(10) << "phase" << std::setw(12) << "wall ms" << std::setw(10) << "entries";
+		if (hardwareCounters)
+			out << std::setw(16) << "cycles" << std::setw(16) << "instructions" << std::setw(8) << "IPC"
+			    << std::setw(14) << "cache MPKI" << std::setw(14) << "branch MPKI";
+		out << "\n";
+		for (size_t phase = 0; phase < phaseCount; ++phase) {
+			const PhaseTotals& phaseTotals = totals[phase];
+			out << std::setw(10) << names[phase] << std::setw(12) << std::chrono::duration<double, std::milli>(phaseTotals.wall).count()
+			    << std::setw(10) << phaseTotals.entries;
+			if (hardwareCounters) {
+				const auto [cycles, instructions, cacheMisses, branchMisses] = phaseTotals.events;
+				// Misses per thousand instructions
+				const auto perKilo = [&](uint64_t count) { return instructions == 0 ? 0.0 : 1000.0 * count / instructions; };
+				out << std::setw(16) << cycles << std::setw(16) << instructions
+				    << std::setw(8) << (cycles == 0 ? 0.0 : double(instructions) / cycles)
+				    << std::setw(14) << perKilo(cacheMisses) << std::setw(14) << perKilo(branchMisses);
+			}
+			out << "\n";
+		}
+		return out.str();
+	}
+}
@@ -0,0 +1,67 @@
+#pragma once
+// This file defines the phase counters. While they are on, tokenizing, parsing, interpreting and native calls
+// are timed on the threads doing them, with CPU cycles, instructions, cache misses and branch misses read
+// through perf_event_open. If the kernel doesn't allow those, only wall time is measured.
+// Time in a nested phase, like a native call while interpreting, only counts for the nested phase.
+// C++
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace rt
+{
+	/// <summary>
+	/// What Runtime is doing
+	/// </summary>
+	enum class Phase : uint8_t
+	{
+		Tokenize,
+		Parse,
+		Interpret,
+		Ffi
+	};
+
+	/// <summary>
+	/// Whether or not phases are counted
+	/// </summary>
+	extern std::atomic<bool> countingPhases;
+
+	/// <summary>
+	/// Starts counting phases, with hardware counters if the kernel allows them, adding to earlier counts
+	/// </summary>
+	/// <returns>Whether or not hardware counters are available</returns>
+	bool startPhaseCounters();
+	/// <summary>
+	/// Stops counting phases, keeping the counts. Phases entered before stay counted until they are left
+	/// </summary>
+	void stopPhaseCounters();
+	/// <summary>
+	/// Returns a table of the counters of every phase, added up over every thread
+	/// </summary>
+	[[nodiscard]] std::string phaseReport();
+
+	/// <summary>
+	/// Counts the time from its creation to its destruction for a phase, if counting phases
+	/// </summary>
+	class PhaseScope
+	{
+	public:
+		explicit PhaseScope(Phase phase)
+		{
+			if (countingPhases.load(std::memory_order_relaxed)) [[unlikely]]
+				enter(phase);
+		}
+		~PhaseScope()
+		{
+			if (entered) [[unlikely]]
+				leave();
+		}
+		PhaseScope(const PhaseScope&) = delete;
+		PhaseScope& operator= (const PhaseScope&) = delete;
+	private:
+		void enter(Phase phase);
+		void leave();
+
+		bool entered = false;
+	};
+}
@@ -0,0 +1,509 @@
+// Runtime
+#include "profiler.h"
+#include "object.h"
+#include "trace.h"
+// C++
+#include <algorithm>
+#include <cerrno>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// C
+#include <signal.h>
+#include <sys/time.h>
+#include <time.h>
+
+// The signal handler reads these, and must not be the first to touch the thread local storage of its thread
+#define SIGNAL_SAFE_TLS __attribute__((tls_model("initial-exec")))
+
+namespace rt
+{
+	std::atomic<bool> profilingCalls = false;
+	static std::atomic<bool> samplingCalls = false;
+	static std::atomic<bool> timingCalls = false;
+
+	static void updateProfilingCalls()
+	{
+		profilingCalls = samplingCalls or timingCalls;
+	}
+
+	/// <summary>
+	/// Call stack of the thread, used while no fiber runs on it
+	/// </summary>
+	static thread_local CallStack threadCalls SIGNAL_SAFE_TLS;
+	/// <summary>
+	/// Call stack of the fiber running on the thread, if any
+	/// </summary>
+	static thread_local CallStack* fiberCalls SIGNAL_SAFE_TLS = nullptr;
+
+	[[nodiscard]] static CallStack& currentCalls()
+	{
+		return fiberCalls != nullptr ? *fiberCalls : threadCalls;
+	}
+
+	CallStack* exchangeCallStack(CallStack* stack)
+	{
+		return std::exchange(fiberCalls, stack);
+	}
+
+	// Call sites
+
+	struct Site
+	{
+		std::string name;
+		std::string file;
+		int line;
+		/// <summary>
+		/// Id of the called object, shared by every site calling it
+		/// </summary>
+		uint32_t object;
+	};
+
+	/// <summary>
+	/// Every call site seen while profiling, by id
+	/// </summary>
+	static std::vector<Site> sites;
+	static std::map<std::tuple<std::string, std::string, int>, uint32_t> siteIds;
+	/// <summary>
+	/// Every called object, by id
+	/// </summary>
+	static std::vector<std::pair<std::string, CallKind>> objects;
+	static std::map<std::pair<std::string, CallKind>, uint32_t> objectIds;
+	static std::mutex sitesMutex;
+
+	struct KnownSite
+	{
+		std::shared_ptr<ast::Call> call;
+		uint32_t site;
+		uint32_t object;
+	};
+
+	/// <summary>
+	/// Call sites seen by the thread. The calls are kept alive, so their addresses are never reused
+	/// </summary>
+	static thread_local std::unordered_map<const ast::Call*, KnownSite> knownSites;
+
+	[[nodiscard]] static KnownSite knownSite(const std::shared_ptr<ast::Call>& call, const std::string& name, CallKind kind)
+	{
+		std::lock_guard lock(sitesMutex);
+		auto object = objectIds.insert({ { name, kind }, static_cast<uint32_t>(objects.size()) });
+		if (object.second)
+			objects.push_back({ name, kind });
+		auto site = siteIds.insert({ { name, call->src.getFile(), call->src.getLine() }, static_cast<uint32_t>(sites.size()) });
+		if (site.second)
+			sites.push_back({ name, call->src.getFile(), call->src.getLine(), object.first->second });
+		return { call, site.first->second, sites[site.first->second].object };
+	}
+
+	// Call times
+
+	/// <summary>
+	/// Call totals of a thread, by object id
+	/// </summary>
+	struct ThreadCallTotals
+	{
+		std::mutex mutex;
+		std::vector<CallTotals> objects;
+	};
+
+	/// <summary>
+	/// Call totals of every thread which made a timed call, including finished threads
+	/// </summary>
+	static std::vector<std::shared_ptr<ThreadCallTotals>> threadTotals;
+	static std::mutex threadTotalsMutex;
+	static thread_local std::shared_ptr<ThreadCallTotals> ownTotals;
+	static std::atomic<bool> callProfilerRunning = false;
+
+	[[nodiscard]] static ThreadCallTotals& callTotals()
+	{
+		if (not ownTotals) {
+			ownTotals = std::make_shared<ThreadCallTotals>();
+			std::lock_guard lock(threadTotalsMutex);
+			threadTotals.push_back(ownTotals);
+		}
+		return *ownTotals;
+	}
+
+	[[nodiscard]] static uint64_t objectBit(uint32_t object)
+	{
+		return uint64_t(1) << (object % 64);
+	}
+
+	void ProfileFrame::enter(const std::shared_ptr<ast::Call>& call, const std::string& name, CallKind kind)
+	{
+		auto it = knownSites.find(call.get());
+		if (it == knownSites.end())
+			it = knownSites.insert({ call.get(), knownSite(call, name, kind) }).first;
+		stack = &currentCalls();
+		depth = stack->depth;
+		if (depth < maxProfiledDepth)
+			stack->sites[depth] = it->second.site;
+		// The site is in place before a sample can see it
+		std::atomic_signal_fence(std::memory_order_release);
+		stack->depth = depth + 1;
+
+		timed = timingCalls.load(std::memory_order_relaxed);
+		if (not timed)
+			return;
+		object = it->second.object;
+		parent = stack->timed;
+		outerObjects = parent != nullptr ? parent->outerObjects | objectBit(parent->object) : 0;
+		recursive = false;
+		// Only walks the calls when one of them may be to the same object
+		if (outerObjects & objectBit(object)) {
+			for (const ProfileFrame* outer = parent; outer != nullptr and not recursive; outer = outer->parent)
+				recursive = outer->object == object;
+		}
+		stack->timed = this;
+		inner = std::chrono::nanoseconds(0);
+		innerCreated = 0;
+		createdAtStart = Object::createdByThread();
+		start = std::chrono::steady_clock::now();
+	}
+
+	void ProfileFrame::leave()
+	{
+		stack->depth = depth;
+		if (not timed)
+			return;
+		const std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - start;
+		const uint64_t created = Object::createdByThread() - createdAtStart;
+		stack->timed = parent;
+		if (parent != nullptr) {
+			parent->inner += elapsed;
+			parent->innerCreated += created;
+		}
+		ThreadCallTotals& totals = callTotals();
+		std::lock_guard lock(totals.mutex);
+		if (totals.objects.size() <= object)
+			totals.objects.resize(object + 1);
+		CallTotals& entry = totals.objects[object];
+		++entry.calls;
+		if (not recursive) {
+			entry.inclusive += elapsed;
+			entry.allocations += created;
+		}
+		entry.exclusive += elapsed - inner;
+		entry.exclusiveAllocations += created - innerCreated;
+	}
+
+	// Samples
+
+	/// <summary>
+	/// Words in the sample buffer, 16 MiB
+	/// </summary>
+	static constexpr size_t sampleCapacity = size_t(1) << 22;
+	/// <summary>
+	/// Each sample is its depth followed by its call sites, outermost first
+	/// </summary>
+	static std::unique_ptr<uint32_t[]> sampleBuffer;
+	static std::atomic<size_t> sampleEnd = 0;
+	static std::atomic<size_t> sampleCount = 0;
+	static std::atomic<size_t> droppedCount = 0;
+	static std::atomic<bool> samplerRunning = false;
+
+	/// <summary>
+	/// CPU time used by the process so far
+	/// </summary>
+	[[nodiscard]] static std::chrono::nanoseconds processTime()
+	{
+		timespec time{};
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+		return std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec);
+	}
+
+	static void takeSample(int)
+	{
+		const int savedErrno = errno;
+		const CallStack& stack = currentCalls();
+		const uint32_t depth = std::min<uint32_t>(uint32_t(stack.depth), maxProfiledDepth);
+		std::atomic_signal_fence(std::memory_order_acquire);
+		// Lock free, as signals may interrupt each other on different threads
+		const size_t start = sampleEnd.fetch_add(depth + 1, std::memory_order_relaxed);
+		if (start + depth + 1 > sampleCapacity) {
+			droppedCount.fetch_add(1, std::memory_order_relaxed);
+		} else {
+			uint32_t* sample = sampleBuffer.get() + start;
+			sample[0] = depth;
+			std::copy(stack.sites, stack.sites + depth, sample + 1);
+			sampleCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		errno = savedErrno;
+	}
+
+	/// <summary>
+	/// Calls f with the call sites of every sample, outermost first
+	/// </summary>
+	template <typename F>
+	static void forEachSample(F&& f)
+	{
+		const size_t end = std::min(sampleEnd.load(), sampleCapacity);
+		for (size_t i = 0; i < end;) {
+			const uint32_t depth = sampleBuffer[i];
+			// Samples which didn't fit are only at the end
+			if (i + 1 + depth > end)
+				break;
+			f(sampleBuffer.get() + i + 1, depth);
+			i += 1 + depth;
+		}
+	}
+
+	SamplingProfiler::SamplingProfiler(std::chrono::microseconds interval)
+		: interval(interval)
+	{
+		if (samplerRunning.exchange(true))
+			throw std::logic_error("A sampling profiler is already running");
+		sampleBuffer = std::make_unique<uint32_t[]>(sampleCapacity);
+		sampleEnd = 0;
+		sampleCount = 0;
+		droppedCount = 0;
+		started = processTime();
+		struct sigaction action {};
+		action.sa_handler = takeSample;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGPROF, &action, nullptr);
+		samplingCalls = true;
+		updateProfilingCalls();
+		const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(interval);
+		itimerval timer{};
+		timer.it_interval.tv_sec = seconds.count();
+		timer.it_interval.tv_usec = (interval - seconds).count();
+		timer.it_value = timer.it_interval;
+		if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+			const int error = errno;
+			samplingCalls = false;
+			updateProfilingCalls();
+			samplerRunning = false;
+			throw std::system_error(error, std::generic_category(), "setitimer");
+		}
+		running = true;
+	}
+
+	SamplingProfiler::~SamplingProfiler()
+	{
+		stop();
+		if (samplerRunning.exchange(false))
+			sampleBuffer.reset();
+	}
+
+	void SamplingProfiler::stop()
+	{
+		if (not running)
+			return;
+		running = false;
+		itimerval timer{};
+		setitimer(ITIMER_PROF, &timer, nullptr);
+		used = processTime() - started;
+		samplingCalls = false;
+		updateProfilingCalls();
+		// A signal may still be pending, and would end the process with the default action
+		signal(SIGPROF, SIG_IGN);
+	}
+
+	size_t SamplingProfiler::samples() const
+	{
+		return sampleCount;
+	}
+
+	size_t SamplingProfiler::dropped() const
+	{
+		return droppedCount;
+	}
+
+	/// <summary>
+	/// Frame of a collapsed stack. Semicolons separate frames, so they can't appear in one
+	/// </summary>
+	[[nodiscard]] static std::string frameLabel(const Site& site)
+	{
+		std::string label = site.name;
+		if (site.line >= 0)
+			label += " (" + site.file + ":" + std::to_string(site.line) + ")";
+		std::replace(label.begin(), label.end(), ';', ',');
+		return label;
+	}
+
+	void SamplingProfiler::writeCollapsed(std::ostream& out) const
+	{
+		std::vector<std::string> labels;
+		{
+			std::lock_guard lock(sitesMutex);
+			for (const Site& site : sites)
+				labels.push_back(frameLabel(site));
+		}
+		std::map<std::string, size_t> stacks;
+		forEachSample([&](const uint32_t* samples, uint32_t depth) {
+			std::string stack = "Main";
+			for (uint32_t i = 0; i < depth; ++i)
+				stack += ";" + labels.at(samples[i]);
+			++stacks[stack];
+		});
+		for (const auto& [stack, count] : stacks)
+			out << stack << " " << count << "\n";
+	}
+
+	void SamplingProfiler::writeTop(std::ostream& out, size_t count) const
+	{
+		std::vector<std::string> names;
+		{
+			std::lock_guard lock(sitesMutex);
+			for (const Site& site : sites)
+				names.push_back(site.name);
+		}
+		// Samples by object name, in the object itself and anywhere in the stack
+		std::unordered_map<std::string, std::pair<size_t, size_t>> times;
+		size_t total = 0;
+		forEachSample([&](const uint32_t* samples, uint32_t depth) {
+			++total;
+			const std::string& self = depth > 0 ? names.at(samples[depth - 1]) : "Main";
+			++times[self].first;
+			// Recursive objects count once per sample
+			std::vector<const std::string*> seen{ &self };
+			++times[self].second;
+			for (uint32_t i = 0; i < depth; ++i) {
+				const std::string& name = names.at(samples[i]);
+				if (std::find_if(seen.begin(), seen.end(), [&](const std::string* s) { return *s == name; }) != seen.end())
+					continue;
+				seen.push_back(&name);
+				++times[name].second;
+			}
+		});
+		std::vector<std::pair<std::string, std::pair<size_t, size_t>>> sorted(times.begin(), times.end());
+		std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+			return a.second.first != b.second.first ? a.second.first > b.second.first : a.second.second > b.second.second;
+		});
+		// The timer fires on scheduler ticks, which may be longer than the interval, so samples share the CPU time used
+		const size_t divisor = std::max<size_t>(total, 1);
+		const double usedMilliseconds = std::chrono::duration<double, std::milli>(running ? processTime() - started : used).count();
+		const double milliseconds = usedMilliseconds / divisor;
+		out << std::fixed << std::setprecision(1) << "Profile: " << total << " samples over " << usedMilliseconds << "ms of CPU time";
+		if (dropped() > 0)
+			out << ", " << dropped() << " dropped";
+		out << "\n" << std::right << std::fixed << std::setprecision(1)
+		    << std::setw(10) << "self ms" << std::setw(8) << "self%"
+		    << std::setw(10) << "total ms" << std::setw(8) << "total%" << "  object\n";
+		for (size_t i = 0; i < std::min(count, sorted.size()); ++i) {
+			const auto& [name, time] = sorted[i];
+			out << std::setw(10) << time.first * milliseconds << std::setw(8) << 100.0 * time.first / divisor
+			    << std::setw(10) << time.second * milliseconds << std::setw(8) << 100.0 * time.second / divisor
+			    << "  " << name << "\n";
+		}
+	}
+
+	// Call profiler
+
+	CallProfiler::CallProfiler()
+	{
+		if (callProfilerRunning.exchange(true))
+			throw std::logic_error("A call profiler is already running");
+		{
+			std::lock_guard lock(threadTotalsMutex);
+			for (auto& totals : threadTotals) {
+				std::lock_guard totalsLock(totals->mutex);
+				totals->objects.clear();
+			}
+		}
+		timingCalls = true;
+		updateProfilingCalls();
+		running = true;
+	}
+
+	CallProfiler::~CallProfiler()
+	{
+		stop();
+		callProfilerRunning = false;
+	}
+
+	void CallProfiler::stop()
+	{
+		if (not running)
+			return;
+		running = false;
+		timingCalls = false;
+		updateProfilingCalls();
+	}
+
+	std::vector<CallTotals> CallProfiler::totals() const
+	{
+		std::vector<CallTotals> merged;
+		{
+			std::lock_guard lock(threadTotalsMutex);
+			for (auto& totals : threadTotals) {
+				std::lock_guard totalsLock(totals->mutex);
+				if (merged.size() < totals->objects.size())
+					merged.resize(totals->objects.size());
+				for (size_t i = 0; i < totals->objects.size(); ++i) {
+					const CallTotals& entry = totals->objects[i];
+					merged[i].calls += entry.calls;
+					merged[i].inclusive += entry.inclusive;
+					merged[i].exclusive += entry.exclusive;
+					merged[i].allocations += entry.allocations;
+					merged[i].exclusiveAllocations += entry.exclusiveAllocations;
+				}
+			}
+		}
+		{
+			std::lock_guard lock(sitesMutex);
+			for (size_t i = 0; i < merged.size(); ++i)
+				std::tie(merged[i].name, merged[i].kind) = objects[i];
+		}
+		std::erase_if(merged, [](const CallTotals& entry) { return entry.calls == 0; });
+		std::sort(merged.begin(), merged.end(), [](const CallTotals& a, const CallTotals& b) {
+			return a.exclusive != b.exclusive ? a.exclusive > b.exclusive : a.name < b.name;
+		});
+		return merged;
+	}
+
+	[[nodiscard]] static const char* kindName(CallKind kind)
+	{
+		switch (kind) {
+		case CallKind::BuiltIn:
+			return "builtin";
+		case CallKind::Shared:
+			return "shared";
+		default:
+			return "object";
+		}
+	}
+
+	void CallProfiler::writeTable(std::ostream& out, size_t count) const
+	{
+		const std::vector<CallTotals> sorted = totals();
+		const auto milliseconds = [](std::chrono::nanoseconds time) { return std::chrono::duration<double, std::milli>(time).count(); };
+		out << "Calls: " << sorted.size() << " objects and builtins called\n" << std::right << std::fixed << std::setprecision(3)
+		    << std::setw(10) << "calls" << std::setw(12) << "total ms" << std::setw(12) << "self ms"
+		    << std::setw(10) << "allocs" << std::setw(14) << "self allocs" << "  object\n";
+		for (size_t i = 0; i < std::min(count, sorted.size()); ++i) {
+			const CallTotals& entry = sorted[i];
+			out << std::setw(10) << entry.calls << std::setw(12) << milliseconds(entry.inclusive) << std::setw(12) << milliseconds(entry.exclusive)
+			    << std::setw(10) << entry.allocations << std::setw(14) << entry.exclusiveAllocations << "  " << entry.name;
+			if (entry.kind != CallKind::Object)
+				out << " (" << kindName(entry.kind) << ")";
+			out << "\n";
+		}
+	}
+
+	void CallProfiler::writeJson(std::ostream& out) const
+	{
+		std::vector<CallTotals> sorted = totals();
+		std::sort(sorted.begin(), sorted.end(), [](const CallTotals& a, const CallTotals& b) {
+			return std::tie(a.name, a.kind) < std::tie(b.name, b.kind);
+		});
+		out << "{\n\t\"calls\": [";
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			const CallTotals& entry = sorted[i];
+			out << (i == 0 ? "\n" : ",\n") << "\t\t{ \"name\": ";
+			writeJsonString(out, entry.name);
+			out << ", \"kind\": \"" << kindName(entry.kind) << "\", \"calls\": " << entry.calls
+			    << ", \"inclusive_ns\": " << entry.inclusive.count() << ", \"exclusive_ns\": " << entry.exclusive.count()
+			    << ", \"allocations\": " << entry.allocations << ", \"exclusive_allocations\": " << entry.exclusiveAllocations << " }";
+		}
+		out << "\n\t]\n}\n";
+	}
+}
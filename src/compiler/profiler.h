@@ -0,0 +1,214 @@
+#pragma once
+// This file defines the profilers. Calls push their call site onto a shadow stack of the thread,
+// or of the fiber, making them. The sampling profiler copies that stack into a buffer on a SIGPROF timer,
+// and the call profiler times every call as it returns.
+// While the profilers are off, calls only check whether one is on.
+// Runtime
+#include "ast.h"
+// C++
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace rt
+{
+	/// <summary>
+	/// Deepest logical stack recorded, deeper calls are counted but not sampled
+	/// </summary>
+	constexpr size_t maxProfiledDepth = 128;
+
+	class ProfileFrame;
+
+	/// <summary>
+	/// What a call calls
+	/// </summary>
+	enum class CallKind : uint8_t
+	{
+		Object,
+		BuiltIn,
+		Shared
+	};
+
+	/// <summary>
+	/// Call sites of the calls being made by a thread or a fiber, innermost last
+	/// </summary>
+	struct CallStack
+	{
+		uint32_t sites[maxProfiledDepth]{};
+		/// <summary>
+		/// Amount of calls being made, which may exceed maxProfiledDepth
+		/// </summary>
+		volatile uint32_t depth = 0;
+		/// <summary>
+		/// Innermost call being timed by the call profiler
+		/// </summary>
+		ProfileFrame* timed = nullptr;
+	};
+
+	/// <summary>
+	/// Whether or not calls are recorded on call stacks, while either profiler runs
+	/// </summary>
+	extern std::atomic<bool> profilingCalls;
+
+	/// <summary>
+	/// Replaces the call stack of the calling thread, for fibers switching in and out.
+	/// nullptr makes the thread use its own
+	/// </summary>
+	/// <returns>The previous call stack</returns>
+	CallStack* exchangeCallStack(CallStack* stack);
+
+	/// <summary>
+	/// Records a call on the call stack for as long as it exists, if profiling
+	/// </summary>
+	class ProfileFrame
+	{
+	public:
+		/// <param name="call">Call site, kept alive by the profiler once seen</param>
+		/// <param name="name">Name of the called object or builtin</param>
+		/// <param name="kind">What is called</param>
+		ProfileFrame(const std::shared_ptr<ast::Call>& call, const std::string& name, CallKind kind)
+		{
+			if (profilingCalls.load(std::memory_order_relaxed)) [[unlikely]]
+				enter(call, name, kind);
+		}
+		~ProfileFrame()
+		{
+			if (stack != nullptr) [[unlikely]]
+				leave();
+		}
+		ProfileFrame(const ProfileFrame&) = delete;
+		ProfileFrame& operator= (const ProfileFrame&) = delete;
+	private:
+		void enter(const std::shared_ptr<ast::Call>& call, const std::string& name, CallKind kind);
+		void leave();
+
+		/// <summary>
+		/// Stack the call was pushed on, as fibers may switch stacks before it returns
+		/// </summary>
+		CallStack* stack = nullptr;
+		uint32_t depth = 0;
+		// Only set when timed by the call profiler
+		bool timed;
+		/// <summary>
+		/// Whether or not the object is already being called further out, so its inclusive time is counted there
+		/// </summary>
+		bool recursive;
+		uint32_t object;
+		/// <summary>
+		/// Bit (object % 64) of every object called further out
+		/// </summary>
+		uint64_t outerObjects;
+		ProfileFrame* parent;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::nanoseconds inner;
+		uint64_t createdAtStart;
+		uint64_t innerCreated;
+	};
+
+	/// <summary>
+	/// Samples the call stacks of the process on a SIGPROF timer. Only one can run at a time
+	/// </summary>
+	class SamplingProfiler
+	{
+	public:
+		/// <summary>
+		/// Starts sampling every interval of CPU time, or every scheduler tick if that is longer. Throws std::system_error if the timer can't be set,
+		/// and std::logic_error if a profiler is already running
+		/// </summary>
+		explicit SamplingProfiler(std::chrono::microseconds interval = std::chrono::milliseconds(1));
+		/// <summary>
+		/// Stops sampling
+		/// </summary>
+		~SamplingProfiler();
+		SamplingProfiler(const SamplingProfiler&) = delete;
+		SamplingProfiler& operator= (const SamplingProfiler&) = delete;
+
+		/// <summary>
+		/// Stops sampling, keeping the samples taken so far
+		/// </summary>
+		void stop();
+		/// <summary>
+		/// Amount of samples taken, and dropped because the buffer was full
+		/// </summary>
+		[[nodiscard]] size_t samples() const;
+		[[nodiscard]] size_t dropped() const;
+		/// <summary>
+		/// Writes one line per distinct stack, as "outer;inner count", which flamegraph tools read
+		/// </summary>
+		void writeCollapsed(std::ostream& out) const;
+		/// <summary>
+		/// Writes a table of the objects with the most samples in themselves, with their total time
+		/// </summary>
+		void writeTop(std::ostream& out, size_t count) const;
+	private:
+		std::chrono::microseconds interval;
+		/// <summary>
+		/// CPU time of the process when sampling started, and used while sampling once stopped
+		/// </summary>
+		std::chrono::nanoseconds started{};
+		std::chrono::nanoseconds used{};
+		bool running = false;
+	};
+
+	/// <summary>
+	/// Totals of the calls to one object or builtin
+	/// </summary>
+	struct CallTotals
+	{
+		std::string name;
+		CallKind kind;
+		uint64_t calls = 0;
+		/// <summary>
+		/// Wall time from call to return, counted once for recursive calls, and the part of it not spent in other calls
+		/// </summary>
+		std::chrono::nanoseconds inclusive{};
+		std::chrono::nanoseconds exclusive{};
+		/// <summary>
+		/// Objects created from call to return, and the part of them not created by other calls
+		/// </summary>
+		uint64_t allocations = 0;
+		uint64_t exclusiveAllocations = 0;
+	};
+
+	/// <summary>
+	/// Counts and times every call of objects, builtins and shared library functions. Only one can run at a time
+	/// </summary>
+	class CallProfiler
+	{
+	public:
+		/// <summary>
+		/// Starts timing calls. Throws std::logic_error if a call profiler is already running
+		/// </summary>
+		CallProfiler();
+		/// <summary>
+		/// Stops timing
+		/// </summary>
+		~CallProfiler();
+		CallProfiler(const CallProfiler&) = delete;
+		CallProfiler& operator= (const CallProfiler&) = delete;
+
+		/// <summary>
+		/// Stops timing new calls. Calls already being made are still counted when they return
+		/// </summary>
+		void stop();
+		/// <summary>
+		/// Totals of every thread, by object or builtin, with the most exclusive time first
+		/// </summary>
+		[[nodiscard]] std::vector<CallTotals> totals() const;
+		/// <summary>
+		/// Writes a table of the objects and builtins with the most exclusive time
+		/// </summary>
+		void writeTable(std::ostream& out, size_t count) const;
+		/// <summary>
+		/// Writes the totals as JSON, sorted by name so profiles of different runs can be diffed
+		/// </summary>
+		void writeJson(std::ostream& out) const;
+	private:
+		bool running = false;
+	};
+}
@@ -1,22 +1,39 @@
 // Runtime
+#include "Runtime.hpp"
 #include "shared_libs.h"
 #include "interpreter.h"
 #include "exceptions.h"
 #include "Stlib/StandardFiles.h"
 #include "object.h"
 #include "symbol_table.h"
+#include "context.h"
 #include "tokenizer.h"
 #include "utils.h"
+#include "extension.h"
+#include "stats.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "ffi_stats.h"
+#include "memory_stats.h"
+#include "thread_pool.h"
 // C++
+#include <algorithm>
 #include <any>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <deque>
+#include <exception>
 #include <ffi.h>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <type_traits>
 #include <variant>
 #include <vector>
 #include <stdexcept>
+#include <thread>
 // C
 #include <dlfcn.h> // TODO: Windows?
 #include <elf.h> // WINDOWS!!
@@ -26,14 +43,6 @@
 
 namespace rt
 {
-	// Location from where callShared is being called.
-	// Having this as a global variable for this file because it's just so much simpler
-	static SourceLocation* srcLoc;
-	
-	/// <summary>
-	/// Stores all currently loaded shared libraries
-	/// </summary>
-	static std::vector<void*> libraries;
 	
 	static std::vector<std::string> getSymbols(void* library)
 	{
@@ -84,13 +93,49 @@ namespace rt
 		return r;
 	}
 
-	void loadSharedLibrary(const char* fileName, SymbolTable* symtab)
+	// Interface given to extensions. Static, since extensions may keep the pointer
+	static rt_extension_api extensionApi = {
+		.abi = RUNTIME_EXTENSION_ABI,
+		.registrar = nullptr,
+		.registerBuiltIn = [](void* registrar, const char* name, rt_builtin function) {
+			static_cast<SymbolTable*>(registrar)->insert(name, BuiltIn(function));
+		},
+		.evaluate = evaluate,
+		.callObject = callObject,
+	};
+
+	// Lets an extension register its builtins into the root of symtab
+	static void registerExtension(rt_register_extension_fn entry, SymbolTable* symtab, const char* fileName)
+	{
+		// The interface is shared by every interpreter
+		static std::mutex registering;
+		std::lock_guard lock(registering);
+		extensionApi.registrar = symtab->root();
+		const int status = entry(&extensionApi);
+		extensionApi.registrar = nullptr;
+		if (status != 0) {
+			throw InterpreterException("Extension failed to register", 0, fileName);
+		}
+	}
+
+	void loadSharedLibrary(const char* fileName, SymbolTable* symtab, bool lazy)
 	{
 		// Handle to the library
 		void* handle = nullptr;
 		handle = dlopen(fileName, RTLD_LAZY | RTLD_GLOBAL);
 		if (!handle) {
-			throw InterpreterException(dlerror(), srcLoc->getLine(), srcLoc->getFile());
+			throw InterpreterException(dlerror(), 0, fileName);
+		}
+		// Native extension
+		if (auto entry = reinterpret_cast<rt_register_extension_fn>(dlsym(handle, "rt_register_extension"))) {
+			registerExtension(entry, symtab, fileName);
+		}
+		if (lazy) {
+			// Symbols get resolved by resolveShared once they are named
+			std::lock_guard lock(symtab->interpreter().librariesMutex);
+			symtab->interpreter().libraries.push_back(Library{ .handle = handle, .lazy = true });
+			symtab->interpreter().hasLazyLibraries = true;
+			return;
 		}
 		std::vector<std::string> symbols = getSymbols(handle);
 		// Demangle names (if C++)
@@ -109,27 +154,510 @@ namespace rt
 						.initialized = false,
 						.retType = std::nullopt,
 						.argTypes = {},
+						.name = sym,
 						}));
 			// These are not yet able to be called, as they do not have
 			// their necessary argument and return types set
 			// The signature must be specified by calling Sign()
 		}
-		libraries.push_back(handle);
+		// resolveShared may be reading the libraries from a parallel call
+		std::lock_guard lock(symtab->interpreter().librariesMutex);
+		symtab->interpreter().libraries.push_back(Library{ .handle = handle, .lazy = false });
+	}
+
+	// Returns the address of a function defined by the library itself, or nullptr.
+	// dlsym also searches the dependencies of a library, which the eager loader never exposed
+	[[nodiscard]] static void* findFunction(void* handle, const char* name)
+	{
+		void* fptr = dlsym(handle, name);
+		if (fptr == nullptr)
+			return nullptr;
+		struct link_map* map = nullptr;
+		dlinfo(handle, RTLD_DI_LINKMAP, &map);
+		Dl_info info;
+		const ElfW(Sym)* sym = nullptr;
+		if (dladdr1(fptr, &info, reinterpret_cast<void**>(const_cast<ElfW(Sym)**>(&sym)), RTLD_DL_SYMENT) == 0 or sym == nullptr)
+			return nullptr;
+		if (reinterpret_cast<ElfW(Addr)>(info.dli_fbase) != map->l_addr)
+			return nullptr;
+		const auto type = ELF64_ST_TYPE(sym->st_info);
+		return (type == STT_FUNC or type == STT_GNU_IFUNC) ? fptr : nullptr;
+	}
+
+	std::shared_ptr<LibFunc> resolveShared(Interpreter& interpreter, const std::string& name)
+	{
+		if (not interpreter.hasLazyLibraries)
+			return nullptr;
+		// Demangled names of functions always have their parameters, and other symbols aren't functions
+		const bool maybeCpp = name.find('(') != std::string::npos or name.find("::") != std::string::npos;
+		std::lock_guard lock(interpreter.librariesMutex);
+		for (auto& lib : interpreter.libraries) {
+			if (not lib.lazy)
+				continue;
+			// Already looked up
+			if (auto it = lib.resolved.find(name); it != lib.resolved.end()) {
+				if (it->second != nullptr)
+					return it->second;
+				continue;
+			}
+			void* fptr = findFunction(lib.handle, name.c_str());
+			if (fptr == nullptr and maybeCpp) {
+				// Might be a demangled C++ name
+				if (not lib.demangled.has_value()) {
+					lib.demangled.emplace();
+					for (const auto& sym : getSymbols(lib.handle)) {
+						int status;
+						char* ret = abi::__cxa_demangle(sym.c_str(), 0, 0, &status);
+						if (status == 0) {
+							lib.demangled->insert({ ret, sym });
+						}
+						free(ret);
+					}
+				}
+				if (auto it = lib.demangled->find(name); it != lib.demangled->end()) {
+					fptr = findFunction(lib.handle, it->second.c_str());
+				}
+			}
+			if (fptr == nullptr) {
+				if (lib.misses < Library::maxMisses) {
+					lib.resolved.insert({ name, nullptr });
+					++lib.misses;
+				}
+				continue;
+			}
+			auto func = std::make_shared<LibFunc>(LibFunc{
+					.function = fptr,
+						.initialized = false,
+						.retType = std::nullopt,
+						.argTypes = {},
+						.name = name,
+						});
+			lib.resolved.insert({ name, func });
+			return func;
+		}
+		return nullptr;
+	}
+
+	void cleanLibraries(Interpreter& interpreter)
+	{
+		for (auto& lib : interpreter.libraries) {
+			dlclose(lib.handle);
+		}
+		interpreter.libraries.clear();
+		interpreter.hasLazyLibraries = false;
+		interpreter.closures.clear();
+	}
+
+	// Buffers
+
+	/// <summary>
+	/// Alignment of buffer memory, large enough for any vector register
+	/// </summary>
+	static constexpr size_t bufferAlignment = 64;
+
+	// Rounds a size up to a non zero multiple of bufferAlignment, as aligned_alloc requires
+	[[nodiscard]] static constexpr size_t alignedSize(size_t size)
+	{
+		size += (bufferAlignment - size % bufferAlignment) % bufferAlignment;
+		return size == 0 ? bufferAlignment : size;
+	}
+
+	Buffer::Buffer(CType elementType, size_t length)
+		: elementType(elementType)
+		, elementSize(typeMap.at(elementType)->size)
+		, length(length)
+	{
+		switch (elementType)
+		{
+		case CType::Void:
+		case CType::Cstring:
+		case CType::Struct:
+		case CType::Complexfloat:
+		case CType::Complexdouble:
+		case CType::Complexlongdouble:
+			throw InterpreterException("Unsupported buffer element type", 0, "Unknown");
+		default:
+			break;
+		}
+		// Lengths which don't fit in memory would wrap to a small allocation
+		if (length > (std::numeric_limits<size_t>::max() - bufferAlignment) / elementSize) [[unlikely]]
+			throw std::bad_alloc();
+		const size_t size = alignedSize(elementSize * length);
+		data = std::aligned_alloc(bufferAlignment, size);
+		if (data == nullptr) [[unlikely]]
+			throw std::bad_alloc();
+		std::memset(data, 0, size);
+	}
+
+	Buffer::~Buffer()
+	{
+		free(data);
+	}
+
+	double Buffer::get(size_t index) const
+	{
+		if (index >= length) [[unlikely]]
+			throw InterpreterException("Buffer index out of range", 0, "Unknown");
+		switch (elementType)
+		{
+		case CType::Uint8:
+			return static_cast<uint8_t*>(data)[index];
+		case CType::Sint8:
+			return static_cast<int8_t*>(data)[index];
+		case CType::Uint16:
+			return static_cast<uint16_t*>(data)[index];
+		case CType::Sint16:
+			return static_cast<int16_t*>(data)[index];
+		case CType::Uint32:
+			return static_cast<uint32_t*>(data)[index];
+		case CType::Sint32:
+			return static_cast<int32_t*>(data)[index];
+		case CType::Uint64:
+			return static_cast<uint64_t*>(data)[index];
+		case CType::Sint64:
+			return static_cast<int64_t*>(data)[index];
+		case CType::Float:
+			return static_cast<float*>(data)[index];
+		case CType::Double:
+			return static_cast<double*>(data)[index];
+		case CType::Uchar:
+			return static_cast<unsigned char*>(data)[index];
+		case CType::Schar:
+			return static_cast<signed char*>(data)[index];
+		case CType::Ushort:
+			return static_cast<unsigned short*>(data)[index];
+		case CType::Sshort:
+			return static_cast<short*>(data)[index];
+		case CType::Uint:
+			return static_cast<unsigned int*>(data)[index];
+		case CType::Sint:
+			return static_cast<int*>(data)[index];
+		case CType::Ulong:
+			return static_cast<unsigned long*>(data)[index];
+		case CType::Slong:
+			return static_cast<long*>(data)[index];
+		case CType::Longdouble:
+			return static_cast<long double*>(data)[index];
+		default:
+			throw InterpreterException("Unimplemented element type", 0, "Unknown");
+		}
+	}
+
+	/// <summary>
+	/// Whether a double converts to T without undefined behaviour. Integer conversions truncate the fraction
+	/// </summary>
+	template <typename T>
+	[[nodiscard]] static bool fitsIn(double value)
+	{
+		if constexpr (std::is_floating_point_v<T>) {
+			return not std::isfinite(value) or std::abs(value) <= static_cast<double>(std::numeric_limits<T>::max());
+		} else {
+			// The limits of integers are powers of two or one less, so the bounds are exact doubles
+			const double whole = std::trunc(value);
+			return whole >= static_cast<double>(std::numeric_limits<T>::min())
+				and whole < static_cast<double>(std::numeric_limits<T>::max()) + 1.0;
+		}
+	}
+
+	// Writes a value into an element of an array if it fits the element type
+	template <typename T>
+	[[nodiscard]] static bool storeElement(void* data, size_t index, double value)
+	{
+		if (not fitsIn<T>(value)) [[unlikely]]
+			return false;
+		static_cast<T*>(data)[index] = static_cast<T>(value);
+		return true;
+	}
+
+	bool Buffer::set(size_t index, double value)
+	{
+		if (index >= length) [[unlikely]]
+			throw InterpreterException("Buffer index out of range", 0, "Unknown");
+		switch (elementType)
+		{
+		case CType::Uint8:
+			return storeElement<uint8_t>(data, index, value);
+		case CType::Sint8:
+			return storeElement<int8_t>(data, index, value);
+		case CType::Uint16:
+			return storeElement<uint16_t>(data, index, value);
+		case CType::Sint16:
+			return storeElement<int16_t>(data, index, value);
+		case CType::Uint32:
+			return storeElement<uint32_t>(data, index, value);
+		case CType::Sint32:
+			return storeElement<int32_t>(data, index, value);
+		case CType::Uint64:
+			return storeElement<uint64_t>(data, index, value);
+		case CType::Sint64:
+			return storeElement<int64_t>(data, index, value);
+		case CType::Float:
+			return storeElement<float>(data, index, value);
+		case CType::Double:
+			return storeElement<double>(data, index, value);
+		case CType::Uchar:
+			return storeElement<unsigned char>(data, index, value);
+		case CType::Schar:
+			return storeElement<signed char>(data, index, value);
+		case CType::Ushort:
+			return storeElement<unsigned short>(data, index, value);
+		case CType::Sshort:
+			return storeElement<short>(data, index, value);
+		case CType::Uint:
+			return storeElement<unsigned int>(data, index, value);
+		case CType::Sint:
+			return storeElement<int>(data, index, value);
+		case CType::Ulong:
+			return storeElement<unsigned long>(data, index, value);
+		case CType::Slong:
+			return storeElement<long>(data, index, value);
+		case CType::Longdouble:
+			return storeElement<long double>(data, index, value);
+		default:
+			throw InterpreterException("Unimplemented element type", 0, "Unknown");
+		}
 	}
 
-	void cleanLibraries() 
+	std::shared_ptr<Buffer> getBuffer(const objectOrValue& arg)
 	{
-		for (auto lib : libraries) {
-			dlclose(lib);
+		if (auto obj = std::get_if<std::shared_ptr<Object>>(&arg)) {
+			if (auto buffer = std::any_cast<std::shared_ptr<Buffer>>(&(*obj)->getNative())) {
+				return *buffer;
+			}
 		}
-		libraries.clear();
+		return nullptr;
+	}
+
+	// Closures
+
+	// Symbol table and argument state of the innermost callShared, in which callbacks are run.
+	// Thread local, so they are never set on the workers running asynchronous calls
+	static thread_local SymbolTable* callbackSymtab = nullptr;
+	static thread_local ArgState* callbackArgState = nullptr;
+	// First exception thrown by a callback, rethrown once the shared function returns
+	static thread_local std::exception_ptr callbackError;
+
+	/// <summary>
+	/// Lets callbacks run while a shared function is being called, restoring the state of any outer call afterwards
+	/// </summary>
+	struct CallbackScope
+	{
+		SymbolTable* symtab;
+		ArgState* argState;
+
+		CallbackScope(SymbolTable* symtab, ArgState* argState)
+			: symtab(callbackSymtab)
+			, argState(callbackArgState)
+		{
+			callbackSymtab = symtab;
+			callbackArgState = argState;
+		}
+		~CallbackScope()
+		{
+			callbackSymtab = symtab;
+			callbackArgState = argState;
+		}
+	};
+
+	static void convertArray(CType type, void* array, double* values, size_t n, bool pack, const SourceLocation& src);
+
+	// Reads an argument passed to a closure as a Runtime value
+	[[nodiscard]] static objectOrValue fromNative(void* arg, const Type& type)
+	{
+		// Null strings and typed pointers have nothing to read, so they become empty values
+		if (type.type == CType::Cstring) {
+			const char* string = *static_cast<char**>(arg);
+			return std::string(string != nullptr ? string : "");
+		}
+		if (type.pointer) {
+			void* pointee = *static_cast<void**>(arg);
+			// Untyped pointers are passed as addresses
+			if (type.type == CType::Void)
+				return static_cast<double>(reinterpret_cast<uintptr_t>(pointee));
+			if (pointee == nullptr)
+				return 0.0;
+			// Typed ones are dereferenced, like the elements given to qsort comparators
+			arg = pointee;
+		}
+		double value;
+		convertArray(type.type, arg, &value, 1, false, SourceLocation());
+		return value;
+	}
+
+	// Writes the value returned by a closure's object as the native return value
+	static void toNative(void* ret, const Type& type, const std::variant<double, std::string>& value)
+	{
+		if (type.type == CType::Void and not type.pointer)
+			return;
+		const double v = getNumericalValue(value);
+		if (type.pointer) {
+			*static_cast<void**>(ret) = reinterpret_cast<void*>(static_cast<uintptr_t>(v));
+			return;
+		}
+		switch (type.type)
+		{
+		case CType::Float:
+			*static_cast<float*>(ret) = static_cast<float>(v);
+			break;
+		case CType::Double:
+			*static_cast<double*>(ret) = v;
+			break;
+		case CType::Longdouble:
+			*static_cast<long double*>(ret) = v;
+			break;
+		default:
+			// libffi widens integral return values to a full register
+			switch (typeMap.at(type.type)->type)
+			{
+			case FFI_TYPE_SINT8:
+			case FFI_TYPE_SINT16:
+			case FFI_TYPE_SINT32:
+			case FFI_TYPE_SINT64:
+				*static_cast<ffi_sarg*>(ret) = static_cast<ffi_sarg>(v);
+				break;
+			default:
+				*static_cast<ffi_arg*>(ret) = static_cast<ffi_arg>(v);
+				break;
+			}
+		}
+	}
+
+	// Entry point of every closure
+	static void callClosure(ffi_cif* cif, void* ret, void** args, void* data)
+	{
+		const Closure* closure = static_cast<Closure*>(data);
+		const LibFunc& func = closure->signature;
+		// Return zero if the object can not be called
+		if (cif->rtype->type != FFI_TYPE_VOID)
+			std::memset(ret, 0, std::max(cif->rtype->size, sizeof(ffi_arg)));
+		// Never called again after a callback has failed, since exceptions can not be thrown through native code
+		if (callbackError)
+			return;
+		// The interpreter is not thread safe, so objects are only called from callShared on the interpreter thread
+		if (callbackSymtab == nullptr) {
+			callbackError = std::make_exception_ptr(InterpreterException("Callback called outside of the interpreter thread", 0, "Unknown"));
+			return;
+		}
+		try {
+			auto object = closure->object.lock();
+			if (object == nullptr)
+				throw InterpreterException("Callback object no longer exists", 0, "Unknown");
+			std::vector<objectOrValue> values;
+			values.reserve(func.argTypes.size());
+			for (size_t i = 0; i < func.argTypes.size(); ++i) {
+				values.push_back(fromNative(args[i], func.argTypes.at(i)));
+			}
+			SymbolTable localSt = SymbolTable(callbackSymtab); // Going down in scope
+			toNative(ret, func.retType.value(), callObject(object, &localSt, *callbackArgState, values));
+		} catch (...) {
+			callbackError = std::current_exception();
+		}
+	}
+
+	// Whether or not closures can pass values of a type
+	[[nodiscard]] static bool closureSupports(const Type& type)
+	{
+		switch (type.type)
+		{
+		case CType::Struct:
+		case CType::Complexfloat:
+		case CType::Complexdouble:
+		case CType::Complexlongdouble:
+			return false;
+		default:
+			return true;
+		}
+	}
+
+	Closure::Closure(std::shared_ptr<Object> object, LibFunc&& func)
+		: object(object)
+		, signature(std::move(func))
+	{
+		for (const auto& t : signature.argTypes) {
+			if (not closureSupports(t) or (t.type == CType::Void and not t.pointer))
+				throw InterpreterException("Unsupported callback parameter type", 0, "Unknown");
+			paramTypes.push_back(t.get());
+		}
+		const Type& retType = signature.retType.value();
+		// Strings would have nothing to own them once the callback returns
+		if (not closureSupports(retType) or retType.type == CType::Cstring)
+			throw InterpreterException("Unsupported callback return type", 0, "Unknown");
+		if (ffi_prep_cif(&cif, FFI_DEFAULT_ABI, paramTypes.size(), retType.get(), paramTypes.data()) != FFI_OK)
+			throw InterpreterException("Unable to prepare cif for callback", 0, "Unknown");
+		closure = static_cast<ffi_closure*>(ffi_closure_alloc(sizeof(ffi_closure), &signature.function));
+		if (closure == nullptr) [[unlikely]]
+			throw std::bad_alloc();
+		if (ffi_prep_closure_loc(closure, &cif, callClosure, this, signature.function) != FFI_OK) {
+			ffi_closure_free(closure);
+			throw InterpreterException("Unable to prepare closure", 0, "Unknown");
+		}
+		signature.initialized = true;
+	}
+
+	Closure::~Closure()
+	{
+		ffi_closure_free(closure);
+	}
+
+	std::shared_ptr<Closure> getClosure(const objectOrValue& arg)
+	{
+		if (auto obj = std::get_if<std::shared_ptr<Object>>(&arg)) {
+			if (auto closure = std::any_cast<std::shared_ptr<Closure>>(&(*obj)->getNative())) {
+				return *closure;
+			}
+		}
+		return nullptr;
+	}
+
+	std::shared_ptr<Closure> findClosure(Interpreter& interpreter, const std::shared_ptr<Object>& object, const std::string& signature)
+	{
+		auto it = interpreter.closures.find({ object.get(), signature });
+		// The address may have been reused by a new object
+		if (it == interpreter.closures.end() or it->second->object.lock() != object)
+			return nullptr;
+		return it->second;
+	}
+
+	std::shared_ptr<Closure> makeClosure(Interpreter& interpreter, std::shared_ptr<Object> object, const std::string& signature, LibFunc&& func)
+	{
+		const Object* key = object.get();
+		auto closure = std::make_shared<Closure>(std::move(object), std::move(func));
+		interpreter.closures.insert_or_assign({ key, signature }, closure);
+		return closure;
+	}
+
+	/// <summary>
+	/// Stores native memory from aligned_alloc on an alt heap, freed at the end of the call
+	/// </summary>
+	static void altStoreMemory(void* memory, [[maybe_unused]] size_t bytes, std::deque<std::any>& altHeap)
+	{
+#if RUNTIME_MEMORY_STATS==1
+		trackAllocation(MemoryCategory::Ffi, static_cast<int64_t>(bytes));
+		altHeap.push_back(std::shared_ptr<void>(memory, [bytes](void* ptr) {
+			free(ptr);
+			trackRelease(MemoryCategory::Ffi, static_cast<int64_t>(bytes));
+		}));
+#else
+		altHeap.push_back(std::shared_ptr<void>(memory, [](void* ptr){free(ptr);} ));
+#endif // RUNTIME_MEMORY_STATS
+	}
+
+	/// <summary>
+	/// Copies a string to an alt heap
+	/// </summary>
+	/// <returns>The copy as a C string, valid until the end of the call</returns>
+	[[nodiscard]] static char* altStoreString(const std::string& string, std::deque<std::any>& altHeap)
+	{
+		auto copy = makeTracked<std::string>(MemoryCategory::Ffi, string);
+		altHeap.push_back(copy);
+		return copy->data();
 	}
 
 	/// <summary>
 	/// Creates a struct in a specified area of memory based on a Runtime object
 	/// </summary>
 	static void structFromObject(void* structMem, std::shared_ptr<Object> obj, const Type& type,
-				     SymbolTable* symtab, ArgState& argState, std::deque<std::any>& altHeap)
+				     SymbolTable* symtab, ArgState& argState, std::deque<std::any>& altHeap, const SourceLocation& src)
 	{
 		// Here we assume we already have all the memory we need allocated;
 		// this function does not allocate any memory, we are passed the structMem
@@ -138,6 +666,7 @@ namespace rt
 
 		// TODO: Packed support, as well as look into the libffi way of doing this
 		// Get members of arg
+		RUNTIME_COUNT_MEMBER_COPY(obj);
 		auto members = obj->getMembers();
 		MemoryExplorer expl = MemoryExplorer(structMem, type);
 		// Assign members
@@ -146,15 +675,14 @@ namespace rt
 			const auto [memory, t] = expl[i];
 			if (t.type == CType::Struct) { // Struct
 				if (not std::holds_alternative<std::shared_ptr<Object>>(members.at(i))) {
-					throw InterpreterException("Cannot create struct from value argument", srcLoc->getLine(), srcLoc->getFile());
+					throw InterpreterException("Cannot create struct from value argument", src.getLine(), src.getFile());
 				}
 				auto member = std::get<std::shared_ptr<Object>>(members.at(i));
-				structFromObject(memory, member, t, symtab, argState, altHeap);
+				structFromObject(memory, member, t, symtab, argState, altHeap, src);
 			} else {
 				const auto value = evaluate(members.at(i), symtab, argState);
 				if (auto str = std::get_if<std::string>(&value)) {
-					altHeap.push_back(*str);
-					*reinterpret_cast<char**>(memory) = std::any_cast<std::string&>(altHeap.back()).data();
+					*reinterpret_cast<char**>(memory) = altStoreString(*str, altHeap);
 				} else {
 					double val = std::get<double>(value);
 					switch (t.type)
@@ -181,7 +709,7 @@ namespace rt
 						}
 						break;
 					default:
-						throw InterpreterException("Unimplemented element type", srcLoc->getLine(), srcLoc->getFile());
+						throw InterpreterException("Unimplemented element type", src.getLine(), src.getFile());
 						break;
 					}
 				}
@@ -192,7 +720,7 @@ namespace rt
 	/// <summary>
 	/// Creates a Runtime object from a struct in memory
 	/// </summary>
-	static std::shared_ptr<Object> objectFromStruct(void* strc, const Type& type)
+	static std::shared_ptr<Object> objectFromStruct(void* strc, const Type& type, const SourceLocation& src)
 	{
 		// TODO: Packed support, as well as look into the libffi way of doing this
 		auto obj = std::make_shared<Object>();
@@ -201,7 +729,7 @@ namespace rt
 			// Loop through member types
 			const auto [memory, t] = expl[i];
 			if (t.type == CType::Struct) {
-				obj->addMember(objectFromStruct(memory, t));
+				obj->addMember(objectFromStruct(memory, t, src));
 			} else {
 				// Get value
 				std::variant<double, std::string> value;
@@ -214,7 +742,7 @@ namespace rt
 					value = static_cast<double>(*reinterpret_cast<float*>(memory));
 					break;
 				default:
-					throw InterpreterException("Unimplemented element type", srcLoc->getLine(), srcLoc->getFile());
+					throw InterpreterException("Unimplemented element type", src.getLine(), src.getFile());
 				}
 				// Add value
 				obj->addMember(value);
@@ -225,13 +753,25 @@ namespace rt
 
 	// Sets the values of a Runtime object based on pointers within a struct
 	// struct may have custom types
-	static void updateObject(void* callArg, std::shared_ptr<Object> obj, const Type& type)
+	/// <summary>
+	/// Sets the value of an object a function wrote to. Frozen objects, and objects without a value (read as zero,
+	/// for example in parallel calls), are left as they are, so the function only changed its copy
+	/// </summary>
+	static void writeBack(Object& object, objectOrValue value)
+	{
+		if (object.isFrozen() or object.size() == 0)
+			return;
+		object.setLast(std::move(value));
+	}
+
+	static void updateObject(void* callArg, std::shared_ptr<Object> obj, const Type& type, const SourceLocation& src)
 	{
 		// Loop through all the members and check if they are pointers
 		MemoryExplorer expl = MemoryExplorer(callArg, type);
 		for (int i = 0; i < type.members.size(); i++) {
 			// Loop through member types
 			const auto [memory, t] = expl[i];
+			RUNTIME_COUNT_MEMBER_COPY(obj);
 			auto member = obj->getMembers()[i];
 			// Check if pointer
 			if (t.pointer or t.type == CType::Cstring) {
@@ -239,7 +779,7 @@ namespace rt
 				if (t.type == CType::Cstring) {
 					char* str = *reinterpret_cast<char**>(memory);
 					if (auto op = std::get_if<std::shared_ptr<Object>>(&member)) {
-						(*op)->setLast(str);
+						writeBack(**op, str);
 					} else {
 						std::get<std::variant<double, std::string>>(member) = str;
 					}
@@ -257,19 +797,19 @@ namespace rt
 					val = **reinterpret_cast<float**>(memory);
 					break;
 				default:
-					throw InterpreterException("Unimplemented element type", srcLoc->getLine(), srcLoc->getFile());
+					throw InterpreterException("Unimplemented element type", src.getLine(), src.getFile());
 				}
 				// Set value
 				if (auto op = std::get_if<std::shared_ptr<Object>>(&member)) {
-					(*op)->setLast(val);
+					writeBack(**op, val);
 				} else {
 					std::get<std::variant<double, std::string>>(member) = val;
 				}
 			} else if (t.type == CType::Struct) {
 				if (not std::holds_alternative<std::shared_ptr<Object>>(member)) {
-					throw InterpreterException("Cannot create struct from value argument", srcLoc->getLine(), srcLoc->getFile());
+					throw InterpreterException("Cannot create struct from value argument", src.getLine(), src.getFile());
 				}
-				updateObject(memory, std::get<std::shared_ptr<Object>>(member), t);
+				updateObject(memory, std::get<std::shared_ptr<Object>>(member), t, src);
 			}
 			// Otherwise no need to update anything
 		}
@@ -298,66 +838,272 @@ namespace rt
 		}
 	}
 
-	[[nodiscard]] objectOrValue callShared(const std::vector<objectOrValue>& args, const LibFunc& func, SymbolTable* symtab, ArgState& argState, SourceLocation src)
+	// Converts doubles into a contiguous array of T. The range check and the conversion are separate loops
+	// free of branches, so both vectorize
+	template <typename T>
+	static void packArray(void* array, const double* values, size_t n, const SourceLocation& src)
+	{
+		bool fits = true;
+		for (size_t i = 0; i < n; ++i) {
+			fits &= fitsIn<T>(values[i]);
+		}
+		if (not fits) [[unlikely]]
+			throw InterpreterException("Value out of range", src.getLine(), src.getFile());
+		T* out = static_cast<T*>(array);
+		for (size_t i = 0; i < n; ++i) {
+			out[i] = static_cast<T>(values[i]);
+		}
+	}
+
+	// Converts a contiguous array of T back into doubles
+	template <typename T>
+	static void unpackArray(const void* array, double* values, size_t n)
+	{
+		const T* in = static_cast<const T*>(array);
+		for (size_t i = 0; i < n; ++i) {
+			values[i] = static_cast<double>(in[i]);
+		}
+	}
+
+	// Converts between doubles and an array of the given element type, in the direction specified by pack
+	static void convertArray(CType type, void* array, double* values, size_t n, bool pack, const SourceLocation& src)
+	{
+		switch (type)
+		{
+		case CType::Uint8:
+			pack ? packArray<uint8_t>(array, values, n, src) : unpackArray<uint8_t>(array, values, n);
+			break;
+		case CType::Sint8:
+			pack ? packArray<int8_t>(array, values, n, src) : unpackArray<int8_t>(array, values, n);
+			break;
+		case CType::Uint16:
+			pack ? packArray<uint16_t>(array, values, n, src) : unpackArray<uint16_t>(array, values, n);
+			break;
+		case CType::Sint16:
+			pack ? packArray<int16_t>(array, values, n, src) : unpackArray<int16_t>(array, values, n);
+			break;
+		case CType::Uint32:
+			pack ? packArray<uint32_t>(array, values, n, src) : unpackArray<uint32_t>(array, values, n);
+			break;
+		case CType::Sint32:
+			pack ? packArray<int32_t>(array, values, n, src) : unpackArray<int32_t>(array, values, n);
+			break;
+		case CType::Uint64:
+			pack ? packArray<uint64_t>(array, values, n, src) : unpackArray<uint64_t>(array, values, n);
+			break;
+		case CType::Sint64:
+			pack ? packArray<int64_t>(array, values, n, src) : unpackArray<int64_t>(array, values, n);
+			break;
+		case CType::Float:
+			pack ? packArray<float>(array, values, n, src) : unpackArray<float>(array, values, n);
+			break;
+		case CType::Double:
+			pack ? packArray<double>(array, values, n, src) : unpackArray<double>(array, values, n);
+			break;
+		case CType::Uchar:
+			pack ? packArray<unsigned char>(array, values, n, src) : unpackArray<unsigned char>(array, values, n);
+			break;
+		case CType::Schar:
+			pack ? packArray<signed char>(array, values, n, src) : unpackArray<signed char>(array, values, n);
+			break;
+		case CType::Ushort:
+			pack ? packArray<unsigned short>(array, values, n, src) : unpackArray<unsigned short>(array, values, n);
+			break;
+		case CType::Sshort:
+			pack ? packArray<short>(array, values, n, src) : unpackArray<short>(array, values, n);
+			break;
+		case CType::Uint:
+			pack ? packArray<unsigned int>(array, values, n, src) : unpackArray<unsigned int>(array, values, n);
+			break;
+		case CType::Sint:
+			pack ? packArray<int>(array, values, n, src) : unpackArray<int>(array, values, n);
+			break;
+		case CType::Ulong:
+			pack ? packArray<unsigned long>(array, values, n, src) : unpackArray<unsigned long>(array, values, n);
+			break;
+		case CType::Slong:
+			pack ? packArray<long>(array, values, n, src) : unpackArray<long>(array, values, n);
+			break;
+		case CType::Longdouble:
+			pack ? packArray<long double>(array, values, n, src) : unpackArray<long double>(array, values, n);
+			break;
+		default:
+			throw InterpreterException("Unimplemented array element type", src.getLine(), src.getFile());
+		}
+	}
+
+	/// <summary>
+	/// A shared function call, with its arguments converted to native values
+	/// </summary>
+	struct PreparedCall
+	{
+		/// <summary>
+		/// Function being called
+		/// </summary>
+		const LibFunc& func;
+		/// <summary>
+		/// Runtime arguments, which pointer values are written back to
+		/// </summary>
+		const std::vector<objectOrValue>& args;
+		/// <summary>
+		/// Location of the call
+		/// </summary>
+		SourceLocation src;
+		/// <summary>
+		/// Stores smart pointers
+		/// The pointers store values that need to be stored in this scope
+		/// but cant be smart pointers by themselves, since their amount
+		/// and type is determined at runtime.
+		/// </summary>
+		std::deque<std::any> altHeap;
+		/// <summary>
+		/// Function signature
+		/// </summary>
+		ffi_cif cif;
+		/// <summary>
+		/// A list of the types of each argument
+		/// </summary>
+		std::vector<ffi_type*> paramTypes;
+		/// <summary>
+		/// Return type
+		/// </summary>
+		ffi_type* returnType;
+		/// <summary>
+		/// Return value data
+		/// </summary>
+		std::shared_ptr<void> ret;
+		/// <summary>
+		/// The values of function arguments
+		/// </summary>
+		std::vector<std::any> arguments;
+		/// <summary>
+		/// List of generic pointers to the values used to call the function.
+		/// This will actually be passed to ffi_call
+		/// </summary>
+		std::vector<void*> call_args;
+		/// <summary>
+		/// Whether or not each argument is native memory passed as is
+		/// </summary>
+		std::vector<bool> buffered;
+		/// <summary>
+		/// Values of array arguments as seen by the function, used to find modified elements afterwards
+		/// </summary>
+		std::vector<std::pair<int, std::vector<double>>> arrays;
+#if RUNTIME_FFI_STATS==1
+		/// <summary>
+		/// Time spent in prepareCall and invokeCall, in nanoseconds
+		/// </summary>
+		uint64_t marshalNs = 0;
+		uint64_t nativeNs = 0;
+#endif // RUNTIME_FFI_STATS
+
+		PreparedCall(const LibFunc& func, const std::vector<objectOrValue>& args, SourceLocation src)
+			: func(func)
+			, args(args)
+			, src(src)
+		{
+		}
+		// call_args points into arguments, so never copy or move
+		PreparedCall(const PreparedCall&) = delete;
+		PreparedCall& operator= (const PreparedCall&) = delete;
+	};
+
+	/// <summary>
+	/// Converts the arguments of a call into native values. Runs on the interpreter thread
+	/// </summary>
+	[[nodiscard]] static std::unique_ptr<PreparedCall> prepareCall(const std::vector<objectOrValue>& args, const LibFunc& func, SymbolTable* symtab, ArgState& argState, SourceLocation src)
 	{
-		// Initialize srcLocation
-		srcLoc = &src;
+		auto call = std::make_unique<PreparedCall>(func, args, src);
 		
 		// TODO: Windows
 		if (not func.initialized)
-			throw InterpreterException("Shared function is not yet bound", srcLoc->getLine(), srcLoc->getFile());
+			throw InterpreterException("Shared function is not yet bound", src.getLine(), src.getFile());
 		
-		// Stores smart pointers
-		// The pointers store values that need to be stored in this scope
-		// but cant be smart pointers by themselves, since their amount
-		// and type is determined at runtime.
-		std::deque<std::any> altHeap;
-
-		// Function signature, created later
-		ffi_cif cif;
+		auto& altHeap = call->altHeap;
 		
 		// Number of params
 		const int narms = func.argTypes.size();
 		
-		// A list of the types of each argument
-		std::vector<ffi_type*> paramTypes;
+		auto& paramTypes = call->paramTypes;
 		paramTypes.reserve(narms);
 		for (int i = 0; i < narms; i++) {
 			paramTypes.push_back(func.argTypes.at(i).get());
 		}
 		
-		// Return type
-		ffi_type* returnType = func.retType.value().get();
+		ffi_type* returnType = call->returnType = func.retType.value().get();
 		
 		// Create CIF
-		if (ffi_prep_cif(&cif, FFI_DEFAULT_ABI, narms,
+		if (ffi_prep_cif(&call->cif, FFI_DEFAULT_ABI, narms,
 				 returnType,
 				 paramTypes.data()) != FFI_OK) {
-			throw InterpreterException("Unable to prepare cif. Likely incorrect arguments or unimplemented features.", srcLoc->getLine(), srcLoc->getFile());
+			throw InterpreterException("Unable to prepare cif. Likely incorrect arguments or unimplemented features.", src.getLine(), src.getFile());
 		}
 		
-		// Return value data
-		std::shared_ptr<void> ret;
 		if (returnType != &ffi_type_void) { // Void doesnt need memory
-			ret = std::shared_ptr<void>(std::aligned_alloc(returnType->alignment, returnType->size), [](void* ptr){free(ptr);});
+			call->ret = std::shared_ptr<void>(std::aligned_alloc(returnType->alignment, returnType->size), [](void* ptr){free(ptr);});
 		}
 		
-		// The values of function arguments
-		std::vector<std::any> arguments;
+		auto& arguments = call->arguments;
 		arguments.reserve(narms); // Reserve so pointers stay valid
 		
-		// List of generic pointers to the values used to call the function.
-		// This will actually be passed to ffi_call
-		std::vector<void*> call_args;
+		auto& call_args = call->call_args;
 		call_args.reserve(narms);
+
+		auto& buffered = call->buffered;
+		buffered.assign(narms, false);
+
+		auto& arrays = call->arrays;
 		
 		// Push the values of arguments to arguments
 		for (int i = 0; i < narms; ++i) {
 			// Cast arg to type wanted by lib
 			const Type& pType = func.argTypes.at(i);
+			if (pType.pointer) {
+				// Buffers are already in native memory, so pass them without copying
+				if (auto buffer = getBuffer(args.at(i))) {
+					if (pType.type != CType::Void and pType.type != buffer->elementType) {
+						throw InterpreterException("Buffer element type does not match parameter type", src.getLine(), src.getFile());
+					}
+					arguments.push_back(buffer->data);
+					// The script may replace the buffer while an async call still writes to it
+					altHeap.push_back(std::move(buffer));
+					buffered[i] = true;
+					continue;
+				}
+				// Callbacks are passed as their trampoline
+				if (auto closure = getClosure(args.at(i))) {
+					arguments.push_back(closure->signature.function);
+					altHeap.push_back(std::move(closure));
+					buffered[i] = true;
+					continue;
+				}
+			}
+			if (pType.array) { // Flatten object into a contiguous array
+				if (not std::holds_alternative<std::shared_ptr<Object>>(args.at(i))) {
+					throw InterpreterException("Cannot create array from value argument", src.getLine(), src.getFile());
+				}
+				RUNTIME_COUNT_MEMBER_COPY(std::get<std::shared_ptr<Object>>(args.at(i)));
+				auto members = std::get<std::shared_ptr<Object>>(args.at(i))->getMembers();
+				const size_t n = members.size();
+				std::vector<double> values;
+				values.reserve(n);
+				for (const auto& member : members) {
+					values.push_back(getNumericalValue(evaluate(member, symtab, argState)));
+				}
+				const size_t arrayBytes = alignedSize(n * typeMap.at(pType.type)->size);
+				void* array = std::aligned_alloc(bufferAlignment, arrayBytes);
+				altStoreMemory(array, arrayBytes, altHeap);
+				convertArray(pType.type, array, values.data(), n, true, src);
+				// Read back, so values are compared after the same truncation the function saw
+				convertArray(pType.type, array, values.data(), n, false, src);
+				arguments.push_back(array);
+				buffered[i] = true;
+				arrays.emplace_back(i, std::move(values));
+				continue;
+			}
 			if (pType.type == CType::Struct) { // Struct
 				if (not std::holds_alternative<std::shared_ptr<Object>>(args.at(i))) {
-					throw InterpreterException("Cannot create struct from value argument", srcLoc->getLine(), srcLoc->getFile());
+					throw InterpreterException("Cannot create struct from value argument", src.getLine(), src.getFile());
 				}
 				auto obj = std::get<std::shared_ptr<Object>>(args.at(i));
 				// Create struct
@@ -365,9 +1111,9 @@ namespace rt
 				void* structMem = std::aligned_alloc(type->alignment, type->size);
 				// Store on alt heap, so it gets deallocated at the end of the function call
 				// This SHOULD work, but not 100% confident, TODO if bored
-				altHeap.push_back(std::shared_ptr<void>(structMem, [](void* ptr){free(ptr);} ));
+				altStoreMemory(structMem, type->size, altHeap);
 				// This function actually pushes all the the necessary data to the memory buffer
-				structFromObject(structMem, obj, pType, symtab, argState, altHeap);
+				structFromObject(structMem, obj, pType, symtab, argState, altHeap, src);
 				arguments.push_back(structMem);
 			} else { // Not struct, feel free to evaluate
 				// Get value of arg
@@ -376,7 +1122,7 @@ namespace rt
 				switch (pType.type)
 				{
 				case CType::Void:
-					throw InterpreterException("Cannot have void as param type", srcLoc->getLine(), srcLoc->getFile());
+					throw InterpreterException("Cannot have void as param type", src.getLine(), src.getFile());
 				case CType::Uint8:
 					arguments.push_back(toAny<uint8_t>(value, pType.pointer, altHeap));
 					break;
@@ -436,14 +1182,13 @@ namespace rt
 					break;
 				case CType::Cstring:
 					if (pType.pointer) {
-						throw InterpreterException("Unimplemented feature", srcLoc->getLine(), srcLoc->getFile());
+						throw InterpreterException("Unimplemented feature", src.getLine(), src.getFile());
 					} else {
-						altHeap.push_back(std::get<std::string>(value));
-						arguments.push_back(std::any_cast<std::string&>(altHeap.back()).data());
+						arguments.push_back(altStoreString(std::get<std::string>(value), altHeap));
 					}
 					break;					
 				default:
-					throw InterpreterException("Unimplemented arg type", srcLoc->getLine(), srcLoc->getFile());
+					throw InterpreterException("Unimplemented arg type", src.getLine(), src.getFile());
 				}					
 			}
 		}
@@ -458,11 +1203,15 @@ namespace rt
 			// nightmare nightmare nightmare 
 			// This is quite prone to errors, errors which are likely quite hard to spot
 			const Type& pType = func.argTypes.at(i);
+			if (buffered[i]) {
+				call_args.push_back(&std::any_cast<void*&>(arguments.at(i)));
+				continue;
+			}
 			
 			switch (pType.type)
 			{
 			case CType::Void:
-				throw InterpreterException("Cannot have void as param type", srcLoc->getLine(), srcLoc->getFile());
+				throw InterpreterException("Cannot have void as param type", src.getLine(), src.getFile());
 			case CType::Uint8:
 				call_args.push_back(toVoid<uint8_t>(arguments.at(i), pType.pointer));
 				break;
@@ -522,7 +1271,7 @@ namespace rt
 				break;				
 			case CType::Cstring:
 				if (pType.pointer) {
-					throw InterpreterException("Unimplemented feature", srcLoc->getLine(), srcLoc->getFile());
+					throw InterpreterException("Unimplemented feature", src.getLine(), src.getFile());
 				} else {
 					call_args.push_back(toVoid<char>(arguments.at(i), true));
 				}
@@ -531,24 +1280,78 @@ namespace rt
 				call_args.push_back(std::any_cast<void*&>(arguments.at(i)));
 				break;
 			default:
-				throw InterpreterException("Unimplemented arg type", srcLoc->getLine(), srcLoc->getFile());
+				throw InterpreterException("Unimplemented arg type", src.getLine(), src.getFile());
 			}			
 		}
 
 		assert(call_args.size() == narms);
 		assert(arguments.size() == narms);
 		
-		// Call the function
-		ffi_call(&cif, FFI_FN(func.function), ret.get(), call_args.data());
-		
+		return call;
+	}
+
+	/// <summary>
+	/// Calls the function. Touches only native memory, so may run on any thread
+	/// </summary>
+	static void invokeCall(PreparedCall& call)
+	{
+		callbackError = nullptr;
+		ffi_call(&call.cif, FFI_FN(call.func.function), call.ret.get(), call.call_args.data());
+		// Rethrow exceptions from callbacks only now that no native frames are left
+		if (callbackError) {
+			auto error = callbackError;
+			callbackError = nullptr;
+			std::rethrow_exception(error);
+		}
+	}
+
+	/// <summary>
+	/// Writes pointer values back to the arguments and converts the return value. Runs on the interpreter thread
+	/// </summary>
+	[[nodiscard]] static objectOrValue finishCall(PreparedCall& call)
+	{
+		const SourceLocation& src = call.src;
+		const LibFunc& func = call.func;
+		const auto& args = call.args;
+		const int narms = func.argTypes.size();
+		ffi_type* returnType = call.returnType;
+		auto& ret = call.ret;
+		auto& arguments = call.arguments;
+		auto& call_args = call.call_args;
+		const auto& buffered = call.buffered;
+
+		// Write modified array elements back to their members
+		for (auto& [i, values] : call.arrays) {
+			const size_t n = values.size();
+			std::vector<double> updated(n);
+			convertArray(func.argTypes.at(i).type, std::any_cast<void*&>(arguments.at(i)), updated.data(), n, false, src);
+			auto obj = std::get<std::shared_ptr<Object>>(args.at(i));
+			// Frozen objects are never written to, so the function only changed its copy
+			if (obj->isFrozen())
+				continue;
+			for (size_t j = 0; j < n; ++j) {
+				if (updated[j] == values[j])
+					continue;
+				objectOrValue* member = obj->getMemberAt(j);
+				if (auto op = std::get_if<std::shared_ptr<Object>>(member)) {
+					writeBack(**op, updated[j]);
+				} else {
+					*member = updated[j];
+				}
+			}
+		}
+
 		// Write pointer values back to their Runtime counterparts
 		for (int i = 0; i < narms; ++i) {
 			const Type& t = func.argTypes.at(i);
+			// Buffers were written in place
+			if (buffered[i])
+				continue;
 			// Check if struct, as they may have pointer members
 			if (t.type == CType::Struct)
 			{
 				if (auto pObj = std::get_if<std::shared_ptr<Object>>(&args.at(i))) {
-					updateObject(call_args.at(i), *pObj, t);
+					updateObject(call_args.at(i), *pObj, t, src);
 				} else {
 #if RUNTIME_DEBUG==1
 					std::cout << "Value passed to struct argument! New values are not written down! Type: " << static_cast<int>(t.type) << std::endl;
@@ -561,7 +1364,7 @@ namespace rt
 				if (auto pObj = std::get_if<std::shared_ptr<Object>>(&args.at(i))) {
 					// First check if string
 					if (t.type == CType::Cstring) {
-						pObj->get()->setLast(*reinterpret_cast<char**>(call_args.at(i)));
+						writeBack(**pObj, *reinterpret_cast<char**>(call_args.at(i)));
 						continue;
 					}
 					// If not string
@@ -626,9 +1429,9 @@ namespace rt
 						val = **reinterpret_cast<long double**>(call_args.at(i));
 						break;
 					default:
-						throw InterpreterException("Unimplemented element type", srcLoc->getLine(), srcLoc->getFile());
+						throw InterpreterException("Unimplemented element type", src.getLine(), src.getFile());
 					}
-					pObj->get()->setLast(val);
+					writeBack(**pObj, val);
 				} else {
 #if RUNTIME_DEBUG==1
 					std::cout << "Value passed to pointer argument! New values are not written down! Type: " << static_cast<int>(t.type) << std::endl;
@@ -641,7 +1444,7 @@ namespace rt
 		// Return value
 		if (returnType->type == FFI_TYPE_STRUCT) {
 			// Construct Runtime object based on struct in memory
-			return objectFromStruct(ret.get(), func.retType.value());
+			return objectFromStruct(ret.get(), func.retType.value(), src);
 		} else {
 			switch (func.retType.value().type)
 			{
@@ -686,8 +1489,126 @@ namespace rt
 			case CType::Longdouble:
 				return static_cast<double>(*reinterpret_cast<long double*>(ret.get()));
 			default:
-				throw InterpreterException("Unimplemented return type", srcLoc->getLine(), srcLoc->getFile());
+				throw InterpreterException("Unimplemented return type", src.getLine(), src.getFile());
+			}
+		}
+	}
+
+#if RUNTIME_FFI_STATS==1
+	// Nanoseconds since an arbitrary point
+	[[nodiscard]] static uint64_t now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+#endif // RUNTIME_FFI_STATS
+
+	[[nodiscard]] objectOrValue callShared(const std::vector<objectOrValue>& args, const LibFunc& func, SymbolTable* symtab, ArgState& argState, SourceLocation src)
+	{
+		TraceSpan span(TraceCategory::Native, func.name);
+		PhaseScope phase(Phase::Ffi);
+#if RUNTIME_FFI_STATS==1
+		const uint64_t start = now();
+#endif // RUNTIME_FFI_STATS
+		auto call = prepareCall(args, func, symtab, argState, src);
+#if RUNTIME_FFI_STATS==1
+		const uint64_t prepared = now();
+#endif // RUNTIME_FFI_STATS
+		{
+			CallbackScope scope(symtab, &argState);
+			invokeCall(*call);
+		}
+#if RUNTIME_FFI_STATS==1
+		const uint64_t called = now();
+		auto result = finishCall(*call);
+		recordCall(func.name, prepared - start, called - prepared, now() - called);
+		return result;
+#else
+		return finishCall(*call);
+#endif // RUNTIME_FFI_STATS
+	}
+
+	// Asynchronous calls
+
+	/// <summary>
+	/// Workers running asynchronous calls. Created on first use
+	/// </summary>
+	static ThreadPool& callPool()
+	{
+		static ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()));
+		return pool;
+	}
+
+	AsyncCall::~AsyncCall()
+	{
+		// The worker may still be using the native memory
+		if (done.valid())
+			done.wait();
+	}
+
+	std::shared_ptr<AsyncCall> callSharedAsync(const std::vector<objectOrValue>& args, std::shared_ptr<LibFunc> func, SymbolTable* symtab, ArgState& argState, SourceLocation src)
+	{
+		auto async = std::make_shared<AsyncCall>();
+		// The call refers to both, so they must live as long as it does
+		async->func = std::move(func);
+		async->args = args;
+#if RUNTIME_FFI_STATS==1
+		const uint64_t start = now();
+		async->call = prepareCall(async->args, *async->func, symtab, argState, src);
+		async->call->marshalNs = now() - start;
+		async->done = callPool().submit([call = async->call.get()]{
+			const uint64_t start = now();
+			invokeCall(*call);
+			call->nativeNs = now() - start;
+		});
+#else
+		async->call = prepareCall(async->args, *async->func, symtab, argState, src);
+		async->done = callPool().submit([call = async->call.get()]{ invokeCall(*call); });
+#endif // RUNTIME_FFI_STATS
+		return async;
+	}
+
+	bool AsyncCall::ready() const
+	{
+		return result.has_value() or error != nullptr or done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}
+
+	objectOrValue AsyncCall::await()
+	{
+		if (error != nullptr)
+			std::rethrow_exception(error);
+		if (not result.has_value()) {
+			// The future can only be read once, so a failure is kept for later awaits
+			try
+			{
+				// Rethrows anything thrown on the worker
+				done.get();
+#if RUNTIME_FFI_STATS==1
+				const uint64_t start = now();
+				result = finishCall(*call);
+				recordCall(func->name, call->marshalNs, call->nativeNs, now() - start);
+#else
+				result = finishCall(*call);
+#endif // RUNTIME_FFI_STATS
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+				call.reset();
+				throw;
+			}
+			// Native memory is no longer needed
+			call.reset();
+		}
+		return result.value();
+	}
+
+	std::shared_ptr<AsyncCall> getAsyncCall(const objectOrValue& arg)
+	{
+		if (auto obj = std::get_if<std::shared_ptr<Object>>(&arg)) {
+			if (auto async = std::any_cast<std::shared_ptr<AsyncCall>>(&(*obj)->getNative())) {
+				return *async;
 			}
 		}
+		return nullptr;
 	}
 }
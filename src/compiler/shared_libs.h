@@ -15,6 +15,9 @@
 #include <cstring>
 #include <experimental/memory>
 #include <any>
+#include <exception>
+#include <future>
+#include <string>
 // C
 #include <cstdlib>
 #include <ffi.h>
@@ -24,6 +27,7 @@ namespace rt
 	// Forward declarations
 	class SymbolTable;
 	class ArgState;
+	class Interpreter;
 
 	enum class CType
 	{
@@ -58,7 +62,7 @@ namespace rt
 	static const std::unordered_map<CType, ffi_type*> typeMap = {
 		{CType::Void, &ffi_type_void},
 		{CType::Uint8, &ffi_type_uint8},
-		{CType::Sint8, &ffi_type_sint},
+		{CType::Sint8, &ffi_type_sint8},
 		{CType::Uint16, &ffi_type_uint16},
 		{CType::Sint16, &ffi_type_sint16},
 		{CType::Uint32, &ffi_type_uint32},
@@ -91,6 +95,8 @@ namespace rt
 		const CType type;
 		// Whether or not pointer
 		const bool pointer;
+		// Whether or not a contiguous array of the type (always a pointer)
+		const bool array;
 		// Members (If struct)
 		std::vector<Type> members;
 		// Libffi type: either observer pointer to existing one, or shared pointer owning struct type
@@ -109,9 +115,10 @@ namespace rt
 		}
 		
 		// Constructor without members
-		Type(CType type, bool pointer)
+		Type(CType type, bool pointer, bool array = false)
 			: type(type)
-			, pointer(pointer)
+			, pointer(pointer or array)
+			, array(array)
 		{
 
 			ffiType = makeFfiType();
@@ -121,6 +128,7 @@ namespace rt
 		Type(CType type, bool pointer, std::vector<Type>& members)
 			: type(type)
 			, pointer(pointer)
+			, array(false)
 			, members(std::move(members))
 		{
 			ffiType = makeFfiType();
@@ -133,6 +141,7 @@ namespace rt
 		Type (Type&& other)
 			: type(other.type)
 			, pointer(other.pointer)
+			, array(other.array)
 			, ffiType(other.ffiType)
 			, members(std::move(other.members))
 			, elements(std::move(other.elements)) // Not sure if move is necessary but must remain stable
@@ -192,16 +201,208 @@ namespace rt
 		/// Argument types
 		/// </summary>
 		std::deque<Type> argTypes;
+		/// <summary>
+		/// Name the function was loaded with
+		/// </summary>
+		std::string name;
 	};
 
+	/// <summary>
+	/// A loaded shared library
+	/// </summary>
+	struct Library
+	{
+		/// <summary>
+		/// Handle returned by dlopen
+		/// </summary>
+		void* handle = nullptr;
+		/// <summary>
+		/// Whether or not symbols are resolved only once they are named
+		/// </summary>
+		bool lazy = false;
+		/// <summary>
+		/// Functions resolved so far, nullptr if a name is known to be missing. At most maxMisses of those are kept
+		/// </summary>
+		std::unordered_map<std::string, std::shared_ptr<LibFunc>> resolved = {};
+		/// <summary>
+		/// Missing names in resolved. Scripts look up every new object name here, so misses stop being cached after a while
+		/// </summary>
+		size_t misses = 0;
+		static constexpr size_t maxMisses = 1024;
+		/// <summary>
+		/// Maps demangled names to mangled ones. Only built once a name which could be a C++ signature isn't found as is
+		/// </summary>
+		std::optional<std::unordered_map<std::string, std::string>> demangled = std::nullopt;
+	};
+
+	/// <summary>
+	/// Contiguous block of native memory holding elements of a single C type.
+	/// Passed to shared functions as a raw pointer, so no per element conversion is needed
+	/// </summary>
+	struct Buffer
+	{
+		/// <summary>
+		/// Start of the memory, aligned for vectorized access
+		/// </summary>
+		void* data;
+		/// <summary>
+		/// Type of every element
+		/// </summary>
+		const CType elementType;
+		/// <summary>
+		/// Size of a single element in bytes
+		/// </summary>
+		const size_t elementSize;
+		/// <summary>
+		/// Amount of elements
+		/// </summary>
+		const size_t length;
+
+		/// <summary>
+		/// Allocates a zeroed buffer of length elements. Throws std::bad_alloc if it doesn't fit in memory
+		/// </summary>
+		Buffer(CType elementType, size_t length);
+		~Buffer();
+		// Owns memory, so never copy
+		Buffer(const Buffer&) = delete;
+		Buffer& operator= (const Buffer&) = delete;
+
+		/// <summary>
+		/// Reads an element as a double
+		/// </summary>
+		[[nodiscard]] double get(size_t index) const;
+		/// <summary>
+		/// Writes a double into an element, converting it to the element type
+		/// </summary>
+		/// <returns>False, writing nothing, if the value is out of the range of the element type</returns>
+		[[nodiscard]] bool set(size_t index, double value);
+	};
+
+	/// <summary>
+	/// Returns the buffer attached to an object, or nullptr if the argument is not a buffer
+	/// </summary>
+	[[nodiscard]] std::shared_ptr<Buffer> getBuffer(const objectOrValue& arg);
+
+	/// <summary>
+	/// Runtime object exposed to native code as a C function pointer
+	/// </summary>
+	struct Closure
+	{
+		/// <summary>
+		/// Object called whenever the function pointer is. Weak, since the object owns the closure
+		/// </summary>
+		std::weak_ptr<Object> object;
+		/// <summary>
+		/// Signature of the function pointer. signature.function is the executable trampoline
+		/// </summary>
+		LibFunc signature;
+		/// <summary>
+		/// Parameter types used by cif
+		/// </summary>
+		std::vector<ffi_type*> paramTypes;
+		/// <summary>
+		/// Call interface of the trampoline
+		/// </summary>
+		ffi_cif cif;
+		/// <summary>
+		/// Writable part of the closure, owned by libffi
+		/// </summary>
+		ffi_closure* closure;
+
+		/// <summary>
+		/// Allocates and prepares the trampoline
+		/// </summary>
+		Closure(std::shared_ptr<Object> object, LibFunc&& signature);
+		~Closure();
+		// Owns the trampoline, so never copy
+		Closure(const Closure&) = delete;
+		Closure& operator= (const Closure&) = delete;
+	};
+
+	/// <summary>
+	/// Returns the closure attached to an object, or nullptr if the argument is not a closure
+	/// </summary>
+	[[nodiscard]] std::shared_ptr<Closure> getClosure(const objectOrValue& arg);
+	/// <summary>
+	/// Looks up a closure previously made for an object with the same signature
+	/// </summary>
+	/// <param name="signature">Type names of the return value and parameters, joined together</param>
+	/// <returns>The closure, or nullptr if none exists yet</returns>
+	[[nodiscard]] std::shared_ptr<Closure> findClosure(Interpreter& interpreter, const std::shared_ptr<Object>& object, const std::string& signature);
+	/// <summary>
+	/// Creates a closure and caches it under the object and signature
+	/// </summary>
+	std::shared_ptr<Closure> makeClosure(Interpreter& interpreter, std::shared_ptr<Object> object, const std::string& signature, LibFunc&& func);
+
+	// Shared function call with its arguments converted to native values
+	struct PreparedCall;
+
+	/// <summary>
+	/// Shared function call running on a worker thread
+	/// </summary>
+	struct AsyncCall
+	{
+		/// <summary>
+		/// Function being called
+		/// </summary>
+		std::shared_ptr<LibFunc> func;
+		/// <summary>
+		/// Arguments of the call, which pointer values are written back to once awaited
+		/// </summary>
+		std::vector<objectOrValue> args;
+		/// <summary>
+		/// Native state of the call, released once awaited
+		/// </summary>
+		std::unique_ptr<PreparedCall> call;
+		/// <summary>
+		/// Becomes ready once the function has returned
+		/// </summary>
+		std::future<void> done;
+		/// <summary>
+		/// Return value, set once awaited
+		/// </summary>
+		std::optional<objectOrValue> result;
+		/// <summary>
+		/// What the call or converting its results threw, rethrown by every later await
+		/// </summary>
+		std::exception_ptr error;
+
+		~AsyncCall();
+		/// <summary>
+		/// Whether or not the function has returned
+		/// </summary>
+		[[nodiscard]] bool ready() const;
+		/// <summary>
+		/// Waits for the function to return, then converts its results on the calling thread
+		/// </summary>
+		/// <returns>The return value, same as callShared</returns>
+		objectOrValue await();
+	};
+
+	/// <summary>
+	/// Converts the arguments of a call, then runs the function on a worker pool without waiting for it
+	/// </summary>
+	[[nodiscard]] std::shared_ptr<AsyncCall> callSharedAsync(const std::vector<objectOrValue>& args, std::shared_ptr<LibFunc> func, SymbolTable* symtab, ArgState& argState, SourceLocation src);
+	/// <summary>
+	/// Returns the asynchronous call attached to an object, or nullptr if the argument is not one
+	/// </summary>
+	[[nodiscard]] std::shared_ptr<AsyncCall> getAsyncCall(const objectOrValue& arg);
+
 	/// <summary>
 	/// Loads a shared library
 	/// </summary>
-	void loadSharedLibrary(const char* fileName, SymbolTable* symtab);
+	/// <param name="lazy">Whether to only record the library, resolving functions once they are named.
+	/// Otherwise every function in the library is inserted into symtab immediately</param>
+	void loadSharedLibrary(const char* fileName, SymbolTable* symtab, bool lazy = true);
+	/// <summary>
+	/// Looks up a function from the lazily loaded libraries of an interpreter. Results are cached
+	/// </summary>
+	/// <returns>The function, or nullptr if no library defines it</returns>
+	[[nodiscard]] std::shared_ptr<LibFunc> resolveShared(Interpreter& interpreter, const std::string& name);
 	/// <summary>
-	/// Unloads all shared libraries
+	/// Unloads all shared libraries of an interpreter, and frees its closures
 	/// </summary>
-	void cleanLibraries();
+	void cleanLibraries(Interpreter& interpreter);
         /// <summary>
 	/// Calls a shared library function
 	/// </summary>
@@ -0,0 +1,433 @@
+// Runtime
+#include "shared_segment.h"
+// C++
+#include <algorithm>
+#include <any>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+// C
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rt
+{
+	// Layout of a segment. Every structure starts at a multiple of 8 bytes,
+	// and structures refer to each other by their offset from the start of the segment
+
+	/// <summary>
+	/// First bytes of every segment, written last so a segment being published is never read
+	/// </summary>
+	static constexpr char segmentMagic[8] = { 'R', 'T', 'S', 'E', 'G', 'M', 'N', 'T' };
+	/// <summary>
+	/// Changes whenever the layout changes
+	/// </summary>
+	static constexpr uint32_t segmentVersion = 1;
+
+	struct SegmentHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t reserved;
+		/// <summary>
+		/// Bytes in use, at most the size of the mapping
+		/// </summary>
+		uint64_t bytes;
+		/// <summary>
+		/// Offset of the published object
+		/// </summary>
+		uint64_t root;
+	};
+
+	/// <summary>
+	/// Followed by its characters, without a terminator
+	/// </summary>
+	struct SegmentString
+	{
+		uint64_t length;
+	};
+
+	enum class SegmentKind : uint32_t
+	{
+		Number,
+		String,
+		Object,
+	};
+
+	struct SegmentEntry
+	{
+		int64_t key;
+		/// <summary>
+		/// Offset of the name of the member, 0 if it has none
+		/// </summary>
+		uint64_t name;
+		SegmentKind kind;
+		uint32_t reserved;
+		/// <summary>
+		/// Bits of the number, or offset of the string or object
+		/// </summary>
+		uint64_t value;
+	};
+
+	/// <summary>
+	/// Followed by its entries in member order, the positions of the entries sorted by key,
+	/// the amount of named entries, and the positions of the named entries sorted by name
+	/// </summary>
+	struct SegmentObject
+	{
+		uint64_t count;
+	};
+
+	[[nodiscard]] static constexpr uint64_t align(uint64_t bytes)
+	{
+		return (bytes + 7) & ~uint64_t(7);
+	}
+
+	/// <summary>
+	/// Offsets of the parts of an object with count entries
+	/// </summary>
+	struct ObjectLayout
+	{
+		explicit ObjectLayout(uint64_t offset, uint64_t count)
+			: entries(offset + sizeof(SegmentObject)),
+			keys(entries + count * sizeof(SegmentEntry)),
+			named(align(keys + count * sizeof(uint32_t))),
+			names(named + sizeof(uint64_t))
+		{}
+
+		/// <summary>
+		/// Offset after the object
+		/// </summary>
+		[[nodiscard]] uint64_t end(uint64_t namedCount) const { return align(names + namedCount * sizeof(uint32_t)); }
+
+		uint64_t entries;
+		uint64_t keys;
+		uint64_t named;
+		uint64_t names;
+	};
+
+	/// <summary>
+	/// Names of the members of an object, with their keys. Names of removed members are skipped
+	/// </summary>
+	[[nodiscard]] static std::vector<std::pair<std::string, int>> namedMembers(Object& object)
+	{
+		std::vector<std::pair<std::string, int>> names;
+		for (const auto& [name, key] : object.getStringKeys()) {
+			if (object.hasMember(key))
+				names.emplace_back(name, key);
+		}
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	/// <summary>
+	/// Serializes an object graph into the segment layout. Objects reachable in several ways are written once
+	/// </summary>
+	class SegmentWriter
+	{
+	public:
+		[[nodiscard]] std::vector<std::byte> write(Object& root)
+		{
+			reserve(sizeof(SegmentHeader));
+			const uint64_t rootOffset = node(root);
+			while (not pending.empty()) {
+				auto [object, offset] = pending.back();
+				pending.pop_back();
+				fill(*object, offset);
+			}
+			// The magic is left for whoever copies the segment into place
+			SegmentHeader& header = at<SegmentHeader>(0);
+			header.version = segmentVersion;
+			header.bytes = buffer.size();
+			header.root = rootOffset;
+			return std::move(buffer);
+		}
+	private:
+		uint64_t reserve(size_t bytes)
+		{
+			const uint64_t offset = buffer.size();
+			buffer.resize(offset + align(bytes));
+			return offset;
+		}
+
+		// References are only valid until the next reserve
+		template <typename T>
+		[[nodiscard]] T& at(uint64_t offset)
+		{
+			return *reinterpret_cast<T*>(buffer.data() + offset);
+		}
+
+		uint64_t string(const std::string& value)
+		{
+			if (auto it = strings.find(value); it != strings.end())
+				return it->second;
+			const uint64_t offset = reserve(sizeof(SegmentString) + value.size());
+			at<SegmentString>(offset).length = value.size();
+			std::memcpy(buffer.data() + offset + sizeof(SegmentString), value.data(), value.size());
+			strings.insert({ value, offset });
+			return offset;
+		}
+
+		/// <summary>
+		/// Reserves space for an object, whose entries are filled in later
+		/// </summary>
+		uint64_t node(Object& object)
+		{
+			if (auto it = nodes.find(&object); it != nodes.end())
+				return it->second;
+			if (object.getExpression() != nullptr)
+				throw std::invalid_argument("Objects holding an expression can't be published");
+			const uint64_t count = object.size();
+			const ObjectLayout layout(buffer.size(), count);
+			const uint64_t offset = reserve(layout.end(namedMembers(object).size()) - buffer.size());
+			nodes.insert({ &object, offset });
+			pending.emplace_back(&object, offset);
+			return offset;
+		}
+
+		void fill(Object& object, uint64_t offset)
+		{
+			const uint64_t count = object.size();
+			const ObjectLayout layout(offset, count);
+			at<SegmentObject>(offset).count = count;
+			std::unordered_map<int, uint32_t> positions;
+			for (uint64_t i = 0; i < count; ++i) {
+				SegmentEntry entry{};
+				entry.key = object.getKeyAt(i);
+				const objectOrValue& member = *object.getMemberAt(i);
+				if (auto child = std::get_if<std::shared_ptr<Object>>(&member)) {
+					entry.kind = SegmentKind::Object;
+					entry.value = node(**child);
+				} else if (auto number = std::get_if<double>(&std::get<std::variant<double, std::string>>(member))) {
+					entry.kind = SegmentKind::Number;
+					entry.value = std::bit_cast<uint64_t>(*number);
+				} else {
+					entry.kind = SegmentKind::String;
+					entry.value = string(std::get<std::string>(std::get<std::variant<double, std::string>>(member)));
+				}
+				at<SegmentEntry>(layout.entries + i * sizeof(SegmentEntry)) = entry;
+				positions.insert({ static_cast<int>(entry.key), static_cast<uint32_t>(i) });
+			}
+			// Entries by key, for lookups by number
+			std::vector<uint32_t> byKey(count);
+			std::iota(byKey.begin(), byKey.end(), 0);
+			std::sort(byKey.begin(), byKey.end(), [&](uint32_t a, uint32_t b) { return object.getKeyAt(a) < object.getKeyAt(b); });
+			std::memcpy(buffer.data() + layout.keys, byKey.data(), count * sizeof(uint32_t));
+			// Entries by name, for lookups by name
+			const auto names = namedMembers(object);
+			at<uint64_t>(layout.named) = names.size();
+			for (size_t i = 0; i < names.size(); ++i) {
+				const uint32_t position = positions.at(names[i].second);
+				const uint64_t name = string(names[i].first);
+				at<SegmentEntry>(layout.entries + position * sizeof(SegmentEntry)).name = name;
+				at<uint32_t>(layout.names + i * sizeof(uint32_t)) = position;
+			}
+		}
+
+		std::vector<std::byte> buffer;
+		std::unordered_map<const Object*, uint64_t> nodes;
+		std::unordered_map<std::string, uint64_t> strings;
+		/// <summary>
+		/// Objects whose space is reserved, but whose entries are not written yet
+		/// </summary>
+		std::vector<std::pair<Object*, uint64_t>> pending;
+	};
+
+	/// <summary>
+	/// Whether or not a segment name is a file path rather than a shared memory object
+	/// </summary>
+	[[nodiscard]] static bool isFile(const std::string& name)
+	{
+		return name.find('/') != std::string::npos;
+	}
+
+	[[nodiscard]] static std::string sharedMemoryName(const std::string& name)
+	{
+		if (name.empty())
+			throw std::invalid_argument("Segment name is empty");
+		return "/" + name;
+	}
+
+	const SegmentNode* getSegmentNode(const objectOrValue& arg)
+	{
+		if (auto obj = std::get_if<std::shared_ptr<Object>>(&arg)) {
+			return std::any_cast<SegmentNode>(&(*obj)->getNative());
+		}
+		return nullptr;
+	}
+
+	template <typename T>
+	const T* Segment::at(uint64_t offset, size_t count) const
+	{
+		// Offsets come from the segment, which another process wrote
+		if (offset % alignof(T) != 0 or offset > length or count > (length - offset) / sizeof(T)) [[unlikely]]
+			throw std::runtime_error("Segment is corrupt");
+		return reinterpret_cast<const T*>(base + offset);
+	}
+
+	void Segment::publish(Object& root, const std::string& name)
+	{
+		std::vector<std::byte> contents = SegmentWriter().write(root);
+		// Files are written next to their final path and renamed over it, shared memory is recreated.
+		// Either way, attached processes keep the old segment
+		const std::string path = isFile(name) ? name + "." + std::to_string(getpid()) + ".tmp" : sharedMemoryName(name);
+		int fd;
+		if (isFile(name)) {
+			fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		} else {
+			shm_unlink(path.c_str());
+			fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		}
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), "Unable to create segment " + name);
+		auto fail = [&](const char* what) {
+			const int error = errno;
+			close(fd);
+			isFile(name) ? unlink(path.c_str()) : shm_unlink(path.c_str());
+			throw std::system_error(error, std::generic_category(), what);
+		};
+		if (ftruncate(fd, contents.size()) != 0)
+			fail("Unable to size segment");
+		void* memory = mmap(nullptr, contents.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (memory == MAP_FAILED)
+			fail("Unable to map segment");
+		std::memcpy(memory, contents.data(), contents.size());
+		std::atomic_thread_fence(std::memory_order_release);
+		std::memcpy(static_cast<SegmentHeader*>(memory)->magic, segmentMagic, sizeof(segmentMagic));
+		munmap(memory, contents.size());
+		close(fd);
+		if (isFile(name) and rename(path.c_str(), name.c_str()) != 0) {
+			const int error = errno;
+			unlink(path.c_str());
+			throw std::system_error(error, std::generic_category(), "Unable to replace segment " + name);
+		}
+	}
+
+	std::shared_ptr<const Segment> Segment::attach(const std::string& name)
+	{
+		const int fd = isFile(name) ? open(name.c_str(), O_RDONLY | O_CLOEXEC) : shm_open(sharedMemoryName(name).c_str(), O_RDONLY, 0);
+		if (fd < 0)
+			throw std::system_error(errno, std::generic_category(), "Unable to open segment " + name);
+		struct stat status;
+		if (fstat(fd, &status) != 0 or static_cast<size_t>(status.st_size) < sizeof(SegmentHeader)) {
+			close(fd);
+			throw std::runtime_error("Not a segment: " + name);
+		}
+		void* memory = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		const int error = errno;
+		close(fd);
+		if (memory == MAP_FAILED)
+			throw std::system_error(error, std::generic_category(), "Unable to map segment " + name);
+		// Unmapped by the destructor from here on
+		std::shared_ptr<const Segment> segment(new Segment(static_cast<const std::byte*>(memory), status.st_size));
+		const SegmentHeader& header = *segment->at<SegmentHeader>(0);
+		if (std::memcmp(header.magic, segmentMagic, sizeof(segmentMagic)) != 0)
+			throw std::runtime_error("Not a segment: " + name);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (header.version != segmentVersion or header.bytes > segment->length)
+			throw std::runtime_error("Segment " + name + " has an unsupported layout");
+		// Checks the root fits
+		(void)segment->root().size();
+		return segment;
+	}
+
+	bool Segment::remove(const std::string& name)
+	{
+		const int result = isFile(name) ? unlink(name.c_str()) : shm_unlink(sharedMemoryName(name).c_str());
+		if (result == 0)
+			return true;
+		if (errno == ENOENT)
+			return false;
+		throw std::system_error(errno, std::generic_category(), "Unable to remove segment " + name);
+	}
+
+	Segment::~Segment()
+	{
+		munmap(const_cast<std::byte*>(base), length);
+	}
+
+	SegmentNode Segment::root() const
+	{
+		return { shared_from_this(), at<SegmentHeader>(0)->root };
+	}
+
+	/// <summary>
+	/// Reads the value of an entry, or the object it refers to
+	/// </summary>
+	[[nodiscard]] static SegmentMember readEntry(const SegmentNode& node, const SegmentEntry& entry, std::string_view string)
+	{
+		switch (entry.kind)
+		{
+		case SegmentKind::Number:
+			return std::variant<double, std::string>(std::bit_cast<double>(entry.value));
+		case SegmentKind::String:
+			return std::variant<double, std::string>(std::string(string));
+		case SegmentKind::Object:
+			return SegmentNode{ node.segment, entry.value };
+		}
+		throw std::runtime_error("Segment is corrupt");
+	}
+
+	size_t SegmentNode::size() const
+	{
+		return segment->at<SegmentObject>(offset)->count;
+	}
+
+	SegmentMember SegmentNode::memberAt(size_t index) const
+	{
+		const uint64_t count = size();
+		if (index >= count)
+			throw std::out_of_range("Segment object has no such member");
+		const SegmentEntry& entry = segment->at<SegmentEntry>(ObjectLayout(offset, count).entries, count)[index];
+		if (entry.kind != SegmentKind::String)
+			return readEntry(*this, entry, {});
+		const uint64_t length = segment->at<SegmentString>(entry.value)->length;
+		return readEntry(*this, entry, { segment->at<char>(entry.value + sizeof(SegmentString), length), length });
+	}
+
+	std::optional<SegmentMember> SegmentNode::member(const std::variant<double, std::string>& key) const
+	{
+		const uint64_t count = size();
+		const ObjectLayout layout(offset, count);
+		const SegmentEntry* entries = segment->at<SegmentEntry>(layout.entries, count);
+		auto entryAt = [&](uint32_t position) -> const SegmentEntry& {
+			if (position >= count) [[unlikely]]
+				throw std::runtime_error("Segment is corrupt");
+			return entries[position];
+		};
+		auto nameOf = [&](const SegmentEntry& entry) -> std::string_view {
+			const uint64_t length = segment->at<SegmentString>(entry.name)->length;
+			return { segment->at<char>(entry.name + sizeof(SegmentString), length), length };
+		};
+		if (auto number = std::get_if<double>(&key)) {
+			// Same conversion as Object::getMember
+			const int64_t wanted = static_cast<int>(*number);
+			const uint32_t* keys = segment->at<uint32_t>(layout.keys, count);
+			const uint32_t* it = std::lower_bound(keys, keys + count, wanted, [&](uint32_t position, int64_t value) {
+				return entryAt(position).key < value;
+			});
+			if (it == keys + count or entryAt(*it).key != wanted)
+				return std::nullopt;
+			return memberAt(*it);
+		}
+		const std::string& wanted = std::get<std::string>(key);
+		const uint64_t named = *segment->at<uint64_t>(layout.named);
+		const uint32_t* names = segment->at<uint32_t>(layout.names, named);
+		const uint32_t* it = std::lower_bound(names, names + named, wanted, [&](uint32_t position, const std::string& value) {
+			return nameOf(entryAt(position)) < value;
+		});
+		if (it == names + named or nameOf(entryAt(*it)) != wanted)
+			return std::nullopt;
+		return memberAt(*it);
+	}
+}
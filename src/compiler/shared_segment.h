@@ -0,0 +1,101 @@
+#pragma once
+// This file defines shared object segments. A frozen object graph is written once into POSIX shared memory
+// or a file, and every process which attaches maps it read-only and reads members in place.
+// The segment only refers to its own contents by offset, so it works at whichever address it is mapped.
+// Runtime
+#include "object.h"
+// C++
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <variant>
+
+namespace rt
+{
+	class Segment;
+	struct SegmentNode;
+
+	/// <summary>
+	/// Member read from a segment, either a value or an object in the same segment
+	/// </summary>
+	using SegmentMember = std::variant<std::variant<double, std::string>, SegmentNode>;
+
+	/// <summary>
+	/// Object inside an attached segment, which keeps the segment mapped
+	/// </summary>
+	struct SegmentNode
+	{
+		std::shared_ptr<const Segment> segment;
+		uint64_t offset;
+
+		/// <summary>
+		/// Amount of members
+		/// </summary>
+		[[nodiscard]] size_t size() const;
+		/// <summary>
+		/// Finds a member by number or name, in logarithmic time
+		/// </summary>
+		[[nodiscard]] std::optional<SegmentMember> member(const std::variant<double, std::string>& key) const;
+		/// <summary>
+		/// Returns the member at a position in the member list, which must be smaller than size()
+		/// </summary>
+		[[nodiscard]] SegmentMember memberAt(size_t index) const;
+	};
+
+	/// <summary>
+	/// Returns the segment object attached to an object, or nullptr if it has none
+	/// </summary>
+	[[nodiscard]] const SegmentNode* getSegmentNode(const objectOrValue& arg);
+
+	/// <summary>
+	/// A read-only mapping of a published segment. Names containing a '/' are file paths,
+	/// other names are POSIX shared memory objects
+	/// </summary>
+	class Segment : public std::enable_shared_from_this<Segment>
+	{
+	public:
+		/// <summary>
+		/// Writes a frozen object graph to a new segment, replacing any segment of the same name.
+		/// Processes attached to the old segment keep reading the old contents.
+		/// Throws std::invalid_argument if an object holds an expression, and std::system_error if the segment can't be written
+		/// </summary>
+		static void publish(Object& root, const std::string& name);
+		/// <summary>
+		/// Maps a published segment. Throws std::system_error if it can't be opened,
+		/// and std::runtime_error if it is not a segment
+		/// </summary>
+		[[nodiscard]] static std::shared_ptr<const Segment> attach(const std::string& name);
+		/// <summary>
+		/// Removes a segment name. Attached processes keep their mapping
+		/// </summary>
+		/// <returns>Whether or not the name existed</returns>
+		static bool remove(const std::string& name);
+
+		~Segment();
+		Segment(const Segment&) = delete;
+		Segment& operator= (const Segment&) = delete;
+
+		/// <summary>
+		/// The published object
+		/// </summary>
+		[[nodiscard]] SegmentNode root() const;
+		/// <summary>
+		/// Size of the mapping in bytes
+		/// </summary>
+		[[nodiscard]] size_t bytes() const { return length; }
+	private:
+		friend struct SegmentNode;
+
+		Segment(const std::byte* base, size_t length) : base(base), length(length) {}
+		/// <summary>
+		/// Returns the structure at an offset, throwing std::runtime_error if it doesn't fit in the mapping
+		/// </summary>
+		template <typename T>
+		[[nodiscard]] const T* at(uint64_t offset, size_t count = 1) const;
+
+		const std::byte* base;
+		size_t length;
+	};
+}
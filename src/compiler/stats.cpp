@@ -0,0 +1,78 @@
+// Runtime
+#include "stats.h"
+// C++
+#include <algorithm>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+	/// <summary>
+	/// Counters of every thread which counted something, including finished threads
+	/// </summary>
+	static std::vector<std::unique_ptr<InterpreterStats>> allStats;
+	static std::mutex allStatsMutex;
+	static thread_local InterpreterStats* ownStats = nullptr;
+
+	InterpreterStats& threadStats()
+	{
+		if (ownStats == nullptr) [[unlikely]] {
+			std::lock_guard lock(allStatsMutex);
+			ownStats = allStats.emplace_back(std::make_unique<InterpreterStats>()).get();
+		}
+		return *ownStats;
+	}
+
+	std::string interpreterStatsReport()
+	{
+		// Threads are expected to be done counting, as this runs at exit
+		InterpreterStats total;
+		{
+			std::lock_guard lock(allStatsMutex);
+			for (const auto& stats : allStats) {
+				total.tokens += stats->tokens;
+				total.astNodes += stats->astNodes;
+				for (size_t i = 0; i < total.interpreted.size(); ++i)
+					total.interpreted[i] += stats->interpreted[i];
+				total.lookUps += stats->lookUps;
+				total.lookUpDepth += stats->lookUpDepth;
+				total.maxLookUpDepth = std::max(total.maxLookUpDepth, stats->maxLookUpDepth);
+				total.lookUpMisses += stats->lookUpMisses;
+				total.evaluates += stats->evaluates;
+				total.softEvaluates += stats->softEvaluates;
+				total.memberCopies += stats->memberCopies;
+				total.membersCopied += stats->membersCopied;
+				for (const auto& [name, calls] : stats->builtInCalls)
+					total.builtInCalls[name] += calls;
+			}
+		}
+		const auto mean = [](uint64_t sum, uint64_t count) { return count == 0 ? 0.0 : double(sum) / count; };
+		std::ostringstream out;
+		out << std::fixed << std::setprecision(2) << std::left;
+		out << "Interpreter statistics\n";
+		out << std::setw(32) << "  tokens" << total.tokens << "\n";
+		out << std::setw(32) << "  ast nodes" << total.astNodes << "\n";
+		const char* kinds[] = { "identifier", "literal", "call", "binary operator" };
+		for (size_t i = 0; i < total.interpreted.size(); ++i)
+			out << std::setw(32) << std::string("  interpreted ") + kinds[i] << total.interpreted[i] << "\n";
+		out << std::setw(32) << "  lookUp calls" << total.lookUps << "\n";
+		out << std::setw(32) << "  lookUp parent depth" << "mean " << mean(total.lookUpDepth, total.lookUps) << ", max " << total.maxLookUpDepth << "\n";
+		out << std::setw(32) << "  lookUp misses" << total.lookUpMisses << "\n";
+		out << std::setw(32) << "  evaluate calls" << total.evaluates << "\n";
+		out << std::setw(32) << "  softEvaluate calls" << total.softEvaluates << "\n";
+		out << std::setw(32) << "  getMembers copies" << total.memberCopies << " (" << total.membersCopied << " members)\n";
+		// Most called first
+		std::vector<std::pair<std::string, uint64_t>> builtIns(total.builtInCalls.begin(), total.builtInCalls.end());
+		std::sort(builtIns.begin(), builtIns.end(), [](const auto& a, const auto& b) {
+			return a.second != b.second ? a.second > b.second : a.first < b.first;
+		});
+		out << "  builtin calls\n";
+		for (const auto& [name, calls] : builtIns)
+			out << "    " << std::setw(28) << name << calls << "\n";
+		return out.str();
+	}
+}
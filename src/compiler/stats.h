@@ -0,0 +1,79 @@
+#pragma once
+// Counters of the work done by the interpreter, printed by --stats. Only counted when built with RUNTIME_STATS,
+// otherwise the counting macros expand to nothing
+// Runtime
+#include "Runtime.hpp"
+// C++
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace rt
+{
+	/// <summary>
+	/// Ast node kinds, as counted by interpret_internal
+	/// </summary>
+	enum class NodeKind : uint8_t
+	{
+		Identifier,
+		Literal,
+		Call,
+		BinaryOperator
+	};
+
+	/// <summary>
+	/// Counters of one thread
+	/// </summary>
+	struct InterpreterStats
+	{
+		uint64_t tokens = 0;
+		uint64_t astNodes = 0;
+		/// <summary>
+		/// interpret_internal calls by NodeKind
+		/// </summary>
+		std::array<uint64_t, 4> interpreted{};
+		uint64_t lookUps = 0;
+		/// <summary>
+		/// Parent symbol tables searched by lookUp, summed and deepest
+		/// </summary>
+		uint64_t lookUpDepth = 0;
+		uint64_t maxLookUpDepth = 0;
+		/// <summary>
+		/// Objects lookUp created for names it couldn't find
+		/// </summary>
+		uint64_t lookUpMisses = 0;
+		uint64_t evaluates = 0;
+		uint64_t softEvaluates = 0;
+		/// <summary>
+		/// getMembers calls, and the members they copied
+		/// </summary>
+		uint64_t memberCopies = 0;
+		uint64_t membersCopied = 0;
+		std::unordered_map<std::string, uint64_t> builtInCalls;
+	};
+
+	/// <summary>
+	/// Counters of the calling thread, created on first use and kept until exit
+	/// </summary>
+	[[nodiscard]] InterpreterStats& threadStats();
+	/// <summary>
+	/// Returns the counters of every thread added up, as a table
+	/// </summary>
+	[[nodiscard]] std::string interpreterStatsReport();
+}
+
+#if RUNTIME_STATS==1
+// Adds to a counter of the calling thread
+#define RUNTIME_COUNT(counter, amount) (::rt::threadStats().counter += (amount))
+// Raises a counter of the calling thread to a value, if it is lower
+#define RUNTIME_COUNT_MAX(counter, value) do { auto& c = ::rt::threadStats().counter; c = std::max<uint64_t>(c, (value)); } while (false)
+// Counts a getMembers call, which copies every member of the object
+#define RUNTIME_COUNT_MEMBER_COPY(object) do { auto& s = ::rt::threadStats(); ++s.memberCopies; s.membersCopied += (object)->size(); } while (false)
+#else
+#define RUNTIME_COUNT(counter, amount) ((void)0)
+#define RUNTIME_COUNT_MAX(counter, value) ((void)0)
+#define RUNTIME_COUNT_MEMBER_COPY(object) ((void)0)
+#endif // RUNTIME_STATS
@@ -4,6 +4,7 @@
 #include "symbol_table.h"
 #include "object.h"
 #include "exceptions.h"
+#include "stats.h"
 #include "Stlib/StandardLibrary.h"
 #include "Stlib/StandardMath.h"
 #include "Stlib/StandardIO.h"
@@ -39,14 +40,19 @@ namespace rt
 	// Symbol table
 	Symbol& SymbolTable::lookUp(std::string key, ArgState& args)
 	{
+		RUNTIME_COUNT(lookUps, 1);
 		// Check if key exists
 		std::unordered_map<std::string, Symbol>::iterator it = locals.find(key);
 		if (it != locals.end()) // Exists
 			return it->second;
 
 		auto p = parent;
+		[[maybe_unused]] uint64_t depth = 0;
 		while (p != nullptr) // Look for key in parent symbol table
 		{
+			++depth;
+			RUNTIME_COUNT(lookUpDepth, 1);
+			RUNTIME_COUNT_MAX(maxLookUpDepth, depth);
 			// Check if key exists
 			std::unordered_map<std::string, Symbol>::iterator it = p->locals.find(key);
 			if (it != p->locals.end()) // Exists
@@ -55,7 +61,16 @@ namespace rt
 				p = p->parent;
 		}
 
+		// Function from a lazily loaded shared library
+		if (auto func = resolveShared(interpreter(), key)) {
+			// Other threads may be reading the global scope
+			if (ParallelScope::current() != nullptr)
+				return locals.insert({ key, func }).first->second;
+			return root()->locals.insert({ key, func }).first->second;
+		}
+
 		// Cannot find, create symbol
+		RUNTIME_COUNT(lookUpMisses, 1);
 #if RUNTIME_DEBUG==1
 		std::cout << "Empty object initialized" << std::endl;
 #endif // RUNTIME_DEBUG
@@ -95,10 +110,25 @@ namespace rt
 			else
 				p = p->parent;
 		}
+		// Function from a lazily loaded shared library
+		if (auto func = resolveShared(interpreter(), key)) {
+			// Other threads may be reading the global scope
+			if (ParallelScope::current() != nullptr)
+				return locals.insert({ key, func }).first->second;
+			return root()->locals.insert({ key, func }).first->second;
+		}
 		// Cannot find, throw
 		throw InterpreterException("Unable to find symbol", 0, "Unknown");
 	}
 
+	SymbolTable* SymbolTable::root()
+	{
+		SymbolTable* p = this;
+		while (p->parent != nullptr)
+			p = p->parent;
+		return p;
+	}
+
 	bool SymbolTable::contains(std::string& key) const
 	{
 		// Check if key exists
@@ -132,6 +162,16 @@ namespace rt
 		locals.insert({key, object});
 	}
 
+	void SymbolTable::insert(const std::string& key, BuiltIn function)
+	{
+		locals.insert_or_assign(key, std::move(function));
+	}
+
+	void SymbolTable::erase(const std::string& key)
+	{
+		locals.erase(key);
+	}
+
 	void SymbolTable::clear()
 	{
 		locals.clear();
@@ -157,9 +197,9 @@ namespace rt
 		return keys;
 	}
 
-	void clearSymtab(SymbolTable& symtab)
+	void clearSymtab(Interpreter& interpreter)
 	{
-		symtab = SymbolTable({
+		interpreter.globalSymtab = SymbolTable(&interpreter, {
 			{"Return", Return },
 			{"Print", Print },
 			{"Input", Input },
@@ -175,6 +215,24 @@ namespace rt
 			{"While", While},
 			{"Format", Format},
 			{"Bind", Bind},
+			{"Callback", Callback},
+			{"CallAsync", CallAsync},
+			{"Ready", Ready},
+			{"Await", Await},
+			{"FfiStats", FfiStats},
+			{"HeapDump", HeapDump},
+			{"MemoryStats", MemoryStats},
+			{"BufferCreate", BufferCreate},
+			{"BufferGet", BufferGet},
+			{"BufferSet", BufferSet},
+			{"ParallelMap", ParallelMap},
+			{"ParallelFor", ParallelFor},
+			{"ParallelReduce", ParallelReduce},
+			{"Spawn", Spawn},
+			{"Yield", Yield},
+			{"ChannelCreate", ChannelCreate},
+			{"Send", Send},
+			{"Receive", Receive},
 			{"System", System},
 			{"GetKeys", GetKeys},
 			{"Size", Size},
@@ -183,6 +241,7 @@ namespace rt
 			{"Or", Or},
 			{"Name", Name},
 			{"Set", Set},
+			{"Freeze", Freeze},
 			{"Evaluate", Evaluate},
 			// Math
 			{"+", Add},
@@ -216,6 +275,22 @@ namespace rt
 			{"FileWrite", FileWrite},
 			{"FileAppendLine", FileAppendLine},
 			{"FileRead", FileRead},
+			{"StreamOpen", StreamOpen},
+			{"SocketConnect", SocketConnect},
+			{"StreamRead", StreamRead},
+			{"StreamWrite", StreamWrite},
+			{"StreamClose", StreamClose},
+			{"Timer", Timer},
+			{"OnComplete", OnComplete},
+			{"RunEvents", RunEvents},
+			{"SegmentPublish", SegmentPublish},
+			{"SegmentAttach", SegmentAttach},
+			{"SegmentGet", SegmentGet},
+			{"SegmentSize", SegmentSize},
+			{"SegmentRemove", SegmentRemove},
 		});
+		// Builtins registered by the embedding program
+		for (const auto& [name, function] : interpreter.hostBuiltIns)
+			interpreter.globalSymtab.insert(name, function);
 	}
 }
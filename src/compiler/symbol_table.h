@@ -13,6 +13,7 @@
 namespace rt
 {
 	class ArgState;
+	class Interpreter;
 };
 
 namespace rt {
@@ -27,6 +28,10 @@ namespace rt {
 		/// Stores higher level variables
 		/// </summary>
 		SymbolTable* parent;
+		/// <summary>
+		/// Interpreter the symbol table belongs to, shared by all of its children
+		/// </summary>
+		Interpreter* context;
 	public:
 		/// <summary>
 		/// Default constructor
@@ -34,13 +39,15 @@ namespace rt {
 		SymbolTable()
 		{
 			parent = nullptr;
+			context = nullptr;
 		}
 		/// <summary>
 		/// Initialized symbol constructor
 		/// </summary>
-		SymbolTable(const std::unordered_map<std::string, Symbol> locals)
+		SymbolTable(Interpreter* interpreter, const std::unordered_map<std::string, Symbol> locals)
 		{
 			parent = nullptr;
+			context = interpreter;
 			this->locals = std::unordered_map<std::string, Symbol>(locals); // TODO what the fuck maaan
 		}
 		/// <summary>
@@ -50,8 +57,22 @@ namespace rt {
 		SymbolTable(SymbolTable* parent)
 		{
 			this->parent = parent;
+			context = parent->context;
 		}
 
+		/// <summary>
+		/// Returns the interpreter the symbol table belongs to
+		/// </summary>
+		Interpreter& interpreter() const { return *context; }
+		/// <summary>
+		/// Returns the symbol table one scope up, or nullptr for the global scope
+		/// </summary>
+		SymbolTable* getParent() const { return parent; }
+		/// <summary>
+		/// Returns the symbols of the local scope
+		/// </summary>
+		const std::unordered_map<std::string, Symbol>& getLocals() const { return locals; }
+
 		/// <summary>
 		/// Looks up a key from the symbol table and its parents
 		/// </summary>
@@ -73,6 +94,14 @@ namespace rt {
 		void updateSymbol(const std::string& key, const std::shared_ptr<rt::Object> object);
 		// Moves a new value into the symbol table
 		void insert(const std::string& key, std::shared_ptr<LibFunc> object);
+		// Adds a builtin function to the symbol table
+		void insert(const std::string& key, BuiltIn function);
+		// Removes a symbol from the local scope
+		void erase(const std::string& key);
+		/// <summary>
+		/// Returns the topmost symbol table, which has no parent
+		/// </summary>
+		SymbolTable* root();
 		/// <summary>
 		/// Clears the symbol table
 		/// </summary>
@@ -91,13 +120,8 @@ namespace rt {
 		std::vector<std::string> getKeys();
 	};
 
-	/// <summary>
-	/// Root symbol table of the program
-	/// </summary>
-	static SymbolTable globalSymtab;
-
-	// Clears a symbol table and fills it with all of the standard library functions.
-	void clearSymtab(SymbolTable& symtab);
+	// Clears the global symbol table of an interpreter and fills it with all of the standard library functions.
+	void clearSymtab(Interpreter& interpreter);
 
 	/// <summary>
 	/// Current state of arguments in the interpreter.
@@ -136,6 +160,14 @@ namespace rt {
 			pos = 0;
 			parent = nullptr;
 		};
+		/// <summary>
+		/// Empty constructor
+		/// </summary>
+		ArgState()
+		{
+			pos = 0;
+			parent = nullptr;
+		};
 
 		/// <summary>
 		/// Returns a pointer to an argument, or nullptr if none exist.
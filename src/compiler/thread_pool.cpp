@@ -0,0 +1,211 @@
+// Runtime
+#include "thread_pool.h"
+// C++
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+namespace rt
+{
+	ThreadPool::ThreadPool(size_t threads)
+	{
+		workers.reserve(threads);
+		for (size_t i = 0; i < threads; ++i) {
+			workers.emplace_back(&ThreadPool::work, this);
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		available.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	std::future<void> ThreadPool::submit(std::function<void()> task)
+	{
+		std::packaged_task<void()> packaged(std::move(task));
+		auto future = packaged.get_future();
+		{
+			std::lock_guard lock(mutex);
+			tasks.push(std::move(packaged));
+		}
+		available.notify_one();
+		return future;
+	}
+
+	void ThreadPool::work()
+	{
+		while (true) {
+			std::packaged_task<void()> task;
+			{
+				std::unique_lock lock(mutex);
+				available.wait(lock, [this]{ return stopping or not tasks.empty(); });
+				// Queued tasks are still run when stopping
+				if (tasks.empty())
+					return;
+				task = std::move(tasks.front());
+				tasks.pop();
+			}
+			task();
+		}
+	}
+
+	// Work stealing pool
+
+	/// <summary>
+	/// Pool and index of the worker running on this thread, if any
+	/// </summary>
+	static thread_local const WorkStealingPool* workerPool = nullptr;
+	static thread_local size_t workerIndex = 0;
+
+	WorkStealingPool::WorkStealingPool(size_t threads)
+	{
+		for (size_t i = 0; i <= threads; ++i) {
+			queues.push_back(std::make_unique<Queue>());
+		}
+		workers.reserve(threads);
+		for (size_t i = 0; i < threads; ++i) {
+			workers.emplace_back(&WorkStealingPool::work, this, i);
+		}
+	}
+
+	WorkStealingPool::~WorkStealingPool()
+	{
+		{
+			std::lock_guard lock(sleepMutex);
+			stopping = true;
+		}
+		available.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	size_t WorkStealingPool::ownIndex() const
+	{
+		return workerPool == this ? workerIndex : queues.size() - 1;
+	}
+
+	void WorkStealingPool::push(size_t index, Range range)
+	{
+		{
+			std::lock_guard lock(queues[index]->mutex);
+			queues[index]->ranges.push_back(range);
+		}
+		queued.fetch_add(1);
+		// Taking the lock orders this with a worker checking queued before sleeping
+		{
+			std::lock_guard lock(sleepMutex);
+		}
+		available.notify_one();
+	}
+
+	bool WorkStealingPool::take(size_t index, Range& range)
+	{
+		// Newest range of our own, it is the most likely to be in cache
+		{
+			Queue& own = *queues[index];
+			std::lock_guard lock(own.mutex);
+			if (not own.ranges.empty()) {
+				range = own.ranges.back();
+				own.ranges.pop_back();
+				queued.fetch_sub(1);
+				return true;
+			}
+		}
+		// Oldest range of another queue, which is the largest one
+		for (size_t i = 1; i < queues.size(); ++i) {
+			Queue& victim = *queues[(index + i) % queues.size()];
+			std::lock_guard lock(victim.mutex);
+			if (not victim.ranges.empty()) {
+				range = victim.ranges.front();
+				victim.ranges.pop_front();
+				queued.fetch_sub(1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void WorkStealingPool::run(size_t index, Range range)
+	{
+		Loop& loop = *range.loop;
+		// Leave the upper halves for thieves
+		while (range.end - range.begin > loop.grain) {
+			const size_t middle = range.begin + (range.end - range.begin) / 2;
+			push(index, Range{ &loop, middle, range.end });
+			range.end = middle;
+		}
+		for (size_t i = range.begin; i < range.end and not loop.failed; ++i) {
+			try {
+				(*loop.body)(i);
+			} catch (...) {
+				std::lock_guard lock(loop.mutex);
+				if (not loop.error)
+					loop.error = std::current_exception();
+				loop.failed = true;
+			}
+		}
+		// The loop may be destroyed as soon as the lock is released
+		std::lock_guard lock(loop.mutex);
+		loop.remaining -= range.end - range.begin;
+		if (loop.remaining == 0)
+			loop.finished.notify_all();
+	}
+
+	void WorkStealingPool::parallelFor(size_t count, const std::function<void(size_t)>& body)
+	{
+		if (count == 0)
+			return;
+		Loop loop;
+		loop.body = &body;
+		// A few ranges per thread, so thieves can even out uneven work
+		loop.grain = std::max<size_t>(1, count / ((workers.size() + 1) * 8));
+		loop.remaining = count;
+		const size_t index = ownIndex();
+		run(index, Range{ &loop, 0, count });
+		// Help until every range has finished
+		Range range;
+		while (loop.remaining != 0) {
+			if (take(index, range)) {
+				run(index, range);
+				continue;
+			}
+			std::unique_lock lock(loop.mutex);
+			// Wake up now and then, thieves may have split off more work
+			loop.finished.wait_for(lock, std::chrono::microseconds(100), [&loop]{ return loop.remaining == 0; });
+		}
+		std::lock_guard lock(loop.mutex);
+		if (loop.error)
+			std::rethrow_exception(loop.error);
+	}
+
+	void WorkStealingPool::work(size_t index)
+	{
+		workerPool = this;
+		workerIndex = index;
+		Range range;
+		while (true) {
+			if (take(index, range)) {
+				run(index, range);
+				continue;
+			}
+			std::unique_lock lock(sleepMutex);
+			available.wait(lock, [this]{ return stopping or queued != 0; });
+			if (stopping)
+				return;
+		}
+	}
+
+	WorkStealingPool& parallelPool()
+	{
+		static WorkStealingPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+		return pool;
+	}
+}
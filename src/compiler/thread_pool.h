@@ -0,0 +1,163 @@
+#pragma once
+// C++
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace rt
+{
+	/// <summary>
+	/// Fixed amount of worker threads running submitted tasks in order
+	/// </summary>
+	class ThreadPool
+	{
+	public:
+		/// <summary>
+		/// Starts the worker threads
+		/// </summary>
+		explicit ThreadPool(size_t threads);
+		/// <summary>
+		/// Finishes all queued tasks, then joins the workers
+		/// </summary>
+		~ThreadPool();
+		// Owns threads, so never copy
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator= (const ThreadPool&) = delete;
+
+		/// <summary>
+		/// Queues a task to be run on a worker
+		/// </summary>
+		/// <returns>Future which becomes ready once the task has run, holding any exception it threw</returns>
+		std::future<void> submit(std::function<void()> task);
+		/// <summary>
+		/// Amount of worker threads
+		/// </summary>
+		[[nodiscard]] size_t size() const { return workers.size(); }
+	private:
+		/// <summary>
+		/// Runs tasks until stopped
+		/// </summary>
+		void work();
+
+		std::vector<std::thread> workers;
+		std::queue<std::packaged_task<void()>> tasks;
+		std::mutex mutex;
+		std::condition_variable available;
+		bool stopping = false;
+	};
+
+	/// <summary>
+	/// Worker threads which split loops into ranges, each worker taking ranges from its own deque
+	/// and stealing from the others once it runs out. The thread waiting for a loop helps run it
+	/// </summary>
+	class WorkStealingPool
+	{
+	public:
+		/// <summary>
+		/// Starts the worker threads
+		/// </summary>
+		explicit WorkStealingPool(size_t threads);
+		/// <summary>
+		/// Joins the workers. Loops must have finished
+		/// </summary>
+		~WorkStealingPool();
+		// Owns threads, so never copy
+		WorkStealingPool(const WorkStealingPool&) = delete;
+		WorkStealingPool& operator= (const WorkStealingPool&) = delete;
+
+		/// <summary>
+		/// Calls body for every index in [0, count) across the workers, returning once all calls have finished.
+		/// Can be called from inside body. If calls throw, the rest are skipped and the first exception is rethrown
+		/// </summary>
+		void parallelFor(size_t count, const std::function<void(size_t)>& body);
+		/// <summary>
+		/// Amount of worker threads, not counting threads waiting for loops
+		/// </summary>
+		[[nodiscard]] size_t size() const { return workers.size(); }
+	private:
+		/// <summary>
+		/// A single call of parallelFor
+		/// </summary>
+		struct Loop
+		{
+			const std::function<void(size_t)>* body;
+			/// <summary>
+			/// Ranges are split until they are at most this long
+			/// </summary>
+			size_t grain;
+			/// <summary>
+			/// Indices not yet run, parallelFor returns once this reaches 0
+			/// </summary>
+			std::atomic<size_t> remaining;
+			std::atomic<bool> failed = false;
+			std::exception_ptr error;
+			/// <summary>
+			/// Guards error, and remaining reaching 0
+			/// </summary>
+			std::mutex mutex;
+			std::condition_variable finished;
+		};
+		/// <summary>
+		/// Indices [begin, end) of a loop
+		/// </summary>
+		struct Range
+		{
+			Loop* loop;
+			size_t begin;
+			size_t end;
+		};
+		/// <summary>
+		/// Ranges of a single worker. The owner works from the back, thieves take from the front
+		/// </summary>
+		struct Queue
+		{
+			std::deque<Range> ranges;
+			std::mutex mutex;
+		};
+
+		/// <summary>
+		/// Runs ranges until stopped
+		/// </summary>
+		void work(size_t index);
+		/// <summary>
+		/// Takes a range from queue index, or steals one from another queue. Returns false if there was none
+		/// </summary>
+		bool take(size_t index, Range& range);
+		/// <summary>
+		/// Splits a range into queue index until it is small enough, then runs it
+		/// </summary>
+		void run(size_t index, Range range);
+		void push(size_t index, Range range);
+		/// <summary>
+		/// Queue of the current thread: its own for workers, the shared one for others
+		/// </summary>
+		[[nodiscard]] size_t ownIndex() const;
+
+		std::vector<std::thread> workers;
+		/// <summary>
+		/// One per worker, followed by the queue shared by all other threads
+		/// </summary>
+		std::vector<std::unique_ptr<Queue>> queues;
+		/// <summary>
+		/// Amount of queued ranges, workers sleep while this is 0
+		/// </summary>
+		std::atomic<size_t> queued = 0;
+		std::mutex sleepMutex;
+		std::condition_variable available;
+		bool stopping = false;
+	};
+
+	/// <summary>
+	/// Pool used by the parallel builtins, one worker per core besides the calling thread
+	/// </summary>
+	WorkStealingPool& parallelPool();
+}
@@ -1,5 +1,8 @@
 #include "tokenizer.h"
 #include "exceptions.h"
+#include "stats.h"
+#include "trace.h"
+#include "perf_counters.h"
 // C++
 #include <vector>
 #include <string>
@@ -17,6 +20,8 @@ namespace rt
 	// Tokenizer
 	std::vector<Token> tokenize(const char* src, const char* srcFile)
 	{
+		TraceSpan span(TraceCategory::Load, "tokenize", srcFile);
+		PhaseScope phase(Phase::Tokenize);
 		int line = 1;
 		std::vector<Token> tokens;
 
@@ -119,6 +124,7 @@ namespace rt
 			if (not match)
 				advance();
 		}
+		RUNTIME_COUNT(tokens, tokens.size());
 		// Return result
 		return tokens;
 	}
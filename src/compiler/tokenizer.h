@@ -1,4 +1,5 @@
 #pragma once
+#include "memory_stats.h"
 #include <vector>
 #include <string>
 
@@ -65,7 +66,7 @@ namespace rt
 		/// <summary>
 		/// Default constructor
 		/// </summary>
-		Token(const std::string text, const TokenType type, const SourceLocation location) : text(text), type(type), src(location) {};
+		Token(const std::string text, const TokenType type, const SourceLocation location) : text(text), type(type), src(location), memoryTag(src) {};
 		/// <summary>
 		/// Constructor without specified source code location, the src member will default to line: -1 file: "\0"
 		/// </summary>
@@ -116,6 +117,7 @@ namespace rt
 		/// Location of the token within the source code
 		/// </summary>
 		const SourceLocation src;
+		[[no_unique_address]] MemoryTag<MemoryCategory::Tokens, Token> memoryTag;
 	};
 
 	/// <summary>
@@ -0,0 +1,180 @@
+// Runtime
+#include "trace.h"
+// C++
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+// C
+#include <unistd.h>
+
+namespace rt
+{
+	std::atomic<bool> tracing = false;
+
+	struct TraceEvent
+	{
+		TraceCategory category;
+		std::string name;
+		std::string detail;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::nanoseconds duration;
+	};
+
+	/// <summary>
+	/// Spans recorded by one thread
+	/// </summary>
+	struct ThreadTrace
+	{
+		/// <summary>
+		/// Only contended while the trace is written
+		/// </summary>
+		std::mutex mutex;
+		std::vector<TraceEvent> events;
+		uint32_t id;
+	};
+
+	/// <summary>
+	/// Spans of every thread which recorded one, including finished threads
+	/// </summary>
+	static std::vector<std::unique_ptr<ThreadTrace>> threadTraces;
+	static std::mutex threadTracesMutex;
+	static thread_local ThreadTrace* ownTrace = nullptr;
+
+	static std::chrono::steady_clock::time_point traceStart;
+	/// <summary>
+	/// Shortest object call recorded, negative to record none
+	/// </summary>
+	static std::atomic<int64_t> objectThresholdNs = -1;
+	static std::optional<std::string> tracePath;
+
+	[[nodiscard]] static ThreadTrace& threadTrace()
+	{
+		if (ownTrace == nullptr) {
+			std::lock_guard lock(threadTracesMutex);
+			ownTrace = threadTraces.emplace_back(std::make_unique<ThreadTrace>()).get();
+			ownTrace->id = static_cast<uint32_t>(threadTraces.size());
+		}
+		return *ownTrace;
+	}
+
+	void startTrace(std::optional<std::string> path, std::optional<std::chrono::nanoseconds> objectThreshold)
+	{
+		{
+			std::lock_guard lock(threadTracesMutex);
+			for (auto& trace : threadTraces) {
+				std::lock_guard traceLock(trace->mutex);
+				trace->events.clear();
+			}
+			tracePath = std::move(path);
+		}
+		traceStart = std::chrono::steady_clock::now();
+		objectThresholdNs = objectThreshold ? objectThreshold->count() : -1;
+		// Written at exit, including when the script calls Exit
+		[[maybe_unused]] static const bool writeAtExit = [] {
+			std::atexit([] {
+				stopTrace();
+				std::optional<std::string> path;
+				{
+					std::lock_guard lock(threadTracesMutex);
+					path = tracePath;
+				}
+				if (not path)
+					return;
+				std::ofstream out(*path);
+				if (out)
+					writeTrace(out);
+				else
+					std::cerr << "Unable to write trace to " << *path << std::endl;
+			});
+			return true;
+		}();
+		tracing = true;
+	}
+
+	void stopTrace()
+	{
+		tracing = false;
+	}
+
+	void TraceSpan::begin()
+	{
+		if (category == TraceCategory::Object and objectThresholdNs.load(std::memory_order_relaxed) < 0)
+			return;
+		started = true;
+		start = std::chrono::steady_clock::now();
+	}
+
+	void TraceSpan::end()
+	{
+		const std::chrono::nanoseconds duration = std::chrono::steady_clock::now() - start;
+		// Most object calls are too short to be worth showing
+		if (category == TraceCategory::Object and duration.count() < objectThresholdNs.load(std::memory_order_relaxed))
+			return;
+		ThreadTrace& trace = threadTrace();
+		std::lock_guard lock(trace.mutex);
+		trace.events.push_back({ category, std::string(name), std::string(detail), start, duration });
+	}
+
+	[[nodiscard]] static const char* categoryName(TraceCategory category)
+	{
+		switch (category) {
+		case TraceCategory::Load:
+			return "load";
+		case TraceCategory::Include:
+			return "include";
+		case TraceCategory::Main:
+			return "main";
+		case TraceCategory::Native:
+			return "native";
+		default:
+			return "object";
+		}
+	}
+
+	void writeJsonString(std::ostream& out, std::string_view string)
+	{
+		out << '"';
+		for (const char c : string) {
+			if (c == '"' or c == '\\')
+				out << '\\' << c;
+			else if (static_cast<unsigned char>(c) < 0x20)
+				out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << int(c) << std::dec << std::setfill(' ');
+			else
+				out << c;
+		}
+		out << '"';
+	}
+
+	void writeTrace(std::ostream& out)
+	{
+		// Microseconds since the trace started, as trace-event timestamps are
+		const auto microseconds = [](std::chrono::nanoseconds time) { return std::chrono::duration<double, std::micro>(time).count(); };
+		const int pid = getpid();
+		std::lock_guard lock(threadTracesMutex);
+		out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+		for (const auto& trace : threadTraces) {
+			std::lock_guard traceLock(trace->mutex);
+			out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << trace->id
+			    << ",\"args\":{\"name\":\"Runtime thread " << trace->id << "\"}}";
+			first = false;
+			for (const TraceEvent& event : trace->events) {
+				out << ",\n{\"name\":";
+				writeJsonString(out, event.name);
+				out << ",\"cat\":\"" << categoryName(event.category) << "\",\"ph\":\"X\",\"ts\":" << microseconds(event.start - traceStart)
+				    << ",\"dur\":" << microseconds(event.duration) << ",\"pid\":" << pid << ",\"tid\":" << trace->id;
+				if (not event.detail.empty()) {
+					out << ",\"args\":{\"detail\":";
+					writeJsonString(out, event.detail);
+					out << "}";
+				}
+				out << "}";
+			}
+		}
+		out << "\n]}\n";
+	}
+}
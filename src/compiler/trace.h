@@ -0,0 +1,83 @@
+#pragma once
+// This file defines the trace recorder, which writes Chrome trace-event JSON for timeline viewers
+// such as chrome://tracing and Perfetto. Spans are buffered by the thread recording them and written
+// out once, normally at exit. While tracing is off, a span only checks whether it is on.
+// C++
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace rt
+{
+	/// <summary>
+	/// What a span covers, written as its category
+	/// </summary>
+	enum class TraceCategory : uint8_t
+	{
+		Load,
+		Include,
+		Main,
+		Native,
+		Object
+	};
+
+	/// <summary>
+	/// Whether or not spans are recorded
+	/// </summary>
+	extern std::atomic<bool> tracing;
+
+	/// <summary>
+	/// Starts recording spans, clearing earlier ones
+	/// </summary>
+	/// <param name="path">File the trace is written to at exit, none to only write it with writeTrace</param>
+	/// <param name="objectThreshold">Shortest callObject call recorded, none to record no object calls</param>
+	void startTrace(std::optional<std::string> path, std::optional<std::chrono::nanoseconds> objectThreshold);
+	/// <summary>
+	/// Stops recording spans, keeping the ones recorded
+	/// </summary>
+	void stopTrace();
+	/// <summary>
+	/// Writes every recorded span as trace-event JSON
+	/// </summary>
+	void writeTrace(std::ostream& out);
+	/// <summary>
+	/// Writes a string as a JSON string literal
+	/// </summary>
+	void writeJsonString(std::ostream& out, std::string_view string);
+
+	/// <summary>
+	/// Records the time from its creation to its destruction as a span, if tracing
+	/// </summary>
+	class TraceSpan
+	{
+	public:
+		/// <param name="name">Name of the span, which must outlive it</param>
+		/// <param name="detail">Shown with the span, for example a file name. Must outlive it</param>
+		TraceSpan(TraceCategory category, std::string_view name, std::string_view detail = {})
+			: category(category), name(name), detail(detail)
+		{
+			if (tracing.load(std::memory_order_relaxed)) [[unlikely]]
+				begin();
+		}
+		~TraceSpan()
+		{
+			if (started) [[unlikely]]
+				end();
+		}
+		TraceSpan(const TraceSpan&) = delete;
+		TraceSpan& operator= (const TraceSpan&) = delete;
+	private:
+		void begin();
+		void end();
+
+		TraceCategory category;
+		std::string_view name;
+		std::string_view detail;
+		bool started = false;
+		std::chrono::steady_clock::time_point start;
+	};
+}
@@ -0,0 +1,262 @@
+// Runtime
+#include "Runtime.hpp"
+#include "libruntime.h"
+#include "compiler/tokenizer.h"
+#include "compiler/parser.h"
+#include "compiler/interpreter.h"
+#include "compiler/context.h"
+#include "compiler/exceptions.h"
+#include "compiler/trace.h"
+#include "compiler/Stlib/StandardFiles.h"
+// C++
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <variant>
+#include <vector>
+
+struct rt_interpreter
+{
+	rt::Interpreter interpreter;
+	/// <summary>
+	/// Last error
+	/// </summary>
+	std::string errorMessage;
+	std::string errorLocation;
+	int exitCode = 0;
+};
+
+struct rt_value
+{
+	objectOrValue value;
+	/// <summary>
+	/// Storage for rt_to_string
+	/// </summary>
+	mutable std::string text;
+};
+
+/// <summary>
+/// Runs function, converting exceptions into an error status stored in the interpreter
+/// </summary>
+template <typename F>
+static rt_status guarded(rt_interpreter* interpreter, F&& function)
+{
+	interpreter->errorMessage.clear();
+	interpreter->errorLocation.clear();
+	try
+	{
+		function();
+		return RT_OK;
+	}
+	catch (const ExitException& e)
+	{
+		interpreter->exitCode = e.getCode();
+		return RT_EXIT;
+	}
+	catch (const TokenizerException& e)
+	{
+		interpreter->errorMessage = e.what();
+		interpreter->errorLocation = e.where();
+		return RT_TOKENIZER_ERROR;
+	}
+	catch (const ParserException& e)
+	{
+		interpreter->errorMessage = e.what();
+		interpreter->errorLocation = e.where();
+		return RT_PARSER_ERROR;
+	}
+	catch (const InterpreterException& e)
+	{
+		interpreter->errorMessage = e.what();
+		interpreter->errorLocation = e.where();
+		return RT_INTERPRETER_ERROR;
+	}
+	catch (const std::exception& e)
+	{
+		interpreter->errorMessage = e.what();
+		return RT_ERROR;
+	}
+}
+
+/// <summary>
+/// Moves a value into a new rt_value, owned by the caller
+/// </summary>
+[[nodiscard]] static rt_value* makeValue(objectOrValue value)
+{
+	return new rt_value{ std::move(value), std::string() };
+}
+
+extern "C"
+{
+	// Interpreters
+
+	const char* rt_version(void)
+	{
+		return RUNTIME_VERSION;
+	}
+
+	rt_interpreter* rt_create(void)
+	{
+		auto interpreter = new rt_interpreter();
+		// Same as the live interpreter, so rt_eval works before anything is loaded
+		interpreter->interpreter.memberInitialization = true;
+		return interpreter;
+	}
+
+	void rt_destroy(rt_interpreter* interpreter)
+	{
+		delete interpreter;
+	}
+
+	void rt_set_arguments(rt_interpreter* interpreter, int argc, char** argv)
+	{
+		interpreter->interpreter.setArguments(argc, argv);
+	}
+
+	rt_status rt_load_source(rt_interpreter* interpreter, const char* source, const char* name)
+	{
+		return guarded(interpreter, [&] {
+			interpreter->interpreter.run(rt::parse(rt::tokenize(source, name), true));
+		});
+	}
+
+	rt_status rt_load_file(rt_interpreter* interpreter, const char* path)
+	{
+		std::string fileText;
+		{
+			rt::TraceSpan span(rt::TraceCategory::Load, "read", path);
+			std::ifstream file;
+			// Open file
+			file.open(path, std::fstream::in);
+			if (file.fail())
+			{
+				interpreter->errorMessage = std::string("Unable to open file ") + path;
+				interpreter->errorLocation.clear();
+				return RT_ERROR;
+			}
+			file.seekg(0, std::ios::end);
+			size_t size = file.tellg();
+			fileText.assign(size, ' ');
+			file.seekg(0);
+			file.read(&fileText[0], size);
+			file.close();
+		}
+		return rt_load_source(interpreter, fileText.c_str(), path);
+	}
+
+	rt_status rt_eval(rt_interpreter* interpreter, const char* source, rt_value** result)
+	{
+		return guarded(interpreter, [&] {
+			objectOrValue value = interpreter->interpreter.live(rt::parse(rt::tokenize(source, "live-input"), false));
+			if (result)
+				*result = makeValue(std::move(value));
+		});
+	}
+
+	rt_status rt_call(rt_interpreter* interpreter, const char* name, rt_value* const* args, size_t argc, rt_value** result)
+	{
+		return guarded(interpreter, [&] {
+			std::vector<objectOrValue> arguments;
+			arguments.reserve(argc);
+			for (size_t i = 0; i < argc; ++i)
+				arguments.push_back(args[i]->value);
+			objectOrValue value = interpreter->interpreter.call(name, std::move(arguments));
+			if (result)
+				*result = makeValue(std::move(value));
+		});
+	}
+
+	rt_status rt_register(rt_interpreter* interpreter, const char* name, rt_host_function function, void* data)
+	{
+		return guarded(interpreter, [&] {
+			interpreter->interpreter.registerBuiltIn(name, [interpreter, function, data](std::vector<objectOrValue>& args, rt::SymbolTable* symtab, rt::ArgState& argState) -> objectOrValue {
+				// Evaluate arguments
+				std::vector<rt_value> values;
+				values.reserve(args.size());
+				for (objectOrValue& arg : args)
+					values.push_back(rt_value{ rt::evaluate(arg, symtab, argState), std::string() });
+				std::vector<rt_value*> pointers;
+				pointers.reserve(values.size());
+				for (rt_value& value : values)
+					pointers.push_back(&value);
+				// Call
+				std::unique_ptr<rt_value> result(function(interpreter, pointers.data(), pointers.size(), data));
+				if (not result)
+					return rt::giveException("Host function failed");
+				return std::move(result->value);
+			});
+		});
+	}
+
+	const char* rt_error_message(const rt_interpreter* interpreter)
+	{
+		return interpreter->errorMessage.c_str();
+	}
+
+	const char* rt_error_location(const rt_interpreter* interpreter)
+	{
+		return interpreter->errorLocation.c_str();
+	}
+
+	int rt_exit_code(const rt_interpreter* interpreter)
+	{
+		return interpreter->exitCode;
+	}
+
+	// Values
+
+	rt_value* rt_number(double number)
+	{
+		return makeValue(std::variant<double, std::string>(number));
+	}
+
+	rt_value* rt_string(const char* string)
+	{
+		return makeValue(std::variant<double, std::string>(std::string(string)));
+	}
+
+	rt_value* rt_exception(const char* message)
+	{
+		return makeValue(rt::giveException(message));
+	}
+
+	void rt_free(rt_value* value)
+	{
+		delete value;
+	}
+
+	rt_value_type rt_type(const rt_value* value)
+	{
+		if (std::holds_alternative<std::shared_ptr<rt::Object>>(value->value))
+			return RT_OBJECT;
+		if (std::holds_alternative<std::string>(std::get<std::variant<double, std::string>>(value->value)))
+			return RT_STRING;
+		return RT_NUMBER;
+	}
+
+	double rt_to_number(const rt_value* value)
+	{
+		if (std::holds_alternative<std::shared_ptr<rt::Object>>(value->value))
+			return 0;
+		try
+		{
+			return rt::getNumericalValue(std::get<std::variant<double, std::string>>(value->value));
+		}
+		catch (const std::exception&)
+		{
+			return 0;
+		}
+	}
+
+	const char* rt_to_string(const rt_value* value)
+	{
+		if (auto object = std::get_if<std::shared_ptr<rt::Object>>(&value->value))
+			value->text = (*object)->getName();
+		else if (auto string = std::get_if<std::string>(&std::get<std::variant<double, std::string>>(value->value)))
+			return string->c_str();
+		else
+			value->text = std::to_string(std::get<double>(std::get<std::variant<double, std::string>>(value->value)));
+		return value->text.c_str();
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+// This file is the C interface of libruntime, for embedding the Runtime interpreter in other programs.
+// Every interpreter is independent, so several can be used at once from different threads,
+// as long as each one is only used by one thread at a time.
+// C
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+	/// <summary>
+	/// An interpreter, with its own global scope and loaded libraries
+	/// </summary>
+	typedef struct rt_interpreter rt_interpreter;
+	/// <summary>
+	/// A number, string or object. Values created by the caller or returned to it must be freed with rt_free
+	/// </summary>
+	typedef struct rt_value rt_value;
+
+	/// <summary>
+	/// Result of an operation. On failure rt_error_message and rt_error_location describe the error
+	/// </summary>
+	typedef enum rt_status
+	{
+		RT_OK = 0,
+		RT_TOKENIZER_ERROR,
+		RT_PARSER_ERROR,
+		RT_INTERPRETER_ERROR,
+		/// <summary>
+		/// Anything else, such as a file that could not be opened
+		/// </summary>
+		RT_ERROR,
+		/// <summary>
+		/// The script called Exit, see rt_exit_code
+		/// </summary>
+		RT_EXIT
+	} rt_status;
+
+	typedef enum rt_value_type
+	{
+		RT_NUMBER,
+		RT_STRING,
+		RT_OBJECT
+	} rt_value_type;
+
+	/// <summary>
+	/// Builtin implemented by the host program. The arguments are evaluated, and owned by the interpreter.
+	/// Ownership of the returned value passes to the interpreter. Returning NULL returns an exception
+	/// </summary>
+	typedef rt_value* (*rt_host_function)(rt_interpreter* interpreter, rt_value* const* args, size_t argc, void* data);
+
+	// Interpreters
+
+	/// <summary>
+	/// Returns the version of the library, such as "v0.12.0"
+	/// </summary>
+	const char* rt_version(void);
+	/// <summary>
+	/// Creates an interpreter with the standard library loaded
+	/// </summary>
+	rt_interpreter* rt_create(void);
+	/// <summary>
+	/// Destroys an interpreter, unloading its shared libraries
+	/// </summary>
+	void rt_destroy(rt_interpreter* interpreter);
+	/// <summary>
+	/// Makes command line arguments available to scripts as carg0, carg1...
+	/// </summary>
+	void rt_set_arguments(rt_interpreter* interpreter, int argc, char** argv);
+	/// <summary>
+	/// Runs a script in the global scope, after which the objects it defines can be called with rt_call
+	/// </summary>
+	/// <param name="name">File name used in error locations</param>
+	rt_status rt_load_source(rt_interpreter* interpreter, const char* source, const char* name);
+	/// <summary>
+	/// Same as rt_load_source, but reads the script from a file
+	/// </summary>
+	rt_status rt_load_file(rt_interpreter* interpreter, const char* path);
+	/// <summary>
+	/// Interprets a single statement, like the live interpreter
+	/// </summary>
+	/// <param name="result">Receives the value of the statement if not NULL</param>
+	rt_status rt_eval(rt_interpreter* interpreter, const char* source, rt_value** result);
+	/// <summary>
+	/// Calls a global object or builtin by name
+	/// </summary>
+	/// <param name="result">Receives the value of the call if not NULL</param>
+	rt_status rt_call(rt_interpreter* interpreter, const char* name, rt_value* const* args, size_t argc, rt_value** result);
+	/// <summary>
+	/// Makes a host function callable from scripts under name. Data is passed to every call
+	/// </summary>
+	rt_status rt_register(rt_interpreter* interpreter, const char* name, rt_host_function function, void* data);
+	/// <summary>
+	/// Message of the last error, valid until the next call on the interpreter
+	/// </summary>
+	const char* rt_error_message(const rt_interpreter* interpreter);
+	/// <summary>
+	/// Location of the last error, such as: File "script.rnt", line 3
+	/// </summary>
+	const char* rt_error_location(const rt_interpreter* interpreter);
+	/// <summary>
+	/// Code passed to Exit, when a call returned RT_EXIT
+	/// </summary>
+	int rt_exit_code(const rt_interpreter* interpreter);
+
+	// Values
+
+	rt_value* rt_number(double number);
+	rt_value* rt_string(const char* string);
+	/// <summary>
+	/// Creates an exception object, which host functions can return to signal an error
+	/// </summary>
+	rt_value* rt_exception(const char* message);
+	void rt_free(rt_value* value);
+	rt_value_type rt_type(const rt_value* value);
+	/// <summary>
+	/// Numerical value. Strings are converted, objects and unconvertible strings give 0
+	/// </summary>
+	double rt_to_number(const rt_value* value);
+	/// <summary>
+	/// String value, the name of an object or a formatted number. Valid as long as the value
+	/// </summary>
+	const char* rt_to_string(const rt_value* value);
+#ifdef __cplusplus
+}
+#endif
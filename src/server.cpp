@@ -0,0 +1,303 @@
+// Runtime
+#include "server.h"
+#include "compiler/tokenizer.h"
+#include "compiler/parser.h"
+#include "compiler/interpreter.h"
+#include "compiler/context.h"
+#include "compiler/exceptions.h"
+// C++
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <system_error>
+#include <unordered_map>
+// C
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace rt
+{
+	// Socket helpers
+
+	[[noreturn]] static void throwErrno(const char* what)
+	{
+		throw std::system_error(errno, std::generic_category(), what);
+	}
+
+	/// <summary>
+	/// Returns the address of a socket path
+	/// </summary>
+	[[nodiscard]] static sockaddr_un socketAddress(const std::string& path)
+	{
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		if (path.size() >= sizeof(address.sun_path))
+			throw std::system_error(ENAMETOOLONG, std::generic_category(), "socket path");
+		std::strcpy(address.sun_path, path.c_str());
+		return address;
+	}
+
+	/// <summary>
+	/// Writes all of data. Returns false if the connection broke
+	/// </summary>
+	static bool writeAll(int fd, const char* data, size_t size)
+	{
+		while (size > 0) {
+			ssize_t written = send(fd, data, size, MSG_NOSIGNAL);
+			if (written < 0 and errno == EINTR)
+				continue;
+			if (written <= 0)
+				return false;
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Reads exactly size bytes. Returns false if the connection ended first
+	/// </summary>
+	static bool readAll(int fd, char* data, size_t size)
+	{
+		while (size > 0) {
+			ssize_t got = read(fd, data, size);
+			if (got < 0 and errno == EINTR)
+				continue;
+			if (got <= 0)
+				return false;
+			data += got;
+			size -= got;
+		}
+		return true;
+	}
+
+	/// <summary>
+	/// Reads a header line, without the newline. Returns false if the connection ended first
+	/// </summary>
+	static bool readLine(int fd, std::string& line)
+	{
+		line.clear();
+		char c;
+		while (readAll(fd, &c, 1)) {
+			if (c == '\n')
+				return true;
+			line += c;
+			if (line.size() > 4096) // Headers are short, don't let a client grow this forever
+				return false;
+		}
+		return false;
+	}
+
+	/// <summary>
+	/// Largest script accepted in a SOURCE request, so a client can't make the server allocate whatever it names
+	/// </summary>
+	static constexpr size_t maxSourceSize = 64 * 1024 * 1024;
+
+	// Running scripts
+
+	/// <summary>
+	/// Resets the interpreter to its warm state and runs a script in it, capturing the output
+	/// </summary>
+	static ScriptResult runScript(Interpreter& interpreter, const SymbolTable& warm, const std::string& source, const std::string& name)
+	{
+		// Forget the previous script
+		interpreter.scheduler.cancel();
+		interpreter.events.cancel();
+		interpreter.globalSymtab = warm;
+		// The table holds the preloaded objects themselves, copy them so scripts can't change them for later ones
+		std::unordered_map<const Object*, std::shared_ptr<Object>> copies;
+		for (const auto& [key, symbol] : warm.getLocals())
+			if (auto object = std::get_if<std::shared_ptr<Object>>(&symbol))
+				interpreter.globalSymtab.updateSymbol(key, Object::deepCopy(*object, copies));
+		interpreter.inEvaluation.clear();
+		interpreter.closures.clear();
+		interpreter.openedFiles.clear();
+		interpreter.mainArgs.clear();
+		interpreter.mainArgState = ArgState(interpreter.mainArgs);
+		interpreter.capture = false;
+		// Run
+		std::ostringstream output;
+		interpreter.output = &output;
+		int status = 0;
+		try
+		{
+			interpreter.run(parse(tokenize(source.c_str(), name.c_str()), true));
+		}
+		catch (const ExitException& e)
+		{
+			status = e.getCode();
+		}
+		catch (const TokenizerException& e)
+		{
+			output << "TokenizerException: " << e.what() << "\n" << e.where() << "\n";
+			status = 1;
+		}
+		catch (const ParserException& e)
+		{
+			output << "ParserException: " << e.what() << "\n" << e.where() << "\n";
+			status = 1;
+		}
+		catch (const InterpreterException& e)
+		{
+			output << "InterpreterException: " << e.what() << "\n" << e.where() << "\n";
+			status = 1;
+		}
+		catch (const std::exception& e)
+		{
+			output << e.what() << "\n";
+			status = 1;
+		}
+		interpreter.output = &std::cout;
+		return { status, output.str() };
+	}
+
+	/// <summary>
+	/// Reads a request from a connection and runs it
+	/// </summary>
+	static void serveConnection(int fd, Interpreter& interpreter, const SymbolTable& warm)
+	{
+		std::string header;
+		if (not readLine(fd, header))
+			return;
+		ScriptResult result;
+		if (header.starts_with("SOURCE ")) {
+			size_t size = 0;
+			if (std::from_chars(header.data() + 7, header.data() + header.size(), size).ec != std::errc())
+				return;
+			if (size > maxSourceSize) {
+				result = { 1, "Request too large\n" };
+			} else {
+				std::string source(size, ' ');
+				if (not readAll(fd, source.data(), size))
+					return;
+				result = runScript(interpreter, warm, source, "remote");
+			}
+		} else if (header.starts_with("FILE ")) {
+			std::string path = header.substr(5);
+			std::ifstream file(path);
+			if (file.fail()) {
+				result = { 1, "Unable to open file " + path + "\n" };
+			} else {
+				std::stringstream text;
+				text << file.rdbuf();
+				result = runScript(interpreter, warm, text.str(), path);
+			}
+		} else {
+			result = { 1, "Malformed request\n" };
+		}
+		const std::string response = std::to_string(result.status) + " " + std::to_string(result.output.size()) + "\n";
+		if (writeAll(fd, response.data(), response.size()))
+			writeAll(fd, result.output.data(), result.output.size());
+	}
+
+	// Server
+
+	Server::Server(ServerOptions options)
+		: options(std::move(options))
+	{
+		sockaddr_un address = socketAddress(this->options.socketPath);
+		listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (listener < 0)
+			throwErrno("socket");
+		unlink(this->options.socketPath.c_str());
+		if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 or listen(listener, SOMAXCONN) < 0) {
+			int error = errno;
+			close(listener);
+			throw std::system_error(error, std::generic_category(), "bind");
+		}
+		for (size_t i = 0; i < std::max<size_t>(1, this->options.workers); ++i)
+			workers.emplace_back(&Server::work, this);
+	}
+
+	Server::~Server()
+	{
+		stop();
+	}
+
+	void Server::stop()
+	{
+		if (stopping.exchange(true))
+			return wait();
+		// Wakes up the workers blocked in accept
+		shutdown(listener, SHUT_RDWR);
+		wait();
+		close(listener);
+		unlink(options.socketPath.c_str());
+	}
+
+	void Server::wait()
+	{
+		for (auto& worker : workers)
+			if (worker.joinable())
+				worker.join();
+	}
+
+	void Server::work()
+	{
+		// Warm up. The interpreter lives on this thread for its whole life
+		Interpreter interpreter;
+		for (const auto& file : options.preload) {
+			const std::string include = "Include('" + file + "')";
+			ScriptResult result = runScript(interpreter, interpreter.globalSymtab, include, "preload");
+			if (result.status != 0)
+				std::cerr << "Unable to preload " << file << ": " << result.output;
+		}
+		const SymbolTable warm = interpreter.globalSymtab;
+		// Serve
+		while (not stopping) {
+			int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+			if (fd < 0) {
+				if (errno == EINTR or errno == ECONNABORTED)
+					continue;
+				break; // Listener shut down
+			}
+			// A bad request must not take the worker down with it
+			try
+			{
+				serveConnection(fd, interpreter, warm);
+			}
+			catch (const std::exception& e)
+			{
+				std::cerr << "Unable to serve request: " << e.what() << std::endl;
+			}
+			close(fd);
+		}
+	}
+
+	// Client
+
+	ScriptResult runRemote(const std::string& socketPath, const std::string& script, bool isPath)
+	{
+		sockaddr_un address = socketAddress(socketPath);
+		int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0)
+			throwErrno("socket");
+		if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+			int error = errno;
+			close(fd);
+			throw std::system_error(error, std::generic_category(), "connect");
+		}
+		const std::string request = isPath
+			? "FILE " + script + "\n"
+			: "SOURCE " + std::to_string(script.size()) + "\n" + script;
+		ScriptResult result{ 1, "" };
+		std::string header;
+		bool ok = writeAll(fd, request.data(), request.size()) and readLine(fd, header);
+		if (ok) {
+			std::istringstream fields(header);
+			size_t size = 0;
+			fields >> result.status >> size;
+			result.output.resize(size);
+			ok = readAll(fd, result.output.data(), size);
+		}
+		close(fd);
+		if (not ok)
+			throw std::system_error(ECONNRESET, std::generic_category(), "server closed the connection");
+		return result;
+	}
+}
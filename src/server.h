@@ -0,0 +1,87 @@
+#pragma once
+// This file defines the script server, which runs scripts sent over a Unix domain socket on warm interpreters.
+// Protocol: the client sends either "SOURCE <length>\n" followed by the script,
+// or "FILE <path>\n". The server answers "<exit status> <length>\n" followed by everything the script printed.
+// Sources longer than 64 MiB are answered with status 1 and "Request too large".
+// C++
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rt
+{
+	/// <summary>
+	/// Settings of a script server
+	/// </summary>
+	struct ServerOptions
+	{
+		/// <summary>
+		/// Path of the Unix domain socket, replaced if it exists
+		/// </summary>
+		std::string socketPath;
+		/// <summary>
+		/// Amount of interpreters, and so of scripts run at once
+		/// </summary>
+		size_t workers = 1;
+		/// <summary>
+		/// Files passed to Include in every interpreter before it accepts scripts
+		/// </summary>
+		std::vector<std::string> preload;
+	};
+
+	/// <summary>
+	/// What running a script produced
+	/// </summary>
+	struct ScriptResult
+	{
+		/// <summary>
+		/// 0, the code passed to Exit, or 1 on errors
+		/// </summary>
+		int status;
+		/// <summary>
+		/// Everything printed, followed by the error if there was one
+		/// </summary>
+		std::string output;
+	};
+
+	/// <summary>
+	/// Serves scripts on a socket until stopped. Every worker thread owns an interpreter,
+	/// whose global scope is reset to its state after preloading before each script. Each script gets its own copies of the preloaded objects
+	/// </summary>
+	class Server
+	{
+	public:
+		/// <summary>
+		/// Binds the socket and starts the workers. Throws std::system_error if the socket cannot be set up
+		/// </summary>
+		Server(ServerOptions options);
+		~Server();
+		Server(const Server&) = delete;
+		Server& operator= (const Server&) = delete;
+		/// <summary>
+		/// Stops accepting scripts and waits for the running ones
+		/// </summary>
+		void stop();
+		/// <summary>
+		/// Blocks until the server is stopped
+		/// </summary>
+		void wait();
+	private:
+		/// <summary>
+		/// Main loop of a worker thread
+		/// </summary>
+		void work();
+
+		ServerOptions options;
+		int listener;
+		std::atomic<bool> stopping = false;
+		std::vector<std::thread> workers;
+	};
+
+	/// <summary>
+	/// Runs a script on a server, given as source code or, if isPath, as the path of a file the server can read
+	/// </summary>
+	/// <returns>What running the script produced. Throws std::system_error if the server cannot be reached</returns>
+	ScriptResult runRemote(const std::string& socketPath, const std::string& script, bool isPath);
+}
@@ -109,3 +109,31 @@ void difficult(dif f)
 	*f.num *= 2;
 	strcpy(f.str, "Updated");
 }
+// Buffers
+void fillSeries(double* data, int n)
+{
+	for (int i = 0; i < n; ++i)
+		data[i] = i * 0.5;
+}
+int sumInts(int* data, int n)
+{
+	int sum = 0;
+	for (int i = 0; i < n; ++i)
+		sum += data[i];
+	return sum;
+}
+// Arrays
+void scaleDoubles(double* data, int n, double factor)
+{
+	for (int i = 0; i < n; ++i)
+		data[i] *= factor;
+}
+// Callbacks
+int applyTwice(int (*f)(int), int x)
+{
+	return f(f(x));
+}
+int applyToNull(int (*f)(const char*, int*))
+{
+	return f(NULL, NULL);
+}
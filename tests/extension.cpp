@@ -0,0 +1,53 @@
+// This is the source code for extension.so, a sample native extension
+// This is used in the extension tests
+// It is built by CMake alongside the tests, or manually in this directory with the command:
+// 	g++ -std=c++20 extension.cpp --shared -fPIC -o extension.so
+// (tsl/ordered_map.h and the Runtime.hpp of the build must be on the include path)
+#include "../src/compiler/extension.h"
+// C++
+#include <cmath>
+
+// Interface given by the interpreter
+static const rt_extension_api* api;
+
+// Doubles a number, like test() in lib.so
+static objectOrValue Twice(std::vector<objectOrValue>& args, rt::SymbolTable* symtab, rt::ArgState& argState)
+{
+	if (args.size() < 1)
+		return rt::giveException("Wrong amount of arguments");
+	return rt::getNumericalValue(api->evaluate(args.at(0), symtab, argState, true)) * 2;
+}
+
+// Returns the length of the hypotenuse of a right triangle
+static objectOrValue Hypotenuse(std::vector<objectOrValue>& args, rt::SymbolTable* symtab, rt::ArgState& argState)
+{
+	if (args.size() < 2)
+		return rt::giveException("Wrong amount of arguments");
+	return std::hypot(rt::getNumericalValue(api->evaluate(args.at(0), symtab, argState, true)),
+			  rt::getNumericalValue(api->evaluate(args.at(1), symtab, argState, true)));
+}
+
+// Calls an object with each remaining argument, returning the sum of the results
+static objectOrValue SumOf(std::vector<objectOrValue>& args, rt::SymbolTable* symtab, rt::ArgState& argState)
+{
+	if (args.size() < 1)
+		return rt::giveException("Wrong amount of arguments");
+	double sum = 0;
+	for (auto it = args.begin() + 1; it != args.end(); ++it) {
+		// Each call gets its own scope, like calls made by the interpreter
+		rt::SymbolTable localSt(symtab);
+		sum += rt::getNumericalValue(api->callObject(args.at(0), &localSt, argState, { *it }));
+	}
+	return sum;
+}
+
+extern "C" int rt_register_extension(const rt_extension_api* extensionApi)
+{
+	if (extensionApi->abi != RUNTIME_EXTENSION_ABI)
+		return 1;
+	api = extensionApi;
+	api->registerBuiltIn(api->registrar, "Twice", Twice);
+	api->registerBuiltIn(api->registrar, "Hypotenuse", Hypotenuse);
+	api->registerBuiltIn(api->registrar, "SumOf", SumOf);
+	return 0;
+}
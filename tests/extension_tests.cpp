@@ -0,0 +1,55 @@
+// Catch 2
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+// Runtime
+#include "../src/compiler/tokenizer.h"
+#include "../src/compiler/parser.h"
+#include "../src/compiler/interpreter.h"
+
+TEST_CASE("Extension builtins", "[extensions]")
+{
+	// Object(Main
+	//	Include("../tests/extension.so")
+	//	Print(Twice(21))
+	//	Print(Hypotenuse(3 4))
+	// )
+	// Excepted output: "42\n5"
+
+	const std::string test1[]{"42.000000", "5.000000"};
+	auto r1 = rt::parse(rt::tokenize("Include('../tests/extension.so')"
+					 "Print(Twice(21))"
+					 "Print(Hypotenuse(3 4))"));
+	auto v1 = rt::interpretAndReturn(r1);
+	REQUIRE(v1.at(0) == test1[0]);
+	REQUIRE(v1.at(1) == test1[1]);
+
+	// Object(Main
+	//	Include("../tests/extension.so")
+	//	Object(Inc +(arg 1))
+	//	Print(SumOf(Inc 1 2 3))
+	// )
+	// Excepted output: "9"
+
+	const std::string test2 = "9.000000";
+	auto r2 = rt::parse(rt::tokenize("Include('../tests/extension.so')"
+					 "Object(Inc +(arg 1))"
+					 "Print(SumOf(Inc 1 2 3))"));
+	REQUIRE(rt::interpretAndReturn(r2).at(0) == test2);
+}
+
+TEST_CASE("Extension versus Bind", "[.][benchmark]")
+{
+	// The same loop, doubling a number through an extension builtin and through a bound function
+
+	auto bound = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					    "Bind('test' 'int' 'int')"
+					    "While(<(i 1000)"
+					    "Assign(i 0 +(i 1))"
+					    "test(i))"));
+	auto extension = rt::parse(rt::tokenize("Include('../tests/extension.so')"
+						"While(<(i 1000)"
+						"Assign(i 0 +(i 1))"
+						"Twice(i))"));
+	BENCHMARK("Bind") { return rt::interpretAndReturn(bound); };
+	BENCHMARK("Extension") { return rt::interpretAndReturn(extension); };
+}
@@ -5,7 +5,19 @@
 #include "../src/compiler/tokenizer.h"
 #include "../src/compiler/parser.h"
 #include "../src/compiler/interpreter.h"
+#include "../src/compiler/context.h"
+#include "../src/compiler/heap_dump.h"
+#include "../src/compiler/memory_stats.h"
+#include "../src/compiler/perf_counters.h"
+#include "../src/compiler/profiler.h"
+#include "../src/compiler/stats.h"
+#include "../src/compiler/trace.h"
 // C++
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
 #include <vector>
 
 TEST_CASE("Object creation, basic evaluation and console output", "[interpreter]")
@@ -205,3 +217,384 @@ TEST_CASE("Runtime exceptions", "[interpreter]")
 	auto v = rt::interpretAndReturn(r1);
 	REQUIRE(v.at(0) == test1);
 }
+
+TEST_CASE("Concurrent interpreters", "[interpreter]")
+{
+	// Object(Main
+	//	Object(n <thread number>)
+	//	Assign(n 0 +(n n))
+	//	Print(n)
+	// )
+	// Expected output: Twice the thread number, from each thread
+	std::vector<std::vector<std::string>> outputs(4);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < outputs.size(); ++i) {
+		threads.emplace_back([i, &outputs] {
+			const std::string source = "Object(n " + std::to_string(i) + ")\nAssign(n 0 +(n n))\nPrint(n)";
+			rt::Interpreter interpreter;
+			for (int run = 0; run < 50; ++run)
+				outputs[i] = interpreter.interpretAndReturn(rt::parse(rt::tokenize(source.c_str())));
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	for (size_t i = 0; i < outputs.size(); ++i)
+		REQUIRE(outputs[i].at(0) == std::to_string(2.0 * i));
+}
+
+TEST_CASE("Frozen objects", "[interpreter]")
+{
+	// Object(Main
+	//	Object(inner 1)
+	//	Object(table 5 6 inner)
+	//	Freeze(table)
+	//	Print(Assign(table 0 1))
+	//	Print(Update(inner 0 2))
+	//	Print(Set(table 1))
+	//	Print(Append(table 1))
+	//	Print(table-1)
+	//	Print(ParallelReduce(table "+" 0))
+	// )
+	// Expected output: Four exceptions, then the unchanged members
+	auto r1 = rt::parse(rt::tokenize("Object(inner 1)\nObject(table 5 6 inner)\nFreeze(table)\n"
+				"Print(Assign(table 0 1))\nPrint(Update(inner 0 2))\nPrint(Set(table 1))\nPrint(Append(table 1))\n"
+				"Print(table-1)\nPrint(ParallelReduce(table \"+\" 0))"));
+	auto v = rt::interpretAndReturn(r1);
+	REQUIRE(v.size() == 6);
+	for (size_t i = 0; i < 4; ++i)
+		REQUIRE(v.at(i) == "Object is frozen");
+	REQUIRE(v.at(4) == "6.000000");
+	REQUIRE(v.at(5) == "12.000000");
+
+	// Object(Main
+	//	Object(Nothing)
+	//	Freeze(Nothing)
+	//	Print(Nothing())
+	//	Print(Size(Nothing))
+	// )
+	// Expected output: "0\n0", calling the frozen object doesn't give it a member
+	auto r2 = rt::parse(rt::tokenize("Object(Nothing)\nFreeze(Nothing)\nPrint(Nothing())\nPrint(Size(Nothing))"));
+	auto v2 = rt::interpretAndReturn(r2);
+	REQUIRE(v2.at(0) == "0.000000");
+	REQUIRE(v2.at(1) == "0.000000");
+
+	// Object(Main
+	//	Object(out)
+	//	Freeze(out)
+	//	Object(source 1 2)
+	//	Object(Square *(x x))
+	//	Print(ParallelMap(out source Square))
+	//	Print(BufferCreate(out "double" 2))
+	//	Print(Size(out))
+	// )
+	// Expected output: Two exceptions, then "0", builtins besides Assign and the like can't change frozen objects either
+	auto r3 = rt::parse(rt::tokenize("Object(out)\nFreeze(out)\nObject(source 1 2)\nObject(Square *(x x))\n"
+				"Print(ParallelMap(out source Square))\nPrint(BufferCreate(out \"double\" 2))\nPrint(Size(out))"));
+	auto v3 = rt::interpretAndReturn(r3);
+	REQUIRE(v3.at(0) == "Object is frozen");
+	REQUIRE(v3.at(1) == "Object is frozen");
+	REQUIRE(v3.at(2) == "0.000000");
+	auto frozen = std::make_shared<rt::Object>("frozen");
+	frozen->freeze();
+	REQUIRE_THROWS_AS(frozen->addMember(objectOrValue(std::variant<double, std::string>(1.0))), rt::FrozenObjectError);
+	REQUIRE_THROWS_AS(frozen->setNative(1), rt::FrozenObjectError);
+
+	// A frozen table of a million members, read by many threads at once without locking
+	constexpr int size = 1000000;
+	auto table = std::make_shared<rt::Object>("table");
+	for (int i = 0; i < size; ++i)
+		table->addMember(objectOrValue(std::variant<double, std::string>(double(i))));
+	table->freeze();
+	std::vector<double> sums(8);
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < sums.size(); ++t) {
+		threads.emplace_back([&table, &sums, t] {
+			for (int i = 0; i < size; ++i)
+				sums[t] += std::get<double>(std::get<std::variant<double, std::string>>(*table->getMember(i)));
+		});
+	}
+	for (auto& thread : threads)
+		thread.join();
+	for (double sum : sums)
+		REQUIRE(sum == double(size) * (size - 1) / 2);
+	REQUIRE(table->size() == size);
+	REQUIRE_THROWS_AS(table->getMember(size), std::out_of_range);
+
+	// The same table read by parallel calls of the interpreter
+	// Object(Main
+	//	Object(Read BufferSet(buf i table-999999))
+	//	BufferCreate(buf "double" 100000)
+	//	ParallelFor(0 100000 Read)
+	//	Print(BufferGet(buf 99999))
+	//	Print(ParallelReduce(table "+" 0))
+	//	Print(Size(table))
+	// )
+	// Expected output: The last member, the sum of all members and the unchanged size
+	rt::Interpreter interpreter;
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(Read BufferSet(buf i table-999999))")));
+	interpreter.globalSymtab.updateSymbol("table", table);
+	interpreter.run(rt::parse(rt::tokenize("BufferCreate(buf \"double\" 100000)\nParallelFor(0 100000 Read)\n"
+				"Print(BufferGet(buf 99999))\nPrint(ParallelReduce(table \"+\" 0))\nPrint(Size(table))")));
+	REQUIRE(interpreter.capturedCout.size() == 3);
+	REQUIRE(interpreter.capturedCout.at(0) == std::to_string(double(size - 1)));
+	REQUIRE(interpreter.capturedCout.at(1) == std::to_string(double(size) * (size - 1) / 2));
+	REQUIRE(interpreter.capturedCout.at(2) == std::to_string(double(size)));
+}
+
+TEST_CASE("Sampling profiler", "[interpreter]")
+{
+	// Object(i 0)
+	// Object(Work Assign(i 0 +(i 1)))
+	// While(<(i 100000) Work())
+	// Run until the profiler has enough samples, which should mostly be in Work
+	rt::SamplingProfiler profiler;
+	rt::Interpreter interpreter;
+	while (profiler.samples() < 20)
+		interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(i 0)\nObject(Work Assign(i 0 +(i 1)))\nWhile(<(i 100000) Work())")));
+	profiler.stop();
+	const size_t samples = profiler.samples();
+	REQUIRE(profiler.dropped() == 0);
+
+	std::ostringstream collapsed;
+	profiler.writeCollapsed(collapsed);
+	REQUIRE(collapsed.str().find("Main;While") != std::string::npos);
+	REQUIRE(collapsed.str().find(";Work") != std::string::npos);
+	std::ostringstream top;
+	profiler.writeTop(top, 5);
+	REQUIRE(top.str().find("Profile: " + std::to_string(samples) + " samples") == 0);
+	REQUIRE(top.str().find("Work") != std::string::npos);
+
+	// No more samples once stopped, and only one profiler with samples at a time
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(i 0)\nWhile(<(i 100000) Assign(i 0 +(i 1)))")));
+	REQUIRE(profiler.samples() == samples);
+	REQUIRE_THROWS_AS(rt::SamplingProfiler(), std::logic_error);
+}
+
+TEST_CASE("Call profiler", "[interpreter]")
+{
+	// Object(i 0)
+	// Object(Inner +(i 1))
+	// Object(Work Assign(i 0 Inner()))
+	// While(<(i 1000) Work())
+	// Every call is counted, with the time of inner calls included in the outer ones
+	rt::CallProfiler profiler;
+	rt::Interpreter interpreter;
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(i 0)\nObject(Inner +(i 1))\nObject(Work Assign(i 0 Inner()))\nWhile(<(i 1000) Work())")));
+	profiler.stop();
+	// Not counted once stopped
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(Work 0)\nWork()")));
+
+	const std::vector<rt::CallTotals> totals = profiler.totals();
+	const auto find = [&](const std::string& name) {
+		auto it = std::find_if(totals.begin(), totals.end(), [&](const rt::CallTotals& entry) { return entry.name == name; });
+		REQUIRE(it != totals.end());
+		return *it;
+	};
+	const rt::CallTotals work = find("Work"), inner = find("Inner"), loop = find("While"), add = find("+");
+	REQUIRE(work.calls == 1000);
+	REQUIRE(work.kind == rt::CallKind::Object);
+	REQUIRE(inner.calls == 1000);
+	REQUIRE(add.calls == 1000);
+	REQUIRE(loop.calls == 1);
+	REQUIRE(loop.kind == rt::CallKind::BuiltIn);
+	REQUIRE(find("<").calls == 1001);
+	REQUIRE(work.exclusive <= work.inclusive);
+	REQUIRE(inner.inclusive <= work.inclusive);
+	REQUIRE(work.inclusive <= loop.inclusive);
+	REQUIRE(add.exclusive == add.inclusive);
+	REQUIRE(loop.allocations >= work.allocations);
+	for (size_t i = 1; i < totals.size(); ++i)
+		REQUIRE(totals[i].exclusive <= totals[i - 1].exclusive);
+
+	std::ostringstream json;
+	profiler.writeJson(json);
+	REQUIRE(json.str().find("{ \"name\": \"Work\", \"kind\": \"object\", \"calls\": 1000, ") != std::string::npos);
+	REQUIRE(json.str().find("{ \"name\": \"While\", \"kind\": \"builtin\", \"calls\": 1, ") != std::string::npos);
+	REQUIRE_THROWS_AS(rt::CallProfiler(), std::logic_error);
+}
+
+TEST_CASE("Interpreter statistics", "[interpreter]")
+{
+	// Object(i 0)
+	// While(<(i 100) Assign(i 0 +(i 1)))
+	// Counted only when built with RUNTIME_STATS, otherwise nothing is counted at all
+	const rt::InterpreterStats before = rt::threadStats();
+	rt::Interpreter interpreter;
+	const std::vector<rt::Token> tokens = rt::tokenize("Object(i 0)\nWhile(<(i 100) Assign(i 0 +(i 1)))");
+	interpreter.interpretAndReturn(rt::parse(tokens));
+	const rt::InterpreterStats& after = rt::threadStats();
+	const auto calls = [](const rt::InterpreterStats& stats, const std::string& name) {
+		auto it = stats.builtInCalls.find(name);
+		return it == stats.builtInCalls.end() ? 0 : it->second;
+	};
+#if RUNTIME_STATS==1
+	REQUIRE(after.tokens - before.tokens == tokens.size());
+	// Main and its Object call, 4 nodes for Object(i 0), and 14 for the loop
+	REQUIRE(after.astNodes - before.astNodes == 21);
+	REQUIRE(after.interpreted[size_t(rt::NodeKind::Call)] > before.interpreted[size_t(rt::NodeKind::Call)]);
+	REQUIRE(after.lookUps > before.lookUps);
+	REQUIRE(after.maxLookUpDepth >= 1);
+	REQUIRE(after.evaluates > before.evaluates);
+	REQUIRE(after.memberCopies > before.memberCopies);
+	REQUIRE(calls(after, "While") - calls(before, "While") == 1);
+	REQUIRE(calls(after, "+") - calls(before, "+") == 100);
+	REQUIRE(calls(after, "<") - calls(before, "<") == 101);
+	REQUIRE(rt::interpreterStatsReport().find("Interpreter statistics") == 0);
+#else
+	REQUIRE(after.tokens == before.tokens);
+	REQUIRE(after.lookUps == before.lookUps);
+	REQUIRE(after.evaluates == before.evaluates);
+	REQUIRE(calls(after, "+") == calls(before, "+"));
+#endif // RUNTIME_STATS
+}
+
+TEST_CASE("Trace events", "[interpreter]")
+{
+	// Object(i 0)
+	// Object(Work Assign(i 0 +(i 1)))
+	// While(<(i 100) Work())
+	// Spans for tokenize, parse, each top-level member, and every call of Work with a threshold of 0
+	rt::startTrace(std::nullopt, std::chrono::nanoseconds(0));
+	rt::Interpreter interpreter;
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(i 0)\nObject(Work Assign(i 0 +(i 1)))\nWhile(<(i 100) Work())", "trace.rnt")));
+	rt::stopTrace();
+	// Not recorded once stopped
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(Later 0)\nLater()", "later.rnt")));
+
+	std::ostringstream trace;
+	rt::writeTrace(trace);
+	const std::string json = trace.str();
+	const auto count = [&](const std::string& text) {
+		size_t found = 0;
+		for (size_t i = json.find(text); i != std::string::npos; i = json.find(text, i + 1))
+			++found;
+		return found;
+	};
+	REQUIRE(json.starts_with("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+	REQUIRE(count("{\"name\":\"tokenize\",\"cat\":\"load\"") == 1);
+	REQUIRE(count("{\"name\":\"parse\",\"cat\":\"load\"") == 1);
+	REQUIRE(count("\"args\":{\"detail\":\"trace.rnt\"}") == 2);
+	REQUIRE(count("\"cat\":\"main\"") == 3);
+	REQUIRE(count("{\"name\":\"While\",\"cat\":\"main\"") == 1);
+	REQUIRE(count("{\"name\":\"Work\",\"cat\":\"object\",\"ph\":\"X\"") == 100);
+	REQUIRE(count("later.rnt") == 0);
+	REQUIRE(json.ends_with("]}\n"));
+
+	// Without a threshold, object calls aren't traced
+	rt::startTrace(std::nullopt, std::nullopt);
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(Work 0)\nWork()")));
+	rt::stopTrace();
+	std::ostringstream untimed;
+	rt::writeTrace(untimed);
+	REQUIRE(untimed.str().find("\"cat\":\"object\"") == std::string::npos);
+	REQUIRE(untimed.str().find("\"cat\":\"main\"") != std::string::npos);
+}
+
+TEST_CASE("Phase counters", "[interpreter]")
+{
+	// Object(Work Random())
+	// Work()
+	// One entry each for tokenize and parse, and the run itself as interpret. Wall time is counted
+	// whether or not the kernel allows hardware counters
+	const bool hardware = rt::startPhaseCounters();
+	rt::Interpreter interpreter;
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(Work Random())\nWork()")));
+	rt::stopPhaseCounters();
+	// Not counted once stopped
+	interpreter.interpretAndReturn(rt::parse(rt::tokenize("Object(Later 0)\nLater()")));
+
+	std::istringstream report(rt::phaseReport());
+	std::string line;
+	std::getline(report, line);
+	REQUIRE(line.starts_with("Phase counters"));
+	REQUIRE((line.find("wall time only") == std::string::npos) == hardware);
+	std::getline(report, line);
+	REQUIRE((line.find("IPC") != std::string::npos) == hardware);
+	std::vector<std::string> phases;
+	while (std::getline(report, line)) {
+		std::istringstream row(line);
+		std::string phase;
+		double wall;
+		uint64_t entries;
+		row >> phase >> wall >> entries;
+		phases.push_back(phase);
+		REQUIRE(wall >= 0);
+		REQUIRE(entries == (phase == "ffi" ? 0 : 1));
+	}
+	REQUIRE(phases == std::vector<std::string>{ "tokenize", "parse", "interpret", "ffi" });
+}
+
+TEST_CASE("Heap dump", "[interpreter]")
+{
+	// Object(A 0)
+	// Object(B 0)
+	// Object(Text 'a string long enough to be stored outside of the string object')
+	// Update(A 1 B)
+	// Update(B 1 A)
+	// Print(HeapDump('heap_test.dump'))
+	// A and B reference each other, so they form a cycle
+	auto printed = rt::interpretAndReturn(rt::parse(rt::tokenize("Object(A 0)\nObject(B 0)\n"
+		"Object(Text 'a string long enough to be stored outside of the string object')\n"
+		"Update(A 1 B)\nUpdate(B 1 A)\nPrint(HeapDump('heap_test.dump'))")));
+	REQUIRE(printed.size() == 1);
+	const size_t written = static_cast<size_t>(std::stod(printed.at(0)));
+
+	std::ifstream in("heap_test.dump");
+	std::stringstream dump;
+	dump << in.rdbuf();
+	in.close();
+	std::remove("heap_test.dump");
+	std::string line;
+	size_t objects = 0;
+	bool globalA = false;
+	while (std::getline(dump, line)) {
+		objects += line.starts_with("object\t");
+		globalA = globalA or (line.starts_with("root\t") and line.ends_with("\tglobal A"));
+	}
+	REQUIRE(written >= 3);
+	REQUIRE(objects == written);
+	REQUIRE(globalA);
+
+	dump.clear();
+	dump.seekg(0);
+	std::ostringstream summary;
+	REQUIRE(rt::summarizeHeapDump(dump, summary, 10));
+	const std::string text = summary.str();
+	REQUIRE(text.starts_with("Heap dump: " + std::to_string(written) + " objects"));
+	REQUIRE(text.find("Largest retainers") != std::string::npos);
+	REQUIRE(text.find("Objects by name") != std::string::npos);
+	REQUIRE(text.find("Reference cycles: 1\n  2 objects") != std::string::npos);
+
+	std::istringstream notDump("something else\n");
+	REQUIRE_FALSE(rt::summarizeHeapDump(notDump, summary, 10));
+	std::istringstream badCount("RuntimeHeapDump 1\nobject\t0\tx\tabc\t1\t1\n");
+	REQUIRE_FALSE(rt::summarizeHeapDump(badCount, summary, 10));
+	std::istringstream tooLarge("RuntimeHeapDump 1\nobject\t0\tx\t1\t99999999999999999999999\t1\n");
+	REQUIRE_FALSE(rt::summarizeHeapDump(tooLarge, summary, 10));
+}
+
+TEST_CASE("Memory statistics", "[interpreter]")
+{
+	// Object(Stats 0)
+	// Copy(Stats MemoryStats())
+	// Print(Size(Stats-1))
+	// Expected output: tracked and resident, and an object for each category when memory is tracked
+	const rt::MemoryUsage before = rt::memoryUsage(rt::MemoryCategory::Objects);
+	auto printed = rt::interpretAndReturn(rt::parse(rt::tokenize("Object(Stats 0)\nCopy(Stats MemoryStats())\nPrint(Size(Stats-1))")));
+	REQUIRE(printed.size() == 1);
+	REQUIRE(printed.at(0) == std::to_string(double(2 + (RUNTIME_MEMORY_STATS == 1 ? rt::memoryCategoryCount : 0))));
+	REQUIRE(rt::residentBytes() > 0);
+
+	const rt::MemoryUsage after = rt::memoryUsage(rt::MemoryCategory::Objects);
+#if RUNTIME_MEMORY_STATS==1
+	REQUIRE(after.allocations > before.allocations);
+	REQUIRE(after.peak >= after.live);
+	// Everything the script made is gone with its interpreter
+	REQUIRE(after.live == before.live);
+	REQUIRE_FALSE(rt::topAllocationSites(rt::MemoryCategory::Ast, 5).empty());
+#else
+	REQUIRE(after.allocations == before.allocations);
+	REQUIRE(after.allocations == 0);
+#endif // RUNTIME_MEMORY_STATS
+	REQUIRE(rt::memoryStatsReport().starts_with("Memory statistics"));
+}
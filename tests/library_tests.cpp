@@ -1,11 +1,19 @@
 // Catch 2
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
 // Runtime
 #include "../src/compiler/tokenizer.h"
 #include "../src/compiler/parser.h"
 #include "../src/compiler/interpreter.h"
+#include "../src/compiler/fibers.h"
+#include "../src/compiler/shared_segment.h"
 // C++
+#include <fstream>
+#include <string>
 #include <vector>
+// C
+#include <sys/stat.h>
+#include <unistd.h>
 
 TEST_CASE("Basic conditionals and loops", "[libraries]")
 {
@@ -68,3 +76,423 @@ TEST_CASE("Format", "[libraries]")
 	auto r1 = rt::parse(rt::tokenize("Print(Format(\"0 == $2\\n\" False))"));
 	REQUIRE(rt::interpretAndReturn(r1).at(0) == test1);
 }
+
+TEST_CASE("Parallel builtins", "[libraries]")
+{
+	// Object(Main
+	//	Object(source 1 2 3 4 5 6 7 8 9 10)
+	//	Object(Square *(x x))
+	//	Object(squares)
+	//	ParallelMap(squares source Square)
+	//	Print(squares-0)
+	//	Print(squares-9)
+	//	Print(Size(squares))
+	// )
+	// Excepted output: "1\n100\n10", results are in the order of source
+
+	const std::string test1[]{"1.000000", "100.000000", "10.000000"};
+	auto r1 = rt::parse(rt::tokenize("Object(source 1 2 3 4 5 6 7 8 9 10)"
+				"Object(Square *(x x))"
+				"Object(squares)"
+				"ParallelMap(squares source Square)"
+				"Print(squares-0)"
+				"Print(squares-9)"
+				"Print(Size(squares))"));
+	auto v1 = rt::interpretAndReturn(r1);
+	REQUIRE(v1.at(0) == test1[0]);
+	REQUIRE(v1.at(1) == test1[1]);
+	REQUIRE(v1.at(2) == test1[2]);
+
+	// Object(Main
+	//	BufferCreate(buf "double" 1000)
+	//	Object(Fill BufferSet(buf i *(i i)))
+	//	ParallelFor(0 1000 Fill)
+	//	Print(BufferGet(buf 999))
+	// )
+	// Excepted output: "998001"
+
+	const std::string test2 = "998001.000000";
+	auto r2 = rt::parse(rt::tokenize("BufferCreate(buf 'double' 1000)"
+				"Object(Fill BufferSet(buf i *(i i)))"
+				"ParallelFor(0 1000 Fill)"
+				"Print(BufferGet(buf 999))"));
+	REQUIRE(rt::interpretAndReturn(r2).at(0) == test2);
+
+	// Object(Main
+	//	Object(source 1 2 3 4 5 6 7 8 9 10)
+	//	Object(unset)
+	//	Object(Offset +(unset x))
+	//	Object(Nothing)
+	//	Object(offsets)
+	//	Object(nothings)
+	//	ParallelMap(offsets source Offset)
+	//	ParallelMap(nothings source Nothing)
+	//	Print(offsets-9)
+	//	Print(nothings-9)
+	//	Print(Size(unset))
+	//	Print(Size(Nothing))
+	// )
+	// Excepted output: "10\n0\n0\n0", the calls share the empty objects, so they aren't given a zero member
+
+	const std::string test3[]{"10.000000", "0.000000", "0.000000", "0.000000"};
+	auto r3 = rt::parse(rt::tokenize("Object(source 1 2 3 4 5 6 7 8 9 10)"
+				"Object(unset)"
+				"Object(Offset +(unset x))"
+				"Object(Nothing)"
+				"Object(offsets)"
+				"Object(nothings)"
+				"ParallelMap(offsets source Offset)"
+				"ParallelMap(nothings source Nothing)"
+				"Print(offsets-9)"
+				"Print(nothings-9)"
+				"Print(Size(unset))"
+				"Print(Size(Nothing))"));
+	auto v3 = rt::interpretAndReturn(r3);
+	for (size_t i = 0; i < 4; ++i)
+		REQUIRE(v3.at(i) == test3[i]);
+
+	// Object(Main
+	//	Object(source 1 2 3 4)
+	//	Object(total 0)
+	//	Object(Count Assign(total 0 +(total x)))
+	//	Object(counts)
+	//	ParallelMap(counts source Count)
+	//	Object(Double Assign(x 0 *(x 2)) +(x 0))
+	//	Object(doubled)
+	//	ParallelMap(doubled source Double)
+	//	Print(counts-0)
+	//	Print(total)
+	//	Print(doubled-3)
+	// )
+	// Excepted output: An exception, "0" and "8", the calls may only change their own arguments
+
+	const std::string test4[]{"Object is shared with other parallel calls", "0.000000", "8.000000"};
+	auto r4 = rt::parse(rt::tokenize("Object(source 1 2 3 4)"
+				"Object(total 0)"
+				"Object(Count Assign(total 0 +(total x)))"
+				"Object(counts)"
+				"ParallelMap(counts source Count)"
+				"Object(Double Assign(x 0 *(x 2)) +(x 0))"
+				"Object(doubled)"
+				"ParallelMap(doubled source Double)"
+				"Print(counts-0)"
+				"Print(total)"
+				"Print(doubled-3)"));
+	auto v4 = rt::interpretAndReturn(r4);
+	for (size_t i = 0; i < 3; ++i)
+		REQUIRE(v4.at(i) == test4[i]);
+}
+
+TEST_CASE("Parallel reduction", "[libraries]")
+{
+	// Object(Main
+	//	Object(source 1 2 3 4 5 6 7 8 9 10)
+	//	Print(ParallelReduce(source "+" 0))
+	//	Print(ParallelReduce(source ">" 0))
+	//	Object(Product *(a b))
+	//	Print(ParallelReduce(source Product 1))
+	//	Object(empty)
+	//	Print(ParallelReduce(empty "+" 7))
+	// )
+	// Excepted output: "55\n10\n3628800\n7", the first two run natively
+
+	const std::string test1[]{"55.000000", "10.000000", "3628800.000000", "7.000000"};
+	auto r1 = rt::parse(rt::tokenize("Object(source 1 2 3 4 5 6 7 8 9 10)"
+				"Print(ParallelReduce(source '+' 0))"
+				"Print(ParallelReduce(source '>' 0))"
+				"Object(Product *(a b))"
+				"Print(ParallelReduce(source Product 1))"
+				"Object(empty)"
+				"Print(ParallelReduce(empty '+' 7))"));
+	auto v1 = rt::interpretAndReturn(r1);
+	REQUIRE(v1.at(0) == test1[0]);
+	REQUIRE(v1.at(1) == test1[1]);
+	REQUIRE(v1.at(2) == test1[2]);
+	REQUIRE(v1.at(3) == test1[3]);
+
+	// Object(Main
+	//	Object(source 5 3 9 7)
+	//	Print(ParallelReduce(source "<" "100"))
+	//	Object(words 5 "a")
+	//	Print(ParallelReduce(words ">" 0))
+	// )
+	// Excepted output: Two exceptions, minimum and maximum of anything but numbers
+
+	auto r2 = rt::parse(rt::tokenize("Object(source 5 3 9 7)"
+				"Print(ParallelReduce(source '<' '100'))"
+				"Object(words 5 'a')"
+				"Print(ParallelReduce(words '>' 0))"));
+	auto v2 = rt::interpretAndReturn(r2);
+	REQUIRE(v2.at(0) == "Minimum and maximum need numbers");
+	REQUIRE(v2.at(1) == "Minimum and maximum need numbers");
+}
+
+TEST_CASE("Parallel reduction speed", "[.][benchmark]")
+{
+	// Summing 10000 members with the native loop and with a Runtime combine function
+
+	const std::string fill = "Object(source)"
+				"Assign(i 0 0)"
+				"While(<(i 10000) Append(source i) Assign(i 0 +(i 1)))"
+				"Object(Sum +(a b))";
+	BENCHMARK("Native")
+	{
+		return rt::interpretAndReturn(rt::parse(rt::tokenize((fill + "Print(ParallelReduce(source '+' 0))").c_str())));
+	};
+	BENCHMARK("Interpreted")
+	{
+		return rt::interpretAndReturn(rt::parse(rt::tokenize((fill + "Print(ParallelReduce(source Sum 0))").c_str())));
+	};
+}
+
+TEST_CASE("Fibers and channels", "[libraries]")
+{
+	// Object(Main
+	//	ChannelCreate(numbers 1)
+	//	ChannelCreate(doubled 1)
+	//	Object(Producer Send(numbers 1) Send(numbers 2) Send(numbers 3))
+	//	Object(Doubler
+	//		Send(doubled *(2 Receive(numbers)))
+	//		Send(doubled *(2 Receive(numbers)))
+	//		Send(doubled *(2 Receive(numbers)))
+	//	)
+	//	Spawn(Producer)
+	//	Spawn(Doubler)
+	//	Print(Receive(doubled))
+	//	Print(Receive(doubled))
+	//	Print(Receive(doubled))
+	// )
+	// Excepted output: "2\n4\n6", the stages wait on the full channels
+
+	const std::string test1[]{"2.000000", "4.000000", "6.000000"};
+	auto r1 = rt::parse(rt::tokenize("ChannelCreate(numbers 1)"
+				"ChannelCreate(doubled 1)"
+				"Object(Producer Send(numbers 1) Send(numbers 2) Send(numbers 3))"
+				"Object(Doubler Send(doubled *(2 Receive(numbers))) Send(doubled *(2 Receive(numbers))) Send(doubled *(2 Receive(numbers))))"
+				"Spawn(Producer)"
+				"Spawn(Doubler)"
+				"Print(Receive(doubled))"
+				"Print(Receive(doubled))"
+				"Print(Receive(doubled))"));
+	auto v1 = rt::interpretAndReturn(r1);
+	REQUIRE(v1.at(0) == test1[0]);
+	REQUIRE(v1.at(1) == test1[1]);
+	REQUIRE(v1.at(2) == test1[2]);
+
+	// Object(Main
+	//	ChannelCreate(out 4)
+	//	Object(Sender Send(out arg))
+	//	Spawn(Sender 5)
+	//	Yield()
+	//	Print(Receive(out))
+	// )
+	// Excepted output: "5", arguments are passed to the fiber
+
+	const std::string test2 = "5.000000";
+	auto r2 = rt::parse(rt::tokenize("ChannelCreate(out 4)"
+				"Object(Sender Send(out arg))"
+				"Spawn(Sender 5)"
+				"Yield()"
+				"Print(Receive(out))"));
+	REQUIRE(rt::interpretAndReturn(r2).at(0) == test2);
+
+	// Object(Main
+	//	ChannelCreate(c 1)
+	//	Receive(c)
+	// )
+	// Excepted output: Exception, nothing can send
+
+	auto r3 = rt::parse(rt::tokenize("ChannelCreate(c 1)"
+				"Receive(c)"));
+	REQUIRE_THROWS_WITH(rt::interpretAndReturn(r3), "Every fiber is waiting, none can continue");
+}
+
+TEST_CASE("Non-blocking I/O", "[libraries]")
+{
+	const std::string file = "/tmp/runtime_io_" + std::to_string(getpid()) + ".txt";
+	const std::string fifo = "/tmp/runtime_io_" + std::to_string(getpid()) + ".fifo";
+
+	// Object(Main
+	//	StreamOpen(out file "w")
+	//	StreamWrite(w out "hello")
+	//	Print(Await(w))
+	//	StreamClose(out)
+	//	StreamOpen(in file)
+	//	StreamRead(r in)
+	//	Print(Await(r))
+	// )
+	// Excepted output: "5\nhello", regular files complete right away
+
+	const std::string test1[]{"5.000000", "hello"};
+	auto r1 = rt::parse(rt::tokenize(("StreamOpen(out '" + file + "' 'w')"
+				"StreamWrite(w out 'hello')"
+				"Print(Await(w))"
+				"StreamClose(out)"
+				"StreamOpen(in '" + file + "')"
+				"StreamRead(r in)"
+				"Print(Await(r))").c_str()));
+	auto v1 = rt::interpretAndReturn(r1);
+	REQUIRE(v1.at(0) == test1[0]);
+	REQUIRE(v1.at(1) == test1[1]);
+	unlink(file.c_str());
+
+	// Object(Main
+	//	StreamOpen(reader fifo)
+	//	StreamOpen(writer fifo "w")
+	//	Object(Show Print(data))
+	//	StreamRead(r reader)
+	//	OnComplete(r Show)
+	//	Timer(t 20)
+	//	StreamWrite(w writer "ping")
+	//	Print(Await(t))
+	// )
+	// Excepted output: "ping\n1", the read completes while waiting for the timer
+
+	REQUIRE(mkfifo(fifo.c_str(), 0600) == 0);
+	const std::string test2[]{"ping", "1.000000"};
+	auto r2 = rt::parse(rt::tokenize(("StreamOpen(reader '" + fifo + "')"
+				"StreamOpen(writer '" + fifo + "' 'w')"
+				"Object(Show Print(data))"
+				"StreamRead(r reader)"
+				"OnComplete(r Show)"
+				"Timer(t 20)"
+				"StreamWrite(w writer 'ping')"
+				"Print(Await(t))").c_str()));
+	auto v2 = rt::interpretAndReturn(r2);
+	REQUIRE(v2.at(0) == test2[0]);
+	REQUIRE(v2.at(1) == test2[1]);
+	unlink(fifo.c_str());
+
+	// Object(Main
+	//	ChannelCreate(c 1)
+	//	Object(Sleeper Timer(t 10) Await(t) Send(c "woke"))
+	//	Spawn(Sleeper)
+	//	Print(Receive(c))
+	// )
+	// Excepted output: "woke", waiting on the channel waits for the timer of the fiber
+
+	const std::string test3 = "woke";
+	auto r3 = rt::parse(rt::tokenize("ChannelCreate(c 1)"
+				"Object(Sleeper Timer(t 10) Await(t) Send(c 'woke'))"
+				"Spawn(Sleeper)"
+				"Print(Receive(c))"));
+	REQUIRE(rt::interpretAndReturn(r3).at(0) == test3);
+
+	// Object(Main
+	//	Object(source 10 20)
+	//	Object(Sleep Timer(t x))
+	//	Object(results)
+	//	ParallelMap(results source Sleep)
+	//	Print(results-0)
+	// )
+	// Excepted output: Exception, the event loop belongs to the main thread
+
+	auto r4 = rt::parse(rt::tokenize("Object(source 10 20)"
+				"Object(Sleep Timer(t x))"
+				"Object(results)"
+				"ParallelMap(results source Sleep)"
+				"Print(results-0)"));
+	REQUIRE(rt::interpretAndReturn(r4).at(0) == "Events cannot be used in parallel calls");
+}
+
+TEST_CASE("Fiber switch speed", "[.][benchmark]")
+{
+	// Two fibers yielding to each other through the scheduler, 1000 switches each
+
+	rt::Scheduler scheduler;
+	BENCHMARK("Switches")
+	{
+		int count = 0;
+		for (int f = 0; f < 2; ++f) {
+			scheduler.spawn([&] {
+				for (int i = 0; i < 1000; ++i) {
+					++count;
+					scheduler.yield();
+				}
+			});
+		}
+		scheduler.waitUntil([&] { return count == 2000; });
+		return count;
+	};
+}
+
+TEST_CASE("Shared memory segments", "[libraries]")
+{
+	const std::string name = "runtime_segment_" + std::to_string(getpid());
+	const std::string file = "/tmp/runtime_segment_" + std::to_string(getpid()) + ".seg";
+
+	// Object(Main
+	//	Object(inner "a" "b")
+	//	Object(table 1.5 "text" inner)
+	//	Update(table "shared" inner)
+	//	Freeze(table)
+	//	SegmentPublish(table name)
+	//	SegmentAttach(seg name)
+	//	Print(SegmentSize(seg))
+	//	Print(SegmentGet(seg 0))
+	//	Print(SegmentGet(seg 1))
+	//	Print(SegmentGet(SegmentGet(seg "shared") 1))
+	//	Print(SegmentSize(SegmentGet(seg 2)))
+	//	Print(SegmentGet(seg 9))
+	//	Print(SegmentRemove(name))
+	//	Print(SegmentGet(seg 1))
+	// )
+	// Excepted output: "4\n1.5\ntext\nb\n2\nNo such member\n1\ntext", attached segments outlive their name
+
+	const std::string test1[]{ "4.000000", "1.500000", "text", "b", "2.000000", "No such member", "1.000000", "text" };
+	auto r1 = rt::parse(rt::tokenize(("Object(inner 'a' 'b')"
+				"Object(table 1.5 'text' inner)"
+				"Update(table 'shared' inner)"
+				"Freeze(table)"
+				"SegmentPublish(table '" + name + "')"
+				"SegmentAttach(seg '" + name + "')"
+				"Print(SegmentSize(seg))"
+				"Print(SegmentGet(seg 0))"
+				"Print(SegmentGet(seg 1))"
+				"Print(SegmentGet(SegmentGet(seg 'shared') 1))"
+				"Print(SegmentSize(SegmentGet(seg 2)))"
+				"Print(SegmentGet(seg 9))"
+				"Print(SegmentRemove('" + name + "'))"
+				"Print(SegmentGet(seg 1))").c_str()));
+	auto v1 = rt::interpretAndReturn(r1);
+	REQUIRE(v1.size() == 8);
+	for (size_t i = 0; i < v1.size(); ++i)
+		REQUIRE(v1.at(i) == test1[i]);
+
+	// A file segment attached twice, so it is mapped at two addresses
+	auto table = std::make_shared<rt::Object>("table");
+	for (int i = 0; i < 1000; ++i)
+		table->addMember(std::variant<double, std::string>(double(i)));
+	table->addMember(std::variant<double, std::string>(std::string("last")), "last");
+	table->freeze();
+	rt::Segment::publish(*table, file);
+	auto first = rt::Segment::attach(file);
+	auto second = rt::Segment::attach(file);
+	for (const auto& segment : { first, second }) {
+		const rt::SegmentNode root = segment->root();
+		REQUIRE(root.size() == 1001);
+		REQUIRE(std::get<std::variant<double, std::string>>(*root.member(999.0)) == std::variant<double, std::string>(999.0));
+		REQUIRE(std::get<std::variant<double, std::string>>(*root.member(std::string("last"))) == std::variant<double, std::string>(std::string("last")));
+		REQUIRE_FALSE(root.member(std::string("missing")).has_value());
+	}
+
+	// Objects which aren't frozen can't be published, and attaching needs a segment
+	// Object(Main
+	//	Object(open 1)
+	//	Print(SegmentPublish(open name))
+	//	Print(SegmentAttach(seg file))
+	// )
+	// Excepted output: "Object must be frozen\nNot a segment: <file>", once the file is overwritten
+	REQUIRE(rt::Segment::remove(file));
+	{
+		std::ofstream garbage(file);
+		garbage << std::string(64, 'x');
+	}
+	auto r2 = rt::parse(rt::tokenize(("Object(open 1)"
+				"Print(SegmentPublish(open '" + name + "'))"
+				"Print(SegmentAttach(seg '" + file + "'))").c_str()));
+	auto v2 = rt::interpretAndReturn(r2);
+	REQUIRE(v2.at(0) == "Object must be frozen");
+	REQUIRE(v2.at(1) == "Not a segment: " + file);
+	unlink(file.c_str());
+}
@@ -0,0 +1,74 @@
+// Catch 2
+#include <catch2/catch_test_macros.hpp>
+// Runtime
+#include "../src/libruntime.h"
+// C++
+#include <memory>
+#include <string>
+
+/// <summary>
+/// Host builtin multiplying its argument by *data
+/// </summary>
+static rt_value* scale(rt_interpreter*, rt_value* const* args, size_t argc, void* data)
+{
+	if (argc != 1)
+		return rt_exception("Wrong amount of arguments");
+	return rt_number(rt_to_number(args[0]) * *static_cast<double*>(data));
+}
+
+static rt_value* fail(rt_interpreter*, rt_value* const*, size_t, void*)
+{
+	return nullptr;
+}
+
+TEST_CASE("C API", "[libruntime]")
+{
+	std::unique_ptr<rt_interpreter, decltype(&rt_destroy)> interpreter(rt_create(), rt_destroy);
+
+	// Object(Main
+	//	Object(Add +(a b))
+	//	Object(Greeting "Hello")
+	// )
+	// Add(2 3)
+	// Excepted value: 5
+	REQUIRE(rt_load_source(interpreter.get(), "Object(Add +(a b))\nObject(Greeting 'Hello')", "api.rnt") == RT_OK);
+	rt_value* args[]{ rt_number(2), rt_string("3") };
+	rt_value* result = nullptr;
+	REQUIRE(rt_call(interpreter.get(), "Add", args, 2, &result) == RT_OK);
+	REQUIRE(rt_type(result) == RT_NUMBER);
+	REQUIRE(rt_to_number(result) == 5);
+	rt_free(result);
+	rt_free(args[0]);
+	rt_free(args[1]);
+	// Objects stay defined between calls
+	REQUIRE(rt_call(interpreter.get(), "Greeting", nullptr, 0, &result) == RT_OK);
+	REQUIRE(rt_type(result) == RT_STRING);
+	REQUIRE(std::string(rt_to_string(result)) == "Hello");
+	rt_free(result);
+
+	// Scale(4)
+	// Excepted value: 8
+	double factor = 2;
+	REQUIRE(rt_register(interpreter.get(), "Scale", scale, &factor) == RT_OK);
+	REQUIRE(rt_eval(interpreter.get(), "Scale(4)", &result) == RT_OK);
+	REQUIRE(rt_to_number(result) == 8);
+	rt_free(result);
+	// Host builtins are callable from loaded scripts too
+	REQUIRE(rt_load_source(interpreter.get(), "Object(Twelve Scale(6))", "api.rnt") == RT_OK);
+	REQUIRE(rt_call(interpreter.get(), "Twelve", nullptr, 0, &result) == RT_OK);
+	REQUIRE(rt_to_number(result) == 12);
+	rt_free(result);
+
+	// Failing host builtin
+	REQUIRE(rt_register(interpreter.get(), "Fail", fail, nullptr) == RT_OK);
+	REQUIRE(rt_eval(interpreter.get(), "Fail()", &result) == RT_OK);
+	REQUIRE(rt_type(result) == RT_OBJECT);
+	REQUIRE(std::string(rt_to_string(result)) == "Exception");
+	rt_free(result);
+
+	// Errors
+	REQUIRE(rt_call(interpreter.get(), "Missing", nullptr, 0, nullptr) == RT_INTERPRETER_ERROR);
+	REQUIRE(std::string(rt_error_message(interpreter.get())) == "Unable to find symbol");
+	REQUIRE(rt_load_file(interpreter.get(), "missing.rnt") == RT_ERROR);
+	REQUIRE(std::string(rt_error_message(interpreter.get())) == "Unable to open file missing.rnt");
+}
@@ -0,0 +1,111 @@
+// Catch 2
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+// Runtime
+#include "../src/server.h"
+#include "../src/compiler/tokenizer.h"
+#include "../src/compiler/parser.h"
+#include "../src/compiler/interpreter.h"
+// C++
+#include <cstring>
+#include <string>
+// C
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/// <summary>
+/// Socket path unique to this process
+/// </summary>
+static std::string testSocket()
+{
+	return "/tmp/runtime_test_" + std::to_string(getpid()) + ".sock";
+}
+
+/// <summary>
+/// Sends a request as is and returns the whole response
+/// </summary>
+static std::string rawRequest(const std::string& request)
+{
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	std::strcpy(address.sun_path, testSocket().c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	REQUIRE(connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+	REQUIRE(write(fd, request.data(), request.size()) == static_cast<ssize_t>(request.size()));
+	std::string response;
+	char buffer[256];
+	ssize_t got;
+	while ((got = read(fd, buffer, sizeof(buffer))) > 0)
+		response.append(buffer, got);
+	close(fd);
+	return response;
+}
+
+TEST_CASE("Script server", "[server]")
+{
+	rt::Server server({ testSocket(), 2, { "../tests/test.rnt" } });
+
+	// Object(Main
+	//	Print(testObj-1)
+	//	Print(Size(testObj))
+	// )
+	// Excepted output: "2\n4", testObj is preloaded
+	auto r1 = rt::runRemote(testSocket(), "Print(testObj-1)\nPrint(Size(testObj))", false);
+	REQUIRE(r1.status == 0);
+	REQUIRE(r1.output == "2.000000\n4.000000\n");
+
+	// Object(Main
+	//	Object(x 1)
+	//	Exit(3)
+	// )
+	// Excepted status: 3
+	auto r2 = rt::runRemote(testSocket(), "Object(x 1)\nExit(3)", false);
+	REQUIRE(r2.status == 3);
+	// Scripts don't see each other's objects
+	auto r3 = rt::runRemote(testSocket(), "Print(Size(x))", false);
+	REQUIRE(r3.output == "0.000000\n");
+
+	// Errors are returned as output
+	auto r4 = rt::runRemote(testSocket(), "Print((", false);
+	REQUIRE(r4.status == 1);
+	REQUIRE(r4.output.starts_with("ParserException"));
+	auto r5 = rt::runRemote(testSocket(), "missing.rnt", true);
+	REQUIRE(r5.status == 1);
+	REQUIRE(r5.output == "Unable to open file missing.rnt\n");
+}
+
+TEST_CASE("Script server isolation", "[server]")
+{
+	rt::Server server({ testSocket(), 1, { "../tests/test.rnt" } });
+
+	// Object(Main
+	//	Assign(testObj 0 5)
+	//	Append(testObj 9)
+	// )
+	// The next script still sees testObj as preloaded
+	auto r1 = rt::runRemote(testSocket(), "Assign(testObj 0 5)\nAppend(testObj 9)\nPrint(testObj-0)", false);
+	REQUIRE(r1.output == "5.000000\n");
+	auto r2 = rt::runRemote(testSocket(), "Print(testObj-0)\nPrint(Size(testObj))", false);
+	REQUIRE(r2.output == "1.000000\n4.000000\n");
+
+	// Sizes over the limit are refused without reading the script, and the worker keeps serving
+	REQUIRE(rawRequest("SOURCE 18446744073709551615\n") == "1 18\nRequest too large\n");
+	auto r3 = rt::runRemote(testSocket(), "Print(Size(testObj))", false);
+	REQUIRE(r3.output == "4.000000\n");
+}
+
+TEST_CASE("Script server latency", "[.][benchmark]")
+{
+	// A short script using a preloaded file, through the server and in a fresh interpreter
+
+	rt::Server server({ testSocket(), 1, { "../tests/test.rnt" } });
+	BENCHMARK("Server")
+	{
+		return rt::runRemote(testSocket(), "Print(Size(testObj))", false);
+	};
+	BENCHMARK("Fresh interpreter")
+	{
+		return rt::interpretAndReturn(rt::parse(rt::tokenize("Include('../tests/test.rnt')\nPrint(Size(testObj))")));
+	};
+}
@@ -5,6 +5,9 @@
 #include "../src/compiler/tokenizer.h"
 #include "../src/compiler/parser.h"
 #include "../src/compiler/interpreter.h"
+#include "../src/compiler/ffi_stats.h"
+#include "../src/compiler/context.h"
+#include "Runtime.hpp"
 
 TEST_CASE("Exceptions", "[shared_libraries]")
 {
@@ -283,3 +286,446 @@ TEST_CASE("Difficult struct", "[shared_libraries]")
 	REQUIRE(rt::interpretAndReturn(r2).at(1) == test1[1]);	
 }
 */
+
+TEST_CASE("Buffers", "[shared_libraries]")
+{
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("fillSeries" "void" "double*" "int")
+	//	BufferCreate(buf "double" 4)
+	//	fillSeries(buf 4)
+	//	Print(BufferGet(buf 3))
+	// )
+	// Excepted output: "1.5"
+
+	const std::string test1 = "1.500000";
+	auto r1 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('fillSeries' 'void' 'double*' 'int')"
+					 "BufferCreate(buf 'double' 4)"
+					 "fillSeries(buf 4)"
+					 "Print(BufferGet(buf 3))"));
+	REQUIRE(rt::interpretAndReturn(r1).at(0) == test1);
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("sumInts" "int" "int*" "int")
+	//	BufferCreate(buf "int" 3)
+	//	BufferSet(buf 0 4)
+	//	BufferSet(buf 2 6)
+	//	Print(sumInts(buf 3))
+	//	Print(buf-"length")
+	// )
+	// Excepted output: "10\n3"
+
+	const std::string test2[]{"10.000000", "3.000000"};
+	auto r2 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('sumInts' 'int' 'int*' 'int')"
+					 "BufferCreate(buf 'int' 3)"
+					 "BufferSet(buf 0 4)"
+					 "BufferSet(buf 2 6)"
+					 "Print(sumInts(buf 3))"
+					 "Print(buf-'length')"));
+	auto v2 = rt::interpretAndReturn(r2);
+	REQUIRE(v2.at(0) == test2[0]);
+	REQUIRE(v2.at(1) == test2[1]);
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("sumInts" "int" "int*" "int")
+	//	BufferCreate(buf "double" 3)
+	//	sumInts(buf 3)
+	// )
+	// Excepted output: Exception
+
+	auto r3 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('sumInts' 'int' 'int*' 'int')"
+					 "BufferCreate(buf 'double' 3)"
+					 "sumInts(buf 3)"));
+	REQUIRE_THROWS_WITH(rt::interpretAndReturn(r3), "Buffer element type does not match parameter type");
+
+	// Object(Main,
+	//	BufferCreate(bytes "uchar" 1)
+	//	Print(BufferSet(bytes 0 256))
+	//	Print(BufferSet(bytes 0 *(-1 1)))
+	//	Print(BufferSet(bytes 0 255))
+	//	Print(BufferGet(bytes 0))
+	// )
+	// Excepted output: Two exceptions, then "1\n255"
+
+	const std::string test4[]{"Value out of range", "Value out of range", "1.000000", "255.000000"};
+	auto r4 = rt::parse(rt::tokenize("BufferCreate(bytes 'uchar' 1)"
+					 "Print(BufferSet(bytes 0 256))"
+					 "Print(BufferSet(bytes 0 *(-1 1)))"
+					 "Print(BufferSet(bytes 0 255))"
+					 "Print(BufferGet(bytes 0))"));
+	auto v4 = rt::interpretAndReturn(r4);
+	for (size_t i = 0; i < 4; ++i)
+		REQUIRE(v4.at(i) == test4[i]);
+
+	// Object(Main,
+	//	Print(BufferCreate(a "double" 1.5))
+	//	Print(BufferCreate(b "double" /(0 0)))
+	//	Print(BufferCreate(c "double" /(1 0)))
+	//	Print(BufferCreate(d "double" 4000000000000000000))
+	// )
+	// Excepted output: Three exceptions for lengths which aren't whole numbers, then one for a length which doesn't fit in memory
+
+	const std::string test5[]{"Length is of wrong type", "Length is of wrong type", "Length is of wrong type", "Buffer is too large"};
+	auto r5 = rt::parse(rt::tokenize("Print(BufferCreate(a 'double' 1.5))"
+					 "Print(BufferCreate(b 'double' /(0 0)))"
+					 "Print(BufferCreate(c 'double' /(1 0)))"
+					 "Print(BufferCreate(d 'double' 4000000000000000000))"));
+	auto v5 = rt::interpretAndReturn(r5);
+	for (size_t i = 0; i < 4; ++i)
+		REQUIRE(v5.at(i) == test5[i]);
+}
+
+TEST_CASE("Array arguments", "[shared_libraries]")
+{
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("sumInts" "int" "int32[]" "int")
+	//	Object(arr 1 2 3.8)
+	//	Print(sumInts(arr 3))
+	//	Print(arr-2)
+	// )
+	// Excepted output: "6\n3.8" (Unmodified elements are not written back)
+
+	const std::string test1[]{"6.000000", "3.800000"};
+	auto r1 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('sumInts' 'int' 'int32[]' 'int')"
+					 "Object(arr 1 2 3.8)"
+					 "Print(sumInts(arr 3))"
+					 "Print(arr-2)"));
+	auto v1 = rt::interpretAndReturn(r1);
+	REQUIRE(v1.at(0) == test1[0]);
+	REQUIRE(v1.at(1) == test1[1]);
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("scaleDoubles" "void" "double[]" "int" "double")
+	//	Object(one 1)
+	//	Object(arr one 2 3)
+	//	scaleDoubles(arr 3 2)
+	//	Print(one)
+	//	Print(arr-2)
+	// )
+	// Excepted output: "2\n6"
+
+	const std::string test2[]{"2.000000", "6.000000"};
+	auto r2 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('scaleDoubles' 'void' 'double[]' 'int' 'double')"
+					 "Object(one 1)"
+					 "Object(arr one 2 3)"
+					 "scaleDoubles(arr 3 2)"
+					 "Print(one)"
+					 "Print(arr-2)"));
+	auto v2 = rt::interpretAndReturn(r2);
+	REQUIRE(v2.at(0) == test2[0]);
+	REQUIRE(v2.at(1) == test2[1]);
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("sumInts" "int" "int32[]" "int")
+	//	Object(arr 1 2 3000000000)
+	//	sumInts(arr 3)
+	// )
+	// Excepted output: Exception, 3000000000 is no int32
+
+	auto r3 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('sumInts' 'int' 'int32[]' 'int')"
+					 "Object(arr 1 2 3000000000)"
+					 "sumInts(arr 3)"));
+	REQUIRE_THROWS_WITH(rt::interpretAndReturn(r3), "Value out of range");
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("fillSeries" "void" "double[]" "int")
+	//	Object(arr 7 3)
+	//	Freeze(arr)
+	//	fillSeries(arr 2)
+	//	Print(arr)
+	// )
+	// Excepted output: "3", frozen objects are not written back to
+
+	const std::string test4 = "3.000000";
+	auto r4 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('fillSeries' 'void' 'double[]' 'int')"
+					 "Object(arr 7 3)"
+					 "Freeze(arr)"
+					 "fillSeries(arr 2)"
+					 "Print(arr)"));
+	REQUIRE(rt::interpretAndReturn(r4).at(0) == test4);
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("fillSeries" "void" "double[]" "int")
+	//	Object(e)
+	//	Object(arr 7 e)
+	//	Object(Fill fillSeries(arr 2))
+	//	ParallelFor(0 1 Fill)
+	//	Print(Size(e))
+	// )
+	// Excepted output: "0", e is read as zero in the parallel call and left without a value
+
+	const std::string test5 = "0.000000";
+	auto r5 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('fillSeries' 'void' 'double[]' 'int')"
+					 "Object(e)"
+					 "Object(arr 7 e)"
+					 "Object(Fill fillSeries(arr 2))"
+					 "ParallelFor(0 1 Fill)"
+					 "Print(Size(e))"));
+	REQUIRE(rt::interpretAndReturn(r5).at(0) == test5);
+}
+
+TEST_CASE("Lazy symbol resolution", "[shared_libraries]")
+{
+	// Object(Main,
+	//	Include("libc.so.6")
+	//	Bind("abs" "int" "int")
+	//	Print(abs(-3))
+	// )
+	// Excepted output: "3"
+
+	const std::string test1 = "3.000000";
+	auto r1 = rt::parse(rt::tokenize("Include('libc.so.6')"
+					 "Bind('abs' 'int' 'int')"
+					 "Print(abs(-3))"));
+	REQUIRE(rt::interpretAndReturn(r1).at(0) == test1);
+
+	// Include("libc.so.6")
+	// Names which can't be C++ signatures don't demangle the library, and only so many misses are remembered
+	rt::Interpreter interpreter;
+	interpreter.run(rt::parse(rt::tokenize("Include('libc.so.6')")));
+	for (int i = 0; i < 2000; ++i)
+		REQUIRE(rt::resolveShared(interpreter, "missing" + std::to_string(i)) == nullptr);
+	const rt::Library& library = interpreter.libraries.back();
+	REQUIRE(not library.demangled.has_value());
+	REQUIRE(library.resolved.size() == rt::Library::maxMisses);
+}
+
+TEST_CASE("Callbacks", "[shared_libraries]")
+{
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("applyTwice" "int" "void*" "int")
+	//	Object(Inc +(x 1))
+	//	Callback(Inc "int" "int")
+	//	Print(applyTwice(Inc 5))
+	// )
+	// Excepted output: "7"
+
+	const std::string test1 = "7.000000";
+	auto r1 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('applyTwice' 'int' 'void*' 'int')"
+					 "Object(Inc +(x 1))"
+					 "Callback(Inc 'int' 'int')"
+					 "Print(applyTwice(Inc 5))"));
+	REQUIRE(rt::interpretAndReturn(r1).at(0) == test1);
+
+	// Object(Main,
+	//	Include("libc.so.6")
+	//	Bind("qsort" "void" "void*" "ulong" "ulong" "void*")
+	//	Object(Compare +(a *(-1 b)))
+	//	Callback(Compare "int" "int*" "int*")
+	//	BufferCreate(buf "int" 3)
+	//	BufferSet(buf 0 3)
+	//	BufferSet(buf 1 1)
+	//	BufferSet(buf 2 2)
+	//	qsort(buf 3 4 Compare)
+	//	Print(BufferGet(buf 0))
+	//	Print(BufferGet(buf 2))
+	// )
+	// Excepted output: "1\n3"
+
+	const std::string test2[]{"1.000000", "3.000000"};
+	auto r2 = rt::parse(rt::tokenize("Include('libc.so.6')"
+					 "Bind('qsort' 'void' 'void*' 'ulong' 'ulong' 'void*')"
+					 "Object(Compare +(a *(-1 b)))"
+					 "Callback(Compare 'int' 'int*' 'int*')"
+					 "BufferCreate(buf 'int' 3)"
+					 "BufferSet(buf 0 3)"
+					 "BufferSet(buf 1 1)"
+					 "BufferSet(buf 2 2)"
+					 "qsort(buf 3 4 Compare)"
+					 "Print(BufferGet(buf 0))"
+					 "Print(BufferGet(buf 2))"));
+	auto v2 = rt::interpretAndReturn(r2);
+	REQUIRE(v2.at(0) == test2[0]);
+	REQUIRE(v2.at(1) == test2[1]);
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("applyTwice" "int" "void*" "int")
+	//	Object(Fail "Not a number")
+	//	Callback(Fail "int" "int")
+	//	applyTwice(Fail 5)
+	// )
+	// Exceptions thrown by the callback are rethrown once the shared function returns
+	auto r3 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('applyTwice' 'int' 'void*' 'int')"
+					 "Object(Fail 'Not a number')"
+					 "Callback(Fail 'int' 'int')"
+					 "applyTwice(Fail 5)"));
+	REQUIRE_THROWS(rt::interpretAndReturn(r3));
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("applyToNull" "int" "void*")
+	//	Object(Nulls Print(Format("[$]" s)) +(p 7))
+	//	Callback(Nulls "int" "cstring" "int*")
+	//	Print(applyToNull(Nulls))
+	// )
+	// Excepted output: "[]\n7", null pointers are read as an empty string and 0
+
+	const std::string test4[]{"[]", "7.000000"};
+	auto r4 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('applyToNull' 'int' 'void*')"
+					 "Object(Nulls Print(Format('[$]' s)) +(p 7))"
+					 "Callback(Nulls 'int' 'cstring' 'int*')"
+					 "Print(applyToNull(Nulls))"));
+	auto v4 = rt::interpretAndReturn(r4);
+	REQUIRE(v4.at(0) == test4[0]);
+	REQUIRE(v4.at(1) == test4[1]);
+}
+
+TEST_CASE("Asynchronous calls", "[shared_libraries]")
+{
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("test" "int" "int")
+	//	Bind("triplePtr" "void" "int*")
+	//	Object(i 7)
+	//	CallAsync(a "test" 21)
+	//	CallAsync(b "triplePtr" i)
+	//	Print(Await(a))
+	//	Await(b)
+	//	Print(i)
+	//	Print(Ready(a))
+	// )
+	// Excepted output: "42\n21\n1"
+
+	const std::string test1[]{"42.000000", "21.000000", "1.000000"};
+	auto r1 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('test' 'int' 'int')"
+					 "Bind('triplePtr' 'void' 'int*')"
+					 "Object(i 7)"
+					 "CallAsync(a 'test' 21)"
+					 "CallAsync(b 'triplePtr' i)"
+					 "Print(Await(a))"
+					 "Await(b)"
+					 "Print(i)"
+					 "Print(Ready(a))"));
+	auto v1 = rt::interpretAndReturn(r1);
+	REQUIRE(v1.at(0) == test1[0]);
+	REQUIRE(v1.at(1) == test1[1]);
+	REQUIRE(v1.at(2) == test1[2]);
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("applyTwice" "int" "void*" "int")
+	//	Object(Inc +(x 1))
+	//	Callback(Inc "int" "int")
+	//	CallAsync(c "applyTwice" Inc 5)
+	//	Await(c)
+	// )
+	// Callbacks can not run on the worker threads, so awaiting rethrows the failure
+
+	auto r2 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('applyTwice' 'int' 'void*' 'int')"
+					 "Object(Inc +(x 1))"
+					 "Callback(Inc 'int' 'int')"
+					 "CallAsync(c 'applyTwice' Inc 5)"
+					 "Await(c)"));
+	REQUIRE_THROWS_WITH(rt::interpretAndReturn(r2), "Callback called outside of the interpreter thread");
+	// Later awaits rethrow the same failure
+	rt::Interpreter interpreter;
+	REQUIRE_THROWS(interpreter.run(rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('applyTwice' 'int' 'void*' 'int')"
+					 "Object(Inc +(x 1))"
+					 "Callback(Inc 'int' 'int')"
+					 "CallAsync(c 'applyTwice' Inc 5)"
+					 "Await(c)"))));
+	auto failed = rt::getAsyncCall(std::get<std::shared_ptr<rt::Object>>(interpreter.globalSymtab.lookUpHard("c")));
+	REQUIRE(failed->ready());
+	REQUIRE_THROWS_WITH(failed->await(), "Callback called outside of the interpreter thread");
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	CallAsync(d "test" 1)
+	//	Exit(0)
+	// )
+	// Excepted output: Exception, test is not bound. Located like calling test(1) directly
+
+	auto where = [](const char* script) {
+		try {
+			rt::interpretAndReturn(rt::parse(rt::tokenize(script)));
+		} catch (const InterpreterException& e) {
+			REQUIRE(std::string(e.what()) == "Shared function is not yet bound");
+			return e.where();
+		}
+		return std::string();
+	};
+	const std::string asyncWhere = where("Include('../tests/lib.so')\nCallAsync(d 'test' 1)\nExit(0)");
+	REQUIRE(asyncWhere == where("Include('../tests/lib.so')\ntest(1)\nExit(0)"));
+	REQUIRE(asyncWhere.find("line -1") == std::string::npos);
+
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("fillSeries" "void" "double*" "int")
+	//	BufferCreate(buf "double" 100000)
+	//	CallAsync(e "fillSeries" buf 100000)
+	//	BufferCreate(buf "double" 1)
+	//	Await(e)
+	//	Print(BufferGet(buf 0))
+	// )
+	// Excepted output: "0", the call keeps writing to the buffer it was given
+
+	const std::string test5 = "0.000000";
+	auto r5 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('fillSeries' 'void' 'double*' 'int')"
+					 "BufferCreate(buf 'double' 100000)"
+					 "CallAsync(e 'fillSeries' buf 100000)"
+					 "BufferCreate(buf 'double' 1)"
+					 "Await(e)"
+					 "Print(BufferGet(buf 0))"));
+	REQUIRE(rt::interpretAndReturn(r5).at(0) == test5);
+}
+
+TEST_CASE("FFI statistics", "[shared_libraries]")
+{
+	// Object(Main,
+	//	Include("../tests/lib.so")
+	//	Bind("test" "int" "int")
+	//	test(1)
+	//	test(2)
+	//	Print(FfiStats())
+	// )
+	// Excepted output: the report, or the exception message when built without RUNTIME_FFI_STATS
+
+	auto r1 = rt::parse(rt::tokenize("Include('../tests/lib.so')"
+					 "Bind('test' 'int' 'int')"
+					 "test(1)"
+					 "test(2)"
+					 "Print(FfiStats())"));
+	auto v1 = rt::interpretAndReturn(r1);
+#if RUNTIME_FFI_STATS==1
+	// Statistics are kept for the whole process, so other tests add to the count
+	REQUIRE(v1.at(0).find("test: ") != std::string::npos);
+	REQUIRE(v1.at(0).find("native") != std::string::npos);
+#else
+	REQUIRE(v1.at(0) == "Runtime was built without RUNTIME_FFI_STATS");
+#endif // RUNTIME_FFI_STATS
+
+	// Durations land in power of two buckets
+	rt::Histogram histogram;
+	histogram.record(0);
+	histogram.record(100);
+	histogram.record(1000);
+	REQUIRE(histogram.count == 3);
+	REQUIRE(histogram.buckets[0] == 1);
+	REQUIRE(histogram.buckets[7] == 1);
+	REQUIRE(histogram.buckets[10] == 1);
+	REQUIRE(histogram.percentile(0.5) == 128);
+}